@@ -0,0 +1,143 @@
+#include <pspkernel.h>
+#include <pspdebug.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "animation.h"
+
+static int read_header(SceUID file, Animation *anim) {
+    unsigned char header[ANIM_HEADER_SIZE];
+    if (sceIoRead(file, header, ANIM_HEADER_SIZE) != ANIM_HEADER_SIZE) return 0;
+
+    memcpy(&anim->frame_count, header, 4);
+    memcpy(&anim->width, header + 4, 2);
+    memcpy(&anim->height, header + 6, 2);
+
+    int line_stride = anim->width + 1; 
+    anim->frame_size = line_stride * anim->height;
+    return 1;
+}
+
+static int frame_offset(Animation *anim, int frame_num) {
+    return ANIM_HEADER_SIZE + frame_num * anim->frame_size;
+}
+
+int probe_animation(const char *filename, Animation *header) {
+    SceUID file = sceIoOpen(filename, PSP_O_RDONLY, 0777);
+    if (file < 0) return 0;
+
+    int ok = read_header(file, header);
+    sceIoClose(file);
+    return ok;
+}
+
+Animation* load_animation(const char *filename, unsigned int cached_frames) {
+    SceUID file = sceIoOpen(filename, PSP_O_RDONLY, 0777);
+    if (file < 0) {
+        pspDebugScreenPrintf("Error: File not found %s\n", filename);
+        return NULL;
+    }
+
+    Animation *anim = (Animation*)malloc(sizeof(Animation));
+    if (!anim) { sceIoClose(file); return NULL; }
+    memset(anim, 0, sizeof(Animation));
+    anim->file = -1;
+    anim->slot_frame[0] = anim->slot_frame[1] = -1;
+    anim->pending_slot = -1;
+    anim->prefetch.done = -1;
+
+    if (!read_header(file, anim)) {
+        pspDebugScreenPrintf("Error: Bad header in %s\n", filename);
+        free(anim);
+        sceIoClose(file);
+        return NULL;
+    }
+
+    if (cached_frames > anim->frame_count) cached_frames = anim->frame_count;
+    anim->cached_frames = cached_frames;
+
+    unsigned int total_data_size = cached_frames * anim->frame_size;
+    
+    if (total_data_size) {
+        anim->data = (char*)malloc(total_data_size);
+        if (!anim->data) {
+            pspDebugScreenPrintf("Error: Out of memory (Need %d bytes)\n", total_data_size);
+            free(anim);
+            sceIoClose(file);
+            return NULL;
+        }
+
+        int read_size = AalibIoRead(file, ANIM_HEADER_SIZE, anim->data, total_data_size,
+                                    PSPAALIB_IO_PRIORITY_BACKGROUND, 1000000);
+        if (read_size != total_data_size) {
+            pspDebugScreenPrintf("Warning: File size mismatch\n");
+        }
+    }
+
+    if (cached_frames == anim->frame_count) {
+        sceIoClose(file);
+        return anim;
+    }
+
+    anim->file = file;
+    anim->frame_buf[0] = (char*)malloc(2 * anim->frame_size);
+    if (!anim->frame_buf[0] || AalibIoCreateRequest(&anim->prefetch) != 0) {
+        pspDebugScreenPrintf("Error: Out of memory (Need %d bytes)\n", 2 * anim->frame_size);
+        free_animation(anim);
+        return NULL;
+    }
+    anim->frame_buf[1] = anim->frame_buf[0] + anim->frame_size;
+
+    return anim;
+}
+
+void free_animation(Animation *anim) {
+    if (anim) {
+        if (anim->prefetch.done >= 0) AalibIoDeleteRequest(&anim->prefetch);
+        if (anim->file >= 0) sceIoClose(anim->file);
+        if (anim->frame_buf[0]) free(anim->frame_buf[0]);
+        if (anim->data) free(anim->data);
+        free(anim);
+    }
+}
+
+static void prefetch_frame(Animation *anim, int slot, int frame_num) {
+    anim->slot_frame[slot] = frame_num;
+    anim->pending_slot = slot;
+    AalibIoSubmit(&anim->prefetch, anim->file, frame_offset(anim, frame_num),
+                  anim->frame_buf[slot], anim->frame_size, PSPAALIB_IO_PRIORITY_ANIMATION,
+                  sceKernelGetSystemTimeLow() + ANIM_PREFETCH_DEADLINE);
+}
+
+const char *get_frame(Animation *anim, int frame_num) {
+    if (frame_num < anim->cached_frames) {
+        return anim->data + (frame_num * anim->frame_size);
+    }
+
+    int slot;
+    for (slot = 0; slot < 2; slot++) {
+        if (anim->slot_frame[slot] == frame_num) break;
+    }
+
+    if (slot == 2) {
+        slot = (anim->pending_slot == 0) ? 1 : 0;
+        anim->slot_frame[slot] = frame_num;
+        if (AalibIoRead(anim->file, frame_offset(anim, frame_num), anim->frame_buf[slot],
+                        anim->frame_size, PSPAALIB_IO_PRIORITY_ANIMATION, 0) != anim->frame_size) {
+            memset(anim->frame_buf[slot], 0, anim->frame_size);
+        }
+    } else if (slot == anim->pending_slot) {
+        anim->pending_slot = -1;
+        if (AalibIoWait(&anim->prefetch) != anim->frame_size) {
+            memset(anim->frame_buf[slot], 0, anim->frame_size);
+        }
+    }
+
+    /* Read the next frame while this one is on screen */
+    int next = (frame_num + 1 < anim->frame_count) ? frame_num + 1 : 0;
+    if (next >= anim->cached_frames && anim->pending_slot < 0 && anim->slot_frame[1 - slot] != next) {
+        prefetch_frame(anim, 1 - slot, next);
+    }
+
+    return anim->frame_buf[slot];
+}
@@ -0,0 +1,30 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <pspkernel.h>
+
+#include "audio/pspaalibio.h"
+
+#define ANIM_HEADER_SIZE 8
+#define ANIM_PREFETCH_DEADLINE 50000
+
+typedef struct {
+    unsigned int frame_count;
+    unsigned short width;
+    unsigned short height;
+    unsigned int frame_size; 
+    char *data;                 /* first cached_frames frames */
+    unsigned int cached_frames;
+    SceUID file;                /* kept open while frames are streamed */
+    char *frame_buf[2];         /* streamed frames, one may be in flight */
+    int slot_frame[2];
+    int pending_slot;
+    AalibIoRequest prefetch;
+} Animation;
+
+int probe_animation(const char *filename, Animation *header);
+Animation* load_animation(const char *filename, unsigned int cached_frames);
+void free_animation(Animation *anim);
+const char *get_frame(Animation *anim, int frame_num);
+
+#endif
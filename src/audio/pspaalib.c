@@ -11,6 +11,11 @@
 
 #include "pspaalib.h"
 
+//Everything the game thread sets on a channel.It is published with a
+//sequence counter:the writer makes it odd while it changes the block,and the
+//audio thread copies the block once per buffer,keeping the previous copy if
+//the counter was odd or moved while copying.Parameters are expected to be
+//set from one thread.
 typedef struct
 {
 	bool effects[7];
@@ -19,26 +24,244 @@ typedef struct
 	float playSpeed;
 	AalibVolume volume;
 	float ampValue;
+	int bufferLength;
+} AalibChannelParams;
+
+typedef struct
+{
+	ScePspFVector2 position;
+	ScePspFVector2 front;
+	ScePspFVector2 velocity;
+} AalibObserver;
+
+typedef struct
+{
+	int command;
+	int argument;
+} AalibCommand;
+
+//Play/stop/pause/seek for a channel which a play thread or the mixer is
+//serving.The game thread only moves tail and the audio thread only moves
+//head,so neither side needs a lock.
+typedef struct
+{
+	AalibCommand commands[PSPAALIB_COMMAND_QUEUE_LENGTH];
+	volatile unsigned int head;
+	volatile unsigned int tail;
+} AalibCommandQueue;
+
+//Running min/max/total of a time in microseconds
+typedef struct
+{
+	unsigned int count;
+	unsigned int min;
+	unsigned int max;
+	unsigned long long total;
+} AalibTimeCounter;
+
+typedef struct
+{
+	AalibChannelParams params;
+	volatile unsigned int sequence;
+	int updateDepth;
+	AalibChannelParams snapshot;
+	AalibObserver observer;
+	AalibResampler speedResampler;
+	AalibDspChain chain;
+	AalibVolume volume;
 	float audioStrength;
-	bool initialized;
+	float playSpeed;
+	const AalibCodec* codec;
+	int stream;
+	bool mixing;
+	AalibCommandQueue queue;
+	volatile unsigned int samplesOutput;
+	AalibTimeCounter process;
+	unsigned int underruns;
+	bool outputRunning;
+	unsigned int starvationBase;
+	unsigned int ioBytesBase;
+	unsigned int ioStallBase;
 } AalibChannelData;
 
-AalibChannelData channels[49];
+//Slots are only allocated while a file is loaded on the channel.codec and
+//stream are looked up once at load time,so calls go straight to the codec.
+AalibChannelData* channels[PSPAALIB_CHANNEL_LAST+1];
 int hardwareChannels[8];
 SceUID threads[8];
-ScePspFVector2 observerPosition={0,0},observerFront={0,1},observerVelocity={0,0};
+SceUID hardwareEvents[8];
+
+//Every buffer the play threads touch is carved out of one arena when the
+//library is initialized,so nothing on the audio path calls the allocator.
+typedef struct
+{
+	short* mainBuf;
+	short* backBuf;
+	short* speedBuf;
+} AalibHardwareBuffers;
+
+static char* audioArena=NULL;
+static AalibHardwareBuffers hardwareBuffers[8];
+
+//Mixer mode:one thread mixes every playing channel into a single hardware
+//output instead of giving each its own thread and hardware channel.
+static bool mixerEnabled=FALSE;
+static SceUID mixerThread=-1,mixerEvent=-1,mixerLock=-1;
+static int mixerHardwareChannel=-1;
+static volatile int mixerBufferLength=PSPAALIB_BUFFER_LENGTH;
+static int* mixerAccumulator=NULL;
+
+static const AalibCodec* codecs[]={&codecOgg,&codecWav,&codecBank};
+
+//Counters are only touched while stats are on.Each play thread and the mixer
+//keep their own output counter,so no two threads write the same one.statsLock
+//keeps a slot from being freed while the counters are read.
+static volatile bool statsEnabled=FALSE;
+static AalibTimeCounter outputStats[9];
+static unsigned int hardwareUnderruns[8];
+static SceUID statsLock=-1;
+static SceUID statsLogThread=-1,statsLogStop=-1,statsLogFile=-1;
+static int statsLogInterval=0;
+
+static AalibObserver observer={{0,0},{0,1},{0,0}};
+static volatile unsigned int observerSequence=0;
+static int observerUpdateDepth=0;
+
+static void LockStats()
+{
+	if (statsLock>=0)
+	{
+		sceKernelWaitSema(statsLock,1,NULL);
+	}
+}
+
+static void UnlockStats()
+{
+	if (statsLock>=0)
+	{
+		sceKernelSignalSema(statsLock,1);
+	}
+}
+
+static void ResetTime(AalibTimeCounter* counter)
+{
+	memset(counter,0,sizeof(AalibTimeCounter));
+	counter->min=0xFFFFFFFF;
+}
+
+static void AddTime(AalibTimeCounter* counter,unsigned int time)
+{
+	counter->count++;
+	counter->total+=time;
+	counter->min=MINA(counter->min,time);
+	counter->max=MAXA(counter->max,time);
+}
+
+static void ReadTime(AalibTimeCounter* counter,unsigned int* min,unsigned int* avg,unsigned int* max)
+{
+	*min=(counter->count)?(counter->min):(0);
+	*avg=(counter->count)?((unsigned int)(counter->total/counter->count)):(0);
+	*max=counter->max;
+}
+
+static void BeginWrite(volatile unsigned int* sequence,int depth)
+{
+	if (!depth)
+	{
+		(*sequence)++;
+		PSPAALIB_BARRIER();
+	}
+}
+
+static void EndWrite(volatile unsigned int* sequence,int depth)
+{
+	if (!depth)
+	{
+		PSPAALIB_BARRIER();
+		(*sequence)++;
+	}
+}
+
+//Copies a published block into dest unless a write is in progress.Never
+//waits,the audio thread just keeps what it had.
+static bool ReadSnapshot(volatile unsigned int* sequence,void* dest,const void* src,int size,void* scratch)
+{
+	unsigned int start=*sequence;
+	if (start&1)
+	{
+		return FALSE;
+	}
+	PSPAALIB_BARRIER();
+	memcpy(scratch,src,size);
+	PSPAALIB_BARRIER();
+	if (*sequence!=start)
+	{
+		return FALSE;
+	}
+	memcpy(dest,scratch,size);
+	return TRUE;
+}
+
+static void TakeChannelSnapshot(int channel)
+{
+	AalibChannelParams params;
+	AalibObserver observerCopy;
+	ReadSnapshot(&channels[channel]->sequence,&channels[channel]->snapshot,&channels[channel]->params,sizeof(AalibChannelParams),&params);
+	ReadSnapshot(&observerSequence,&channels[channel]->observer,&observer,sizeof(AalibObserver),&observerCopy);
+}
+
+//Hands a channel which nothing serves yet the parameters set so far,so its
+//first buffer doesn't depend on the game thread being outside an update when
+//the audio side takes its first snapshot.Not inside AalibBeginUpdate().
+static void PublishChannelParams(int channel)
+{
+	if (!channels[channel]->updateDepth)
+	{
+		channels[channel]->snapshot=channels[channel]->params;
+	}
+}
+
+//Returns the codec which plays channel,or NULL if no codec does.
+static const AalibCodec* FindCodec(int channel)
+{
+	int i;
+	for (i=0;i<sizeof(codecs)/sizeof(codecs[0]);i++)
+	{
+		if ((codecs[i]->firstChannel<=channel)&&(channel<=codecs[i]->lastChannel))
+		{
+			return codecs[i];
+		}
+	}
+	return NULL;
+}
+
+//Returns PSPAALIB_SUCCESS if a file is loaded on channel.
+static int CheckChannel(int channel)
+{
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
+	{
+		return PSPAALIB_ERROR_INVALID_CHANNEL;
+	}
+	return (channels[channel])?(PSPAALIB_SUCCESS):(PSPAALIB_ERROR_UNINITIALIZED_CHANNEL);
+}
+
+//Returns the channel's slot,or NULL if nothing is loaded on it.
+static AalibChannelData* GetChannel(int channel)
+{
+	return ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))?(NULL):(channels[channel]);
+}
 
 int AalibIsFree(int channel)
 {
-	return channels[channel].initialized ? 1 : 0; 
+	return GetChannel(channel) ? 1 : 0; 
 }
 
 AalibVolume AalibGetVolume(int channel)
 {
-	return channels[channel].volume;
+	return (GetChannel(channel))?(channels[channel]->volume):((AalibVolume){0.0f,0.0f});
 }
 
-int GetFreeHardwareChannel(int channel)
+static int FindHardwareChannel(int channel)
 {
 	int i;
 	for (i=0;i<8;i++)
@@ -48,6 +271,16 @@ int GetFreeHardwareChannel(int channel)
 			return i;
 		}
 	}
+	return -1;
+}
+
+int GetFreeHardwareChannel(int channel)
+{
+	int i=FindHardwareChannel(channel);
+	if (i>=0)
+	{
+		return i;
+	}
 
 	for (i=0;i<8;i++)
 	{
@@ -61,87 +294,243 @@ int GetFreeHardwareChannel(int channel)
 	return -1;
 }
 
+//Called by the play thread once its stream has stopped.
 int FreeHardwareChannel(int channel)
 {
-	int i;
-	for (i=0;i<8;i++)
+	int i=FindHardwareChannel(channel);
+	if (i<0)
 	{
-		if (hardwareChannels[i]==channel)
-		{
-			while (AalibGetStatus(channel)!=PSPAALIB_STATUS_STOPPED)
-			{
-				sceKernelDelayThread(10);
-			}
-			sceAudioChRelease(i);
-			printf("released channel %d\n", i);
-			hardwareChannels[i]=PSPAALIB_CHANNEL_NONE;
-			return TRUE;
-		}
+		return FALSE;
+	}
+	sceAudioChRelease(i);
+	printf("released channel %d\n", i);
+	hardwareChannels[i]=PSPAALIB_CHANNEL_NONE;
+	return TRUE;
+}
+
+//Lets a play thread sleeping on a paused stream re-check its state.
+static void WakeHardwareChannel(int channel)
+{
+	if (mixerEnabled)
+	{
+		sceKernelSetEventFlag(mixerEvent,PSPAALIB_EVENT_WAKE);
+		return;
+	}
+	int i=FindHardwareChannel(channel);
+	if (i>=0)
+	{
+		sceKernelSetEventFlag(hardwareEvents[i],PSPAALIB_EVENT_WAKE);
+	}
+}
+
+//Blocks until the play thread serving channel,if any,has exited.
+static void WaitHardwareChannel(int channel)
+{
+	int i=FindHardwareChannel(channel);
+	if (i>=0)
+	{
+		sceKernelWaitThreadEnd(threads[i],NULL);
 	}
-	return FALSE;
 }
 
 int GetRawBuffer(short* buf,int length,float amp,int channel)
 {
-	if ((channel<1)||(channel>48))
+	AalibChannelData* data=GetChannel(channel);
+	if (!data)
 	{
 		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
-	if ((PSPAALIB_CHANNEL_WAV_1<=channel)&&(channel<=PSPAALIB_CHANNEL_WAV_32))
+	return data->codec->getBuffer(buf,length,amp,data->stream);
+}
+
+//Works out volume,strength and play speed for a batch of channels from their
+//snapshots.The spatial math runs once over the whole batch,whether or not a
+//channel uses it,so the loop has no per-channel branches.voices needs room
+//for count entries.
+static void UpdateChannelParams(int* list,int count,AalibSpatialVoice* voices)
+{
+	int i;
+	for (i=0;i<count;i++)
 	{
-		return GetBufferWav(buf,length,amp,channel-PSPAALIB_CHANNEL_WAV_1);
+		AalibChannelParams* params=&channels[list[i]]->snapshot;
+		AalibObserver* view=&channels[list[i]]->observer;
+		voices[i].position=(ScePspFVector2){params->position.x-view->position.x,params->position.y-view->position.y};
+		voices[i].velocity=params->velocity;
+		voices[i].observerVelocity=view->velocity;
+		voices[i].front=view->front;
+	}
+	UpdateSpatialVoices(voices,count);
+	for (i=0;i<count;i++)
+	{
+		AalibChannelParams* params=&channels[list[i]]->snapshot;
+		AalibChannelData* data=channels[list[i]];
+		//Control Volume
+		if (params->effects[PSPAALIB_EFFECT_STEREO_BY_POSITION])
+		{
+			data->volume=voices[i].volume;
+		}
+		else if(params->effects[PSPAALIB_EFFECT_VOLUME_MANUAL])
+		{
+			data->volume=params->volume;
+		}
+		else
+		{
+			data->volume=(AalibVolume){1.0f,1.0f};
+		}
+		data->audioStrength=(params->effects[PSPAALIB_EFFECT_STRENGTH_BY_POSITION])?(voices[i].strength):(1.0f);
+		//Control Play Speed
+		float playSpeed=1.0f;
+		if (params->effects[PSPAALIB_EFFECT_DOPPLER])
+		{
+			playSpeed=voices[i].playSpeed;
+		}
+		else if (params->effects[PSPAALIB_EFFECT_PLAYSPEED])
+		{
+			playSpeed=params->playSpeed;
+		}
+		data->playSpeed=MINA(playSpeed,PSPAALIB_MAX_PLAY_SPEED);
 	}
-	return PSPAALIB_ERROR_INVALID_CHANNEL;
 }
 
-void GetProcessedBuffer(void* abuf,unsigned int length,int channel)
+//Fills length frames of dest with the channel's output,gained and panned.With
+//accumulate set they are added to the mixer's int buffer instead.The
+//channel's parameters must have been updated by UpdateChannelParams().
+void GetProcessedBuffer(void* dest,unsigned int length,int channel,short* speedBuf,bool accumulate)
 {
-	short* buf=(short*) abuf;
-	//Control Volume
-	if (channels[channel].effects[PSPAALIB_EFFECT_STEREO_BY_POSITION])
+	AalibChannelParams* params=&channels[channel]->snapshot;
+	float playSpeed=channels[channel]->playSpeed;
+	float ampValue=(params->effects[PSPAALIB_EFFECT_AMPLIFY])?(params->ampValue):(1.0f);
+	//The speed is turned into a 16.16 step once per buffer
+	unsigned int step=(playSpeed>0)?((unsigned int)(playSpeed*65536.0f)):(0);
+	float gainLeft=ampValue*channels[channel]->volume.left*channels[channel]->audioStrength;
+	float gainRight=ampValue*channels[channel]->volume.right*channels[channel]->audioStrength;
+	AalibDspChain* chain=&channels[channel]->chain;
+	CompileDspChain(chain,(params->effects[PSPAALIB_EFFECT_PLAYSPEED])||(params->effects[PSPAALIB_EFFECT_DOPPLER]),step,params->effects[PSPAALIB_EFFECT_MIX],gainLeft,gainRight,accumulate,length);
+	//Get Buffer
+	if (!chain->kernel)
 	{
-		channels[channel].volume=GetVolumes(channels[channel].position,observerPosition,observerFront);
+		GetRawBuffer((short*)dest,length,gainLeft,channel);
+		return;
 	}
-	else if(!channels[channel].effects[PSPAALIB_EFFECT_VOLUME_MANUAL])
+	short* src=speedBuf+2*PSPAALIB_RESAMPLER_HISTORY;
+	GetRawBuffer(src,GetDspChainFrames(chain,length),1.0f,channel);
+	chain->kernel(dest,src,length,chain);
+}
+
+//GetProcessedBuffer(),timed into the channel's counters while stats are on.
+static void ProcessChannel(void* dest,unsigned int length,int channel,short* speedBuf,bool accumulate)
+{
+	if (!statsEnabled)
 	{
-		channels[channel].volume=(AalibVolume){1.0f,1.0f};
+		GetProcessedBuffer(dest,length,channel,speedBuf,accumulate);
+		return;
 	}
-	if (channels[channel].effects[PSPAALIB_EFFECT_STRENGTH_BY_POSITION])
+	unsigned int start=sceKernelGetSystemTimeLow();
+	GetProcessedBuffer(dest,length,channel,speedBuf,accumulate);
+	AddTime(&channels[channel]->process,sceKernelGetSystemTimeLow()-start);
+}
+
+static int ApplyChannelCommand(int channel,int command,int argument)
+{
+	AalibChannelData* data=channels[channel];
+	switch (command)
 	{
-		channels[channel].audioStrength=GetStrengthByPosition(channels[channel].position,observerPosition);
+		case PSPAALIB_COMMAND_PLAY:
+			//Only restarts a stream stopped by an earlier command in the queue
+			if (!data->codec->getStopReason(data->stream))
+			{
+				return PSPAALIB_SUCCESS;
+			}
+			data->samplesOutput=0;
+			return data->codec->play(data->stream);
+		case PSPAALIB_COMMAND_STOP:
+			return data->codec->stop(data->stream);
+		case PSPAALIB_COMMAND_PAUSE:
+			return data->codec->pause(data->stream);
+		case PSPAALIB_COMMAND_SEEK:
+			return data->codec->seekSample(argument,data->stream);
 	}
-	else
+	return PSPAALIB_ERROR_INVALID_CHANNEL;
+}
+
+//Run by whoever owns the stream:the thread or mixer serving it,or the game
+//thread once nothing does.
+static void ApplyChannelCommands(int channel)
+{
+	AalibCommandQueue* queue=&channels[channel]->queue;
+	while (queue->head!=queue->tail)
+	{
+		PSPAALIB_BARRIER();
+		AalibCommand* command=&queue->commands[queue->head%PSPAALIB_COMMAND_QUEUE_LENGTH];
+		ApplyChannelCommand(channel,command->command,command->argument);
+		PSPAALIB_BARRIER();
+		queue->head++;
+	}
+}
+
+static bool IsChannelServed(int channel)
+{
+	return (mixerEnabled)?(channels[channel]->mixing):(FindHardwareChannel(channel)>=0);
+}
+
+//Commands for a stream which is being played are queued for the audio side
+//and take effect at the next buffer.Anything else is applied right away.A
+//command which arrives while a play thread is winding down is picked up by
+//the next AalibPlay().
+static int PostChannelCommand(int channel,int command,int argument)
+{
+	int result=PSPAALIB_SUCCESS;
+	AalibCommandQueue* queue=&channels[channel]->queue;
+	if (mixerEnabled)
 	{
-		channels[channel].audioStrength=1.0f;
+		sceKernelWaitSema(mixerLock,1,NULL);
 	}
-	//Control Play Speed
-	if (channels[channel].effects[PSPAALIB_EFFECT_DOPPLER])
+	if (!IsChannelServed(channel))
 	{
-		channels[channel].playSpeed=GetDopplerPlaySpeed(channels[channel].position,channels[channel].velocity,observerPosition,observerVelocity);
+		result=ApplyChannelCommand(channel,command,argument);
 	}
-	else if (!channels[channel].effects[PSPAALIB_EFFECT_PLAYSPEED])
+	else if (queue->tail-queue->head>=PSPAALIB_COMMAND_QUEUE_LENGTH)
 	{
-		channels[channel].playSpeed=1.0f;
+		result=PSPAALIB_WARNING_COMMAND_QUEUE_FULL;
 	}
-	if (!channels[channel].effects[PSPAALIB_EFFECT_AMPLIFY])
+	else
 	{
-		channels[channel].ampValue=1.0f;
+		queue->commands[queue->tail%PSPAALIB_COMMAND_QUEUE_LENGTH]=(AalibCommand){command,argument};
+		PSPAALIB_BARRIER();
+		queue->tail++;
+		WakeHardwareChannel(channel);
 	}
-	//Get Buffer
-	if ((channels[channel].effects[PSPAALIB_EFFECT_PLAYSPEED])||(channels[channel].effects[PSPAALIB_EFFECT_DOPPLER])||(channels[channel].effects[PSPAALIB_EFFECT_MIX]))
-	{		
-		short* tempBuf;
-		tempBuf=malloc((int)(length*channels[channel].playSpeed*2*sizeof(short)));
-		GetRawBuffer(tempBuf,length*channels[channel].playSpeed,channels[channel].ampValue,channel);
-		GetBufferSpeedEffect(buf,tempBuf,length,channels[channel].playSpeed,channels[channel].effects[PSPAALIB_EFFECT_MIX]);
-		free(tempBuf);
+	if (mixerEnabled)
+	{
+		sceKernelSignalSema(mixerLock,1);
 	}
-	else
+	return result;
+}
+
+//Sampled right before a buffer goes out:the hardware ran dry if it has
+//nothing left to play by then.
+static bool IsHardwareDry(int hardwareChannel)
+{
+	return (statsEnabled)&&(sceAudioGetChannelRestLen(hardwareChannel)==0);
+}
+
+//The first buffer after a play or resume always finds the hardware empty,so
+//only a channel which was output last time counts.Returns TRUE if it did.
+static bool CountUnderrun(int channel,bool dry)
+{
+	bool counted=(dry)&&(channels[channel]->outputRunning);
+	if (counted)
 	{
-		GetRawBuffer(buf,length,channels[channel].ampValue,channel);
+		channels[channel]->underruns++;
 	}
+	channels[channel]->outputRunning=TRUE;
+	return counted;
 }
 
+//The play thread is started by AalibPlay once the stream is already playing.
+//It fills one buffer while the other is queued;sceAudioOutputBlocking
+//is what paces it,and while the stream is paused it sleeps on its event flag
+//instead of outputting silence.It exits as soon as the stream stops.
 int PlayThread(SceSize argsize, void* args)
 {
 	if (argsize!=sizeof(int))
@@ -150,207 +539,702 @@ int PlayThread(SceSize argsize, void* args)
 	}
 	int hardwareChannel=*((int*)args);
 	int channel=hardwareChannels[hardwareChannel];
-	int stopReason;
-	void *mainBuf,*backBuf,*tempBuf;
-	mainBuf=malloc(4096);
-	backBuf=malloc(4096);
-	sceAudioChReserve(hardwareChannel,1024,PSP_AUDIO_FORMAT_STEREO);
-	while(TRUE)
+	short *mainBuf,*backBuf,*tempBuf,*speedBuf;
+	AalibSpatialVoice voice;
+	mainBuf=hardwareBuffers[hardwareChannel].mainBuf;
+	backBuf=hardwareBuffers[hardwareChannel].backBuf;
+	speedBuf=hardwareBuffers[hardwareChannel].speedBuf;
+	TakeChannelSnapshot(channel);
+	int length=channels[channel]->snapshot.bufferLength;
+	sceAudioChReserve(hardwareChannel,length,PSP_AUDIO_FORMAT_STEREO);
+	channels[channel]->outputRunning=FALSE;
+	while (1)
 	{
-		stopReason=AalibGetStopReason(channel);
-		if (!stopReason)
+		ApplyChannelCommands(channel);
+		if (AalibGetStopReason(channel))
 		{
-			goto Play;
+			break;
 		}
-		else if (stopReason<0)
+		if (AalibGetStatus(channel)==PSPAALIB_STATUS_PAUSED)
 		{
-			sceKernelDelayThread(10);
+			channels[channel]->outputRunning=FALSE;
+			sceKernelWaitEventFlag(hardwareEvents[hardwareChannel],PSPAALIB_EVENT_WAKE,PSP_EVENT_WAITOR|PSP_EVENT_WAITCLEAR,NULL,NULL);
 			continue;
 		}
-		else
+		TakeChannelSnapshot(channel);
+		if (channels[channel]->snapshot.bufferLength!=length)
+		{
+			length=channels[channel]->snapshot.bufferLength;
+			sceAudioSetChannelDataLen(hardwareChannel,length);
+		}
+		unsigned int start=(statsEnabled)?(sceKernelGetSystemTimeLow()):(0);
+		UpdateChannelParams(&channel,1,&voice);
+		ProcessChannel(mainBuf,length,channel,speedBuf,FALSE);
+		if (statsEnabled)
 		{
-			goto Release;
+			AddTime(&outputStats[hardwareChannel],sceKernelGetSystemTimeLow()-start);
 		}
+		bool dry=IsHardwareDry(hardwareChannel);
+		sceAudioOutputBlocking(hardwareChannel,PSP_AUDIO_VOLUME_MAX,mainBuf);
+		channels[channel]->samplesOutput+=length;
+		if (CountUnderrun(channel,dry))
+		{
+			hardwareUnderruns[hardwareChannel]++;
+		}
+		tempBuf=mainBuf;
+		mainBuf=backBuf;
+		backBuf=tempBuf;
+	}
+	ApplyChannelCommand(channel,PSPAALIB_COMMAND_STOP,0);
+	FreeHardwareChannel(channel);
+	sceKernelExitThread(0);
+	return 0;
+}
+
+//Same buffer handling as PlayThread,but every buffer is the saturated sum of
+//all channels flagged for mixing.Volume and strength are applied while
+//mixing,so the hardware output always runs at full volume.The thread sleeps
+//on mixerEvent while nothing is audible.
+int MixerThread(SceSize argsize, void* args)
+{
+	int length=mixerBufferLength;
+	int hardwareChannel=sceAudioChReserve(PSP_AUDIO_NEXT_CHANNEL,length,PSP_AUDIO_FORMAT_STEREO);
+	if (hardwareChannel<0)
+	{
+		//AalibSetMixerMode() reports it
+		mixerEnabled=FALSE;
+		sceKernelSetEventFlag(mixerEvent,PSPAALIB_EVENT_READY);
+		sceKernelExitThread(0);
+		return 0;
 	}
-Play:
-	GetProcessedBuffer(mainBuf,1024,channel);
-	while (!AalibGetStopReason(channel))
+	short *mainBuf,*backBuf,*tempBuf,*speedBuf;
+	mainBuf=hardwareBuffers[0].mainBuf;
+	backBuf=hardwareBuffers[0].backBuf;
+	speedBuf=hardwareBuffers[0].speedBuf;
+	int channel,active,i;
+	int mixed[PSPAALIB_CHANNEL_LAST];
+	AalibSpatialVoice voices[PSPAALIB_CHANNEL_LAST];
+	mixerHardwareChannel=hardwareChannel;
+	sceKernelSetEventFlag(mixerEvent,PSPAALIB_EVENT_READY);
+	while (mixerEnabled)
 	{
-		sceAudioOutputPanned(hardwareChannel,(unsigned int)(channels[channel].volume.left*channels[channel].audioStrength*PSP_AUDIO_VOLUME_MAX),(unsigned int)(channels[channel].volume.right*channels[channel].audioStrength*PSP_AUDIO_VOLUME_MAX),mainBuf);
-		GetProcessedBuffer(backBuf,1024,channel);
-		while (sceAudioGetChannelRestLen(hardwareChannel))
+		active=0;
+		if (mixerBufferLength!=length)
+		{
+			length=mixerBufferLength;
+			sceAudioSetChannelDataLen(hardwareChannel,length);
+		}
+		unsigned int start=(statsEnabled)?(sceKernelGetSystemTimeLow()):(0);
+		memset(mixerAccumulator,0,length*2*sizeof(int));
+		sceKernelWaitSema(mixerLock,1,NULL);
+		for (channel=1;channel<=PSPAALIB_CHANNEL_LAST;channel++)
 		{
-			sceKernelDelayThread(100);
+			if (!channels[channel])
+			{
+				continue;
+			}
+			if (!channels[channel]->mixing)
+			{
+				channels[channel]->outputRunning=FALSE;
+				continue;
+			}
+			ApplyChannelCommands(channel);
+			if (AalibGetStopReason(channel))
+			{
+				channels[channel]->mixing=FALSE;
+				channels[channel]->outputRunning=FALSE;
+				ApplyChannelCommand(channel,PSPAALIB_COMMAND_STOP,0);
+				continue;
+			}
+			if (AalibGetStatus(channel)==PSPAALIB_STATUS_PAUSED)
+			{
+				channels[channel]->outputRunning=FALSE;
+				continue;
+			}
+			TakeChannelSnapshot(channel);
+			mixed[active++]=channel;
+		}
+		//Parameters for every audible channel in one batch,then the mix
+		UpdateChannelParams(mixed,active,voices);
+		for (i=0;i<active;i++)
+		{
+			ProcessChannel(mixerAccumulator,length,mixed[i],speedBuf,TRUE);
+		}
+		sceKernelSignalSema(mixerLock,1);
+		if (!active)
+		{
+			sceKernelWaitEventFlag(mixerEvent,PSPAALIB_EVENT_WAKE,PSP_EVENT_WAITOR|PSP_EVENT_WAITCLEAR,NULL,NULL);
+			continue;
+		}
+		SaturateMix(mainBuf,mixerAccumulator,length);
+		if (statsEnabled)
+		{
+			AddTime(&outputStats[8],sceKernelGetSystemTimeLow()-start);
+		}
+		bool dry=IsHardwareDry(hardwareChannel),counted=FALSE;
+		sceAudioOutputBlocking(hardwareChannel,PSP_AUDIO_VOLUME_MAX,mainBuf);
+		//A channel may have been unloaded while the buffer was going out
+		sceKernelWaitSema(mixerLock,1,NULL);
+		for (i=0;i<active;i++)
+		{
+			if ((channels[mixed[i]])&&(channels[mixed[i]]->mixing))
+			{
+				channels[mixed[i]]->samplesOutput+=length;
+				counted|=CountUnderrun(mixed[i],dry);
+			}
+		}
+		sceKernelSignalSema(mixerLock,1);
+		if (counted)
+		{
+			hardwareUnderruns[hardwareChannel]++;
 		}
 		tempBuf=mainBuf;
 		mainBuf=backBuf;
 		backBuf=tempBuf;
 	}
-Release:
-	FreeHardwareChannel(channel);
-	AalibStop(channel);
-	free(mainBuf);
-    free(backBuf);
+	mixerHardwareChannel=-1;
+	sceAudioChRelease(hardwareChannel);
 	sceKernelExitThread(0);
 	return 0;
 }
 
+int AalibSetMixerMode(bool enable)
+{
+	int channel;
+	for (channel=1;channel<=PSPAALIB_CHANNEL_LAST;channel++)
+	{
+		if (AalibGetStatus(channel)==PSPAALIB_STATUS_PLAYING||AalibGetStatus(channel)==PSPAALIB_STATUS_PAUSED)
+		{
+			return PSPAALIB_ERROR_CHANNELS_PLAYING;
+		}
+	}
+	if (enable==mixerEnabled)
+	{
+		return PSPAALIB_SUCCESS;
+	}
+	if (!enable)
+	{
+		mixerEnabled=FALSE;
+		sceKernelSetEventFlag(mixerEvent,PSPAALIB_EVENT_WAKE);
+		sceKernelWaitThreadEnd(mixerThread,NULL);
+		return PSPAALIB_SUCCESS;
+	}
+	if (mixerThread<0)
+	{
+		mixerAccumulator=malloc(PSPAALIB_MAX_BUFFER_LENGTH*2*sizeof(int));
+		if (!mixerAccumulator)
+		{
+			return PSPAALIB_ERROR_INSUFFICIENT_RAM;
+		}
+		mixerThread=sceKernelCreateThread("aalibmixer",MixerThread,0x18,0x8000,0,NULL);
+		mixerEvent=sceKernelCreateEventFlag("aalibmixer",0,0,NULL);
+		mixerLock=sceKernelCreateSema("aalibmixer",0,1,1,NULL);
+		if ((mixerThread<0)||(mixerEvent<0)||(mixerLock<0))
+		{
+			//Undone so the next call creates them all again
+			if (mixerThread>=0)
+			{
+				sceKernelDeleteThread(mixerThread);
+			}
+			if (mixerEvent>=0)
+			{
+				sceKernelDeleteEventFlag(mixerEvent);
+			}
+			if (mixerLock>=0)
+			{
+				sceKernelDeleteSema(mixerLock);
+			}
+			free(mixerAccumulator);
+			mixerAccumulator=NULL;
+			mixerThread=-1;
+			mixerEvent=-1;
+			mixerLock=-1;
+			return PSPAALIB_ERROR_CREATE_THREAD;
+		}
+	}
+	mixerEnabled=TRUE;
+	sceKernelClearEventFlag(mixerEvent,0);
+	sceKernelStartThread(mixerThread,0,NULL);
+	//The mixer reserves its hardware channel before it mixes anything
+	sceKernelWaitEventFlag(mixerEvent,PSPAALIB_EVENT_READY,PSP_EVENT_WAITOR|PSP_EVENT_WAITCLEAR,NULL,NULL);
+	if (!mixerEnabled)
+	{
+		sceKernelWaitThreadEnd(mixerThread,NULL);
+		return PSPAALIB_ERROR_NO_FREE_CHANNELS;
+	}
+	return PSPAALIB_SUCCESS;
+}
+
 int AalibInit()
 {
 	char c[11];
 	int i;
+	//Sized for the largest buffer a channel may ask for
+	int outputSize=PSPAALIB_MAX_BUFFER_LENGTH*2*sizeof(short);
+	//The resampler history sits in front of the source frames
+	int speedSize=(PSPAALIB_MAX_FETCH_LENGTH+PSPAALIB_RESAMPLER_HISTORY)*2*sizeof(short);
+	for (i=0;i<9;i++)
+	{
+		ResetTime(&outputStats[i]);
+	}
+	statsLock=sceKernelCreateSema("aalibstats",0,1,1,NULL);
+	audioArena=malloc(8*(2*outputSize+speedSize));
+	if (!audioArena)
+	{
+		return PSPAALIB_ERROR_INSUFFICIENT_RAM;
+	}
+	for (i=0;i<8;i++)
+	{
+		char* base=audioArena+i*(2*outputSize+speedSize);
+		hardwareBuffers[i].mainBuf=(short*)base;
+		hardwareBuffers[i].backBuf=(short*)(base+outputSize);
+		hardwareBuffers[i].speedBuf=(short*)(base+2*outputSize);
+	}
 	for (i=0;i<8;i++)
 	{
 		sprintf(c,"aalibplay%i",i);
 		threads[i]=sceKernelCreateThread(c,PlayThread,0x18,0x8000,0,NULL);
-		if (threads[i]<0)
+		hardwareEvents[i]=sceKernelCreateEventFlag(c,0,0,NULL);
+		if ((threads[i]<0)||(hardwareEvents[i]<0))
 		{
 			return PSPAALIB_WARNING_CREATE_THREAD;
 		}
 	}
-	return PSPAALIB_SUCCESS;
+	return AalibIoInit();
 }
 
 int AalibSetAmplification(int channel,float amplificationValue)
 {
-	if ((channel<1)||(channel>48))
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
 	{
 		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
+	if (!channels[channel])
+	{
+		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
+	}
 	if (amplificationValue<0)
 	{
 		return PSPAALIB_ERROR_INVALID_AMPLIFICATION_VALUE;
 	}
-	channels[channel].ampValue=amplificationValue;
+	BeginWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
+	channels[channel]->params.ampValue=amplificationValue;
+	EndWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
 	return PSPAALIB_SUCCESS;
 }
 
 int AalibSetVolume(int channel,AalibVolume volume)
 {
-	if ((channel<1)||(channel>48))
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
 	{
 		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
-	channels[channel].volume=volume;
+	if (!channels[channel])
+	{
+		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
+	}
+	BeginWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
+	channels[channel]->params.volume=volume;
+	EndWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
 	return PSPAALIB_SUCCESS;
 }
 
 int AalibSetPlaySpeed(int channel,float playSpeed)
 {
-	if ((channel<1)||(channel>48))
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
 	{
 		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
-	channels[channel].playSpeed=playSpeed;
+	if (!channels[channel])
+	{
+		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
+	}
+	BeginWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
+	channels[channel]->params.playSpeed=playSpeed;
+	EndWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
+	return PSPAALIB_SUCCESS;
+}
+
+int AalibSetBufferSize(int channel,int length)
+{
+	if ((channel<0)||(channel>PSPAALIB_CHANNEL_LAST))
+	{
+		return PSPAALIB_ERROR_INVALID_CHANNEL;
+	}
+	if ((length<PSPAALIB_MIN_BUFFER_LENGTH)||(length>PSPAALIB_MAX_BUFFER_LENGTH)||(length%PSPAALIB_BUFFER_ALIGN))
+	{
+		return PSPAALIB_ERROR_INVALID_BUFFER_LENGTH;
+	}
+	if (channel==PSPAALIB_CHANNEL_NONE)
+	{
+		mixerBufferLength=length;
+		return PSPAALIB_SUCCESS;
+	}
+	if (!channels[channel])
+	{
+		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
+	}
+	BeginWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
+	channels[channel]->params.bufferLength=length;
+	EndWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
 	return PSPAALIB_SUCCESS;
 }
 
 int AalibSetObserverVelocity(ScePspFVector2 velocity)
 {
-	observerVelocity=velocity;
+	BeginWrite(&observerSequence,observerUpdateDepth);
+	observer.velocity=velocity;
+	EndWrite(&observerSequence,observerUpdateDepth);
 	return PSPAALIB_SUCCESS;
 }
 
 int AalibSetObserverPosition(ScePspFVector2 position)
 {
-	observerPosition=position;
+	BeginWrite(&observerSequence,observerUpdateDepth);
+	observer.position=position;
+	EndWrite(&observerSequence,observerUpdateDepth);
 	return PSPAALIB_SUCCESS;
 }
 
 int AalibSetObserverFront(ScePspFVector2 front)
 {
-	observerFront=front;
+	BeginWrite(&observerSequence,observerUpdateDepth);
+	observer.front=front;
+	EndWrite(&observerSequence,observerUpdateDepth);
 	return PSPAALIB_SUCCESS;
 }
 
 int AalibSetPosition(int channel,ScePspFVector2 position)
 {
-	if ((channel<1)||(channel>48))
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
 	{
 		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
-	channels[channel].position=position;
+	if (!channels[channel])
+	{
+		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
+	}
+	BeginWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
+	channels[channel]->params.position=position;
+	EndWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
 	return PSPAALIB_SUCCESS;
 }
 
 int AalibSetVelocity(int channel,ScePspFVector2 velocity)
 {
-	if ((channel<1)||(channel>48))
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
 	{
 		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
-	channels[channel].velocity=velocity;
+	if (!channels[channel])
+	{
+		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
+	}
+	BeginWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
+	channels[channel]->params.velocity=velocity;
+	EndWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
 	return PSPAALIB_SUCCESS;
 }
 
 int AalibEnable(int channel,int effect)
 {
-	if ((channel<1)||(channel>48))
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
 	{
 		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
+	if (!channels[channel])
+	{
+		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
+	}
 	if ((effect<0)||(effect>6))
 	{
 		return PSPAALIB_ERROR_INVALID_EFFECT;
 	}
-	channels[channel].effects[effect]=TRUE;
+	BeginWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
+	channels[channel]->params.effects[effect]=TRUE;
+	EndWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
 	return PSPAALIB_SUCCESS;
 }
 
 int AalibDisable(int channel,int effect)
 {
-	if ((channel<1)||(channel>48))
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
+	{
+		return PSPAALIB_ERROR_INVALID_CHANNEL;
+	}
+	if (!channels[channel])
+	{
+		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
+	}
+	if ((effect<0)||(effect>6))
+	{
+		return PSPAALIB_ERROR_INVALID_EFFECT;
+	}
+	BeginWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
+	channels[channel]->params.effects[effect]=FALSE;
+	EndWrite(&channels[channel]->sequence,channels[channel]->updateDepth);
+	return PSPAALIB_SUCCESS;
+}
+
+int AalibBeginUpdate(int channel)
+{
+	if ((channel<0)||(channel>PSPAALIB_CHANNEL_LAST))
+	{
+		return PSPAALIB_ERROR_INVALID_CHANNEL;
+	}
+	if (channel==PSPAALIB_CHANNEL_NONE)
+	{
+		BeginWrite(&observerSequence,observerUpdateDepth++);
+		return PSPAALIB_SUCCESS;
+	}
+	if (!channels[channel])
+	{
+		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
+	}
+	BeginWrite(&channels[channel]->sequence,channels[channel]->updateDepth++);
+	return PSPAALIB_SUCCESS;
+}
+
+int AalibEndUpdate(int channel)
+{
+	if ((channel<0)||(channel>PSPAALIB_CHANNEL_LAST))
 	{
 		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
-	channels[channel].effects[effect]=FALSE;
+	if (channel==PSPAALIB_CHANNEL_NONE)
+	{
+		if (observerUpdateDepth>0)
+		{
+			EndWrite(&observerSequence,--observerUpdateDepth);
+		}
+		return PSPAALIB_SUCCESS;
+	}
+	if (!channels[channel])
+	{
+		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
+	}
+	if (channels[channel]->updateDepth>0)
+	{
+		EndWrite(&channels[channel]->sequence,--channels[channel]->updateDepth);
+	}
 	return PSPAALIB_SUCCESS;
 }
 
+//Stops channel and waits until neither a play thread nor the mixer is
+//serving it any more.
+static void ReleaseChannel(int channel)
+{
+	AalibStop(channel);
+	if (mixerEnabled)
+	{
+		sceKernelWaitSema(mixerLock,1,NULL);
+		channels[channel]->mixing=FALSE;
+		sceKernelSignalSema(mixerLock,1);
+	}
+	WaitHardwareChannel(channel);
+}
+
 int AalibUnload(int channel)
 {
-	if ((channel<1)||(channel>48))
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
 	{
 		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
-	channels[channel].initialized=FALSE;
-	if ((PSPAALIB_CHANNEL_WAV_1<=channel)&&(channel<=PSPAALIB_CHANNEL_WAV_32))
+	AalibChannelData* data=channels[channel];
+	if (!data)
 	{
-		return UnloadWav(channel-PSPAALIB_CHANNEL_WAV_1);
+		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
 	}
-	return PSPAALIB_ERROR_INVALID_CHANNEL;
+	ReleaseChannel(channel);
+	LockStats();
+	//Nothing serves the channel any more,whatever is still queued goes with it
+	int result=data->codec->unload(data->stream);
+	//The mixer only looks at the slots while holding its lock
+	if (mixerEnabled)
+	{
+		sceKernelWaitSema(mixerLock,1,NULL);
+	}
+	channels[channel]=NULL;
+	if (mixerEnabled)
+	{
+		sceKernelSignalSema(mixerLock,1);
+	}
+	free(data);
+	UnlockStats();
+	return result;
+}
+
+//Gives channel a slot,keeping the one it already has,and sets it to its
+//defaults for codec.Returns FALSE if there is no memory for a new slot.
+static bool PrepareChannel(int channel,const AalibCodec* codec)
+{
+	if (!channels[channel])
+	{
+		AalibChannelData* data=(AalibChannelData*)malloc(sizeof(AalibChannelData));
+		if (!data)
+		{
+			return FALSE;
+		}
+		memset(data,0,sizeof(AalibChannelData));
+		PSPAALIB_BARRIER();
+		channels[channel]=data;
+	}
+	BeginWrite(&channels[channel]->sequence,0);
+	memset(channels[channel]->params.effects,0,7);
+	channels[channel]->params.position=(ScePspFVector2){0.0f,0.0f};
+	channels[channel]->params.velocity=(ScePspFVector2){0.0f,0.0f};
+	channels[channel]->params.playSpeed=1.0f;
+	channels[channel]->params.volume=(AalibVolume){1.0f,1.0f};
+	channels[channel]->params.ampValue=1.0f;
+	channels[channel]->params.bufferLength=PSPAALIB_BUFFER_LENGTH;
+	EndWrite(&channels[channel]->sequence,0);
+	channels[channel]->updateDepth=0;
+	channels[channel]->snapshot=channels[channel]->params;
+	ResetResampler(&channels[channel]->speedResampler);
+	channels[channel]->chain.resampler=&channels[channel]->speedResampler;
+	channels[channel]->chain.primed=FALSE;
+	channels[channel]->volume=(AalibVolume){1.0f,1.0f};
+	channels[channel]->audioStrength=1.0f;
+	channels[channel]->playSpeed=1.0f;
+	channels[channel]->queue.head=channels[channel]->queue.tail;
+	channels[channel]->samplesOutput=0;
+	ResetTime(&channels[channel]->process);
+	channels[channel]->underruns=0;
+	channels[channel]->outputRunning=FALSE;
+	channels[channel]->starvationBase=0;
+	channels[channel]->ioBytesBase=0;
+	channels[channel]->ioStallBase=0;
+	channels[channel]->codec=codec;
+	channels[channel]->stream=channel-codec->firstChannel;
+	return TRUE;
 }
 
 int AalibLoad(char* filename,int channel,bool loadToRam)
 {
-	if ((channel<1)||(channel>52))
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
 	{
 		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
-	memset(channels[channel].effects,0,7);
-	channels[channel].position=(ScePspFVector2){0.0f,0.0f};
-	channels[channel].velocity=(ScePspFVector2){0.0f,0.0f};
-	channels[channel].playSpeed=1.0f;
-	channels[channel].volume=(AalibVolume){1.0f,1.0f};
-	channels[channel].ampValue=1.0f;
-	channels[channel].initialized=TRUE;
-	if ((PSPAALIB_CHANNEL_WAV_1<=channel)&&(channel<=PSPAALIB_CHANNEL_WAV_32))
+	const AalibCodec* codec=FindCodec(channel);
+	if (!codec)
 	{
-		return LoadWav(filename,channel-PSPAALIB_CHANNEL_WAV_1,loadToRam);
+		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
-	return PSPAALIB_ERROR_INVALID_CHANNEL;
+	if (!PrepareChannel(channel,codec))
+	{
+		return PSPAALIB_ERROR_INSUFFICIENT_RAM;
+	}
+	LockStats();
+	int result=codec->load(filename,channels[channel]->stream,loadToRam);
+	UnlockStats();
+	if (result!=PSPAALIB_SUCCESS)
+	{
+		//Nothing to play,give the slot back
+		AalibUnload(channel);
+	}
+	return result;
+}
+
+int AalibLoadBank(char* filename,int bank)
+{
+	if (GetClipCountBank(bank))
+	{
+		AalibUnloadBank(bank);
+	}
+	return LoadBank(filename,bank);
+}
+
+int AalibUnloadBank(int bank)
+{
+	int channel;
+	for (channel=PSPAALIB_CHANNEL_BANK_1;channel<=PSPAALIB_CHANNEL_BANK_16;channel++)
+	{
+		if ((channels[channel])&&(GetBankOfChannel(channel-PSPAALIB_CHANNEL_BANK_1)==bank))
+		{
+			AalibUnload(channel);
+		}
+	}
+	return UnloadBank(bank);
+}
+
+int AalibGetClipCount(int bank)
+{
+	return GetClipCountBank(bank);
+}
+
+//The bank and clip are checked before the channel is touched,so a bad index
+//leaves whatever it was playing alone.A channel keeps its slot from one clip
+//to the next.
+int AalibLoadClip(int channel,int bank,int clip)
+{
+	if ((channel<PSPAALIB_CHANNEL_BANK_1)||(channel>PSPAALIB_CHANNEL_BANK_16))
+	{
+		return PSPAALIB_ERROR_INVALID_CHANNEL;
+	}
+	int count=GetClipCountBank(bank);
+	if (!count)
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_BANK;
+	}
+	if ((clip<0)||(clip>=count))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CLIP;
+	}
+	if (channels[channel])
+	{
+		ReleaseChannel(channel);
+	}
+	if (!PrepareChannel(channel,&codecBank))
+	{
+		return PSPAALIB_ERROR_INSUFFICIENT_RAM;
+	}
+	LockStats();
+	int result=LoadClipBank(bank,clip,channels[channel]->stream);
+	UnlockStats();
+	return result;
 }
 
 int AalibPlay(int channel)
 {
-	if ((channel<1)||(channel>52))
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
 	{
 		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
-	if (!channels[channel].initialized)
+	if (!channels[channel])
 	{
 		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
 	}
+	if (mixerEnabled)
+	{
+		//Holding the lock makes this thread the only one touching the queue
+		int result=PSPAALIB_SUCCESS;
+		sceKernelWaitSema(mixerLock,1,NULL);
+		ApplyChannelCommands(channel);
+		if (AalibGetStopReason(channel))
+		{
+			result=ApplyChannelCommand(channel,PSPAALIB_COMMAND_PLAY,0);
+		}
+		if ((result==PSPAALIB_SUCCESS)&&(!channels[channel]->mixing))
+		{
+			PublishChannelParams(channel);
+		}
+		if (result==PSPAALIB_SUCCESS)
+		{
+			channels[channel]->mixing=TRUE;
+			WakeHardwareChannel(channel);
+		}
+		sceKernelSignalSema(mixerLock,1);
+		return result;
+	}
+	if ((IsChannelServed(channel))&&(!AalibGetStopReason(channel)))
+	{
+		//Keeps its place behind any stop still queued for the play thread
+		return PostChannelCommand(channel,PSPAALIB_COMMAND_PLAY,0);
+	}
+	//A thread which is still winding down after a stop holds on to its
+	//hardware channel until it exits
+	WaitHardwareChannel(channel);
+	ApplyChannelCommands(channel);
 	if (!AalibGetStopReason(channel))
 	{
 		return PSPAALIB_SUCCESS;
@@ -360,69 +1244,103 @@ int AalibPlay(int channel)
 	{
 		return PSPAALIB_WARNING_NO_FREE_CHANNELS;
 	}
-	sceKernelStartThread(threads[hardwareChannel],sizeof(int),(void*)(&hardwareChannel));
-	if ((PSPAALIB_CHANNEL_WAV_1<=channel)&&(channel<=PSPAALIB_CHANNEL_WAV_32))
+	//The last thread on it may have let go of the channel but not exited yet
+	sceKernelWaitThreadEnd(threads[hardwareChannel],NULL);
+	int result=ApplyChannelCommand(channel,PSPAALIB_COMMAND_PLAY,0);
+	if (result!=PSPAALIB_SUCCESS)
 	{
-		return PlayWav(channel-PSPAALIB_CHANNEL_WAV_1);
+		hardwareChannels[hardwareChannel]=PSPAALIB_CHANNEL_NONE;
+		return result;
 	}
-	return PSPAALIB_ERROR_INVALID_CHANNEL;
+	PublishChannelParams(channel);
+	sceKernelClearEventFlag(hardwareEvents[hardwareChannel],0);
+	sceKernelStartThread(threads[hardwareChannel],sizeof(int),(void*)(&hardwareChannel));
+	return PSPAALIB_SUCCESS;
 }
 
 int AalibStop(int channel)
 {
-	if ((PSPAALIB_CHANNEL_WAV_1<=channel)&&(channel<=PSPAALIB_CHANNEL_WAV_32))
+	int result=CheckChannel(channel);
+	if (result!=PSPAALIB_SUCCESS)
 	{
-		return StopWav(channel-PSPAALIB_CHANNEL_WAV_1);
+		return result;
 	}
-	return PSPAALIB_ERROR_INVALID_CHANNEL;
+	return PostChannelCommand(channel,PSPAALIB_COMMAND_STOP,0);
 }
 
 int AalibPause(int channel)
 {
-	if ((PSPAALIB_CHANNEL_WAV_1<=channel)&&(channel<=PSPAALIB_CHANNEL_WAV_32))
+	int result=CheckChannel(channel);
+	if (result!=PSPAALIB_SUCCESS)
 	{
-		return PauseWav(channel-PSPAALIB_CHANNEL_WAV_1);
+		return result;
 	}
-	return PSPAALIB_ERROR_INVALID_CHANNEL;
+	return PostChannelCommand(channel,PSPAALIB_COMMAND_PAUSE,0);
 }
 
 int AalibRewind(int channel)
 {
-	if ((PSPAALIB_CHANNEL_WAV_1<=channel)&&(channel<=PSPAALIB_CHANNEL_WAV_32))
+	return AalibSeekSample(channel,0);
+}
+
+int AalibSeek(int channel,int time)
+{
+	return AalibSeekMs(channel,((time>=0)&&(time<INT_MAX/1000))?(time*1000):(-1));
+}
+
+int AalibSeekMs(int channel,int ms)
+{
+	int result=CheckChannel(channel);
+	if (result!=PSPAALIB_SUCCESS)
 	{
-		return RewindWav(channel-PSPAALIB_CHANNEL_WAV_1);
+		return result;
 	}
-	return PSPAALIB_ERROR_INVALID_CHANNEL;
+	int sample=channels[channel]->codec->getSampleForMs(ms,channels[channel]->stream);
+	if (sample<0)
+	{
+		return channels[channel]->codec->invalidSeekTime;
+	}
+	return AalibSeekSample(channel,sample);
 }
 
-int AalibSeek(int channel,int time)
+//Codecs which can read the target ahead do so right away,before the command
+//even reaches the audio side.
+int AalibSeekSample(int channel,int sample)
 {
-	if ((PSPAALIB_CHANNEL_WAV_1<=channel)&&(channel<=PSPAALIB_CHANNEL_WAV_32))
+	int result=CheckChannel(channel);
+	if (result!=PSPAALIB_SUCCESS)
 	{
-		return SeekWav(channel-PSPAALIB_CHANNEL_WAV_1,time);
+		return result;
 	}
-	
-	return PSPAALIB_ERROR_INVALID_CHANNEL;
+	if (channels[channel]->codec->preroll)
+	{
+		result=channels[channel]->codec->preroll(sample,channels[channel]->stream);
+		if (result!=PSPAALIB_SUCCESS)
+		{
+			return result;
+		}
+	}
+	return PostChannelCommand(channel,PSPAALIB_COMMAND_SEEK,sample);
 }
 
 int AalibSetAutoloop(int channel,bool autoloop)
 {
-	if ((PSPAALIB_CHANNEL_WAV_1<=channel)&&(channel<=PSPAALIB_CHANNEL_WAV_32))
+	int result=CheckChannel(channel);
+	if (result!=PSPAALIB_SUCCESS)
 	{
-		return SetAutoloopWav(channel-PSPAALIB_CHANNEL_WAV_1,autoloop);
+		return result;
 	}
-	
-	return PSPAALIB_ERROR_INVALID_CHANNEL;
+	return channels[channel]->codec->setAutoloop(channels[channel]->stream,autoloop);
 }
 
 int AalibGetStopReason(int channel)
 {
-	if ((PSPAALIB_CHANNEL_WAV_1<=channel)&&(channel<=PSPAALIB_CHANNEL_WAV_32))
+	int result=CheckChannel(channel);
+	if (result!=PSPAALIB_SUCCESS)
 	{
-		return GetStopReasonWav(channel-PSPAALIB_CHANNEL_WAV_1);
+		return result;
 	}
-	
-	return PSPAALIB_ERROR_INVALID_CHANNEL;
+	return channels[channel]->codec->getStopReason(channels[channel]->stream);
 }
 
 int AalibGetStatus(int channel)
@@ -431,25 +1349,277 @@ int AalibGetStatus(int channel)
 	{
 		return -1;
 	}	
-	if ((channel<1)||(channel>48))
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
 	{
 		return PSPAALIB_ERROR_INVALID_CHANNEL;
 	}
-	if ((PSPAALIB_CHANNEL_WAV_1<=channel)&&(channel<=PSPAALIB_CHANNEL_WAV_32))
+	AalibChannelData* data=channels[channel];
+	if ((!data)||(data->codec->getStopReason(data->stream)))
+	{
+		return PSPAALIB_STATUS_STOPPED;
+	}
+	else if (data->codec->getPaused(data->stream))
+	{
+		return PSPAALIB_STATUS_PAUSED;
+	}
+	else
+	{
+		return PSPAALIB_STATUS_PLAYING;
+	}
+}
+
+int AalibGetStreamInfo(int channel,AalibStreamInfo* info)
+{
+	int result=CheckChannel(channel);
+	if (result!=PSPAALIB_SUCCESS)
+	{
+		return result;
+	}
+	return channels[channel]->codec->getStreamInfo(channels[channel]->stream,info);
+}
+
+int AalibGetMetadata(int channel,AalibMetadata* metadata)
+{
+	int result=CheckChannel(channel);
+	if (result!=PSPAALIB_SUCCESS)
+	{
+		return result;
+	}
+	return channels[channel]->codec->getMetadata(channels[channel]->stream,metadata);
+}
+
+//Samples handed to the hardware minus what it still has queued.The counter
+//is read again after the queue so a buffer going out in between is not
+//counted twice.
+int AalibGetPlaybackPosition(int channel,AalibPlaybackPosition* position)
+{
+	if ((channel<1)||(channel>PSPAALIB_CHANNEL_LAST))
+	{
+		return PSPAALIB_ERROR_INVALID_CHANNEL;
+	}
+	if (!channels[channel])
+	{
+		return PSPAALIB_ERROR_UNINITIALIZED_CHANNEL;
+	}
+	int hardwareChannel=(mixerEnabled)?((channels[channel]->mixing)?(mixerHardwareChannel):(-1)):(FindHardwareChannel(channel));
+	unsigned int output;
+	int queued;
+	do
+	{
+		output=channels[channel]->samplesOutput;
+		queued=(hardwareChannel>=0)?(sceAudioGetChannelRestLen(hardwareChannel)):(0);
+	} while (output!=channels[channel]->samplesOutput);
+	queued=MINA(MAXA(queued,0),(int)output);
+	position->samplesQueued=queued;
+	position->samplesPlayed=output-queued;
+	position->bufferLength=(mixerEnabled)?(mixerBufferLength):(channels[channel]->params.bufferLength);
+	return PSPAALIB_SUCCESS;
+}
+
+int AalibSetStreamCache(int channel,int size)
+{
+	int result=CheckChannel(channel);
+	if (result!=PSPAALIB_SUCCESS)
+	{
+		return result;
+	}
+	if (!channels[channel]->codec->setStreamCache)
+	{
+		return PSPAALIB_ERROR_INVALID_CHANNEL;
+	}
+	return channels[channel]->codec->setStreamCache(channels[channel]->stream,size);
+}
+
+//Called with statsLock held
+static void ReadChannelStats(AalibChannelData* data,AalibChannelStats* stats)
+{
+	AalibStreamInfo info;
+	memset(stats,0,sizeof(AalibChannelStats));
+	stats->buffers=data->process.count;
+	stats->underruns=data->underruns;
+	ReadTime(&data->process,&stats->processTimeMin,&stats->processTimeAvg,&stats->processTimeMax);
+	if (data->codec->getStreamInfo(data->stream,&info)==PSPAALIB_SUCCESS)
+	{
+		stats->ioStarvation=info.underruns-data->starvationBase;
+		stats->ioBytes=info.ioBytes-data->ioBytesBase;
+		stats->ioStallTime=info.ioStallTime-data->ioStallBase;
+	}
+}
+
+int AalibEnableStats(bool enable)
+{
+	//Everything counts from when the stats were turned on
+	if ((enable)&&(!statsEnabled))
+	{
+		AalibResetStats();
+	}
+	statsEnabled=enable;
+	AalibIoEnableStats(enable);
+	return PSPAALIB_SUCCESS;
+}
+
+int AalibResetStats()
+{
+	AalibStreamInfo info;
+	int i;
+	LockStats();
+	for (i=0;i<9;i++)
+	{
+		ResetTime(&outputStats[i]);
+	}
+	memset(hardwareUnderruns,0,sizeof(hardwareUnderruns));
+	for (i=1;i<=PSPAALIB_CHANNEL_LAST;i++)
 	{
-		if (GetStopReasonWav(channel-PSPAALIB_CHANNEL_WAV_1))
+		if (!channels[i])
 		{
-			return PSPAALIB_STATUS_STOPPED;
+			continue;
 		}
-		else if (GetPausedWav(channel-PSPAALIB_CHANNEL_WAV_1))
+		ResetTime(&channels[i]->process);
+		channels[i]->underruns=0;
+		//The codecs count from the load on,so the counters start from here
+		if (channels[i]->codec->getStreamInfo(channels[i]->stream,&info)==PSPAALIB_SUCCESS)
 		{
-			return PSPAALIB_STATUS_PAUSED;
+			channels[i]->starvationBase=info.underruns;
+			channels[i]->ioBytesBase=info.ioBytes;
+			channels[i]->ioStallBase=info.ioStallTime;
 		}
-		else
+	}
+	AalibIoResetStats();
+	UnlockStats();
+	return PSPAALIB_SUCCESS;
+}
+
+int AalibGetChannelStats(int channel,AalibChannelStats* stats)
+{
+	LockStats();
+	int result=CheckChannel(channel);
+	if (result==PSPAALIB_SUCCESS)
+	{
+		ReadChannelStats(channels[channel],stats);
+	}
+	UnlockStats();
+	return result;
+}
+
+int AalibGetEngineStats(AalibEngineStats* stats)
+{
+	AalibChannelStats channelStats;
+	AalibIoStats ioStats;
+	AalibTimeCounter total;
+	int i;
+	memset(stats,0,sizeof(AalibEngineStats));
+	ResetTime(&total);
+	LockStats();
+	for (i=0;i<9;i++)
+	{
+		total.count+=outputStats[i].count;
+		total.total+=outputStats[i].total;
+		total.min=MINA(total.min,outputStats[i].min);
+		total.max=MAXA(total.max,outputStats[i].max);
+	}
+	for (i=0;i<8;i++)
+	{
+		stats->hardwareUnderruns[i]=hardwareUnderruns[i];
+		stats->underruns+=hardwareUnderruns[i];
+	}
+	for (i=1;i<=PSPAALIB_CHANNEL_LAST;i++)
+	{
+		if (channels[i])
 		{
-			return PSPAALIB_STATUS_PLAYING;
+			ReadChannelStats(channels[i],&channelStats);
+			stats->ioStarvation+=channelStats.ioStarvation;
+			stats->channels++;
 		}
 	}
-	
-	return PSPAALIB_ERROR_INVALID_CHANNEL;
+	UnlockStats();
+	stats->buffers=total.count;
+	ReadTime(&total,&stats->processTimeMin,&stats->processTimeAvg,&stats->processTimeMax);
+	AalibIoGetStats(&ioStats);
+	stats->ioRequests=ioStats.requests;
+	stats->ioBytes=ioStats.bytes;
+	stats->ioReadTime=ioStats.readTime;
+	stats->ioStallTime=ioStats.stallTime;
+	stats->ioLate=ioStats.late;
+	return PSPAALIB_SUCCESS;
+}
+
+static void WriteStatsLog()
+{
+	char line[256];
+	AalibEngineStats engine;
+	AalibChannelStats stats;
+	int channel,length;
+	AalibGetEngineStats(&engine);
+	length=sprintf(line,"aalib %u ms: %d channels,%u buffers,%u underruns,%u starved,%u/%u/%u us per buffer,io %u requests %u bytes %u us read %u us stalled %u late\n",
+		sceKernelGetSystemTimeLow()/1000,engine.channels,engine.buffers,engine.underruns,engine.ioStarvation,engine.processTimeMin,engine.processTimeAvg,engine.processTimeMax,
+		engine.ioRequests,engine.ioBytes,engine.ioReadTime,engine.ioStallTime,engine.ioLate);
+	sceIoWrite(statsLogFile,line,length);
+	for (channel=1;channel<=PSPAALIB_CHANNEL_LAST;channel++)
+	{
+		if (AalibGetChannelStats(channel,&stats)==PSPAALIB_SUCCESS)
+		{
+			length=sprintf(line,"  channel %d: %u buffers,%u underruns,%u starved,%u/%u/%u us per buffer,io %u bytes %u us stalled\n",
+				channel,stats.buffers,stats.underruns,stats.ioStarvation,stats.processTimeMin,stats.processTimeAvg,stats.processTimeMax,stats.ioBytes,stats.ioStallTime);
+			sceIoWrite(statsLogFile,line,length);
+		}
+	}
+}
+
+//Sleeps on statsLogStop for the interval,so stopping it doesn't wait out a
+//whole period.
+static int StatsLogThread(SceSize argsize,void* args)
+{
+	while (1)
+	{
+		SceUInt timeout=statsLogInterval*1000;
+		if (sceKernelWaitSema(statsLogStop,1,&timeout)>=0)
+		{
+			break;
+		}
+		WriteStatsLog();
+	}
+	sceKernelExitThread(0);
+	return 0;
+}
+
+int AalibSetStatsLog(char* filename,int interval)
+{
+	if (statsLogThread>=0)
+	{
+		sceKernelSignalSema(statsLogStop,1);
+		sceKernelWaitThreadEnd(statsLogThread,NULL);
+		sceKernelDeleteThread(statsLogThread);
+		sceIoClose(statsLogFile);
+		statsLogThread=-1;
+		statsLogFile=-1;
+	}
+	if ((!filename)||(interval<=0))
+	{
+		return PSPAALIB_SUCCESS;
+	}
+	if (statsLogStop<0)
+	{
+		statsLogStop=sceKernelCreateSema("aalibstatslog",0,0,1,NULL);
+	}
+	statsLogFile=sceIoOpen(filename,PSP_O_WRONLY|PSP_O_CREAT|PSP_O_TRUNC,0777);
+	if (statsLogFile<0)
+	{
+		return PSPAALIB_ERROR_OPEN_FILE;
+	}
+	statsLogInterval=interval;
+	statsLogThread=sceKernelCreateThread("aalibstatslog",StatsLogThread,0x30,0x4000,0,NULL);
+	if ((statsLogStop<0)||(statsLogThread<0))
+	{
+		if (statsLogThread>=0)
+		{
+			sceKernelDeleteThread(statsLogThread);
+		}
+		sceIoClose(statsLogFile);
+		statsLogFile=-1;
+		statsLogThread=-1;
+		return PSPAALIB_ERROR_CREATE_THREAD;
+	}
+	AalibEnableStats(TRUE);
+	sceKernelStartThread(statsLogThread,0,NULL);
+	return PSPAALIB_SUCCESS;
 }
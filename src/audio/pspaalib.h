@@ -27,6 +27,8 @@
 #define _PSPAALIB_H_
 
 #include "pspaalibwav.h"
+#include "pspaalibogg.h"
+#include "pspaalibbank.h"
 #include "pspaalibcommon.h"
 #include "pspaalibeffects.h"
 
@@ -60,7 +62,8 @@ int AalibSetAmplification(int channel,float amplificationValue);
 //		channel:One of PSPAALIB_CHANNEL_*
 //		volume:AalibVolume structure which contains the new
 //				volumes.1.0f means maximum volume,0.0f means
-//				mute.
+//				mute.It is applied in software in the same
+//				pass as the other effects.
 //		
 //		Returns 0 on success,>0 on error.
 ////////////////////////////////////////////////
@@ -81,8 +84,30 @@ int AalibSetVolume(int channel,AalibVolume volume);
 int AalibSetPlaySpeed(int channel,float playSpeed);
 
 
+////////////////////////////////////////////////
+//		Set how many samples a stream produces per
+//		buffer.Smaller buffers lower the output latency
+//		at the cost of more CPU time per second.Takes
+//		effect at the next buffer.In mixer mode all
+//		streams share the mixer's buffer size.
+//		
+//		channel:One of PSPAALIB_CHANNEL_*,or
+//				PSPAALIB_CHANNEL_NONE for the mixer.
+//		length:PSPAALIB_MIN_BUFFER_LENGTH to
+//				PSPAALIB_MAX_BUFFER_LENGTH samples,a
+//				multiple of PSPAALIB_BUFFER_ALIGN.
+//				PSPAALIB_BUFFER_LENGTH by default.
+//		
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibSetBufferSize(int channel,int length);
+
+
 ////////////////////////////////////////////////
 //		Set a stream's source position in 2D space.
+//		Volume,strength and Doppler changes it causes
+//		are ramped over the next buffer.
 //		
 //		channel:One of PSPAALIB_CHANNEL_*
 //		position:The new position for the source.
@@ -167,6 +192,24 @@ int AalibEnable(int channel,int effect);
 int AalibDisable(int channel,int effect);
 
 
+////////////////////////////////////////////////
+//		Group several parameter changes so the audio
+//		thread sees all of them at the same buffer.
+//		Between AalibBeginUpdate() and AalibEndUpdate()
+//		the channel keeps playing with the parameters
+//		it had before.Calls can be nested.Parameters
+//		and commands should all come from one thread.
+//		
+//		channel:One of PSPAALIB_CHANNEL_*,or
+//				PSPAALIB_CHANNEL_NONE for the observer.
+//		
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibBeginUpdate(int channel);
+int AalibEndUpdate(int channel);
+
+
 ////////////////////////////////////////////////
 //		Initalize the PSP Advanced Audio Library.
 //		
@@ -176,6 +219,26 @@ int AalibDisable(int channel,int effect);
 int AalibInit();
 
 
+////////////////////////////////////////////////
+//		Switch mixer mode on or off.In mixer mode all
+//		playing streams are mixed in software into one
+//		hardware channel by a single thread,so the 8
+//		stream limit of AalibPlay() goes away.Volume and
+//		strength are applied while mixing.Can only be
+//		called while no stream is playing or paused.
+//		
+//		enable:TRUE to mix in software,FALSE to give
+//				every stream its own hardware channel.
+//		
+//		Returns 0 on success,>0 on error.If the mixer
+//		finds no free hardware channel,mixer mode stays
+//		off and PSPAALIB_ERROR_NO_FREE_CHANNELS is
+//		returned.
+////////////////////////////////////////////////
+
+int AalibSetMixerMode(bool enable);
+
+
 ////////////////////////////////////////////////
 //		Load an audio file and prepare it for playing.
 //		
@@ -183,7 +246,16 @@ int AalibInit();
 //		channel:One of PSPAALIB_CHANNEL_*.The channel
 //				onto which the file is opened.Note that you 
 //				specify a file's format using the channel number.
-//				The extensions are not scanned.
+//				The extensions are not scanned.WAV files may
+//				be PCM (8/16 bit) or IMA-ADPCM (mono/stereo).
+//				OGG channels play Ogg Vorbis,decoded ahead
+//				of the audio thread with Tremor.
+//		loadToRam:Keep the whole file in RAM.The data
+//				is read in chunks by a background thread,
+//				so the call returns right away and the
+//				channel can be played while loading.
+//				Ignored for OGG channels,which are always
+//				streamed.
 //		
 //		Returns 0 on success,>0 on error.
 ////////////////////////////////////////////////
@@ -193,6 +265,8 @@ int AalibLoad(char* filename,int channel,bool loadToRam);
 
 ////////////////////////////////////////////////
 //		Unload an audio file and release all resources used.
+//		A channel only takes up memory while a file is
+//		loaded on it.
 //		
 //		channel:One of PSPAALIB_CHANNEL_*.
 //		
@@ -201,6 +275,59 @@ int AalibLoad(char* filename,int channel,bool loadToRam);
 
 int AalibUnload(int channel);
 
+////////////////////////////////////////////////
+//		Load a sound bank made by bank.py.The whole
+//		file is read at once into one block of RAM;
+//		its clips are already 44100Hz 16 bit stereo,
+//		so nothing is parsed or converted when they
+//		are played.A bank already loaded on the slot
+//		is unloaded first.
+//
+//		filename:The name of the bank file.
+//		bank:0 to PSPAALIB_MAX_BANKS-1.
+//
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibLoadBank(char* filename,int bank);
+
+////////////////////////////////////////////////
+//		Unload a sound bank.Channels playing its clips
+//		are unloaded with it.
+//
+//		bank:0 to PSPAALIB_MAX_BANKS-1.
+//
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibUnloadBank(int bank);
+
+////////////////////////////////////////////////
+//		Retrieve the number of clips in a bank,0 if
+//		it isn't loaded.
+////////////////////////////////////////////////
+
+int AalibGetClipCount(int bank);
+
+////////////////////////////////////////////////
+//		Prepare a clip from a loaded bank for playing,
+//		like AalibLoad() does for a file.Nothing is
+//		allocated or read;the channel only points at
+//		the clip's frames in the bank.If the channel
+//		is playing it is stopped first,which waits
+//		for its play thread to finish the buffer it
+//		is on.
+//
+//		channel:One of PSPAALIB_CHANNEL_BANK_*.
+//		bank:A bank loaded with AalibLoadBank().
+//		clip:The clip's index in the bank,as printed
+//				by bank.py.
+//
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibLoadClip(int channel,int bank,int clip);
+
 
 ////////////////////////////////////////////////
 //		Reserve a hardware channel and start playing an 
@@ -208,7 +335,8 @@ int AalibUnload(int channel);
 //		There are a total of 8 hardware channels,which
 //		means you can't have more than 8 streams playing at
 //		once.In case there are no more hardware channels
-//		left,error code -5 is returned.
+//		left,error code -5 is returned.In mixer mode
+//		(see AalibSetMixerMode()) there is no such limit.
 //		
 //		channel:One of PSPAALIB_CHANNEL_*
 //		
@@ -220,7 +348,9 @@ int AalibPlay(int channel);
 
 ////////////////////////////////////////////////
 //		Stop playing a stream and release the hardware
-//		channel.
+//		channel.While a stream is playing,stop,pause,
+//		rewind and seek are queued and take effect at
+//		the start of its next buffer.
 //		
 //		channel:One of PSPAALIB_CHANNEL_*
 //		
@@ -252,6 +382,28 @@ int AalibPause(int channel);
 int AalibRewind(int channel);
 
 
+////////////////////////////////////////////////
+//		Move a stream to a new position.A streamed
+//		channel keeps playing from where it was until
+//		the data at the target has been read,so the
+//		audio thread never waits for the Memory Stick.
+//		The time this took is reported as seekLatency
+//		by AalibGetStreamInfo().
+//		
+//		channel:One of PSPAALIB_CHANNEL_*
+//		time:Position in seconds.
+//		ms:Position in milliseconds.
+//		sample:Position in sample frames at the
+//				file's own sample rate.
+//		
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibSeek(int channel,int time);
+int AalibSeekMs(int channel,int ms);
+int AalibSeekSample(int channel,int sample);
+
+
 ////////////////////////////////////////////////
 //		Set whether a stream should repeat forever.
 //		
@@ -289,6 +441,157 @@ int AalibGetStopReason(int channel);
 
 int AalibGetStatus(int channel);
 
+////////////////////////////////////////////////
+//		Retrieve a stream's read-ahead state.
+//		
+//		channel:One of PSPAALIB_CHANNEL_*
+//		info:Receives the read-ahead buffer size and
+//				fill level in bytes,and how many times
+//				the audio thread had to wait for the
+//				Memory Stick.seekLatency is how many
+//				microseconds the last seek took to reach
+//				the audio thread.ioBytes
+//				counts everything read from the Memory
+//				Stick,loopIoBytes what the last full pass
+//				through the loop read.
+//				Channels loaded to RAM are read in the
+//				background,bufferFill is how much of the
+//				data is resident so far.firstSampleTime is
+//				how many microseconds after AalibLoad()
+//				the first samples were resident,loadTime
+//				how long the whole load took,or -1 while
+//				it is still running.
+//				For OGG channels the buffer is the decoded
+//				PCM ring and decodeCost is how many
+//				microseconds of decoding a second of audio
+//				took so far.
+//		
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibGetStreamInfo(int channel,AalibStreamInfo* info);
+
+
+////////////////////////////////////////////////
+//		Retrieve the tags of a loaded file.For WAV
+//		files these come from the LIST/INFO chunk
+//		(INAM,IART,IPRD,ICRD,IGNR,ICMT) and are
+//		converted to UTF-8.Missing tags are empty
+//		strings.
+//		
+//		channel:One of PSPAALIB_CHANNEL_*
+//		metadata:Receives the tags.
+//		
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibGetMetadata(int channel,AalibMetadata* metadata);
+
+
+////////////////////////////////////////////////
+//		Give a streamed channel a RAM cache for its
+//		loop.The first pass through the loop fills
+//		the cache while streaming,later passes read
+//		the cached part from memory.If the loop is
+//		larger than the cache only its start is kept,
+//		which still hides the seek back to the loop
+//		start.Passing 0 drops the cache.Channels
+//		loaded to RAM ignore this.
+//		
+//		channel:One of PSPAALIB_CHANNEL_*
+//		size:Most bytes to cache.
+//		
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibSetStreamCache(int channel,int size);
+
+////////////////////////////////////////////////
+//		Retrieve how far a stream has actually been
+//		heard,for syncing video to it or measuring
+//		output latency.
+//		
+//		channel:One of PSPAALIB_CHANNEL_*
+//		position:Receives the samples played since
+//				AalibPlay() started the stream from
+//				stopped,the samples still queued in the
+//				hardware and the current buffer size.
+//				Seeking does not reset the count.
+//		
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibGetPlaybackPosition(int channel,AalibPlaybackPosition* position);
+
+////////////////////////////////////////////////
+//		Turn the engine counters on or off.They cost
+//		nothing while off;while on,each buffer is
+//		timed and every I/O wait is measured.Turning
+//		them on starts every counter from zero.
+//		
+//		enable:TRUE to start counting.
+//		
+//		Returns 0 on success.
+////////////////////////////////////////////////
+
+int AalibEnableStats(bool enable);
+
+////////////////////////////////////////////////
+//		Start every counter from zero.The codecs'
+//		own counts in AalibGetStreamInfo() are not
+//		touched.
+//		
+//		Returns 0 on success.
+////////////////////////////////////////////////
+
+int AalibResetStats();
+
+////////////////////////////////////////////////
+//		Retrieve a channel's counters:buffers produced,
+//		underruns (buffers which found the hardware
+//		channel with nothing left to play),fetches
+//		the codec couldn't serve for lack of data,how
+//		long producing a buffer took and the I/O it
+//		did and waited for.
+//		
+//		channel:One of PSPAALIB_CHANNEL_*
+//		stats:Receives the counters since the channel
+//				was loaded or AalibResetStats().
+//		
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibGetChannelStats(int channel,AalibChannelStats* stats);
+
+////////////////////////////////////////////////
+//		Retrieve the engine's counters:hardware buffers
+//		output,time to produce one,underruns per
+//		hardware channel and in total,I/O starvation
+//		of the loaded channels and the I/O scheduler's
+//		totals.
+//		
+//		stats:Receives the counters.
+//		
+//		Returns 0 on success.
+////////////////////////////////////////////////
+
+int AalibGetEngineStats(AalibEngineStats* stats);
+
+////////////////////////////////////////////////
+//		Write the engine's and every loaded channel's
+//		counters to a file every interval ms from a
+//		low priority thread.Turns the counters on.
+//		
+//		filename:The log file,overwritten.NULL stops
+//				logging.
+//		interval:Time between dumps in ms,0 stops
+//				logging.
+//		
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibSetStatsLog(char* filename,int interval);
+
 AalibVolume AalibGetVolume(int channel);
 
 int GetFreeHardwareChannel(int channel);
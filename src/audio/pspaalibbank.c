@@ -0,0 +1,435 @@
+////////////////////////////////////////////////
+//
+//		pspaalibbank.c
+//		Part of the PSP Advanced Audio Library
+//		Created by Arshia001
+//
+//		This file includes functions for playing clips
+//		out of sound banks.A bank is read whole with one
+//		open into one allocation,and its clips are
+//		already in the output format,so starting one
+//		only points a channel at its frames.
+//
+////////////////////////////////////////////////
+
+#include "pspaalibbank.h"
+
+typedef struct
+{
+	char* arena;
+	const AalibBankClip* clips;
+	const short* data;
+	int clipCount;
+	int size;
+	int loadTime;
+} BankInfo;
+
+typedef struct
+{
+	const short* data;
+	int frames;
+	int loopStart;
+	int loopEnd;
+	int pos;
+	int bank;
+	int stopReason;
+	bool paused;
+	bool autoloop;
+	bool initialized;
+} BankVoice;
+
+static BankInfo banks[PSPAALIB_MAX_BANKS];
+
+//Voices are fixed,so loading a clip never allocates
+static BankVoice voicesBank[16];
+
+static inline short Saturate(int sample)
+{
+	return (sample>32767)?(32767):((sample<-32768)?(-32768):(sample));
+}
+
+//Checks the header and every index entry once,so nothing on the audio path
+//has to.
+static bool CheckBank(const char* arena,int size)
+{
+	const AalibBankHeader* header=(const AalibBankHeader*)arena;
+	if ((size<sizeof(AalibBankHeader))||(memcmp(header->magic,"AALB",4))||(header->version!=PSPAALIB_BANK_VERSION)||(!header->clipCount))
+	{
+		return FALSE;
+	}
+	unsigned int indexEnd=sizeof(AalibBankHeader)+header->clipCount*sizeof(AalibBankClip);
+	if ((header->dataOffset<indexEnd)||(header->dataOffset&3)||(header->dataSize&3)||(header->dataOffset>size)||(header->dataSize>size-header->dataOffset))
+	{
+		return FALSE;
+	}
+	unsigned int dataFrames=header->dataSize/4;
+	const AalibBankClip* clips=(const AalibBankClip*)(arena+sizeof(AalibBankHeader));
+	int i;
+	for (i=0;i<header->clipCount;i++)
+	{
+		if ((clips[i].offset>dataFrames)||(clips[i].frames>dataFrames-clips[i].offset)||(clips[i].loopEnd>clips[i].frames)||(clips[i].loopStart>clips[i].loopEnd))
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+int LoadBank(char* filename,int bank)
+{
+	if ((bank<0)||(bank>=PSPAALIB_MAX_BANKS))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_BANK;
+	}
+	if (banks[bank].arena)
+	{
+		UnloadBank(bank);
+	}
+	unsigned int start=sceKernelGetSystemTimeLow();
+	SceUID file=sceIoOpen(filename,PSP_O_RDONLY,0777);
+	if (file<0)
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_FILE;
+	}
+	int size=sceIoLseek32(file,0,PSP_SEEK_END);
+	if (size<(int)sizeof(AalibBankHeader))
+	{
+		sceIoClose(file);
+		return PSPAALIB_ERROR_BANK_INVALID_FILE;
+	}
+	char* arena=(char*)malloc(size);
+	if (!arena)
+	{
+		sceIoClose(file);
+		return PSPAALIB_ERROR_BANK_INSUFFICIENT_RAM;
+	}
+	//The whole file in one go,the scheduler only splits it so streams
+	//playing meanwhile still get their reads in
+	int result=AalibIoRead(file,0,arena,size,PSPAALIB_IO_PRIORITY_BACKGROUND,1000000);
+	sceIoClose(file);
+	if ((result!=size)||(!CheckBank(arena,size)))
+	{
+		free(arena);
+		return PSPAALIB_ERROR_BANK_INVALID_FILE;
+	}
+	const AalibBankHeader* header=(const AalibBankHeader*)arena;
+	banks[bank].clips=(const AalibBankClip*)(arena+sizeof(AalibBankHeader));
+	banks[bank].data=(const short*)(arena+header->dataOffset);
+	banks[bank].clipCount=header->clipCount;
+	banks[bank].size=size;
+	banks[bank].loadTime=sceKernelGetSystemTimeLow()-start;
+	banks[bank].arena=arena;
+	return PSPAALIB_SUCCESS;
+}
+
+//Channels playing from the bank must have been unloaded first.
+int UnloadBank(int bank)
+{
+	if ((bank<0)||(bank>=PSPAALIB_MAX_BANKS)||(!banks[bank].arena))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_BANK;
+	}
+	free(banks[bank].arena);
+	memset(&banks[bank],0,sizeof(BankInfo));
+	return PSPAALIB_SUCCESS;
+}
+
+//Returns 0 if the bank isn't loaded.
+int GetClipCountBank(int bank)
+{
+	if ((bank<0)||(bank>=PSPAALIB_MAX_BANKS)||(!banks[bank].arena))
+	{
+		return 0;
+	}
+	return banks[bank].clipCount;
+}
+
+//Returns the bank channel is playing from,or -1.
+int GetBankOfChannel(int channel)
+{
+	if ((channel<0)||(channel>15)||(!voicesBank[channel].initialized))
+	{
+		return -1;
+	}
+	return voicesBank[channel].bank;
+}
+
+int LoadClipBank(int bank,int clip,int channel)
+{
+	if ((channel<0)||(channel>15))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CHANNEL;
+	}
+	if ((bank<0)||(bank>=PSPAALIB_MAX_BANKS)||(!banks[bank].arena))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_BANK;
+	}
+	if ((clip<0)||(clip>=banks[bank].clipCount))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CLIP;
+	}
+	const AalibBankClip* entry=&banks[bank].clips[clip];
+	voicesBank[channel].data=banks[bank].data+2*entry->offset;
+	voicesBank[channel].frames=entry->frames;
+	voicesBank[channel].loopStart=entry->loopStart;
+	voicesBank[channel].loopEnd=entry->loopEnd;
+	voicesBank[channel].pos=0;
+	voicesBank[channel].bank=bank;
+	voicesBank[channel].autoloop=FALSE;
+	voicesBank[channel].paused=TRUE;
+	voicesBank[channel].stopReason=PSPAALIB_STOP_JUST_LOADED;
+	voicesBank[channel].initialized=TRUE;
+	return PSPAALIB_SUCCESS;
+}
+
+//Clips are loaded with LoadClipBank(),a bank channel can't open a file
+int LoadFileBank(char* filename,int channel,bool loadToRam)
+{
+	return PSPAALIB_ERROR_BANK_INVALID_FILE;
+}
+
+int UnloadClipBank(int channel)
+{
+	if ((channel<0)||(channel>15))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CHANNEL;
+	}
+	if (!voicesBank[channel].initialized)
+	{
+		return PSPAALIB_ERROR_BANK_UNINITIALIZED_CHANNEL;
+	}
+	memset(&voicesBank[channel],0,sizeof(BankVoice));
+	voicesBank[channel].bank=-1;
+	return PSPAALIB_SUCCESS;
+}
+
+bool GetPausedBank(int channel)
+{
+	if ((channel<0)||(channel>15))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CHANNEL;
+	}
+	if (!voicesBank[channel].initialized)
+	{
+		return PSPAALIB_ERROR_BANK_UNINITIALIZED_CHANNEL;
+	}
+	return voicesBank[channel].paused;
+}
+
+int SetAutoloopBank(int channel,bool autoloop)
+{
+	if ((channel<0)||(channel>15))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CHANNEL;
+	}
+	if (!voicesBank[channel].initialized)
+	{
+		return PSPAALIB_ERROR_BANK_UNINITIALIZED_CHANNEL;
+	}
+	voicesBank[channel].autoloop=autoloop;
+	return PSPAALIB_SUCCESS;
+}
+
+int GetStopReasonBank(int channel)
+{
+	if ((channel<0)||(channel>15))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CHANNEL;
+	}
+	if (!voicesBank[channel].initialized)
+	{
+		return PSPAALIB_ERROR_BANK_UNINITIALIZED_CHANNEL;
+	}
+	return voicesBank[channel].stopReason;
+}
+
+int PlayBank(int channel)
+{
+	if ((channel<0)||(channel>15))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CHANNEL;
+	}
+	if (!voicesBank[channel].initialized)
+	{
+		return PSPAALIB_ERROR_BANK_UNINITIALIZED_CHANNEL;
+	}
+	voicesBank[channel].paused=FALSE;
+	voicesBank[channel].stopReason=PSPAALIB_STOP_NOT_STOPPED;
+	return PSPAALIB_SUCCESS;
+}
+
+int StopBank(int channel)
+{
+	if ((channel<0)||(channel>15))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CHANNEL;
+	}
+	if (!voicesBank[channel].initialized)
+	{
+		return PSPAALIB_ERROR_BANK_UNINITIALIZED_CHANNEL;
+	}
+	voicesBank[channel].pos=0;
+	voicesBank[channel].paused=TRUE;
+	voicesBank[channel].stopReason=PSPAALIB_STOP_ON_REQUEST;
+	return PSPAALIB_SUCCESS;
+}
+
+int PauseBank(int channel)
+{
+	if ((channel<0)||(channel>15))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CHANNEL;
+	}
+	if (!voicesBank[channel].initialized)
+	{
+		return PSPAALIB_ERROR_BANK_UNINITIALIZED_CHANNEL;
+	}
+	voicesBank[channel].paused=!voicesBank[channel].paused;
+	voicesBank[channel].stopReason=PSPAALIB_STOP_NOT_STOPPED;
+	return PSPAALIB_SUCCESS;
+}
+
+int SeekBankSample(int sample,int channel)
+{
+	if ((channel<0)||(channel>15))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CHANNEL;
+	}
+	if (!voicesBank[channel].initialized)
+	{
+		return PSPAALIB_ERROR_BANK_UNINITIALIZED_CHANNEL;
+	}
+	if ((sample<0)||(sample>=voicesBank[channel].frames))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_SEEK_TIME;
+	}
+	voicesBank[channel].pos=sample;
+	return PSPAALIB_SUCCESS;
+}
+
+//Returns the sample at ms milliseconds,or -1 on error.
+int GetSampleForMsBank(int ms,int channel)
+{
+	if ((channel<0)||(channel>15)||(!voicesBank[channel].initialized)||(ms<0))
+	{
+		return -1;
+	}
+	long long sample=(long long)ms*PSP_SAMPLE_RATE/1000;
+	return (sample>INT_MAX)?(-1):((int)sample);
+}
+
+//Copies frames of the clip,wrapping from loopEnd to loopStart with autoloop
+//on.Returns fewer frames only at the end of the clip.
+static int FetchBank(int channel,short* dest,int frames,int gain)
+{
+	BankVoice* voice=&voicesBank[channel];
+	int done=0,count,i;
+	while (done<frames)
+	{
+		int end=(voice->autoloop)?(voice->loopEnd):(voice->frames);
+		if (voice->pos>=end)
+		{
+			if ((!voice->autoloop)||(voice->loopStart>=voice->loopEnd))
+			{
+				break;
+			}
+			voice->pos=voice->loopStart;
+			continue;
+		}
+		count=MINA(frames-done,end-voice->pos);
+		const short* src=voice->data+2*voice->pos;
+		if (gain==PSPAALIB_GAIN_ONE)
+		{
+			memcpy(dest+2*done,src,4*count);
+		}
+		else
+		{
+			for (i=0;i<2*count;i++)
+			{
+				dest[2*done+i]=Saturate((src[i]*gain)>>PSPAALIB_GAIN_SHIFT);
+			}
+		}
+		voice->pos+=count;
+		done+=count;
+	}
+	return done;
+}
+
+int GetBufferBank(short* buf,int length,float amp,int channel)
+{
+	if ((channel<0)||(channel>15))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CHANNEL;
+	}
+	if ((!voicesBank[channel].initialized)||(voicesBank[channel].paused)||(voicesBank[channel].stopReason==PSPAALIB_STOP_END_OF_STREAM))
+	{
+		memset((char*)buf,0,4*length);
+		return PSPAALIB_WARNING_PAUSED_BUFFER_REQUESTED;
+	}
+	int gain=(amp<PSPAALIB_GAIN_MAX)?((int)(amp*PSPAALIB_GAIN_ONE)):(PSPAALIB_GAIN_MAX*PSPAALIB_GAIN_ONE);
+	int done=FetchBank(channel,buf,length,gain);
+	if (done<length)
+	{
+		//Played out the clip,stop after this buffer
+		memset((char*)(buf+2*done),0,4*(length-done));
+		voicesBank[channel].pos=0;
+		voicesBank[channel].paused=TRUE;
+		voicesBank[channel].stopReason=PSPAALIB_STOP_END_OF_STREAM;
+	}
+	return PSPAALIB_SUCCESS;
+}
+
+int GetMetadataBank(int channel,AalibMetadata* metadata)
+{
+	if ((channel<0)||(channel>15))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CHANNEL;
+	}
+	if (!voicesBank[channel].initialized)
+	{
+		return PSPAALIB_ERROR_BANK_UNINITIALIZED_CHANNEL;
+	}
+	memset(metadata,0,sizeof(AalibMetadata));
+	return PSPAALIB_SUCCESS;
+}
+
+//A clip is always all in RAM,the bank's read counts as its load
+int GetStreamInfoBank(int channel,AalibStreamInfo* info)
+{
+	if ((channel<0)||(channel>15))
+	{
+		return PSPAALIB_ERROR_BANK_INVALID_CHANNEL;
+	}
+	if (!voicesBank[channel].initialized)
+	{
+		return PSPAALIB_ERROR_BANK_UNINITIALIZED_CHANNEL;
+	}
+	memset(info,0,sizeof(AalibStreamInfo));
+	info->bufferSize=4*voicesBank[channel].frames;
+	info->bufferFill=info->bufferSize;
+	info->loadTime=banks[voicesBank[channel].bank].loadTime;
+	info->firstSampleTime=info->loadTime;
+	return PSPAALIB_SUCCESS;
+}
+
+const AalibCodec codecBank=
+{
+	PSPAALIB_CHANNEL_BANK_1,
+	PSPAALIB_CHANNEL_BANK_16,
+	PSPAALIB_ERROR_BANK_INVALID_SEEK_TIME,
+	LoadFileBank,
+	UnloadClipBank,
+	GetBufferBank,
+	PlayBank,
+	StopBank,
+	PauseBank,
+	SeekBankSample,
+	NULL,
+	GetSampleForMsBank,
+	SetAutoloopBank,
+	GetStopReasonBank,
+	GetPausedBank,
+	GetStreamInfoBank,
+	GetMetadataBank,
+	NULL
+};
@@ -0,0 +1,64 @@
+////////////////////////////////////////////////
+//
+//		pspaalibbank.h
+//		Part of the PSP Advanced Audio Library
+//		Created by Arshia001
+//
+//		This file includes the sound bank format and
+//		function declarations for pspaalibbank.c.
+//
+////////////////////////////////////////////////
+
+#ifndef _PSPAALIBBANK_H_
+#define _PSPAALIBBANK_H_
+
+#include "pspaalibcommon.h"
+#include "pspaalibio.h"
+
+#define PSPAALIB_MAX_BANKS 4
+#define PSPAALIB_BANK_VERSION 1
+#define PSPAALIB_BANK_ALIGN 64
+
+//A bank file,little endian as written by bank.py:the header,clipCount index
+//entries and then every clip's frames,already at 44100Hz 16 bit stereo.The
+//data and each clip start on PSPAALIB_BANK_ALIGN bytes.Offsets are in frames
+//from the start of the data,loop points in frames from the clip's start.
+typedef struct
+{
+	char magic[4];
+	unsigned short version;
+	unsigned short clipCount;
+	unsigned int dataOffset;
+	unsigned int dataSize;
+} AalibBankHeader;
+
+typedef struct
+{
+	unsigned int offset;
+	unsigned int frames;
+	unsigned int loopStart;
+	unsigned int loopEnd;
+} AalibBankClip;
+
+int LoadBank(char* filename,int bank);
+int UnloadBank(int bank);
+int GetClipCountBank(int bank);
+int GetBankOfChannel(int channel);
+int LoadClipBank(int bank,int clip,int channel);
+bool GetPausedBank(int channel);
+int SetAutoloopBank(int channel,bool autoloop);
+int GetStopReasonBank(int channel);
+int PlayBank(int channel);
+int StopBank(int channel);
+int PauseBank(int channel);
+int SeekBankSample(int sample,int channel);
+int GetSampleForMsBank(int ms,int channel);
+int GetBufferBank(short* buf,int length,float amp,int channel);
+int LoadFileBank(char* filename,int channel,bool loadToRam);
+int UnloadClipBank(int channel);
+int GetMetadataBank(int channel,AalibMetadata* metadata);
+int GetStreamInfoBank(int channel,AalibStreamInfo* info);
+
+extern const AalibCodec codecBank;
+
+#endif
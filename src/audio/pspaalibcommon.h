@@ -12,20 +12,33 @@
 #ifndef _PSPAALIBCOMMON_H_
 #define _PSPAALIBCOMMON_H_
 
+//A host build gets the kernel,I/O and audio calls from pspaalibhost.c
+#ifdef PSPAALIB_HOST
+#include "pspaalibhost.h"
+#else
 #include <pspkernel.h>
 #include <psputility.h>
 #include <pspaudio.h>
+#include <pspmp3.h>
+#include <pspatrac3.h>
+#endif
+#include <stdio.h>
 #include <string.h>
 #include <malloc.h>
 #include <limits.h>
 #include <math.h>
-#include <pspmp3.h>
-#include <pspatrac3.h>
 #include <tremor/ivorbiscodec.h>
 #include <tremor/ivorbisfile.h>
 #include <setjmp.h>
 //#include <vorbis/vorbisfile.h>
 
+//Counted by the host layer,see AalibHostGetThreadAllocations()
+#ifdef PSPAALIB_HOST
+#include <stdlib.h>
+#define malloc(size) AalibHostMalloc(size)
+#define free(pointer) AalibHostFree(pointer)
+#endif
+
 #ifndef bool
     #define bool unsigned char
 #endif
@@ -37,6 +50,24 @@
 
 #define PSP_SAMPLE_RATE 44100
 
+#define PSPAALIB_BUFFER_LENGTH 1024
+#define PSPAALIB_MIN_BUFFER_LENGTH 256
+#define PSPAALIB_MAX_BUFFER_LENGTH 4096
+#define PSPAALIB_BUFFER_ALIGN 64
+#define PSPAALIB_MAX_PLAY_SPEED 4.0f
+//Most frames a codec is asked for in one buffer:the largest buffer at the
+//highest play speed
+#define PSPAALIB_MAX_FETCH_LENGTH ((int)(PSPAALIB_MAX_BUFFER_LENGTH*PSPAALIB_MAX_PLAY_SPEED))
+
+#define PSPAALIB_GAIN_SHIFT 12
+#define PSPAALIB_GAIN_ONE (1<<PSPAALIB_GAIN_SHIFT)
+#define PSPAALIB_GAIN_MAX 16
+#define PSPAALIB_RAMP_SHIFT 12
+
+#define PSPAALIB_SPEED_OF_SOUND 340.0f
+
+#define PSPAALIB_RESAMPLER_HISTORY 2
+
 #define PSPAALIB_CHANNEL_NONE 0
 #define PSPAALIB_CHANNEL_SCEMP3_1 1
 #define PSPAALIB_CHANNEL_SCEMP3_2 2
@@ -88,6 +119,25 @@
 #define PSPAALIB_CHANNEL_WAV_31 47
 #define PSPAALIB_CHANNEL_WAV_32 48
 
+#define PSPAALIB_CHANNEL_BANK_1 49
+#define PSPAALIB_CHANNEL_BANK_2 50
+#define PSPAALIB_CHANNEL_BANK_3 51
+#define PSPAALIB_CHANNEL_BANK_4 52
+#define PSPAALIB_CHANNEL_BANK_5 53
+#define PSPAALIB_CHANNEL_BANK_6 54
+#define PSPAALIB_CHANNEL_BANK_7 55
+#define PSPAALIB_CHANNEL_BANK_8 56
+#define PSPAALIB_CHANNEL_BANK_9 57
+#define PSPAALIB_CHANNEL_BANK_10 58
+#define PSPAALIB_CHANNEL_BANK_11 59
+#define PSPAALIB_CHANNEL_BANK_12 60
+#define PSPAALIB_CHANNEL_BANK_13 61
+#define PSPAALIB_CHANNEL_BANK_14 62
+#define PSPAALIB_CHANNEL_BANK_15 63
+#define PSPAALIB_CHANNEL_BANK_16 64
+
+#define PSPAALIB_CHANNEL_LAST PSPAALIB_CHANNEL_BANK_16
+
 #define PSPAALIB_EFFECT_MIX 0
 #define PSPAALIB_EFFECT_PLAYSPEED 1
 #define PSPAALIB_EFFECT_STEREO_BY_POSITION 2
@@ -102,12 +152,31 @@
 #define PSPAALIB_STOP_JUST_LOADED -3
 #define PSPAALIB_STOP_UNLOADED -4
 
+#define PSPAALIB_EVENT_WAKE 1
+#define PSPAALIB_EVENT_READY 2
+
+#define PSPAALIB_COMMAND_PLAY 0
+#define PSPAALIB_COMMAND_STOP 1
+#define PSPAALIB_COMMAND_PAUSE 2
+#define PSPAALIB_COMMAND_SEEK 3
+#define PSPAALIB_COMMAND_QUEUE_LENGTH 8
+
+//User threads all run on the Allegrex,so ordering the shared parameter and
+//command blocks only needs the compiler to keep its stores in order.A host
+//runs them on several cores and needs a real fence.
+#ifdef PSPAALIB_HOST
+#define PSPAALIB_BARRIER() __sync_synchronize()
+#else
+#define PSPAALIB_BARRIER() __asm__ __volatile__("":::"memory")
+#endif
+
 #define PSPAALIB_STATUS_STOPPED -1
 #define PSPAALIB_STATUS_PAUSED -2
 #define PSPAALIB_STATUS_PLAYING -3
 
 #define PSPAALIB_SUCCESS 0
 
+#define PSPAALIB_WARNING_COMMAND_QUEUE_FULL -8
 #define PSPAALIB_WARNING_WAV_INVALID_SBPS -7
 
 #define PSPAALIB_WARNING_CREATE_THREAD -6
@@ -120,6 +189,12 @@
 #define PSPAALIB_ERROR_UNINITIALIZED_CHANNEL 2
 #define PSPAALIB_ERROR_INVALID_EFFECT 3
 #define PSPAALIB_ERROR_INVALID_AMPLIFICATION_VALUE 4
+#define PSPAALIB_ERROR_IO_UNINITIALIZED 5
+#define PSPAALIB_ERROR_INSUFFICIENT_RAM 6
+#define PSPAALIB_ERROR_CHANNELS_PLAYING 7
+#define PSPAALIB_ERROR_INVALID_BUFFER_LENGTH 8
+#define PSPAALIB_ERROR_OPEN_FILE 9
+#define PSPAALIB_ERROR_CREATE_THREAD 10
 
 #define PSPAALIB_ERROR_WAV_INVALID_CHANNEL 11
 #define PSPAALIB_ERROR_WAV_INVALID_FILE 12
@@ -128,6 +203,22 @@
 #define PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL 15
 #define PSPAALIB_ERROR_WAV_INSUFFICIENT_RAM 16
 
+#define PSPAALIB_ERROR_OGG_INVALID_CHANNEL 21
+#define PSPAALIB_ERROR_OGG_INVALID_FILE 22
+#define PSPAALIB_ERROR_OGG_INVALID_SEEK_TIME 23
+#define PSPAALIB_ERROR_OGG_UNINITIALIZED_CHANNEL 24
+#define PSPAALIB_ERROR_OGG_INSUFFICIENT_RAM 25
+
+#define PSPAALIB_ERROR_BANK_INVALID_CHANNEL 31
+#define PSPAALIB_ERROR_BANK_INVALID_FILE 32
+#define PSPAALIB_ERROR_BANK_INVALID_SEEK_TIME 33
+#define PSPAALIB_ERROR_BANK_UNINITIALIZED_CHANNEL 34
+#define PSPAALIB_ERROR_BANK_INSUFFICIENT_RAM 35
+#define PSPAALIB_ERROR_BANK_INVALID_BANK 36
+#define PSPAALIB_ERROR_BANK_INVALID_CLIP 37
+
+#define PSPAALIB_ERROR_NO_FREE_CHANNELS 41
+
 
 
 #define MAXA(A,B) ((A>B)?(A):(B))
@@ -139,6 +230,106 @@ typedef struct
 	float right;
 } AalibVolume;
 
+//One channel's spatial parameters,see UpdateSpatialVoices().position is the
+//source relative to the observer and front the observer's facing.
+typedef struct
+{
+	ScePspFVector2 position;
+	ScePspFVector2 velocity;
+	ScePspFVector2 observerVelocity;
+	ScePspFVector2 front;
+	AalibVolume volume;
+	float strength;
+	float playSpeed;
+} AalibSpatialVoice;
+
+//Resampler state carried from one buffer to the next:the fractional source
+//position and the two source frames it currently sits between.
+typedef struct
+{
+	unsigned int phase;
+	short history[2*PSPAALIB_RESAMPLER_HISTORY];
+} AalibResampler;
+
+//A channel's effects after the raw fetch,see CompileDspChain().The kernel
+//writes length frames to dest,either shorts or added to an int accumulator.
+typedef struct AalibDspChain AalibDspChain;
+typedef void (*AalibDspKernel)(void* dest,short* src,int length,AalibDspChain* chain);
+
+struct AalibDspChain
+{
+	AalibDspKernel kernel;
+	bool speed;
+	bool primed;
+	unsigned int step;
+	int stepDelta;
+	unsigned int targetStep;
+	int gainLeft;
+	int gainRight;
+	int gainLeftDelta;
+	int gainRightDelta;
+	int targetGainLeft;
+	int targetGainRight;
+	AalibResampler* resampler;
+};
+
+typedef struct
+{
+	int bufferSize;
+	int bufferFill;
+	int underruns;
+	int seekLatency;
+	int cacheSize;
+	int cacheFill;
+	unsigned int ioBytes;
+	unsigned int loopIoBytes;
+	int loadTime;
+	int firstSampleTime;
+	int decodeCost;
+	unsigned int ioStallTime;
+} AalibStreamInfo;
+
+//Counters kept while AalibEnableStats() is on.Times are in microseconds;a
+//channel's process times cover the effects and the fetch for one buffer,the
+//engine's cover everything produced for one hardware buffer.underruns are
+//buffers which found the hardware with nothing left to play,ioStarvation
+//fetches the codec couldn't serve because the data wasn't read yet.
+typedef struct
+{
+	unsigned int buffers;
+	unsigned int underruns;
+	unsigned int ioStarvation;
+	unsigned int processTimeMin;
+	unsigned int processTimeAvg;
+	unsigned int processTimeMax;
+	unsigned int ioBytes;
+	unsigned int ioStallTime;
+} AalibChannelStats;
+
+typedef struct
+{
+	unsigned int buffers;
+	unsigned int underruns;
+	unsigned int hardwareUnderruns[8];
+	unsigned int ioStarvation;
+	unsigned int processTimeMin;
+	unsigned int processTimeAvg;
+	unsigned int processTimeMax;
+	unsigned int ioRequests;
+	unsigned int ioBytes;
+	unsigned int ioReadTime;
+	unsigned int ioStallTime;
+	unsigned int ioLate;
+	int channels;
+} AalibEngineStats;
+
+typedef struct
+{
+	unsigned int samplesPlayed;
+	int samplesQueued;
+	int bufferLength;
+} AalibPlaybackPosition;
+
 typedef struct {
     char title[256];
     char artist[256];
@@ -162,6 +353,31 @@ typedef struct {
 
 #define PSSPAALIB_MAX_COVER_SIZE 128
 
+//What a codec provides for its range of channels.Functions take the channel
+//within the codec's range,counting from 0.preroll and setStreamCache may be
+//NULL if the codec has no use for them.
+typedef struct
+{
+	int firstChannel;
+	int lastChannel;
+	int invalidSeekTime;
+	int (*load)(char* filename,int channel,bool loadToRam);
+	int (*unload)(int channel);
+	int (*getBuffer)(short* buf,int length,float amp,int channel);
+	int (*play)(int channel);
+	int (*stop)(int channel);
+	int (*pause)(int channel);
+	int (*seekSample)(int sample,int channel);
+	int (*preroll)(int sample,int channel);
+	int (*getSampleForMs)(int ms,int channel);
+	int (*setAutoloop)(int channel,bool autoloop);
+	int (*getStopReason)(int channel);
+	bool (*getPaused)(int channel);
+	int (*getStreamInfo)(int channel,AalibStreamInfo* info);
+	int (*getMetadata)(int channel,AalibMetadata* metadata);
+	int (*setStreamCache)(int channel,int size);
+} AalibCodec;
+
 int ConvertStringToUTF8(char* str, int max_length);
 
 #endif
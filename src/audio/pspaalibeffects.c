@@ -17,84 +17,266 @@
 
 #include "pspaalibeffects.h"
 
-void GetBufferSpeedEffect(short* dest,short* src,int length,float speed,bool mix)
+//Fixed point linear resampler shared by the WAV rate conversion and the play
+//speed effect.step is the source advance per output frame in 16.16.The source
+//position is kept relative to the two history frames,so a buffer needs exactly
+//GetResamplerFrames new source frames and the phase runs on across buffers
+//without a seam.src must have PSPAALIB_RESAMPLER_HISTORY free frames in front
+//of it,the history is copied there so the inner loop never branches.
+//A 4-tap cubic was weighed as an option and dropped:"hostbench resampler"
+//puts it at about 4 times the cost per frame of this one for some 30dB less
+//THD+N,it would need a third history frame all through the chain,and the
+//converter writes 44100Hz files,so only the play speed effect resamples.
+
+void ResetResampler(AalibResampler* resampler)
 {
-	int i;
-	if (mix)
+	memset(resampler,0,sizeof(AalibResampler));
+}
+
+int GetResamplerFrames(AalibResampler* resampler,int length,unsigned int step)
+{
+	return (int)((resampler->phase+(unsigned long long)length*step)>>16);
+}
+
+//Most frames GetResamplerFrames() can return for length,whatever the phase.
+//Sizes the buffers the source frames are fetched into.
+int GetResamplerMaxFrames(int length,unsigned int step)
+{
+	return (int)((0xFFFF+(unsigned long long)length*step)>>16);
+}
+
+void ResampleLinear(short* dest,short* src,int length,unsigned int step,AalibResampler* resampler)
+{
+	short* frames=src-2*PSPAALIB_RESAMPLER_HISTORY;
+	unsigned int position=resampler->phase;
+	int i,index,frac,a,b;
+	memcpy(frames,resampler->history,sizeof(resampler->history));
+	for (i=0;i<length;i++,position+=step)
 	{
-		for (i=0;i<length;i++)
-		{
-			dest[2*i]=(src[2*(int)(i*speed)]+src[2*(int)(i*speed)+1])/2;
-			dest[2*i+1]=dest[2*i];
-		}
+		index=2*(position>>16);
+		//15 bits of fraction keep (b-a)*frac inside an int
+		frac=(position&0xFFFF)>>1;
+		a=frames[index];
+		b=frames[index+2];
+		dest[2*i]=a+(((b-a)*frac)>>15);
+		a=frames[index+1];
+		b=frames[index+3];
+		dest[2*i+1]=a+(((b-a)*frac)>>15);
 	}
-	else
+	memcpy(resampler->history,frames+2*(position>>16),sizeof(resampler->history));
+	resampler->phase=position&0xFFFF;
+}
+
+//Effect chain run on a channel after the raw fetch.The kernel is picked from
+//a table for the effects which are on,so the per-frame loop has no effect
+//checks:each frame is resampled,mixed down to mono,gained and panned in one
+//go and then stored or added to the mixer's accumulator.Gains and the play
+//speed are ramped linearly across the buffer from where the last one ended,
+//so moving sources don't step from one buffer to the next.Gains ramp in Q24.
+
+static inline int GetChainGain(float gain)
+{
+	if (gain<=0)
 	{
-		for (i=0;i<length;i++)
-		{
-			dest[2*i]=src[2*(int)(i*speed)];
-			dest[2*i+1]=src[2*(int)(i*speed)+1];
-		}
+		return 0;
 	}
-	
+	return (gain<PSPAALIB_GAIN_MAX)?((int)(gain*PSPAALIB_GAIN_ONE)):(PSPAALIB_GAIN_MAX*PSPAALIB_GAIN_ONE);
+}
+
+static inline short SaturateSample(int sample)
+{
+	return (sample>32767)?(32767):((sample<-32768)?(-32768):(sample));
 }
 
-float GetVectorAngle(ScePspFVector2 v)
+static inline __attribute__((always_inline)) void RunDspChain(void* dest,short* src,int length,AalibDspChain* chain,bool resample,bool mixdown,bool accumulate)
 {
-	if (v.x==0)
+	short* frames=src;
+	unsigned int position=0;
+	unsigned int step=chain->step;
+	int stepDelta=chain->stepDelta;
+	int gainLeft=chain->gainLeft;
+	int gainRight=chain->gainRight;
+	int gainLeftDelta=chain->gainLeftDelta;
+	int gainRightDelta=chain->gainRightDelta;
+	int i,index,frac,a,b,left,right;
+	if (resample)
+	{
+		frames=src-2*PSPAALIB_RESAMPLER_HISTORY;
+		memcpy(frames,chain->resampler->history,sizeof(chain->resampler->history));
+		position=chain->resampler->phase;
+	}
+	for (i=0;i<length;i++)
+	{
+		if (resample)
+		{
+			index=2*(position>>16);
+			frac=(position&0xFFFF)>>1;
+			a=frames[index];
+			b=frames[index+2];
+			left=a+(((b-a)*frac)>>15);
+			a=frames[index+1];
+			b=frames[index+3];
+			right=a+(((b-a)*frac)>>15);
+			position+=step;
+			step+=stepDelta;
+		}
+		else
+		{
+			left=frames[2*i];
+			right=frames[2*i+1];
+		}
+		if (mixdown)
+		{
+			left=right=(left+right)/2;
+		}
+		left=(left*(gainLeft>>PSPAALIB_RAMP_SHIFT))>>PSPAALIB_GAIN_SHIFT;
+		right=(right*(gainRight>>PSPAALIB_RAMP_SHIFT))>>PSPAALIB_GAIN_SHIFT;
+		gainLeft+=gainLeftDelta;
+		gainRight+=gainRightDelta;
+		if (accumulate)
+		{
+			((int*)dest)[2*i]+=left;
+			((int*)dest)[2*i+1]+=right;
+		}
+		else
+		{
+			((short*)dest)[2*i]=SaturateSample(left);
+			((short*)dest)[2*i+1]=SaturateSample(right);
+		}
+	}
+	if (resample)
 	{
-		v.x=0.000001;
+		memcpy(chain->resampler->history,frames+2*(position>>16),sizeof(chain->resampler->history));
+		chain->resampler->phase=position&0xFFFF;
 	}
-	return ((v.x>0)?(atan(v.y/v.x)):(atan(v.y/v.x)+PI));
+	//Land exactly on the targets whatever the rounding of the deltas
+	chain->step=chain->targetStep;
+	chain->gainLeft=chain->targetGainLeft<<PSPAALIB_RAMP_SHIFT;
+	chain->gainRight=chain->targetGainRight<<PSPAALIB_RAMP_SHIFT;
+}
+
+static void KernelGain(void* dest,short* src,int length,AalibDspChain* chain)
+{
+	RunDspChain(dest,src,length,chain,FALSE,FALSE,FALSE);
 }
 
-float GetVectorLength(ScePspFVector2 v)
+static void KernelMixdown(void* dest,short* src,int length,AalibDspChain* chain)
 {
-	return sqrt(pow(v.x,2)+pow(v.y,2));
+	RunDspChain(dest,src,length,chain,FALSE,TRUE,FALSE);
 }
 
-void RotateVector(ScePspFVector2* v,float angle)
+static void KernelSpeed(void* dest,short* src,int length,AalibDspChain* chain)
 {
-	float length=GetVectorLength(*v);
-	float vectorAngle=GetVectorAngle(*v);
-	v->x=length*cos(vectorAngle+angle);
-	v->y=length*sin(vectorAngle+angle);
+	RunDspChain(dest,src,length,chain,TRUE,FALSE,FALSE);
 }
 
-float GetClippedAngle(float angle,float clip)
+static void KernelSpeedMixdown(void* dest,short* src,int length,AalibDspChain* chain)
 {
-	while (angle>clip)
+	RunDspChain(dest,src,length,chain,TRUE,TRUE,FALSE);
+}
+
+static void KernelGainAccumulate(void* dest,short* src,int length,AalibDspChain* chain)
+{
+	RunDspChain(dest,src,length,chain,FALSE,FALSE,TRUE);
+}
+
+static void KernelMixdownAccumulate(void* dest,short* src,int length,AalibDspChain* chain)
+{
+	RunDspChain(dest,src,length,chain,FALSE,TRUE,TRUE);
+}
+
+static void KernelSpeedAccumulate(void* dest,short* src,int length,AalibDspChain* chain)
+{
+	RunDspChain(dest,src,length,chain,TRUE,FALSE,TRUE);
+}
+
+static void KernelSpeedMixdownAccumulate(void* dest,short* src,int length,AalibDspChain* chain)
+{
+	RunDspChain(dest,src,length,chain,TRUE,TRUE,TRUE);
+}
+
+//Sets up the chain for the next buffer of length frames.A chain which only
+//stores the frames with the same steady gain on both sides has no kernel,the
+//fetch applies the gain and writes the output itself.
+void CompileDspChain(AalibDspChain* chain,bool speed,unsigned int step,bool mixdown,float gainLeft,float gainRight,bool accumulate,int length)
+{
+	static const AalibDspKernel kernels[2][2][2]=
+	{
+		{{KernelGain,KernelGainAccumulate},{KernelMixdown,KernelMixdownAccumulate}},
+		{{KernelSpeed,KernelSpeedAccumulate},{KernelSpeedMixdown,KernelSpeedMixdownAccumulate}}
+	};
+	chain->targetStep=(speed)?(step):(1<<16);
+	chain->targetGainLeft=GetChainGain(gainLeft);
+	chain->targetGainRight=GetChainGain(gainRight);
+	if (!chain->primed)
 	{
-		angle-=2*clip;
+		//Nothing to ramp from on the first buffer
+		chain->step=chain->targetStep;
+		chain->gainLeft=chain->targetGainLeft<<PSPAALIB_RAMP_SHIFT;
+		chain->gainRight=chain->targetGainRight<<PSPAALIB_RAMP_SHIFT;
+		chain->primed=TRUE;
 	}
-	while (angle<(-clip))
+	chain->speed=speed;
+	chain->stepDelta=((int)chain->targetStep-(int)chain->step)/length;
+	chain->gainLeftDelta=((chain->targetGainLeft<<PSPAALIB_RAMP_SHIFT)-chain->gainLeft)/length;
+	chain->gainRightDelta=((chain->targetGainRight<<PSPAALIB_RAMP_SHIFT)-chain->gainRight)/length;
+	chain->kernel=kernels[speed?1:0][mixdown?1:0][accumulate?1:0];
+	if ((!speed)&&(!mixdown)&&(!accumulate)&&(chain->targetGainLeft==chain->targetGainRight)&&(!chain->gainLeftDelta)&&(!chain->gainRightDelta))
 	{
-		angle+=2*clip;
+		chain->kernel=NULL;
+		chain->step=chain->targetStep;
+		chain->gainLeft=chain->targetGainLeft<<PSPAALIB_RAMP_SHIFT;
+		chain->gainRight=chain->targetGainRight<<PSPAALIB_RAMP_SHIFT;
 	}
-	return angle;
 }
 
-AalibVolume GetVolumes(ScePspFVector2 sourcePosition,ScePspFVector2 observerPosition,ScePspFVector2 observerFront)
+//Source frames the next buffer reads,following the play speed ramp.
+int GetDspChainFrames(AalibDspChain* chain,int length)
 {
-	AalibVolume result;
-	ScePspFVector2 relativePosition={sourcePosition.x-observerPosition.x,sourcePosition.y-observerPosition.y};
-	float pad=sin(GetClippedAngle(GetVectorAngle(relativePosition)-GetVectorAngle(observerFront),PI));
-	result.right=((pad>0)?(MAXA(0,1-pad)):(1.0f));
-	result.left=((pad<0)?(MAXA(0,1+pad)):(1.0f));
-	return result;
+	if (!chain->speed)
+	{
+		return length;
+	}
+	long long total=(long long)length*chain->step+(long long)chain->stepDelta*length*(length-1)/2;
+	return (int)((chain->resampler->phase+total)>>16);
 }
 
-float GetDopplerPlaySpeed(ScePspFVector2 sourcePosition,ScePspFVector2 sourceVelocity,ScePspFVector2 observerPosition,ScePspFVector2 observerVelocity)
+void SaturateMix(short* dest,int* src,int length)
 {
-	ScePspFVector2 relativePosition={observerPosition.x-sourcePosition.x,observerPosition.y-sourcePosition.y};
-	float angle=GetVectorAngle(relativePosition);
-	RotateVector(&observerVelocity,-angle);
-	RotateVector(&sourceVelocity,-angle);
-	return ((340-observerVelocity.x)/(340-sourceVelocity.x));
+	int i,sample;
+	for (i=0;i<2*length;i++)
+	{
+		sample=src[i];
+		dest[i]=(sample>32767)?(32767):((sample<-32768)?(-32768):(sample));
+	}
 }
 
-float GetStrengthByPosition(ScePspFVector2 sourcePosition,ScePspFVector2 observerPosition)
+//Spatial parameters for a batch of voices in one pass,in single precision and
+//without trigonometry:the sine of the angle between the observer's front and
+//the source is their cross product over the lengths,and the Doppler shift
+//only needs the velocities projected on the line between the two.Every
+//voice goes through the same straight line of float operations,which is
+//what the VFPU wants,and the effects a voice has switched off are ignored
+//by the caller.
+void UpdateSpatialVoices(AalibSpatialVoice* voices,int count)
 {
-	ScePspFVector2 relativePosition={sourcePosition.x-observerPosition.x,sourcePosition.y-observerPosition.y};
-	return MINA(1,sqrt(1/GetVectorLength(relativePosition)));
+	int i;
+	for (i=0;i<count;i++)
+	{
+		AalibSpatialVoice* voice=&voices[i];
+		float x=voice->position.x;
+		float y=voice->position.y;
+		//Keeps a source sitting on the observer away from 0/0
+		float distance2=x*x+y*y+1e-12f;
+		float frontLength2=voice->front.x*voice->front.x+voice->front.y*voice->front.y+1e-12f;
+		float inverseDistance=1.0f/sqrtf(distance2);
+		float pad=(voice->front.x*y-voice->front.y*x)*inverseDistance/sqrtf(frontLength2);
+		voice->volume.left=MINA(1.0f,1.0f+pad);
+		voice->volume.right=MINA(1.0f,1.0f-pad);
+		voice->strength=MINA(1.0f,sqrtf(inverseDistance));
+		//Velocities along the line from the source to the observer
+		float source=-(voice->velocity.x*x+voice->velocity.y*y)*inverseDistance;
+		float observer=-(voice->observerVelocity.x*x+voice->observerVelocity.y*y)*inverseDistance;
+		voice->playSpeed=(PSPAALIB_SPEED_OF_SOUND-observer)/(PSPAALIB_SPEED_OF_SOUND-source);
+	}
 }
@@ -16,9 +16,13 @@
 
 #define sgn(a) ((a>0)?(1):(-1))
 
-void GetBufferSpeedEffect(short* dest,short* src,int length,float speed,bool mix);
-AalibVolume GetVolumes(ScePspFVector2 sourcePosition,ScePspFVector2 observerPosition,ScePspFVector2 observerFront);
-float GetDopplerPlaySpeed(ScePspFVector2 sourcePosition,ScePspFVector2 sourceVelocity,ScePspFVector2 observerPosition,ScePspFVector2 observerVelocity);
-float GetStrengthByPosition(ScePspFVector2 sourcePosition,ScePspFVector2 observerPosition);
+void ResetResampler(AalibResampler* resampler);
+int GetResamplerFrames(AalibResampler* resampler,int length,unsigned int step);
+int GetResamplerMaxFrames(int length,unsigned int step);
+void ResampleLinear(short* dest,short* src,int length,unsigned int step,AalibResampler* resampler);
+void CompileDspChain(AalibDspChain* chain,bool speed,unsigned int step,bool mixdown,float gainLeft,float gainRight,bool accumulate,int length);
+int GetDspChainFrames(AalibDspChain* chain,int length);
+void SaturateMix(short* dest,int* src,int length);
+void UpdateSpatialVoices(AalibSpatialVoice* voices,int count);
 
 #endif
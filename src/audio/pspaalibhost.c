@@ -0,0 +1,795 @@
+////////////////////////////////////////////////
+//
+//		pspaalibhost.c
+//		Part of the PSP Advanced Audio Library
+//		Created by Arshia001
+//
+//		This file includes the host platform layer.The
+//		kernel objects are built on pthreads,file I/O goes
+//		straight to the C library and the eight hardware
+//		audio channels are simulated:each one holds a
+//		playing and a queued buffer against its own clock,
+//		so sceAudioOutputBlocking() paces the play threads
+//		the way the PSP does,and writes what it gets to a
+//		file or nowhere.Thread priorities are ignored.
+//
+////////////////////////////////////////////////
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "pspaalibcommon.h"
+
+//Every streamed WAV channel holds three semaphores,so a full set of channels
+//needs far more than the threads do
+#define HOST_MAX_OBJECTS 256
+#define HOST_SAMPLE_RATE 44100
+#define HOST_MAX_ARGS 64
+
+#define HOST_ERROR_NO_MEMORY ((int)0x80020190)
+#define HOST_ERROR_NO_OBJECT ((int)0x80020198)
+#define HOST_ERROR_NOT_DORMANT ((int)0x800201A4)
+#define HOST_ERROR_SEMA_ZERO ((int)0x800201AD)
+#define HOST_ERROR_SEMA_OVERFLOW ((int)0x800201AE)
+#define HOST_ERROR_AUDIO_CHANNEL ((int)0x80260003)
+
+typedef struct
+{
+	bool used;
+	SceKernelThreadEntry entry;
+	bool running;
+	SceSize argsize;
+	char args[HOST_MAX_ARGS];
+} HostThread;
+
+typedef struct
+{
+	bool used;
+	int count;
+	int max;
+} HostSema;
+
+typedef struct
+{
+	bool used;
+	u32 bits;
+} HostEventFlag;
+
+typedef struct
+{
+	bool reserved;
+	int length;
+	int format;
+	unsigned long long busyUntil;
+	unsigned long long lastDuration;
+	unsigned int frames;
+	FILE* sink;
+} HostAudioChannel;
+
+//One lock and one condition for every kernel object.Waits are short and the
+//library has a handful of threads,so nothing is gained by finer locking.
+static pthread_mutex_t hostLock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hostChanged;
+static pthread_once_t hostOnce=PTHREAD_ONCE_INIT;
+static HostThread hostThreads[HOST_MAX_OBJECTS];
+static HostSema hostSemas[HOST_MAX_OBJECTS];
+static HostEventFlag hostEventFlags[HOST_MAX_OBJECTS];
+static __thread int currentThread=-1;
+
+static pthread_mutex_t audioLock=PTHREAD_MUTEX_INITIALIZER;
+static HostAudioChannel audioChannels[PSP_AUDIO_CHANNEL_MAX];
+static char* sinkPattern=NULL;
+static float clockSpeed=1.0f;
+
+static unsigned int threadAllocations=0;
+static unsigned int threadWakeups=0;
+static int createsBeforeFailure=-1;
+
+static pthread_mutex_t ioLock=PTHREAD_MUTEX_INITIALIZER;
+static unsigned int ioBytesPerSecond=0;
+static unsigned int ioLatency=0;
+static unsigned long long ioBusyUntil=0;
+
+static void InitHost()
+{
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+	pthread_cond_init(&hostChanged,&attr);
+	pthread_condattr_destroy(&attr);
+}
+
+static void Lock()
+{
+	pthread_once(&hostOnce,InitHost);
+	pthread_mutex_lock(&hostLock);
+}
+
+static void Unlock()
+{
+	pthread_mutex_unlock(&hostLock);
+}
+
+static unsigned long long GetTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (unsigned long long)now.tv_sec*1000000+now.tv_nsec/1000;
+}
+
+//Waits for hostChanged with hostLock held.Returns FALSE once the timeout,in
+//microseconds from start,has run out.
+static bool Wait(SceUInt* timeout,unsigned long long start)
+{
+	if (!timeout)
+	{
+		pthread_cond_wait(&hostChanged,&hostLock);
+		return TRUE;
+	}
+	unsigned long long end=start+*timeout;
+	struct timespec deadline={(time_t)(end/1000000),(long)(end%1000000)*1000};
+	if (pthread_cond_timedwait(&hostChanged,&hostLock,&deadline)==ETIMEDOUT)
+	{
+		*timeout=0;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void Changed()
+{
+	pthread_cond_broadcast(&hostChanged);
+}
+
+u32 sceKernelGetSystemTimeLow()
+{
+	return (u32)GetTime();
+}
+
+//Blocking calls made on the library's threads are counted as wakeups
+static void CountWakeup()
+{
+	if (currentThread>=0)
+	{
+		__sync_fetch_and_add(&threadWakeups,1);
+	}
+}
+
+unsigned int AalibHostGetWakeups()
+{
+	return __sync_fetch_and_add(&threadWakeups,0);
+}
+
+int sceKernelDelayThread(SceUInt delay)
+{
+	usleep(delay);
+	CountWakeup();
+	return 0;
+}
+
+SceSize sceKernelTotalFreeMemSize()
+{
+	unsigned long long size=(unsigned long long)sysconf(_SC_AVPHYS_PAGES)*sysconf(_SC_PAGESIZE);
+	return (SceSize)MINA(size,0xFFFFFFFFULL);
+}
+
+//Allocator
+
+//The names are in parentheses so the macros in pspaalibcommon.h don't apply
+static void CountAllocation()
+{
+	if (currentThread>=0)
+	{
+		__sync_fetch_and_add(&threadAllocations,1);
+	}
+}
+
+void* AalibHostMalloc(size_t size)
+{
+	CountAllocation();
+	return (malloc)(size);
+}
+
+void AalibHostFree(void* pointer)
+{
+	CountAllocation();
+	(free)(pointer);
+}
+
+unsigned int AalibHostGetThreadAllocations()
+{
+	return __sync_fetch_and_add(&threadAllocations,0);
+}
+
+//Threads
+
+static void FinishThread()
+{
+	if (currentThread<0)
+	{
+		return;
+	}
+	Lock();
+	hostThreads[currentThread].running=FALSE;
+	Changed();
+	Unlock();
+}
+
+static void* ThreadMain(void* arg)
+{
+	int id=(int)(long)arg;
+	currentThread=id;
+	hostThreads[id].entry(hostThreads[id].argsize,(hostThreads[id].argsize)?(hostThreads[id].args):(NULL));
+	FinishThread();
+	return NULL;
+}
+
+//Called with the lock held
+static bool CreateFails()
+{
+	if (createsBeforeFailure<0)
+	{
+		return FALSE;
+	}
+	if (!createsBeforeFailure)
+	{
+		return TRUE;
+	}
+	createsBeforeFailure--;
+	return FALSE;
+}
+
+void AalibHostFailCreate(int after)
+{
+	Lock();
+	createsBeforeFailure=after;
+	Unlock();
+}
+
+unsigned int AalibHostGetObjects()
+{
+	int i;
+	unsigned int count=0;
+	Lock();
+	for (i=1;i<HOST_MAX_OBJECTS;i++)
+	{
+		count+=hostThreads[i].used+hostSemas[i].used+hostEventFlags[i].used;
+	}
+	Unlock();
+	return count;
+}
+
+SceUID sceKernelCreateThread(const char* name,SceKernelThreadEntry entry,int priority,int stackSize,SceUInt attr,void* option)
+{
+	int i;
+	Lock();
+	if (CreateFails())
+	{
+		Unlock();
+		return HOST_ERROR_NO_MEMORY;
+	}
+	for (i=1;i<HOST_MAX_OBJECTS;i++)
+	{
+		if (!hostThreads[i].used)
+		{
+			memset(&hostThreads[i],0,sizeof(HostThread));
+			hostThreads[i].used=TRUE;
+			hostThreads[i].entry=entry;
+			Unlock();
+			return i;
+		}
+	}
+	Unlock();
+	return HOST_ERROR_NO_OBJECT;
+}
+
+//A thread which has ended can be started again,as on the PSP
+int sceKernelStartThread(SceUID thread,SceSize argsize,void* argp)
+{
+	pthread_t handle;
+	if ((thread<1)||(thread>=HOST_MAX_OBJECTS)||(!hostThreads[thread].used)||(argsize>HOST_MAX_ARGS))
+	{
+		return HOST_ERROR_NO_OBJECT;
+	}
+	Lock();
+	if (hostThreads[thread].running)
+	{
+		Unlock();
+		return HOST_ERROR_NOT_DORMANT;
+	}
+	hostThreads[thread].running=TRUE;
+	hostThreads[thread].argsize=argsize;
+	memcpy(hostThreads[thread].args,argp,argsize);
+	Unlock();
+	if (pthread_create(&handle,NULL,ThreadMain,(void*)(long)thread))
+	{
+		FinishThread();
+		return HOST_ERROR_NO_OBJECT;
+	}
+	pthread_detach(handle);
+	return 0;
+}
+
+int sceKernelExitThread(int status)
+{
+	FinishThread();
+	pthread_exit(NULL);
+	return 0;
+}
+
+int sceKernelWaitThreadEnd(SceUID thread,SceUInt* timeout)
+{
+	if ((thread<1)||(thread>=HOST_MAX_OBJECTS)||(!hostThreads[thread].used))
+	{
+		return HOST_ERROR_NO_OBJECT;
+	}
+	unsigned long long start=GetTime();
+	Lock();
+	while (hostThreads[thread].running)
+	{
+		if (!Wait(timeout,start))
+		{
+			Unlock();
+			CountWakeup();
+			return SCE_KERNEL_ERROR_WAIT_TIMEOUT;
+		}
+	}
+	Unlock();
+	CountWakeup();
+	return 0;
+}
+
+int sceKernelDeleteThread(SceUID thread)
+{
+	if ((thread<1)||(thread>=HOST_MAX_OBJECTS)||(!hostThreads[thread].used))
+	{
+		return HOST_ERROR_NO_OBJECT;
+	}
+	Lock();
+	int result=(hostThreads[thread].running)?(HOST_ERROR_NOT_DORMANT):(0);
+	if (!result)
+	{
+		hostThreads[thread].used=FALSE;
+	}
+	Unlock();
+	return result;
+}
+
+//Semaphores
+
+static HostSema* GetSema(SceUID sema)
+{
+	return ((sema<1)||(sema>=HOST_MAX_OBJECTS)||(!hostSemas[sema].used))?(NULL):(&hostSemas[sema]);
+}
+
+SceUID sceKernelCreateSema(const char* name,SceUInt attr,int initial,int max,void* option)
+{
+	int i;
+	Lock();
+	if (CreateFails())
+	{
+		Unlock();
+		return HOST_ERROR_NO_MEMORY;
+	}
+	for (i=1;i<HOST_MAX_OBJECTS;i++)
+	{
+		if (!hostSemas[i].used)
+		{
+			hostSemas[i].used=TRUE;
+			hostSemas[i].count=initial;
+			hostSemas[i].max=max;
+			Unlock();
+			return i;
+		}
+	}
+	Unlock();
+	return HOST_ERROR_NO_OBJECT;
+}
+
+int sceKernelDeleteSema(SceUID sema)
+{
+	Lock();
+	HostSema* it=GetSema(sema);
+	if (it)
+	{
+		it->used=FALSE;
+		Changed();
+	}
+	Unlock();
+	return (it)?(0):(HOST_ERROR_NO_OBJECT);
+}
+
+int sceKernelSignalSema(SceUID sema,int signal)
+{
+	int result=0;
+	Lock();
+	HostSema* it=GetSema(sema);
+	if (!it)
+	{
+		result=HOST_ERROR_NO_OBJECT;
+	}
+	else if (it->count+signal>it->max)
+	{
+		result=HOST_ERROR_SEMA_OVERFLOW;
+	}
+	else
+	{
+		it->count+=signal;
+		Changed();
+	}
+	Unlock();
+	return result;
+}
+
+int sceKernelWaitSema(SceUID sema,int signal,SceUInt* timeout)
+{
+	unsigned long long start=GetTime();
+	Lock();
+	HostSema* it;
+	while ((it=GetSema(sema))&&(it->count<signal))
+	{
+		if (!Wait(timeout,start))
+		{
+			Unlock();
+			CountWakeup();
+			return SCE_KERNEL_ERROR_WAIT_TIMEOUT;
+		}
+	}
+	if (it)
+	{
+		it->count-=signal;
+	}
+	Unlock();
+	CountWakeup();
+	return (it)?(0):(HOST_ERROR_NO_OBJECT);
+}
+
+int sceKernelPollSema(SceUID sema,int signal)
+{
+	int result=0;
+	Lock();
+	HostSema* it=GetSema(sema);
+	if (!it)
+	{
+		result=HOST_ERROR_NO_OBJECT;
+	}
+	else if (it->count<signal)
+	{
+		result=HOST_ERROR_SEMA_ZERO;
+	}
+	else
+	{
+		it->count-=signal;
+	}
+	Unlock();
+	return result;
+}
+
+//Event flags
+
+static HostEventFlag* GetEventFlag(SceUID flag)
+{
+	return ((flag<1)||(flag>=HOST_MAX_OBJECTS)||(!hostEventFlags[flag].used))?(NULL):(&hostEventFlags[flag]);
+}
+
+SceUID sceKernelCreateEventFlag(const char* name,int attr,int bits,void* option)
+{
+	int i;
+	Lock();
+	if (CreateFails())
+	{
+		Unlock();
+		return HOST_ERROR_NO_MEMORY;
+	}
+	for (i=1;i<HOST_MAX_OBJECTS;i++)
+	{
+		if (!hostEventFlags[i].used)
+		{
+			hostEventFlags[i].used=TRUE;
+			hostEventFlags[i].bits=bits;
+			Unlock();
+			return i;
+		}
+	}
+	Unlock();
+	return HOST_ERROR_NO_OBJECT;
+}
+
+int sceKernelDeleteEventFlag(SceUID flag)
+{
+	Lock();
+	HostEventFlag* it=GetEventFlag(flag);
+	if (it)
+	{
+		it->used=FALSE;
+		Changed();
+	}
+	Unlock();
+	return (it)?(0):(HOST_ERROR_NO_OBJECT);
+}
+
+int sceKernelSetEventFlag(SceUID flag,u32 bits)
+{
+	Lock();
+	HostEventFlag* it=GetEventFlag(flag);
+	if (it)
+	{
+		it->bits|=bits;
+		Changed();
+	}
+	Unlock();
+	return (it)?(0):(HOST_ERROR_NO_OBJECT);
+}
+
+//Keeps only the bits set in bits,as on the PSP
+int sceKernelClearEventFlag(SceUID flag,u32 bits)
+{
+	Lock();
+	HostEventFlag* it=GetEventFlag(flag);
+	if (it)
+	{
+		it->bits&=bits;
+	}
+	Unlock();
+	return (it)?(0):(HOST_ERROR_NO_OBJECT);
+}
+
+static bool IsFlagSet(u32 bits,u32 want,u32 wait)
+{
+	return (wait&PSP_EVENT_WAITOR)?((bits&want)!=0):((bits&want)==want);
+}
+
+int sceKernelWaitEventFlag(SceUID flag,u32 bits,u32 wait,u32* outBits,SceUInt* timeout)
+{
+	unsigned long long start=GetTime();
+	Lock();
+	HostEventFlag* it;
+	while ((it=GetEventFlag(flag))&&(!IsFlagSet(it->bits,bits,wait)))
+	{
+		if (!Wait(timeout,start))
+		{
+			Unlock();
+			CountWakeup();
+			return SCE_KERNEL_ERROR_WAIT_TIMEOUT;
+		}
+	}
+	if (it)
+	{
+		if (outBits)
+		{
+			*outBits=it->bits;
+		}
+		if (wait&PSP_EVENT_WAITCLEARALL)
+		{
+			it->bits=0;
+		}
+		else if (wait&PSP_EVENT_WAITCLEAR)
+		{
+			it->bits&=~bits;
+		}
+	}
+	Unlock();
+	CountWakeup();
+	return (it)?(0):(HOST_ERROR_NO_OBJECT);
+}
+
+//File I/O
+
+SceUID sceIoOpen(const char* file,int flags,int mode)
+{
+	int hostFlags=((flags&PSP_O_RDWR)==PSP_O_RDWR)?(O_RDWR):((flags&PSP_O_WRONLY)?(O_WRONLY):(O_RDONLY));
+	hostFlags|=(flags&PSP_O_CREAT)?(O_CREAT):(0);
+	hostFlags|=(flags&PSP_O_TRUNC)?(O_TRUNC):(0);
+	hostFlags|=(flags&PSP_O_APPEND)?(O_APPEND):(0);
+	int fd=open(file,hostFlags,mode);
+	return (fd<0)?(-errno):(fd);
+}
+
+int sceIoClose(SceUID fd)
+{
+	return close(fd);
+}
+
+void AalibHostSetIoThrottle(unsigned int bytesPerSecond,unsigned int latency)
+{
+	pthread_mutex_lock(&ioLock);
+	ioBytesPerSecond=bytesPerSecond;
+	ioLatency=latency;
+	ioBusyUntil=0;
+	pthread_mutex_unlock(&ioLock);
+}
+
+//The throttled device does one transfer at a time:a read takes its turn after
+//the ones already under way and returns once its own time has passed.
+static void ThrottleRead(SceSize size)
+{
+	pthread_mutex_lock(&ioLock);
+	if (!ioBytesPerSecond)
+	{
+		pthread_mutex_unlock(&ioLock);
+		return;
+	}
+	unsigned long long now=GetTime();
+	ioBusyUntil=MAXA(now,ioBusyUntil)+ioLatency+(unsigned long long)size*1000000/ioBytesPerSecond;
+	unsigned long long until=ioBusyUntil;
+	pthread_mutex_unlock(&ioLock);
+	usleep((useconds_t)(until-now));
+}
+
+int sceIoRead(SceUID fd,void* data,SceSize size)
+{
+	ThrottleRead(size);
+	return (int)read(fd,data,size);
+}
+
+int sceIoWrite(SceUID fd,const void* data,SceSize size)
+{
+	return (int)write(fd,data,size);
+}
+
+SceOff sceIoLseek(SceUID fd,SceOff offset,int whence)
+{
+	return lseek(fd,offset,whence);
+}
+
+int sceIoLseek32(SceUID fd,int offset,int whence)
+{
+	return (int)lseek(fd,offset,whence);
+}
+
+//Audio
+
+static FILE* OpenSink(int channel)
+{
+	char name[512];
+	if (!sinkPattern)
+	{
+		return NULL;
+	}
+	snprintf(name,sizeof(name),sinkPattern,channel);
+	return fopen(name,"wb");
+}
+
+int AalibHostSetSink(const char* pattern)
+{
+	int i,result=0;
+	pthread_mutex_lock(&audioLock);
+	free(sinkPattern);
+	sinkPattern=(pattern)?(strdup(pattern)):(NULL);
+	for (i=0;i<PSP_AUDIO_CHANNEL_MAX;i++)
+	{
+		if (audioChannels[i].sink)
+		{
+			fclose(audioChannels[i].sink);
+		}
+		audioChannels[i].sink=NULL;
+		audioChannels[i].frames=0;
+		if ((pattern)&&(!(audioChannels[i].sink=OpenSink(i))))
+		{
+			result=-1;
+		}
+	}
+	pthread_mutex_unlock(&audioLock);
+	return result;
+}
+
+void AalibHostSetClock(float speed)
+{
+	clockSpeed=MAXA(speed,0.0f);
+}
+
+unsigned int AalibHostGetFramesOutput(int channel)
+{
+	return ((channel<0)||(channel>=PSP_AUDIO_CHANNEL_MAX))?(0):(audioChannels[channel].frames);
+}
+
+int sceAudioChReserve(int channel,int samplecount,int format)
+{
+	int result=HOST_ERROR_AUDIO_CHANNEL;
+	pthread_mutex_lock(&audioLock);
+	if (channel==PSP_AUDIO_NEXT_CHANNEL)
+	{
+		for (channel=0;(channel<PSP_AUDIO_CHANNEL_MAX)&&(audioChannels[channel].reserved);channel++);
+	}
+	if ((channel>=0)&&(channel<PSP_AUDIO_CHANNEL_MAX)&&(!audioChannels[channel].reserved))
+	{
+		audioChannels[channel].reserved=TRUE;
+		audioChannels[channel].length=samplecount;
+		audioChannels[channel].format=format;
+		audioChannels[channel].busyUntil=0;
+		audioChannels[channel].lastDuration=0;
+		result=channel;
+	}
+	pthread_mutex_unlock(&audioLock);
+	return result;
+}
+
+int sceAudioChRelease(int channel)
+{
+	if ((channel<0)||(channel>=PSP_AUDIO_CHANNEL_MAX)||(!audioChannels[channel].reserved))
+	{
+		return HOST_ERROR_AUDIO_CHANNEL;
+	}
+	if (audioChannels[channel].sink)
+	{
+		fflush(audioChannels[channel].sink);
+	}
+	audioChannels[channel].reserved=FALSE;
+	return 0;
+}
+
+int sceAudioSetChannelDataLen(int channel,int samplecount)
+{
+	if ((channel<0)||(channel>=PSP_AUDIO_CHANNEL_MAX)||(!audioChannels[channel].reserved))
+	{
+		return HOST_ERROR_AUDIO_CHANNEL;
+	}
+	audioChannels[channel].length=samplecount;
+	return 0;
+}
+
+//The hardware plays one buffer while it holds the next,so the call returns as
+//soon as the buffer before this one has started playing.
+int sceAudioOutputBlocking(int channel,int vol,void* buf)
+{
+	if ((channel<0)||(channel>=PSP_AUDIO_CHANNEL_MAX)||(!audioChannels[channel].reserved))
+	{
+		return HOST_ERROR_AUDIO_CHANNEL;
+	}
+	HostAudioChannel* it=&audioChannels[channel];
+	int samples=it->length*((it->format==PSP_AUDIO_FORMAT_MONO)?(1):(2));
+	if (clockSpeed>0)
+	{
+		unsigned long long duration=(unsigned long long)((double)it->length*1000000/HOST_SAMPLE_RATE/clockSpeed);
+		unsigned long long now=GetTime();
+		if (it->busyUntil-it->lastDuration>now)
+		{
+			usleep((useconds_t)(it->busyUntil-it->lastDuration-now));
+			now=GetTime();
+		}
+		it->busyUntil=MAXA(now,it->busyUntil)+duration;
+		it->lastDuration=duration;
+	}
+	pthread_mutex_lock(&audioLock);
+	if (it->sink)
+	{
+		if (vol>=PSP_AUDIO_VOLUME_MAX)
+		{
+			fwrite(buf,sizeof(short),samples,it->sink);
+		}
+		else
+		{
+			int i;
+			short sample;
+			for (i=0;i<samples;i++)
+			{
+				sample=(short)((((short*)buf)[i]*vol)>>15);
+				fwrite(&sample,sizeof(short),1,it->sink);
+			}
+		}
+	}
+	it->frames+=it->length;
+	pthread_mutex_unlock(&audioLock);
+	CountWakeup();
+	return it->length;
+}
+
+int sceAudioGetChannelRestLen(int channel)
+{
+	if ((channel<0)||(channel>=PSP_AUDIO_CHANNEL_MAX)||(!audioChannels[channel].reserved))
+	{
+		return HOST_ERROR_AUDIO_CHANNEL;
+	}
+	unsigned long long now=GetTime();
+	HostAudioChannel* it=&audioChannels[channel];
+	if ((clockSpeed<=0)||(it->busyUntil<=now))
+	{
+		return 0;
+	}
+	return (int)((double)(it->busyUntil-now)*HOST_SAMPLE_RATE*clockSpeed/1000000);
+}
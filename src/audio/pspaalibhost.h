@@ -0,0 +1,180 @@
+////////////////////////////////////////////////
+//
+//		pspaalibhost.h
+//		Part of the PSP Advanced Audio Library
+//		Created by Arshia001
+//
+//		This file includes the declarations for the host
+//		platform layer.A build with PSPAALIB_HOST defined
+//		gets the part of the PSP kernel,I/O and audio API
+//		which the library uses from pspaalibhost.c instead
+//		of the SDK,so the library runs unchanged on Linux.
+//
+////////////////////////////////////////////////
+
+#ifndef _PSPAALIBHOST_H_
+#define _PSPAALIBHOST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int SceUID;
+typedef unsigned int SceSize;
+typedef unsigned int SceUInt;
+typedef int SceInt32;
+typedef long long SceInt64;
+typedef long long SceOff;
+typedef uint32_t u32;
+typedef int (*SceKernelThreadEntry)(SceSize args,void* argp);
+
+typedef struct
+{
+	float x;
+	float y;
+} ScePspFVector2;
+
+#define PSP_O_RDONLY 0x0001
+#define PSP_O_WRONLY 0x0002
+#define PSP_O_RDWR 0x0003
+#define PSP_O_APPEND 0x0100
+#define PSP_O_CREAT 0x0200
+#define PSP_O_TRUNC 0x0400
+
+#define PSP_SEEK_SET 0
+#define PSP_SEEK_CUR 1
+#define PSP_SEEK_END 2
+
+#define PSP_EVENT_WAITAND 0x00
+#define PSP_EVENT_WAITOR 0x01
+#define PSP_EVENT_WAITCLEARALL 0x10
+#define PSP_EVENT_WAITCLEAR 0x20
+
+#define PSP_AUDIO_VOLUME_MAX 0x8000
+#define PSP_AUDIO_CHANNEL_MAX 8
+#define PSP_AUDIO_NEXT_CHANNEL (-1)
+#define PSP_AUDIO_FORMAT_STEREO 0
+#define PSP_AUDIO_FORMAT_MONO 0x10
+
+#define SCE_KERNEL_ERROR_WAIT_TIMEOUT ((int)0x800201A8)
+
+u32 sceKernelGetSystemTimeLow();
+int sceKernelDelayThread(SceUInt delay);
+SceSize sceKernelTotalFreeMemSize();
+
+SceUID sceKernelCreateThread(const char* name,SceKernelThreadEntry entry,int priority,int stackSize,SceUInt attr,void* option);
+int sceKernelStartThread(SceUID thread,SceSize argsize,void* argp);
+int sceKernelExitThread(int status);
+int sceKernelWaitThreadEnd(SceUID thread,SceUInt* timeout);
+int sceKernelDeleteThread(SceUID thread);
+
+SceUID sceKernelCreateSema(const char* name,SceUInt attr,int initial,int max,void* option);
+int sceKernelDeleteSema(SceUID sema);
+int sceKernelSignalSema(SceUID sema,int signal);
+int sceKernelWaitSema(SceUID sema,int signal,SceUInt* timeout);
+int sceKernelPollSema(SceUID sema,int signal);
+
+SceUID sceKernelCreateEventFlag(const char* name,int attr,int bits,void* option);
+int sceKernelDeleteEventFlag(SceUID flag);
+int sceKernelSetEventFlag(SceUID flag,u32 bits);
+int sceKernelClearEventFlag(SceUID flag,u32 bits);
+int sceKernelWaitEventFlag(SceUID flag,u32 bits,u32 wait,u32* outBits,SceUInt* timeout);
+
+SceUID sceIoOpen(const char* file,int flags,int mode);
+int sceIoClose(SceUID fd);
+int sceIoRead(SceUID fd,void* data,SceSize size);
+int sceIoWrite(SceUID fd,const void* data,SceSize size);
+SceOff sceIoLseek(SceUID fd,SceOff offset,int whence);
+int sceIoLseek32(SceUID fd,int offset,int whence);
+
+int sceAudioChReserve(int channel,int samplecount,int format);
+int sceAudioChRelease(int channel);
+int sceAudioSetChannelDataLen(int channel,int samplecount);
+int sceAudioOutputBlocking(int channel,int vol,void* buf);
+int sceAudioGetChannelRestLen(int channel);
+
+////////////////////////////////////////////////
+//		Where the simulated hardware channels write.
+//
+//		pattern:printf pattern with one %d for the
+//				hardware channel,e.g. "out%d.raw".Each
+//				channel gets a raw 16 bit stereo file.
+//				NULL drops the output.
+//
+//		Returns 0 on success,<0 if a file can't be
+//		created.
+////////////////////////////////////////////////
+
+int AalibHostSetSink(const char* pattern);
+
+////////////////////////////////////////////////
+//		How fast the simulated hardware plays.
+//
+//		speed:1.0 plays in real time,2.0 twice as
+//				fast.0 never blocks,so buffers are
+//				produced as fast as the library can.
+////////////////////////////////////////////////
+
+void AalibHostSetClock(float speed);
+
+////////////////////////////////////////////////
+//		Frames written to a simulated hardware channel
+//		since AalibHostSetSink() or the start.
+////////////////////////////////////////////////
+
+unsigned int AalibHostGetFramesOutput(int channel);
+
+////////////////////////////////////////////////
+//		malloc() and free() calls the library made
+//		on the threads it started (play,mixer,I/O,
+//		decoder,loader and stats threads) since the
+//		start.A host build routes the library's own
+//		malloc() and free() through here;the ones
+//		inside Tremor aren't counted.
+////////////////////////////////////////////////
+
+unsigned int AalibHostGetThreadAllocations();
+
+////////////////////////////////////////////////
+//		Times the library's threads came back from a
+//		call that can block:sceKernelDelayThread(),
+//		waits on semaphores,event flags and threads,
+//		and sceAudioOutputBlocking(),since the start.
+////////////////////////////////////////////////
+
+unsigned int AalibHostGetWakeups();
+
+////////////////////////////////////////////////
+//		Makes sceIoRead() behave like a slow card:
+//		reads are served one at a time,each taking
+//		latency microseconds plus its length at
+//		bytesPerSecond.
+//
+//		bytesPerSecond:0 turns the throttle off.
+//		latency:Fixed cost of every read,in
+//				microseconds.
+////////////////////////////////////////////////
+
+void AalibHostSetIoThrottle(unsigned int bytesPerSecond,unsigned int latency);
+
+////////////////////////////////////////////////
+//		Makes creating threads,semaphores and event
+//		flags fail,to test the library's cleanup.
+//
+//		after:How many more may be created before
+//				every later one fails.-1 lets them
+//				all succeed again.
+////////////////////////////////////////////////
+
+void AalibHostFailCreate(int after);
+
+////////////////////////////////////////////////
+//		Threads,semaphores and event flags which
+//		exist now.
+////////////////////////////////////////////////
+
+unsigned int AalibHostGetObjects();
+
+void* AalibHostMalloc(size_t size);
+void AalibHostFree(void* pointer);
+
+#endif
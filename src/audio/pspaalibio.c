@@ -0,0 +1,326 @@
+////////////////////////////////////////////////
+//
+//		pspaalibio.c
+//		Part of the PSP Advanced Audio Library
+//		Created by Arshia001
+//
+//		This file includes the I/O scheduler.One thread
+//		owns all sceIoRead calls.Pending requests are kept
+//		in a list;the thread always serves the most urgent
+//		one and merges it with pending requests which
+//		continue it in the same file,so small interleaved
+//		reads from different streams don't thrash the
+//		Memory Stick.
+//
+////////////////////////////////////////////////
+
+#include "pspaalibio.h"
+
+static AalibIoRequest* pendingRequests=NULL;
+static SceUID ioLock=-1,ioWork=-1,ioThread=-1;
+static char* stagingBuf=NULL;
+static volatile bool statsEnabled=FALSE;
+static AalibIoStats stats;
+
+static bool IsMoreUrgent(AalibIoRequest* a,AalibIoRequest* b)
+{
+	if (a->priority!=b->priority)
+	{
+		return a->priority<b->priority;
+	}
+	return (int)(a->deadline-b->deadline)<0;
+}
+
+static void Unlink(AalibIoRequest* request)
+{
+	AalibIoRequest** link=&pendingRequests;
+	while (*link)
+	{
+		if (*link==request)
+		{
+			*link=request->next;
+			request->next=NULL;
+			return;
+		}
+		link=&(*link)->next;
+	}
+}
+
+static AalibIoRequest* FindContinuation(AalibIoRequest* request)
+{
+	AalibIoRequest* it;
+	for (it=pendingRequests;it;it=it->next)
+	{
+		if ((it->file==request->file)&&(it->offset==request->offset+request->length))
+		{
+			return it;
+		}
+	}
+	return NULL;
+}
+
+//Picks the most urgent request and chains every pending read which continues
+//it,as long as the whole run fits in one transfer.Called with ioLock held.
+static AalibIoRequest* TakeBatch(int* batchLength)
+{
+	AalibIoRequest *best=pendingRequests,*it,*tail;
+	if (!best)
+	{
+		return NULL;
+	}
+	for (it=best->next;it;it=it->next)
+	{
+		if (IsMoreUrgent(it,best))
+		{
+			best=it;
+		}
+	}
+	Unlink(best);
+	best->status=PSPAALIB_IO_STATUS_BUSY;
+	*batchLength=best->length;
+	tail=best;
+	while ((it=FindContinuation(tail))&&(*batchLength+it->length<=PSPAALIB_IO_MAX_TRANSFER))
+	{
+		Unlink(it);
+		it->status=PSPAALIB_IO_STATUS_BUSY;
+		*batchLength+=it->length;
+		tail->next=it;
+		tail=it;
+	}
+	return best;
+}
+
+static int ReadAt(SceUID file,int offset,void* dest,int length)
+{
+	if (sceIoLseek32(file,offset,PSP_SEEK_SET)!=offset)
+	{
+		return -1;
+	}
+	return sceIoRead(file,dest,length);
+}
+
+static void Complete(AalibIoRequest* request,int result)
+{
+	if ((statsEnabled)&&((int)(sceKernelGetSystemTimeLow()-request->deadline)>0))
+	{
+		stats.late++;
+	}
+	request->result=result;
+	request->status=PSPAALIB_IO_STATUS_DONE;
+	sceKernelSignalSema(request->done,1);
+}
+
+static void ServeBatch(AalibIoRequest* batch,int batchLength)
+{
+	AalibIoRequest *it,*next;
+	bool contiguous=TRUE;
+	for (it=batch;it->next;it=it->next)
+	{
+		if ((char*)it->dest+it->length!=(char*)it->next->dest)
+		{
+			contiguous=FALSE;
+			break;
+		}
+	}
+	char* dest=(contiguous)?((char*)batch->dest):(stagingBuf);
+	unsigned int start=(statsEnabled)?(sceKernelGetSystemTimeLow()):(0);
+	int result=ReadAt(batch->file,batch->offset,dest,batchLength);
+	if (statsEnabled)
+	{
+		stats.readTime+=sceKernelGetSystemTimeLow()-start;
+		stats.transfers++;
+		stats.bytes+=MAXA(0,result);
+	}
+	int done=0;
+	for (it=batch;it;it=next)
+	{
+		next=it->next;
+		it->next=NULL;
+		int got=(result<0)?(result):(MINA(it->length,MAXA(0,result-done)));
+		if ((!contiguous)&&(got>0))
+		{
+			memcpy(it->dest,stagingBuf+done,got);
+		}
+		done+=it->length;
+		if (statsEnabled)
+		{
+			stats.requests++;
+		}
+		Complete(it,got);
+	}
+}
+
+static int IoThread(SceSize argsize,void* args)
+{
+	AalibIoRequest* batch;
+	int batchLength;
+	while (TRUE)
+	{
+		sceKernelWaitSema(ioWork,1,NULL);
+		sceKernelWaitSema(ioLock,1,NULL);
+		batch=TakeBatch(&batchLength);
+		sceKernelSignalSema(ioLock,1);
+		if (batch)
+		{
+			ServeBatch(batch,batchLength);
+		}
+	}
+	return 0;
+}
+
+int AalibIoInit()
+{
+	if (ioThread>=0)
+	{
+		return PSPAALIB_SUCCESS;
+	}
+	stagingBuf=malloc(PSPAALIB_IO_MAX_TRANSFER);
+	ioLock=sceKernelCreateSema("aalibiolock",0,1,1,NULL);
+	ioWork=sceKernelCreateSema("aalibiowork",0,0,INT_MAX,NULL);
+	ioThread=sceKernelCreateThread("aalibio",IoThread,0x16,0x4000,0,NULL);
+	if ((!stagingBuf)||(ioLock<0)||(ioWork<0)||(ioThread<0))
+	{
+		//Undone so a later call tries again instead of finding a thread
+		//which was never started
+		int result=(stagingBuf)?(PSPAALIB_ERROR_CREATE_THREAD):(PSPAALIB_ERROR_INSUFFICIENT_RAM);
+		if (ioThread>=0)
+		{
+			sceKernelDeleteThread(ioThread);
+		}
+		if (ioWork>=0)
+		{
+			sceKernelDeleteSema(ioWork);
+		}
+		if (ioLock>=0)
+		{
+			sceKernelDeleteSema(ioLock);
+		}
+		free(stagingBuf);
+		stagingBuf=NULL;
+		ioLock=-1;
+		ioWork=-1;
+		ioThread=-1;
+		return result;
+	}
+	sceKernelStartThread(ioThread,0,NULL);
+	return PSPAALIB_SUCCESS;
+}
+
+int AalibIoCreateRequest(AalibIoRequest* request)
+{
+	memset(request,0,sizeof(AalibIoRequest));
+	request->done=sceKernelCreateSema("aalibioreq",0,0,1,NULL);
+	return (request->done<0)?(PSPAALIB_ERROR_CREATE_THREAD):(PSPAALIB_SUCCESS);
+}
+
+void AalibIoDeleteRequest(AalibIoRequest* request)
+{
+	if (request->status==PSPAALIB_IO_STATUS_PENDING||request->status==PSPAALIB_IO_STATUS_BUSY)
+	{
+		AalibIoWait(request);
+	}
+	if (request->done>=0)
+	{
+		sceKernelDeleteSema(request->done);
+	}
+	request->done=-1;
+}
+
+int AalibIoSubmit(AalibIoRequest* request,SceUID file,int offset,void* dest,int length,int priority,unsigned int deadline)
+{
+	if (ioThread<0)
+	{
+		return PSPAALIB_ERROR_IO_UNINITIALIZED;
+	}
+	if (request->status==PSPAALIB_IO_STATUS_DONE)
+	{
+		sceKernelPollSema(request->done,1);
+	}
+	request->file=file;
+	request->offset=offset;
+	request->dest=dest;
+	request->length=length;
+	request->priority=priority;
+	request->deadline=deadline;
+	request->result=0;
+	request->status=PSPAALIB_IO_STATUS_PENDING;
+	sceKernelWaitSema(ioLock,1,NULL);
+	request->next=pendingRequests;
+	pendingRequests=request;
+	sceKernelSignalSema(ioLock,1);
+	sceKernelSignalSema(ioWork,1);
+	return PSPAALIB_SUCCESS;
+}
+
+int AalibIoWait(AalibIoRequest* request)
+{
+	if (request->status==PSPAALIB_IO_STATUS_IDLE)
+	{
+		return request->result;
+	}
+	if ((!statsEnabled)||(request->status==PSPAALIB_IO_STATUS_DONE))
+	{
+		sceKernelWaitSema(request->done,1,NULL);
+		request->status=PSPAALIB_IO_STATUS_IDLE;
+		return request->result;
+	}
+	unsigned int start=sceKernelGetSystemTimeLow();
+	sceKernelWaitSema(request->done,1,NULL);
+	unsigned int time=sceKernelGetSystemTimeLow()-start;
+	request->waitTime+=time;
+	//Several threads may be waiting at once
+	sceKernelWaitSema(ioLock,1,NULL);
+	stats.stallTime+=time;
+	sceKernelSignalSema(ioLock,1);
+	request->status=PSPAALIB_IO_STATUS_IDLE;
+	return request->result;
+}
+
+int AalibIoRead(SceUID file,int offset,void* dest,int length,int priority,unsigned int deadline)
+{
+	AalibIoRequest request;
+	int result,done=0;
+	if (AalibIoCreateRequest(&request))
+	{
+		return -1;
+	}
+	//Large reads are split so a bulk load can't hold the device for long
+	//while a stream is waiting.
+	while (done<length)
+	{
+		int chunk=MINA(length-done,PSPAALIB_IO_MAX_TRANSFER);
+		if (AalibIoSubmit(&request,file,offset+done,(char*)dest+done,chunk,priority,sceKernelGetSystemTimeLow()+deadline))
+		{
+			done=-1;
+			break;
+		}
+		result=AalibIoWait(&request);
+		if (result<0)
+		{
+			done=result;
+			break;
+		}
+		done+=result;
+		if (result<chunk)
+		{
+			break;
+		}
+	}
+	AalibIoDeleteRequest(&request);
+	return done;
+}
+
+void AalibIoEnableStats(bool enable)
+{
+	statsEnabled=enable;
+}
+
+void AalibIoGetStats(AalibIoStats* result)
+{
+	*result=stats;
+}
+
+void AalibIoResetStats()
+{
+	memset(&stats,0,sizeof(AalibIoStats));
+}
@@ -0,0 +1,118 @@
+////////////////////////////////////////////////
+//
+//		pspaalibio.h
+//		Part of the PSP Advanced Audio Library
+//		Created by Arshia001
+//
+//		This file includes the declarations for the
+//		I/O scheduler.All file reads which happen while
+//		streams are playing should go through it so that
+//		audio reads are served first and neighbouring
+//		reads are merged into larger transfers.
+//
+////////////////////////////////////////////////
+
+#ifndef _PSPAALIBIO_H_
+#define _PSPAALIBIO_H_
+
+#include "pspaalibcommon.h"
+
+#define PSPAALIB_IO_PRIORITY_AUDIO 0
+#define PSPAALIB_IO_PRIORITY_ANIMATION 1
+#define PSPAALIB_IO_PRIORITY_BACKGROUND 2
+
+#define PSPAALIB_IO_STATUS_IDLE 0
+#define PSPAALIB_IO_STATUS_PENDING 1
+#define PSPAALIB_IO_STATUS_BUSY 2
+#define PSPAALIB_IO_STATUS_DONE 3
+
+#define PSPAALIB_IO_MAX_TRANSFER (64*1024)
+
+typedef struct AalibIoRequest
+{
+	SceUID file;
+	int offset;
+	int length;
+	void* dest;
+	int priority;
+	unsigned int deadline;
+	volatile int status;
+	int result;
+	SceUID done;
+	unsigned int waitTime;
+	struct AalibIoRequest* next;
+} AalibIoRequest;
+
+//Scheduler counters,kept only while enabled.Times are in microseconds.
+//stallTime is how long callers were blocked in AalibIoWait() and late the
+//number of requests finished after their deadline.
+typedef struct
+{
+	unsigned int requests;
+	unsigned int transfers;
+	unsigned int bytes;
+	unsigned int readTime;
+	unsigned int stallTime;
+	unsigned int late;
+} AalibIoStats;
+
+////////////////////////////////////////////////
+//		Start the I/O scheduler thread.Called by
+//		AalibInit().
+//		
+//		Returns 0 on success,>0 on error.A failed
+//		call leaves nothing behind,so it can be
+//		called again.
+////////////////////////////////////////////////
+
+int AalibIoInit();
+
+////////////////////////////////////////////////
+//		Prepare/release a request structure.Requests
+//		are owned by the caller and can be reused once
+//		they are done.AalibIoCreateRequest() returns
+//		0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibIoCreateRequest(AalibIoRequest* request);
+void AalibIoDeleteRequest(AalibIoRequest* request);
+
+////////////////////////////////////////////////
+//		Queue a read of length bytes at offset in file
+//		into dest.Requests are served by priority
+//		(PSPAALIB_IO_PRIORITY_*),then by deadline,which
+//		is a sceKernelGetSystemTimeLow() value.
+//		
+//		Returns 0 on success,>0 on error.
+////////////////////////////////////////////////
+
+int AalibIoSubmit(AalibIoRequest* request,SceUID file,int offset,void* dest,int length,int priority,unsigned int deadline);
+
+////////////////////////////////////////////////
+//		Block until a submitted request is done.
+//		
+//		Returns the number of bytes read,or <0 on
+//		I/O error.
+////////////////////////////////////////////////
+
+int AalibIoWait(AalibIoRequest* request);
+
+////////////////////////////////////////////////
+//		Submit a request and wait for it.deadline is
+//		relative to now,in microseconds.
+////////////////////////////////////////////////
+
+int AalibIoRead(SceUID file,int offset,void* dest,int length,int priority,unsigned int deadline);
+
+////////////////////////////////////////////////
+//		Turn the scheduler counters on or off,read
+//		and clear them.While they are on,each
+//		request also adds the time its caller spent
+//		in AalibIoWait() to its waitTime.
+////////////////////////////////////////////////
+
+void AalibIoEnableStats(bool enable);
+void AalibIoGetStats(AalibIoStats* stats);
+void AalibIoResetStats();
+
+#endif
@@ -0,0 +1,777 @@
+////////////////////////////////////////////////
+//
+//		pspaalibogg.c
+//		Part of the PSP Advanced Audio Library
+//		Created by Arshia001
+//
+//		This file includes functions for playing Ogg
+//		Vorbis files with the integer Tremor decoder.
+//
+////////////////////////////////////////////////
+
+#include <strings.h>
+#include "pspaalibogg.h"
+
+typedef struct
+{
+	SceUID file;
+	int fileSize;
+	int filePos;
+	AalibIoRequest request;
+	OggVorbis_File vf;
+	int numChannels;
+	int sampleRate;
+	int totalFrames;
+	unsigned int step;
+	AalibResampler resampler;
+	short* pcm;
+	short* ring;
+	short* decodeBuf;
+	volatile unsigned int written;
+	volatile unsigned int read;
+	volatile int seekTarget;
+	volatile unsigned int seekRequest;
+	volatile unsigned int seekServed;
+	unsigned int seekApplied;
+	volatile unsigned int seekMark;
+	bool seekWait;
+	unsigned int seekTime;
+	int seekLatency;
+	volatile bool endOfData;
+	volatile bool active;
+	bool paused;
+	bool autoloop;
+	bool initialized;
+	int stopReason;
+	int underruns;
+	SceUID decoded;
+	unsigned int decodeTime;
+	unsigned int decodedFrames;
+	unsigned int ioBytes;
+	unsigned int loadStart;
+	int loadTime;
+	int firstSampleTime;
+	AalibMetadata metadata;
+} OggFileInfo;
+
+//A channel's state only exists while a file is loaded on it
+OggFileInfo* streamsOgg[10];
+
+static SceUID decoderThread=-1;
+static SceUID decoderWork=-1;
+static volatile int decoderChannel=-1;
+
+//Vorbis is decoded ahead of the audio thread by one decoder thread shared by
+//all channels.It fills a ring of stereo frames at the file's own rate,the
+//audio thread only applies the gain and resamples.The ring has a single
+//writer (the decoder,which owns the OggVorbis_File) and a single reader (the
+//audio thread),so the two only share the written and read counters.
+
+static inline short Saturate(int sample)
+{
+	return (sample>32767)?(32767):((sample<-32768)?(-32768):(sample));
+}
+
+static inline unsigned int GetRingFill(int channel)
+{
+	return streamsOgg[channel]->written-streamsOgg[channel]->read;
+}
+
+//File access for Tremor,through the I/O scheduler so the decoder's reads are
+//ordered with the other streams.A read is due before the ring runs dry.
+
+static size_t ReadOgg(void* ptr,size_t size,size_t nmemb,void* datasource)
+{
+	OggFileInfo* stream=(OggFileInfo*)datasource;
+	int length=MINA((int)(size*nmemb),stream->fileSize-stream->filePos);
+	if ((size==0)||(length<=0))
+	{
+		return 0;
+	}
+	unsigned int deadline=sceKernelGetSystemTimeLow()+(unsigned int)((long long)(stream->written-stream->read)*1000000/MAXA(stream->sampleRate,1));
+	if (AalibIoSubmit(&stream->request,stream->file,stream->filePos,ptr,length,PSPAALIB_IO_PRIORITY_AUDIO,deadline))
+	{
+		return 0;
+	}
+	int got=AalibIoWait(&stream->request);
+	if (got<=0)
+	{
+		return 0;
+	}
+	stream->filePos+=got;
+	stream->ioBytes+=got;
+	return got/size;
+}
+
+static int SeekOgg(void* datasource,ogg_int64_t offset,int whence)
+{
+	OggFileInfo* stream=(OggFileInfo*)datasource;
+	ogg_int64_t pos;
+	switch (whence)
+	{
+		case PSP_SEEK_SET:
+			pos=offset;
+			break;
+		case PSP_SEEK_CUR:
+			pos=stream->filePos+offset;
+			break;
+		case PSP_SEEK_END:
+			pos=stream->fileSize+offset;
+			break;
+		default:
+			return -1;
+	}
+	if ((pos<0)||(pos>stream->fileSize))
+	{
+		return -1;
+	}
+	stream->filePos=(int)pos;
+	return 0;
+}
+
+static int CloseOgg(void* datasource)
+{
+	OggFileInfo* stream=(OggFileInfo*)datasource;
+	sceIoClose(stream->file);
+	stream->file=-1;
+	return 0;
+}
+
+static long TellOgg(void* datasource)
+{
+	return ((OggFileInfo*)datasource)->filePos;
+}
+
+//One decoder step for a channel:a pending seek,the wrap at the end of the
+//file,or one ov_read into the ring.Returns FALSE if the channel has nothing
+//to do until the audio thread reads more.
+static bool DecodeStep(int channel)
+{
+	unsigned int request=streamsOgg[channel]->seekRequest;
+	if (request!=streamsOgg[channel]->seekServed)
+	{
+		PSPAALIB_BARRIER();
+		ov_pcm_seek(&streamsOgg[channel]->vf,streamsOgg[channel]->seekTarget);
+		streamsOgg[channel]->endOfData=FALSE;
+		//Everything written from here on is at the target
+		streamsOgg[channel]->seekMark=streamsOgg[channel]->written;
+		PSPAALIB_BARRIER();
+		streamsOgg[channel]->seekServed=request;
+		return TRUE;
+	}
+	if (streamsOgg[channel]->endOfData)
+	{
+		if (!streamsOgg[channel]->autoloop)
+		{
+			return FALSE;
+		}
+		ov_pcm_seek(&streamsOgg[channel]->vf,0);
+		streamsOgg[channel]->endOfData=FALSE;
+	}
+	if (PSPAALIB_OGG_RING_FRAMES-GetRingFill(channel)<PSPAALIB_OGG_DECODE_FRAMES)
+	{
+		return FALSE;
+	}
+	//A mono file would fit twice the frames in the bytes of a stereo one,but
+	//the ring is only known to have room for PSPAALIB_OGG_DECODE_FRAMES
+	vorbis_info* info=ov_info(&streamsOgg[channel]->vf,-1);
+	int numChannels=(info)?(info->channels):(streamsOgg[channel]->numChannels);
+	int bitstream;
+	unsigned int start=sceKernelGetSystemTimeLow();
+	long got=ov_read(&streamsOgg[channel]->vf,(char*)streamsOgg[channel]->decodeBuf,MINA(numChannels,2)*PSPAALIB_OGG_DECODE_FRAMES*sizeof(short),&bitstream);
+	streamsOgg[channel]->decodeTime+=sceKernelGetSystemTimeLow()-start;
+	if (got==OV_HOLE)
+	{
+		//A gap in the data,the decoder picks up after it
+		return TRUE;
+	}
+	if (got<=0)
+	{
+		if ((got==0)&&(streamsOgg[channel]->autoloop))
+		{
+			//The wrap is sample exact since the ring just carries on
+			ov_pcm_seek(&streamsOgg[channel]->vf,0);
+		}
+		else
+		{
+			streamsOgg[channel]->endOfData=TRUE;
+		}
+		return TRUE;
+	}
+	//The read may have moved on to a chained stream with other channels
+	info=ov_info(&streamsOgg[channel]->vf,-1);
+	numChannels=(info)?(info->channels):(streamsOgg[channel]->numChannels);
+	int frames=MINA((int)(got/(numChannels*sizeof(short))),PSPAALIB_OGG_DECODE_FRAMES);
+	int i,right=(numChannels>1)?(1):(0);
+	unsigned int pos=streamsOgg[channel]->written;
+	short* src=streamsOgg[channel]->decodeBuf;
+	for (i=0;i<frames;i++,pos++,src+=numChannels)
+	{
+		short* dest=streamsOgg[channel]->ring+2*(pos&(PSPAALIB_OGG_RING_FRAMES-1));
+		dest[0]=src[0];
+		dest[1]=src[right];
+	}
+	streamsOgg[channel]->decodedFrames+=frames;
+	PSPAALIB_BARRIER();
+	streamsOgg[channel]->written=pos;
+	if (streamsOgg[channel]->firstSampleTime<0)
+	{
+		streamsOgg[channel]->firstSampleTime=sceKernelGetSystemTimeLow()-streamsOgg[channel]->loadStart;
+	}
+	return TRUE;
+}
+
+static int DecoderThread(SceSize args,void* argp)
+{
+	int channel;
+	bool busy;
+	while (TRUE)
+	{
+		sceKernelWaitSema(decoderWork,1,NULL);
+		do
+		{
+			busy=FALSE;
+			for (channel=0;channel<10;channel++)
+			{
+				//Publish the channel before looking at it,UnloadOgg clears
+				//active and then waits until the decoder has left the channel
+				decoderChannel=channel;
+				PSPAALIB_BARRIER();
+				if ((streamsOgg[channel])&&(streamsOgg[channel]->active))
+				{
+					if (DecodeStep(channel))
+					{
+						busy=TRUE;
+					}
+					sceKernelSignalSema(streamsOgg[channel]->decoded,1);
+				}
+				decoderChannel=-1;
+			}
+		} while (busy);
+	}
+	return 0;
+}
+
+static int StartDecoder()
+{
+	if (decoderThread>=0)
+	{
+		return PSPAALIB_SUCCESS;
+	}
+	decoderWork=sceKernelCreateSema("aalibogg",0,0,1,NULL);
+	decoderThread=sceKernelCreateThread("aaliboggdecoder",DecoderThread,0x19,0x10000,0,NULL);
+	if ((decoderWork<0)||(decoderThread<0))
+	{
+		if (decoderThread>=0)
+		{
+			sceKernelDeleteThread(decoderThread);
+		}
+		if (decoderWork>=0)
+		{
+			sceKernelDeleteSema(decoderWork);
+		}
+		decoderThread=-1;
+		decoderWork=-1;
+		return PSPAALIB_ERROR_CREATE_THREAD;
+	}
+	sceKernelStartThread(decoderThread,0,NULL);
+	return PSPAALIB_SUCCESS;
+}
+
+static void WakeDecoder()
+{
+	sceKernelSignalSema(decoderWork,1);
+}
+
+//Waits until the decoder has done something for the channel.
+static bool WaitDecoder(int channel)
+{
+	if (!streamsOgg[channel]->active)
+	{
+		return FALSE;
+	}
+	WakeDecoder();
+	return (sceKernelWaitSema(streamsOgg[channel]->decoded,1,NULL)>=0);
+}
+
+static void RequestSeek(int channel,int sample,bool wait)
+{
+	streamsOgg[channel]->seekTarget=sample;
+	streamsOgg[channel]->seekWait=wait;
+	streamsOgg[channel]->seekTime=sceKernelGetSystemTimeLow();
+	PSPAALIB_BARRIER();
+	streamsOgg[channel]->seekRequest++;
+	WakeDecoder();
+}
+
+//Like WAV streams,a seek keeps playing the old position until the decoder has
+//data at the target,unless the ring runs out first or nobody was listening
+//when it was made.
+static void ApplySeek(int channel,unsigned int frames)
+{
+	if (streamsOgg[channel]->seekApplied==streamsOgg[channel]->seekRequest)
+	{
+		return;
+	}
+	if ((streamsOgg[channel]->seekWait)||(GetRingFill(channel)<frames))
+	{
+		while (streamsOgg[channel]->seekServed!=streamsOgg[channel]->seekRequest)
+		{
+			if (!WaitDecoder(channel))
+			{
+				break;
+			}
+		}
+	}
+	if (streamsOgg[channel]->seekServed!=streamsOgg[channel]->seekRequest)
+	{
+		return;
+	}
+	PSPAALIB_BARRIER();
+	if ((int)(streamsOgg[channel]->seekMark-streamsOgg[channel]->read)>0)
+	{
+		streamsOgg[channel]->read=streamsOgg[channel]->seekMark;
+	}
+	streamsOgg[channel]->seekApplied=streamsOgg[channel]->seekRequest;
+	streamsOgg[channel]->seekLatency=(int)(sceKernelGetSystemTimeLow()-streamsOgg[channel]->seekTime);
+}
+
+//Returns how many frames are in the ring,waiting for the decoder if it is
+//behind and the end of the data has not been reached.
+static unsigned int WaitForFrames(int channel,unsigned int frames)
+{
+	if ((GetRingFill(channel)<frames)&&(!streamsOgg[channel]->endOfData))
+	{
+		streamsOgg[channel]->underruns++;
+		while ((GetRingFill(channel)<frames)&&(!streamsOgg[channel]->endOfData))
+		{
+			if (!WaitDecoder(channel))
+			{
+				break;
+			}
+		}
+	}
+	return GetRingFill(channel);
+}
+
+bool GetPausedOgg(int channel)
+{
+	if ((channel<0)||(channel>9))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_CHANNEL;
+	}
+	if ((!streamsOgg[channel])||(!streamsOgg[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_OGG_UNINITIALIZED_CHANNEL;
+	}
+	return streamsOgg[channel]->paused;
+}
+
+int SetAutoloopOgg(int channel,bool autoloop)
+{
+	if ((channel<0)||(channel>9))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_CHANNEL;
+	}
+	if ((!streamsOgg[channel])||(!streamsOgg[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_OGG_UNINITIALIZED_CHANNEL;
+	}
+	streamsOgg[channel]->autoloop=autoloop;
+	WakeDecoder();
+	return PSPAALIB_SUCCESS;
+}
+
+int GetStopReasonOgg(int channel)
+{
+	if ((channel<0)||(channel>9))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_CHANNEL;
+	}
+	if ((!streamsOgg[channel])||(!streamsOgg[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_OGG_UNINITIALIZED_CHANNEL;
+	}
+	return streamsOgg[channel]->stopReason;
+}
+
+int PlayOgg(int channel)
+{
+	if ((channel<0)||(channel>9))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_CHANNEL;
+	}
+	if ((!streamsOgg[channel])||(!streamsOgg[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_OGG_UNINITIALIZED_CHANNEL;
+	}
+	streamsOgg[channel]->paused=FALSE;
+	streamsOgg[channel]->stopReason=PSPAALIB_STOP_NOT_STOPPED;
+	return PSPAALIB_SUCCESS;
+}
+
+int StopOgg(int channel)
+{
+	if ((channel<0)||(channel>9))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_CHANNEL;
+	}
+	if ((!streamsOgg[channel])||(!streamsOgg[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_OGG_UNINITIALIZED_CHANNEL;
+	}
+	RequestSeek(channel,0,TRUE);
+	streamsOgg[channel]->paused=TRUE;
+	streamsOgg[channel]->stopReason=PSPAALIB_STOP_ON_REQUEST;
+	return PSPAALIB_SUCCESS;
+}
+
+int PauseOgg(int channel)
+{
+	if ((channel<0)||(channel>9))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_CHANNEL;
+	}
+	if ((!streamsOgg[channel])||(!streamsOgg[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_OGG_UNINITIALIZED_CHANNEL;
+	}
+	streamsOgg[channel]->paused=!streamsOgg[channel]->paused;
+	streamsOgg[channel]->stopReason=PSPAALIB_STOP_NOT_STOPPED;
+	return PSPAALIB_SUCCESS;
+}
+
+int SeekOggSample(int sample,int channel)
+{
+	if ((channel<0)||(channel>9))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_CHANNEL;
+	}
+	if ((!streamsOgg[channel])||(!streamsOgg[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_OGG_UNINITIALIZED_CHANNEL;
+	}
+	if ((sample<0)||(sample>streamsOgg[channel]->totalFrames))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_SEEK_TIME;
+	}
+	RequestSeek(channel,sample,streamsOgg[channel]->paused);
+	return PSPAALIB_SUCCESS;
+}
+
+//Returns the sample at ms milliseconds,or -1 on error.
+int GetSampleForMsOgg(int ms,int channel)
+{
+	if ((channel<0)||(channel>9)||(!streamsOgg[channel])||(!streamsOgg[channel]->initialized)||(ms<0))
+	{
+		return -1;
+	}
+	long long sample=(long long)ms*streamsOgg[channel]->sampleRate/1000;
+	return (sample>INT_MAX)?(-1):((int)sample);
+}
+
+int GetBufferOgg(short* buf,int length,float amp,int channel)
+{
+	if ((channel<0)||(channel>9))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_CHANNEL;
+	}
+	if (!streamsOgg[channel] || streamsOgg[channel]->paused || !streamsOgg[channel]->initialized || streamsOgg[channel]->stopReason==PSPAALIB_STOP_END_OF_STREAM)
+	{
+		memset((char*)buf,0,4*length);
+		return PSPAALIB_WARNING_PAUSED_BUFFER_REQUESTED;
+	}
+	bool resampled=(streamsOgg[channel]->pcm!=NULL);
+	unsigned int frames=resampled?GetResamplerFrames(&streamsOgg[channel]->resampler,length,streamsOgg[channel]->step):length;
+	int gain=(amp<PSPAALIB_GAIN_MAX)?((int)(amp*PSPAALIB_GAIN_ONE)):(PSPAALIB_GAIN_MAX*PSPAALIB_GAIN_ONE);
+	short* pcm=resampled?(streamsOgg[channel]->pcm+2*PSPAALIB_RESAMPLER_HISTORY):(buf);
+	ApplySeek(channel,frames);
+	//At high play speeds a buffer takes more frames than the ring holds,so
+	//they are taken in pieces the decoder refills in between
+	unsigned int done=0,count,i,pos;
+	while (done<frames)
+	{
+		count=MINA(WaitForFrames(channel,MINA(frames-done,PSPAALIB_OGG_RING_FRAMES-PSPAALIB_OGG_DECODE_FRAMES)),frames-done);
+		if (!count)
+		{
+			break;
+		}
+		pos=streamsOgg[channel]->read;
+		for (i=done;i<done+count;i++,pos++)
+		{
+			short* src=streamsOgg[channel]->ring+2*(pos&(PSPAALIB_OGG_RING_FRAMES-1));
+			pcm[2*i]=Saturate((src[0]*gain)>>PSPAALIB_GAIN_SHIFT);
+			pcm[2*i+1]=Saturate((src[1]*gain)>>PSPAALIB_GAIN_SHIFT);
+		}
+		PSPAALIB_BARRIER();
+		streamsOgg[channel]->read=pos;
+		WakeDecoder();
+		done+=count;
+	}
+	if (done<frames)
+	{
+		//Played out the end of the file,stop after this buffer
+		memset((char*)(pcm+2*done),0,4*(frames-done));
+		RequestSeek(channel,0,TRUE);
+		streamsOgg[channel]->paused=TRUE;
+		streamsOgg[channel]->stopReason=PSPAALIB_STOP_END_OF_STREAM;
+	}
+	if (resampled)
+	{
+		ResampleLinear(buf,pcm,length,streamsOgg[channel]->step,&streamsOgg[channel]->resampler);
+	}
+	return PSPAALIB_SUCCESS;
+}
+
+static char* GetOggCommentField(AalibMetadata* metadata,const char* comment,int* size,int* skip)
+{
+	static const char* keys[]={"TITLE=","ARTIST=","ALBUM=","DATE=","GENRE=","COMMENT=","DESCRIPTION="};
+	char* fields[]={metadata->title,metadata->artist,metadata->album,metadata->year,metadata->genre,metadata->comment,metadata->comment};
+	int sizes[]={sizeof(metadata->title),sizeof(metadata->artist),sizeof(metadata->album),sizeof(metadata->year),sizeof(metadata->genre),sizeof(metadata->comment),sizeof(metadata->comment)};
+	int i;
+	for (i=0;i<7;i++)
+	{
+		*skip=strlen(keys[i]);
+		//Vorbis comment names are case insensitive
+		if (strncasecmp(comment,keys[i],*skip)==0)
+		{
+			*size=sizes[i];
+			return fields[i];
+		}
+	}
+	return NULL;
+}
+
+//Vorbis comments should already be UTF-8,badly tagged files go through the
+//same conversion as WAV tags.
+static void ReadOggComments(int channel)
+{
+	vorbis_comment* comment=ov_comment(&streamsOgg[channel]->vf,-1);
+	int i,size,skip;
+	if (!comment)
+	{
+		return;
+	}
+	for (i=0;i<comment->comments;i++)
+	{
+		char* field=GetOggCommentField(&streamsOgg[channel]->metadata,comment->user_comments[i],&size,&skip);
+		if ((!field)||(field[0]))
+		{
+			continue;
+		}
+		int length=MINA(comment->comment_lengths[i]-skip,size-1);
+		memcpy(field,comment->user_comments[i]+skip,MAXA(length,0));
+		field[MAXA(length,0)]='\0';
+		ConvertStringToUTF8(field,size);
+	}
+}
+
+//Vorbis is always streamed,loadToRam is only there to match the other codecs.
+int LoadOgg(char* filename,int channel,bool loadToRam)
+{
+	if ((channel<0)||(channel>9))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_CHANNEL;
+	}
+	if (streamsOgg[channel])
+	{
+		UnloadOgg(channel);
+	}
+	streamsOgg[channel]=(OggFileInfo*)malloc(sizeof(OggFileInfo));
+	if (!streamsOgg[channel])
+	{
+		return PSPAALIB_ERROR_OGG_INSUFFICIENT_RAM;
+	}
+	memset(streamsOgg[channel],0,sizeof(OggFileInfo));
+	memset(&streamsOgg[channel]->metadata,0,sizeof(AalibMetadata));
+	streamsOgg[channel]->loadStart=sceKernelGetSystemTimeLow();
+	streamsOgg[channel]->file=sceIoOpen(filename,PSP_O_RDONLY,0777);
+	if (streamsOgg[channel]->file<0)
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_FILE;
+	}
+	streamsOgg[channel]->fileSize=sceIoLseek32(streamsOgg[channel]->file,0,PSP_SEEK_END);
+	streamsOgg[channel]->filePos=0;
+	streamsOgg[channel]->sampleRate=0;
+	streamsOgg[channel]->written=0;
+	streamsOgg[channel]->read=0;
+	streamsOgg[channel]->ioBytes=0;
+	if (AalibIoCreateRequest(&streamsOgg[channel]->request)!=PSPAALIB_SUCCESS)
+	{
+		sceIoClose(streamsOgg[channel]->file);
+		return PSPAALIB_ERROR_CREATE_THREAD;
+	}
+	ov_callbacks callbacks={ReadOgg,SeekOgg,CloseOgg,TellOgg};
+	if (ov_open_callbacks(streamsOgg[channel],&streamsOgg[channel]->vf,NULL,0,callbacks)<0)
+	{
+		AalibIoDeleteRequest(&streamsOgg[channel]->request);
+		sceIoClose(streamsOgg[channel]->file);
+		return PSPAALIB_ERROR_OGG_INVALID_FILE;
+	}
+	vorbis_info* info=ov_info(&streamsOgg[channel]->vf,-1);
+	ogg_int64_t total=ov_pcm_total(&streamsOgg[channel]->vf,-1);
+	streamsOgg[channel]->numChannels=info->channels;
+	streamsOgg[channel]->sampleRate=info->rate;
+	streamsOgg[channel]->totalFrames=(total<0)?(0):((total>INT_MAX)?(INT_MAX):((int)total));
+	streamsOgg[channel]->step=((unsigned long long)streamsOgg[channel]->sampleRate<<16)/PSP_SAMPLE_RATE;
+	ResetResampler(&streamsOgg[channel]->resampler);
+
+	//Sized for the most frames a buffer at the highest play speed resamples
+	int maxFrames=GetResamplerMaxFrames(PSPAALIB_MAX_FETCH_LENGTH,streamsOgg[channel]->step);
+	streamsOgg[channel]->pcm=NULL;
+	if (streamsOgg[channel]->step!=(1<<16))
+	{
+		streamsOgg[channel]->pcm=(short*)malloc((maxFrames+PSPAALIB_RESAMPLER_HISTORY)*2*sizeof(short));
+	}
+	streamsOgg[channel]->ring=(short*)malloc(PSPAALIB_OGG_RING_FRAMES*2*sizeof(short));
+	streamsOgg[channel]->decodeBuf=(short*)malloc(PSPAALIB_OGG_DECODE_FRAMES*2*sizeof(short));
+	streamsOgg[channel]->decoded=sceKernelCreateSema("aaliboggdecoded",0,0,1,NULL);
+	if ((!streamsOgg[channel]->ring)||(!streamsOgg[channel]->decodeBuf)||((streamsOgg[channel]->step!=(1<<16))&&(!streamsOgg[channel]->pcm)))
+	{
+		free(streamsOgg[channel]->ring);
+		free(streamsOgg[channel]->decodeBuf);
+		free(streamsOgg[channel]->pcm);
+		sceKernelDeleteSema(streamsOgg[channel]->decoded);
+		ov_clear(&streamsOgg[channel]->vf);
+		AalibIoDeleteRequest(&streamsOgg[channel]->request);
+		return PSPAALIB_ERROR_OGG_INSUFFICIENT_RAM;
+	}
+	ReadOggComments(channel);
+
+	streamsOgg[channel]->seekRequest=0;
+	streamsOgg[channel]->seekServed=0;
+	streamsOgg[channel]->seekApplied=0;
+	streamsOgg[channel]->seekLatency=0;
+	streamsOgg[channel]->endOfData=FALSE;
+	streamsOgg[channel]->underruns=0;
+	streamsOgg[channel]->decodeTime=0;
+	streamsOgg[channel]->decodedFrames=0;
+	streamsOgg[channel]->firstSampleTime=-1;
+	streamsOgg[channel]->loadTime=sceKernelGetSystemTimeLow()-streamsOgg[channel]->loadStart;
+	streamsOgg[channel]->initialized=TRUE;
+	streamsOgg[channel]->paused=TRUE;
+	streamsOgg[channel]->stopReason=PSPAALIB_STOP_JUST_LOADED;
+	if (StartDecoder()!=PSPAALIB_SUCCESS)
+	{
+		//AalibLoad() unloads the channel again
+		return PSPAALIB_ERROR_CREATE_THREAD;
+	}
+	//The decoder starts filling the ring right away
+	streamsOgg[channel]->active=TRUE;
+	WakeDecoder();
+	return PSPAALIB_SUCCESS;
+}
+
+//Freed only once the decoder is off the channel,it may have read the slot
+//just before it was cleared.
+static void FreeStreamOgg(int channel)
+{
+	OggFileInfo* stream=streamsOgg[channel];
+	streamsOgg[channel]=NULL;
+	PSPAALIB_BARRIER();
+	while (decoderChannel==channel)
+	{
+		sceKernelDelayThread(1000);
+	}
+	free(stream);
+}
+
+int UnloadOgg(int channel)
+{
+	if ((channel<0)||(channel>9))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_CHANNEL;
+	}
+	if (!streamsOgg[channel])
+	{
+		return PSPAALIB_ERROR_OGG_UNINITIALIZED_CHANNEL;
+	}
+	if (!streamsOgg[channel]->initialized)
+	{
+		//Left behind by a load which failed
+		FreeStreamOgg(channel);
+		return PSPAALIB_ERROR_OGG_UNINITIALIZED_CHANNEL;
+	}
+	streamsOgg[channel]->paused=TRUE;
+	streamsOgg[channel]->active=FALSE;
+	PSPAALIB_BARRIER();
+	while (decoderChannel==channel)
+	{
+		sceKernelDelayThread(1000);
+	}
+	//Wake an audio thread still waiting for the decoder
+	sceKernelSignalSema(streamsOgg[channel]->decoded,1);
+	sceKernelDeleteSema(streamsOgg[channel]->decoded);
+	ov_clear(&streamsOgg[channel]->vf);
+	AalibIoDeleteRequest(&streamsOgg[channel]->request);
+	free(streamsOgg[channel]->ring);
+	streamsOgg[channel]->ring=NULL;
+	free(streamsOgg[channel]->decodeBuf);
+	streamsOgg[channel]->decodeBuf=NULL;
+	free(streamsOgg[channel]->pcm);
+	streamsOgg[channel]->pcm=NULL;
+	FreeStreamOgg(channel);
+	return PSPAALIB_SUCCESS;
+}
+
+int GetMetadataOgg(int channel,AalibMetadata* metadata)
+{
+	if ((channel<0)||(channel>9))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_CHANNEL;
+	}
+	if ((!streamsOgg[channel])||(!streamsOgg[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_OGG_UNINITIALIZED_CHANNEL;
+	}
+	memcpy(metadata,&streamsOgg[channel]->metadata,sizeof(AalibMetadata));
+	return PSPAALIB_SUCCESS;
+}
+
+int GetStreamInfoOgg(int channel,AalibStreamInfo* info)
+{
+	if ((channel<0)||(channel>9))
+	{
+		return PSPAALIB_ERROR_OGG_INVALID_CHANNEL;
+	}
+	if ((!streamsOgg[channel])||(!streamsOgg[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_OGG_UNINITIALIZED_CHANNEL;
+	}
+	info->bufferSize=PSPAALIB_OGG_RING_FRAMES*2*sizeof(short);
+	info->bufferFill=GetRingFill(channel)*2*sizeof(short);
+	info->underruns=streamsOgg[channel]->underruns;
+	info->seekLatency=streamsOgg[channel]->seekLatency;
+	info->cacheSize=0;
+	info->cacheFill=0;
+	info->ioBytes=streamsOgg[channel]->ioBytes;
+	info->loopIoBytes=0;
+	info->loadTime=streamsOgg[channel]->loadTime;
+	info->firstSampleTime=streamsOgg[channel]->firstSampleTime;
+	//Decoder time per second of audio
+	info->decodeCost=(streamsOgg[channel]->decodedFrames)?((int)((long long)streamsOgg[channel]->decodeTime*streamsOgg[channel]->sampleRate/streamsOgg[channel]->decodedFrames)):(0);
+	info->ioStallTime=streamsOgg[channel]->request.waitTime;
+	return PSPAALIB_SUCCESS;
+}
+
+const AalibCodec codecOgg=
+{
+	PSPAALIB_CHANNEL_OGG_1,
+	PSPAALIB_CHANNEL_OGG_10,
+	PSPAALIB_ERROR_OGG_INVALID_SEEK_TIME,
+	LoadOgg,
+	UnloadOgg,
+	GetBufferOgg,
+	PlayOgg,
+	StopOgg,
+	PauseOgg,
+	SeekOggSample,
+	NULL,
+	GetSampleForMsOgg,
+	SetAutoloopOgg,
+	GetStopReasonOgg,
+	GetPausedOgg,
+	GetStreamInfoOgg,
+	GetMetadataOgg,
+	NULL
+};
@@ -0,0 +1,38 @@
+////////////////////////////////////////////////
+//
+//		pspaalibogg.h
+//		Part of the PSP Advanced Audio Library
+//		Created by Arshia001
+//
+//		This file includes function declarations for
+//		pspaalibogg.c.
+//
+////////////////////////////////////////////////
+
+#ifndef _PSPAALIBOGG_H_
+#define _PSPAALIBOGG_H_
+
+#include "pspaalibcommon.h"
+#include "pspaalibio.h"
+#include "pspaalibeffects.h"
+
+#define PSPAALIB_OGG_RING_FRAMES (16*1024)
+#define PSPAALIB_OGG_DECODE_FRAMES 1024
+
+bool GetPausedOgg(int channel);
+int SetAutoloopOgg(int channel,bool autoloop);
+int GetStopReasonOgg(int channel);
+int PlayOgg(int channel);
+int StopOgg(int channel);
+int PauseOgg(int channel);
+int SeekOggSample(int sample,int channel);
+int GetSampleForMsOgg(int ms,int channel);
+int GetBufferOgg(short* buf,int length,float amp,int channel);
+int LoadOgg(char* filename,int channel,bool loadToRam);
+int UnloadOgg(int channel);
+int GetMetadataOgg(int channel,AalibMetadata* metadata);
+int GetStreamInfoOgg(int channel,AalibStreamInfo* info);
+
+extern const AalibCodec codecOgg;
+
+#endif
@@ -11,6 +11,18 @@
 
 #include "pspaalibwav.h"
 
+typedef void (*WavKernel)(short* dest,const char* src,int length,int stride,int gain);
+
+typedef struct
+{
+	const char* block;
+	int frame;
+	int frames;
+	int skip;
+	int predictor[2];
+	int index[2];
+} AdpcmState;
+
 typedef struct
 {
 	SceUID file;
@@ -18,8 +30,17 @@ typedef struct
 	int dataLength;
 	int dataLocation;
 	int dataPos;
+	int loopStart;
+	int loopEnd;
+	int loopSkip;
+	int loopEndFrame;
+	int totalFrames;
+	int framesPerBlock;
+	bool adpcm;
+	AdpcmState adpcmState;
 	short sigBytes;
 	short numChannels;
+	short blockAlign;
 	int sampleRate;
 	int bytesPerSecond;
 	int stopReason;
@@ -28,9 +49,519 @@ typedef struct
 	bool autoloop;
 	bool initialized;
 	AalibMetadata metadata;
+	AalibIoRequest request;
+	WavKernel kernel;
+	unsigned int step;
+	AalibResampler resampler;
+	short* pcm;
+	char* ring;
+	int ringHead;
+	int ringFill;
+	int ringPending;
+	int readPos;
+	int underruns;
+	SceUID lock;
+	char* preroll;
+	AalibIoRequest prerollRequest;
+	int prerollPos;
+	int prerollLength;
+	int seekTarget;
+	int seekSkip;
+	bool seekPending;
+	unsigned int seekTime;
+	int seekLatency;
+	char* cache;
+	int cacheSize;
+	int cacheFill;
+	int ringPendingPos;
+	int ringPendingIndex;
+	unsigned int ioBytes;
+	unsigned int loopIoMark;
+	unsigned int loopIoBytes;
+	volatile int loaded;
+	volatile bool loading;
+	volatile bool loadWaiting;
+	SceUID loadSignal;
+	unsigned int loadStart;
+	int loadTime;
+	int firstSampleTime;
 } WavFileInfo;
 
-WavFileInfo streamsWav[32];
+//A channel's state only exists while a file is loaded on it
+WavFileInfo* streamsWav[32];
+
+static SceUID loaderThread=-1;
+static SceUID loaderWork=-1;
+static volatile int loaderChannel=-1;
+
+//Sample kernels.One is picked at load time for the file's format so the
+//per-sample loop has no format checks.stride is the number of interleaved
+//source channels.Files which are not at 44100Hz are converted to stereo at
+//their own rate and then go through the shared linear resampler.
+
+static inline short Saturate(int sample)
+{
+	return (sample>32767)?(32767):((sample<-32768)?(-32768):(sample));
+}
+
+static inline short Gain(int sample,int gain)
+{
+	return Saturate((sample*gain)>>PSPAALIB_GAIN_SHIFT);
+}
+
+static inline int Sample8(const char* src,int index)
+{
+	return (((unsigned char*)src)[index]-128)<<8;
+}
+
+static void KernelMono8Native(short* dest,const char* src,int length,int stride,int gain)
+{
+	int i;
+	for (i=0;i<length;i++)
+	{
+		dest[2*i]=dest[2*i+1]=Gain(Sample8(src,i),gain);
+	}
+}
+
+static void KernelStereo8Native(short* dest,const char* src,int length,int stride,int gain)
+{
+	int i;
+	for (i=0;i<length;i++)
+	{
+		dest[2*i]=Gain(Sample8(src,i*stride),gain);
+		dest[2*i+1]=Gain(Sample8(src,i*stride+1),gain);
+	}
+}
+
+static void KernelMono16Native(short* dest,const char* src,int length,int stride,int gain)
+{
+	const short* samples=(const short*)src;
+	int i;
+	for (i=0;i<length;i++)
+	{
+		dest[2*i]=dest[2*i+1]=Gain(samples[i],gain);
+	}
+}
+
+static void KernelStereo16Native(short* dest,const char* src,int length,int stride,int gain)
+{
+	const short* samples=(const short*)src;
+	int i;
+	for (i=0;i<length;i++)
+	{
+		dest[2*i]=Gain(samples[i*stride],gain);
+		dest[2*i+1]=Gain(samples[i*stride+1],gain);
+	}
+}
+
+static WavKernel SelectKernel(short sigBytes,short numChannels)
+{
+	static const WavKernel kernels[2][2]=
+	{
+		{KernelMono8Native,KernelStereo8Native},
+		{KernelMono16Native,KernelStereo16Native}
+	};
+	if (((sigBytes!=1)&&(sigBytes!=2))||(numChannels<1))
+	{
+		return NULL;
+	}
+	return kernels[sigBytes-1][(numChannels>1)?1:0];
+}
+
+//IMA-ADPCM.Each block starts with the first sample and step index of every
+//channel,then holds 4 bit codes in groups of 8 per channel.The decoder keeps
+//its state between calls,so a block is decoded straight into the output in
+//as many pieces as the buffers need.
+
+static const short adpcmSteps[89]=
+{
+	7,8,9,10,11,12,13,14,16,17,19,21,23,25,28,31,34,37,41,45,50,55,60,66,73,80,88,97,
+	107,118,130,143,157,173,190,209,230,253,279,307,337,371,408,449,494,544,598,658,
+	724,796,876,963,1060,1166,1282,1411,1552,1707,1878,2066,2272,2499,2749,3024,3327,
+	3660,4026,4428,4871,5358,5894,6484,7132,7845,8630,9493,10442,11487,12635,13899,
+	15289,16818,18500,20350,22385,24623,27086,29794,32767
+};
+
+static const signed char adpcmIndexShift[8]={-1,-1,-1,-1,2,4,6,8};
+
+static inline int DecodeAdpcmNibble(int nibble,int* predictor,int* index)
+{
+	int step=adpcmSteps[*index];
+	int diff=step>>3;
+	if (nibble&1)
+	{
+		diff+=step>>2;
+	}
+	if (nibble&2)
+	{
+		diff+=step>>1;
+	}
+	if (nibble&4)
+	{
+		diff+=step;
+	}
+	*predictor=Saturate((nibble&8)?(*predictor-diff):(*predictor+diff));
+	*index=MINA(MAXA(*index+adpcmIndexShift[nibble&7],0),88);
+	return *predictor;
+}
+
+//Decodes the next count frames of the current block as stereo into dest,or
+//only advances the decoder if dest is NULL.
+static void DecodeAdpcm(short* dest,AdpcmState* state,int numChannels,int count,int gain)
+{
+	const unsigned char* block=(const unsigned char*)state->block;
+	int i,c,n,sample[2];
+	for (i=0;i<count;i++,state->frame++)
+	{
+		for (c=0;c<numChannels;c++)
+		{
+			if (state->frame==0)
+			{
+				sample[c]=state->predictor[c];
+				continue;
+			}
+			n=state->frame-1;
+			int code=block[4*numChannels*(1+(n>>3))+4*c+((n&7)>>1)];
+			sample[c]=DecodeAdpcmNibble((n&1)?(code>>4):(code&15),&state->predictor[c],&state->index[c]);
+		}
+		if (dest)
+		{
+			dest[2*i]=Gain(sample[0],gain);
+			dest[2*i+1]=Gain(sample[numChannels-1],gain);
+		}
+	}
+}
+
+static void StartAdpcmBlock(AdpcmState* state,const char* block,int numChannels,int frames)
+{
+	int c;
+	for (c=0;c<numChannels;c++)
+	{
+		short first;
+		memcpy(&first,block+4*c,2);
+		state->predictor[c]=first;
+		state->index[c]=MINA(((const unsigned char*)block)[4*c+2],88);
+	}
+	state->block=block;
+	state->frame=0;
+	state->frames=frames;
+	if (state->skip>0)
+	{
+		//A seek or loop start inside the block
+		DecodeAdpcm(NULL,state,numChannels,MINA(state->skip,frames),0);
+		state->skip=0;
+	}
+}
+
+
+//Read-ahead for streamed channels.The ring holds the data chunk bytes which
+//follow dataPos,wrapping from loopEnd to loopStart when autoloop is on.At most
+//one read per channel is in flight at a time,and it is only issued once a whole
+//PSPAALIB_WAV_READ_SIZE slot is free,so the Memory Stick sees large reads and
+//the audio thread only copies from memory.All of this runs with the channel's
+//lock held.
+
+//Moves the read position.For ADPCM pos is the start of a block,the block in
+//progress is dropped and skip frames of the next one are decoded but not
+//played.
+static void SetDataPos(int channel,int pos,int skip)
+{
+	streamsWav[channel]->dataPos=pos;
+	streamsWav[channel]->adpcmState.frame=0;
+	streamsWav[channel]->adpcmState.frames=0;
+	streamsWav[channel]->adpcmState.skip=skip;
+}
+
+//Where playback wraps or ends
+static int GetPlayEnd(int channel)
+{
+	return (streamsWav[channel]->autoloop)?(streamsWav[channel]->loopEnd):(streamsWav[channel]->dataLength);
+}
+
+static void LockStream(int channel)
+{
+	if (streamsWav[channel]->lock>=0)
+	{
+		sceKernelWaitSema(streamsWav[channel]->lock,1,NULL);
+	}
+}
+
+static void UnlockStream(int channel)
+{
+	if (streamsWav[channel]->lock>=0)
+	{
+		sceKernelSignalSema(streamsWav[channel]->lock,1);
+	}
+}
+
+//Bytes from pos on which the loop cache already holds.The cache covers the
+//start of the loop region and is filled as the first pass reads it.
+static int GetCachedLength(int channel,int pos)
+{
+	int cacheEnd=streamsWav[channel]->loopStart+streamsWav[channel]->cacheFill;
+	if ((!streamsWav[channel]->cache)||(pos<streamsWav[channel]->loopStart)||(pos>=cacheEnd))
+	{
+		return 0;
+	}
+	return cacheEnd-pos;
+}
+
+static int CollectStreamRead(int channel,bool wait)
+{
+	if (!streamsWav[channel]->ringPending)
+	{
+		return 0;
+	}
+	if ((!wait)&&(streamsWav[channel]->request.status!=PSPAALIB_IO_STATUS_DONE))
+	{
+		return 0;
+	}
+	int result=AalibIoWait(&streamsWav[channel]->request);
+	int got=MAXA(0,result);
+	streamsWav[channel]->readPos-=streamsWav[channel]->ringPending-got;
+	streamsWav[channel]->ringFill+=got;
+	streamsWav[channel]->ringPending=0;
+	streamsWav[channel]->ioBytes+=got;
+	//Extends the cache if the read covers the byte right after its end
+	int offset=streamsWav[channel]->loopStart+streamsWav[channel]->cacheFill-streamsWav[channel]->ringPendingPos;
+	if ((streamsWav[channel]->cache)&&(offset>=0)&&(offset<got))
+	{
+		int length=MINA(got-offset,streamsWav[channel]->cacheSize-streamsWav[channel]->cacheFill);
+		memcpy(streamsWav[channel]->cache+streamsWav[channel]->cacheFill,streamsWav[channel]->ring+streamsWav[channel]->ringPendingIndex+offset,length);
+		streamsWav[channel]->cacheFill+=length;
+	}
+	return got;
+}
+
+static void ServiceStream(int channel,bool force)
+{
+	CollectStreamRead(channel,FALSE);
+	if (streamsWav[channel]->ringPending)
+	{
+		return;
+	}
+	while (1)
+	{
+		int end=GetPlayEnd(channel);
+		if (streamsWav[channel]->readPos>=end)
+		{
+			if (!streamsWav[channel]->autoloop)
+			{
+				return;
+			}
+			streamsWav[channel]->readPos=streamsWav[channel]->loopStart;
+			streamsWav[channel]->loopIoBytes=streamsWav[channel]->ioBytes-streamsWav[channel]->loopIoMark;
+			streamsWav[channel]->loopIoMark=streamsWav[channel]->ioBytes;
+		}
+		int space=PSPAALIB_WAV_RING_SIZE-streamsWav[channel]->ringFill;
+		int writeIndex=(streamsWav[channel]->ringHead+streamsWav[channel]->ringFill)%PSPAALIB_WAV_RING_SIZE;
+		int length=MINA(space,PSPAALIB_WAV_RING_SIZE-writeIndex);
+		length=MINA(length,end-streamsWav[channel]->readPos);
+		if (length<=0)
+		{
+			return;
+		}
+		//Cached bytes are copied in right away,whatever the free space
+		int cached=GetCachedLength(channel,streamsWav[channel]->readPos);
+		if (cached>0)
+		{
+			length=MINA(length,cached);
+			memcpy(streamsWav[channel]->ring+writeIndex,streamsWav[channel]->cache+streamsWav[channel]->readPos-streamsWav[channel]->loopStart,length);
+			streamsWav[channel]->ringFill+=length;
+			streamsWav[channel]->readPos+=length;
+			continue;
+		}
+		if ((!force)&&(space<PSPAALIB_WAV_READ_SIZE))
+		{
+			return;
+		}
+		length=MINA(length,PSPAALIB_WAV_READ_SIZE);
+		//Due when whatever is buffered now has been played
+		unsigned int deadline=sceKernelGetSystemTimeLow()+(unsigned int)((long long)streamsWav[channel]->ringFill*1000000/streamsWav[channel]->bytesPerSecond);
+		AalibIoSubmit(&streamsWav[channel]->request,streamsWav[channel]->file,streamsWav[channel]->dataLocation+streamsWav[channel]->readPos,streamsWav[channel]->ring+writeIndex,length,PSPAALIB_IO_PRIORITY_AUDIO,deadline);
+		streamsWav[channel]->ringPendingPos=streamsWav[channel]->readPos;
+		streamsWav[channel]->ringPendingIndex=writeIndex;
+		streamsWav[channel]->readPos+=length;
+		streamsWav[channel]->ringPending=length;
+		return;
+	}
+}
+
+static void ResetStream(int channel)
+{
+	CollectStreamRead(channel,TRUE);
+	streamsWav[channel]->ringHead=0;
+	streamsWav[channel]->ringFill=0;
+	streamsWav[channel]->readPos=streamsWav[channel]->dataPos;
+	ServiceStream(channel,FALSE);
+}
+
+//Fills the whole ring at load,on the caller's thread.The hardware takes the
+//first two buffers at once,so a ring holding only the first read would run dry
+//on a slow card before the second one arrives.
+static void PrimeStream(int channel)
+{
+	ResetStream(channel);
+	while (streamsWav[channel]->ringPending)
+	{
+		CollectStreamRead(channel,TRUE);
+		ServiceStream(channel,FALSE);
+	}
+}
+
+//TRUE if the ring holds the bytes which follow dataPos in order and none past
+//the play end,so it stays valid when autoloop changes.A ring which wrapped at
+//the old loop end or read past the new one has to be refilled.
+static bool RingFollows(int channel)
+{
+	int buffered=streamsWav[channel]->ringFill+streamsWav[channel]->ringPending;
+	return (streamsWav[channel]->dataPos+buffered==streamsWav[channel]->readPos)&&(streamsWav[channel]->readPos<=GetPlayEnd(channel));
+}
+
+//Copies length bytes to dest and consumes them.Missing bytes repeat the last
+//frame.
+static void ReadStream(int channel,char* dest,int length)
+{
+	CollectStreamRead(channel,FALSE);
+	if (streamsWav[channel]->ringFill<length)
+	{
+		streamsWav[channel]->underruns++;
+		while (streamsWav[channel]->ringFill<length)
+		{
+			ServiceStream(channel,TRUE);
+			if ((!streamsWav[channel]->ringPending)||(!CollectStreamRead(channel,TRUE)))
+			{
+				break;
+			}
+		}
+	}
+	int available=MINA(streamsWav[channel]->ringFill,length);
+	int first=MINA(available,PSPAALIB_WAV_RING_SIZE-streamsWav[channel]->ringHead);
+	memcpy(dest,streamsWav[channel]->ring+streamsWav[channel]->ringHead,first);
+	memcpy(dest+first,streamsWav[channel]->ring,available-first);
+	if (available<length)
+	{
+		int i,frame=streamsWav[channel]->blockAlign;
+		for (i=MAXA(available,frame);i<length;i++)
+		{
+			dest[i]=dest[i-frame];
+		}
+	}
+	streamsWav[channel]->ringHead=(streamsWav[channel]->ringHead+available)%PSPAALIB_WAV_RING_SIZE;
+	streamsWav[channel]->ringFill-=available;
+	ServiceStream(channel,FALSE);
+}
+
+//Background loader for channels loaded to RAM.Every channel which is still
+//loading gets one chunk per round,so several loads progress together.Playback
+//may start as soon as LoadWav returns,the audio thread only waits if it
+//catches up with the loaded part.
+
+static void LoadChunk(int channel)
+{
+	int pos=streamsWav[channel]->loaded;
+	int length=MINA(PSPAALIB_WAV_LOAD_CHUNK,streamsWav[channel]->dataLength-pos);
+	int priority=(streamsWav[channel]->loadWaiting)?(PSPAALIB_IO_PRIORITY_AUDIO):(PSPAALIB_IO_PRIORITY_BACKGROUND);
+	int got=-1;
+	if (!AalibIoSubmit(&streamsWav[channel]->request,streamsWav[channel]->file,streamsWav[channel]->dataLocation+pos,streamsWav[channel]->data+pos,length,priority,sceKernelGetSystemTimeLow()+1000000))
+	{
+		got=AalibIoWait(&streamsWav[channel]->request);
+	}
+	if (got<=0)
+	{
+		//Read error or truncated file,the rest plays as silence
+		memset(streamsWav[channel]->data+pos,(streamsWav[channel]->sigBytes==1)?(0x80):(0),streamsWav[channel]->dataLength-pos);
+		got=streamsWav[channel]->dataLength-pos;
+	}
+	PSPAALIB_BARRIER();
+	streamsWav[channel]->loaded=pos+got;
+	if (streamsWav[channel]->firstSampleTime<0)
+	{
+		streamsWav[channel]->firstSampleTime=sceKernelGetSystemTimeLow()-streamsWav[channel]->loadStart;
+	}
+	if (streamsWav[channel]->loaded>=streamsWav[channel]->dataLength)
+	{
+		sceIoClose(streamsWav[channel]->file);
+		streamsWav[channel]->file=-1;
+		streamsWav[channel]->loadTime=sceKernelGetSystemTimeLow()-streamsWav[channel]->loadStart;
+		streamsWav[channel]->loading=FALSE;
+	}
+}
+
+static int LoaderThread(SceSize args,void* argp)
+{
+	int channel;
+	bool busy;
+	while (TRUE)
+	{
+		sceKernelWaitSema(loaderWork,1,NULL);
+		do
+		{
+			busy=FALSE;
+			for (channel=0;channel<32;channel++)
+			{
+				//Publish the channel before looking at it,UnloadWav clears
+				//loading and then waits until the loader has left the channel
+				loaderChannel=channel;
+				PSPAALIB_BARRIER();
+				if ((streamsWav[channel])&&(streamsWav[channel]->loading))
+				{
+					LoadChunk(channel);
+					sceKernelSignalSema(streamsWav[channel]->loadSignal,1);
+					busy=TRUE;
+				}
+				loaderChannel=-1;
+			}
+		} while (busy);
+	}
+	return 0;
+}
+
+static int StartLoader()
+{
+	if (loaderThread>=0)
+	{
+		return PSPAALIB_SUCCESS;
+	}
+	loaderWork=sceKernelCreateSema("aalibwavload",0,0,1,NULL);
+	loaderThread=sceKernelCreateThread("aalibwavloader",LoaderThread,0x20,0x4000,0,NULL);
+	if ((loaderWork<0)||(loaderThread<0))
+	{
+		if (loaderThread>=0)
+		{
+			sceKernelDeleteThread(loaderThread);
+		}
+		if (loaderWork>=0)
+		{
+			sceKernelDeleteSema(loaderWork);
+		}
+		loaderThread=-1;
+		loaderWork=-1;
+		return PSPAALIB_ERROR_CREATE_THREAD;
+	}
+	sceKernelStartThread(loaderThread,0,NULL);
+	return PSPAALIB_SUCCESS;
+}
+
+//Returns how many bytes from pos on are resident,waiting for the loader
+//if the play position has caught up with it.
+static int WaitForLoad(int channel,int pos,int length)
+{
+	if (streamsWav[channel]->loaded<pos+length)
+	{
+		streamsWav[channel]->underruns++;
+		streamsWav[channel]->loadWaiting=TRUE;
+		while ((streamsWav[channel]->loaded<pos+length)&&(streamsWav[channel]->loading))
+		{
+			if (sceKernelWaitSema(streamsWav[channel]->loadSignal,1,NULL)<0)
+			{
+				break;
+			}
+		}
+		streamsWav[channel]->loadWaiting=FALSE;
+	}
+	return MINA(length,streamsWav[channel]->loaded-pos);
+}
 
 bool GetPausedWav(int channel)
 {
@@ -38,11 +569,11 @@ bool GetPausedWav(int channel)
 	{
 		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
 	}
-	if (!streamsWav[channel].initialized)
+	if ((!streamsWav[channel])||(!streamsWav[channel]->initialized))
 	{
 		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
 	}
-	return streamsWav[channel].paused;
+	return streamsWav[channel]->paused;
 }
 
 int SetAutoloopWav(int channel,bool autoloop)
@@ -51,11 +582,20 @@ int SetAutoloopWav(int channel,bool autoloop)
 	{
 		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
 	}
-	if (!streamsWav[channel].initialized)
+	if ((!streamsWav[channel])||(!streamsWav[channel]->initialized))
 	{
 		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
 	}
-	streamsWav[channel].autoloop=autoloop;
+	LockStream(channel);
+	if (streamsWav[channel]->autoloop!=autoloop)
+	{
+		streamsWav[channel]->autoloop=autoloop;
+		if ((!streamsWav[channel]->loadToRam)&&(!RingFollows(channel)))
+		{
+			PrimeStream(channel);
+		}
+	}
+	UnlockStream(channel);
 	return PSPAALIB_SUCCESS;
 }
 
@@ -65,11 +605,11 @@ int GetStopReasonWav(int channel)
 	{
 		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
 	}
-	if (!streamsWav[channel].initialized)
+	if ((!streamsWav[channel])||(!streamsWav[channel]->initialized))
 	{
 		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
 	}
-	return streamsWav[channel].stopReason;
+	return streamsWav[channel]->stopReason;
 }
 
 int PlayWav(int channel)
@@ -78,12 +618,12 @@ int PlayWav(int channel)
 	{
 		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
 	}
-	if (!streamsWav[channel].initialized)
+	if ((!streamsWav[channel])||(!streamsWav[channel]->initialized))
 	{
 		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
 	}
-	streamsWav[channel].paused=FALSE;
-	streamsWav[channel].stopReason=PSPAALIB_STOP_NOT_STOPPED;
+	streamsWav[channel]->paused=FALSE;
+	streamsWav[channel]->stopReason=PSPAALIB_STOP_NOT_STOPPED;
 	return PSPAALIB_SUCCESS;
 }
 
@@ -93,13 +633,13 @@ int StopWav(int channel)
 	{
 		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
 	}
-	if (!streamsWav[channel].initialized)
+	if ((!streamsWav[channel])||(!streamsWav[channel]->initialized))
 	{
 		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
 	}
 	RewindWav(channel);
-	streamsWav[channel].paused=TRUE;
-	streamsWav[channel].stopReason=PSPAALIB_STOP_ON_REQUEST;
+	streamsWav[channel]->paused=TRUE;
+	streamsWav[channel]->stopReason=PSPAALIB_STOP_ON_REQUEST;
 	return PSPAALIB_SUCCESS;
 }
 
@@ -109,256 +649,886 @@ int PauseWav(int channel)
 	{
 		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
 	}
-	if (!streamsWav[channel].initialized)
+	if ((!streamsWav[channel])||(!streamsWav[channel]->initialized))
 	{
 		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
 	}
-	streamsWav[channel].paused=!streamsWav[channel].paused;
-	streamsWav[channel].stopReason=PSPAALIB_STOP_NOT_STOPPED;
+	streamsWav[channel]->paused=!streamsWav[channel]->paused;
+	streamsWav[channel]->stopReason=PSPAALIB_STOP_NOT_STOPPED;
 	return PSPAALIB_SUCCESS;
 }
 
-int SeekWav(int time,int channel)
+//Seeking a streamed channel never makes the audio thread wait for the Memory
+//Stick.The first PSPAALIB_WAV_READ_SIZE bytes at the target are read into the
+//preroll buffer first,and the stream keeps playing from where it was until
+//they have arrived.Only then the ring is switched over to them.
+
+//Byte position of the block holding sample,ADPCM seeks then skip
+//sample%framesPerBlock frames into it.
+static int GetSeekPosition(int channel,int sample)
+{
+	if ((sample<0)||(sample>streamsWav[channel]->totalFrames))
+	{
+		return -1;
+	}
+	return MINA((sample/streamsWav[channel]->framesPerBlock)*streamsWav[channel]->blockAlign,streamsWav[channel]->dataLength);
+}
+
+static void StartPreroll(int channel,int pos)
+{
+	if ((streamsWav[channel]->prerollPos==pos)&&(streamsWav[channel]->prerollRequest.status!=PSPAALIB_IO_STATUS_IDLE))
+	{
+		return;
+	}
+	//The buffer may still be the target of an older seek's read
+	AalibIoWait(&streamsWav[channel]->prerollRequest);
+	streamsWav[channel]->prerollPos=pos;
+	streamsWav[channel]->prerollLength=MINA(PSPAALIB_WAV_READ_SIZE,GetPlayEnd(channel)-pos);
+	if (GetCachedLength(channel,pos)>=streamsWav[channel]->prerollLength)
+	{
+		//ResetStream will fill the ring from the cache without waiting
+		streamsWav[channel]->prerollLength=0;
+	}
+	streamsWav[channel]->seekTime=sceKernelGetSystemTimeLow();
+	if (streamsWav[channel]->prerollLength>0)
+	{
+		AalibIoSubmit(&streamsWav[channel]->prerollRequest,streamsWav[channel]->file,streamsWav[channel]->dataLocation+pos,streamsWav[channel]->preroll,streamsWav[channel]->prerollLength,PSPAALIB_IO_PRIORITY_AUDIO,streamsWav[channel]->seekTime);
+	}
+}
+
+//Switches the stream to the pending seek target once its preroll and any ring
+//read still in flight are done,or right away if wait is set.
+static void FinishSeek(int channel,bool wait)
+{
+	if (!streamsWav[channel]->seekPending)
+	{
+		return;
+	}
+	if (!wait)
+	{
+		if ((streamsWav[channel]->prerollRequest.status!=PSPAALIB_IO_STATUS_DONE)&&(streamsWav[channel]->prerollRequest.status!=PSPAALIB_IO_STATUS_IDLE))
+		{
+			return;
+		}
+		if ((streamsWav[channel]->ringPending)&&(streamsWav[channel]->request.status!=PSPAALIB_IO_STATUS_DONE))
+		{
+			return;
+		}
+	}
+	int got=(streamsWav[channel]->prerollLength>0)?(MAXA(0,AalibIoWait(&streamsWav[channel]->prerollRequest))):(0);
+	streamsWav[channel]->ioBytes+=got;
+	streamsWav[channel]->seekPending=FALSE;
+	SetDataPos(channel,streamsWav[channel]->seekTarget,streamsWav[channel]->seekSkip);
+	if ((streamsWav[channel]->prerollPos!=streamsWav[channel]->seekTarget)||(got<=0))
+	{
+		ResetStream(channel);
+	}
+	else
+	{
+		CollectStreamRead(channel,TRUE);
+		memcpy(streamsWav[channel]->ring,streamsWav[channel]->preroll,got);
+		streamsWav[channel]->ringHead=0;
+		streamsWav[channel]->ringFill=got;
+		streamsWav[channel]->readPos=streamsWav[channel]->prerollPos+got;
+		ServiceStream(channel,FALSE);
+	}
+	streamsWav[channel]->prerollPos=-1;
+	streamsWav[channel]->seekLatency=(int)(sceKernelGetSystemTimeLow()-streamsWav[channel]->seekTime);
+}
+
+//Can be called ahead of SeekWavSample() from another thread so the read is
+//already under way when the seek gets applied.
+int PrerollWav(int sample,int channel)
 {
 	if ((channel<0)||(channel>31))
 	{
 		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
 	}
-	if (!streamsWav[channel].initialized)
+	if ((!streamsWav[channel])||(!streamsWav[channel]->initialized))
 	{
 		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
 	}
-	int dataPos=(int) time*streamsWav[channel].bytesPerSecond;
-	if (dataPos>streamsWav[channel].dataLength)
+	int pos=GetSeekPosition(channel,sample);
+	if (pos<0)
 	{
 		return PSPAALIB_ERROR_WAV_INVALID_SEEK_TIME;
 	}
-	streamsWav[channel].dataPos=dataPos;
-	if (!streamsWav[channel].loadToRam)
+	if (!streamsWav[channel]->loadToRam)
 	{
-		sceIoLseek(streamsWav[channel].file,streamsWav[channel].dataLocation+streamsWav[channel].dataPos,PSP_SEEK_SET);
+		LockStream(channel);
+		StartPreroll(channel,pos);
+		UnlockStream(channel);
 	}
 	return PSPAALIB_SUCCESS;
 }
 
-int RewindWav(int channel)
+int SeekWavSample(int sample,int channel)
 {
-	return SeekWav(0,channel);
+	if ((channel<0)||(channel>31))
+	{
+		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
+	}
+	if ((!streamsWav[channel])||(!streamsWav[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
+	}
+	int pos=GetSeekPosition(channel,sample);
+	if (pos<0)
+	{
+		return PSPAALIB_ERROR_WAV_INVALID_SEEK_TIME;
+	}
+	LockStream(channel);
+	int skip=sample%streamsWav[channel]->framesPerBlock;
+	if (streamsWav[channel]->loadToRam)
+	{
+		SetDataPos(channel,pos,skip);
+		streamsWav[channel]->seekLatency=0;
+	}
+	else
+	{
+		StartPreroll(channel,pos);
+		streamsWav[channel]->seekTarget=pos;
+		streamsWav[channel]->seekSkip=skip;
+		streamsWav[channel]->seekPending=TRUE;
+		//Nobody is waiting for a paused stream's next buffer
+		FinishSeek(channel,streamsWav[channel]->paused);
+	}
+	UnlockStream(channel);
+	return PSPAALIB_SUCCESS;
 }
 
-int GetBufferWav(short* buf,int length,float amp,int channel)
+//Returns the sample at ms milliseconds,or -1 on error.
+int GetSampleForMsWav(int ms,int channel)
+{
+	if ((channel<0)||(channel>31)||(!streamsWav[channel])||(!streamsWav[channel]->initialized)||(ms<0))
+	{
+		return -1;
+	}
+	long long sample=(long long)ms*streamsWav[channel]->sampleRate/1000;
+	return (sample>INT_MAX)?(-1):((int)sample);
+}
+
+//Used by stop and the end of the stream,so it takes effect at once.
+int RewindWav(int channel)
 {
 	if ((channel<0)||(channel>31))
 	{
 		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
 	}
-	if (streamsWav[channel].paused || !streamsWav[channel].initialized || streamsWav[channel].stopReason==PSPAALIB_STOP_END_OF_STREAM)
+	if ((!streamsWav[channel])||(!streamsWav[channel]->initialized))
 	{
-		memset((char*)buf,0,4*length);
-		return PSPAALIB_WARNING_PAUSED_BUFFER_REQUESTED;
+		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
 	}
-	int i,index;
-	int realLength=length*streamsWav[channel].sigBytes*streamsWav[channel].numChannels*streamsWav[channel].sampleRate/PSP_SAMPLE_RATE;
-	if (streamsWav[channel].dataPos+realLength>=streamsWav[channel].dataLength)
+	LockStream(channel);
+	streamsWav[channel]->seekPending=FALSE;
+	SetDataPos(channel,0,0);
+	if (!streamsWav[channel]->loadToRam)
 	{
-		RewindWav(channel);
-		if (!streamsWav[channel].autoloop)
-		{
-			streamsWav[channel].paused=TRUE;
-			streamsWav[channel].stopReason=PSPAALIB_STOP_END_OF_STREAM;
-			memset((char*)buf,0,4*length);
-			return PSPAALIB_SUCCESS;
-		}
-		return GetBufferWav(buf,length,amp,channel);
+		ResetStream(channel);
 	}
-	if (streamsWav[channel].loadToRam)
+	UnlockStream(channel);
+	return PSPAALIB_SUCCESS;
+}
+
+//Converts the next frames source frames to stereo in dest.With autoloop on
+//the data wraps from loopEnd to loopStart as often as needed inside one call,
+//so a loop never loses or repeats a sample.Returns fewer frames only when
+//the end of the data was reached.
+static int FetchWav(int channel,short* dest,int frames,int gain)
+{
+	int done=0,count,end;
+	char* src;
+	while (done<frames)
 	{
-		for (i=0;i<length;i++)
+		end=GetPlayEnd(channel);
+		if (streamsWav[channel]->dataPos>=end)
 		{
-			if (streamsWav[channel].sigBytes==1)
+			if (!streamsWav[channel]->autoloop)
 			{
-				index=streamsWav[channel].numChannels*(int)(i*streamsWav[channel].sampleRate/PSP_SAMPLE_RATE)+streamsWav[channel].dataPos;
-				buf[2*i]=(streamsWav[channel].data[index]<<8)*amp;
-				index+=((streamsWav[channel].numChannels>1)?1:0);
-				buf[2*i+1]=(streamsWav[channel].data[index]<<8)*amp;
+				break;
 			}
-			else if (streamsWav[channel].sigBytes==2)
-			{
-				index=streamsWav[channel].numChannels*(int)(i*streamsWav[channel].sampleRate/PSP_SAMPLE_RATE)+(streamsWav[channel].dataPos/2);
-				buf[2*i]=(((short*)streamsWav[channel].data)[index])*amp;
-				index+=((streamsWav[channel].numChannels>1)?1:0);
-				buf[2*i+1]=(((short*)streamsWav[channel].data)[index])*amp;
-			}
-			else
+			SetDataPos(channel,streamsWav[channel]->loopStart,0);
+			continue;
+		}
+		count=MINA(frames-done,(end-streamsWav[channel]->dataPos)/streamsWav[channel]->blockAlign);
+		if (count<=0)
+		{
+			//A partial frame before the end
+			streamsWav[channel]->dataPos=end;
+			continue;
+		}
+		if (streamsWav[channel]->loadToRam)
+		{
+			count=WaitForLoad(channel,streamsWav[channel]->dataPos,count*streamsWav[channel]->blockAlign)/streamsWav[channel]->blockAlign;
+			if (count<=0)
 			{
-				memset((char*)buf,0,4*length);
-				return PSPAALIB_WARNING_WAV_INVALID_SBPS;
+				break;
 			}
+			src=streamsWav[channel]->data+streamsWav[channel]->dataPos;
+		}
+		else
+		{
+			//The scratch holds one buffer,faster play speeds take several
+			count=MINA(count,PSPAALIB_WAV_SCRATCH_FRAMES);
+			ReadStream(channel,streamsWav[channel]->data,count*streamsWav[channel]->blockAlign);
+			src=streamsWav[channel]->data;
 		}
+		streamsWav[channel]->kernel(dest+2*done,src,count,streamsWav[channel]->numChannels,gain);
+		streamsWav[channel]->dataPos+=count*streamsWav[channel]->blockAlign;
+		done+=count;
+	}
+	return done;
+}
+
+//Reads the block at dataPos and starts decoding it.The frames of the last
+//block and of the block holding the loop end are cut to totalFrames or
+//loopEndFrame,so ADPCM loops are as exact as PCM ones.Returns FALSE at the
+//end of the data.
+static bool NextAdpcmBlock(int channel)
+{
+	int end=GetPlayEnd(channel);
+	if (streamsWav[channel]->dataPos>=end)
+	{
+		if (!streamsWav[channel]->autoloop)
+		{
+			return FALSE;
+		}
+		SetDataPos(channel,streamsWav[channel]->loopStart,streamsWav[channel]->loopSkip);
+	}
+	int pos=streamsWav[channel]->dataPos;
+	int header=4*streamsWav[channel]->numChannels;
+	int length=MINA(streamsWav[channel]->blockAlign,streamsWav[channel]->dataLength-pos);
+	int limit=(streamsWav[channel]->autoloop)?(streamsWav[channel]->loopEndFrame):(streamsWav[channel]->totalFrames);
+	int frames=MINA(streamsWav[channel]->framesPerBlock,limit-(pos/streamsWav[channel]->blockAlign)*streamsWav[channel]->framesPerBlock);
+	char* src;
+	if (streamsWav[channel]->loadToRam)
+	{
+		length=WaitForLoad(channel,pos,length);
+		src=streamsWav[channel]->data+pos;
 	}
 	else
 	{
-		sceIoRead(streamsWav[channel].file,streamsWav[channel].data,realLength);
-		for (i=0;i<length;i++)
+		ReadStream(channel,streamsWav[channel]->data,length);
+		src=streamsWav[channel]->data;
+	}
+	streamsWav[channel]->dataPos=pos+length;
+	if (length<header)
+	{
+		return FALSE;
+	}
+	//A short last block only holds whole groups of 8 frames
+	frames=MINA(frames,1+8*((length-header)/header));
+	if (frames<=0)
+	{
+		return streamsWav[channel]->autoloop;
+	}
+	StartAdpcmBlock(&streamsWav[channel]->adpcmState,src,streamsWav[channel]->numChannels,frames);
+	return TRUE;
+}
+
+static int FetchAdpcm(int channel,short* dest,int frames,int gain)
+{
+	AdpcmState* state=&streamsWav[channel]->adpcmState;
+	int done=0,count;
+	while (done<frames)
+	{
+		if (state->frame>=state->frames)
 		{
-			if (streamsWav[channel].sigBytes==1)
-			{
-				index=streamsWav[channel].numChannels*(int)(i*streamsWav[channel].sampleRate/PSP_SAMPLE_RATE);
-				buf[2*i]=(streamsWav[channel].data[index]<<8)*amp;
-				index+=((streamsWav[channel].numChannels>1)?1:0);
-				buf[2*i+1]=(streamsWav[channel].data[index]<<8)*amp;
-			}
-			else if (streamsWav[channel].sigBytes==2)
+			if (!NextAdpcmBlock(channel))
 			{
-				index=streamsWav[channel].numChannels*(int)(i*streamsWav[channel].sampleRate/PSP_SAMPLE_RATE);
-				buf[2*i]=(((short*)streamsWav[channel].data)[index])*amp;
-				index+=((streamsWav[channel].numChannels>1)?1:0);
-				buf[2*i+1]=(((short*)streamsWav[channel].data)[index])*amp;
-			}
-			else
-			{
-				memset((char*)buf,0,4*length);
-				return PSPAALIB_WARNING_WAV_INVALID_SBPS;
+				break;
 			}
+			continue;
 		}
+		count=MINA(frames-done,state->frames-state->frame);
+		DecodeAdpcm(dest+2*done,state,streamsWav[channel]->numChannels,count,gain);
+		done+=count;
 	}
-	streamsWav[channel].dataPos+=realLength;
+	return done;
+}
+
+int GetBufferWav(short* buf,int length,float amp,int channel)
+{
+	if ((channel<0)||(channel>31))
+	{
+		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
+	}
+	if (!streamsWav[channel] || streamsWav[channel]->paused || !streamsWav[channel]->initialized || streamsWav[channel]->stopReason==PSPAALIB_STOP_END_OF_STREAM)
+	{
+		memset((char*)buf,0,4*length);
+		return PSPAALIB_WARNING_PAUSED_BUFFER_REQUESTED;
+	}
+	if ((!streamsWav[channel]->kernel)&&(!streamsWav[channel]->adpcm))
+	{
+		memset((char*)buf,0,4*length);
+		return PSPAALIB_WARNING_WAV_INVALID_SBPS;
+	}
+	bool resampled=(streamsWav[channel]->pcm!=NULL);
+	int frames=resampled?GetResamplerFrames(&streamsWav[channel]->resampler,length,streamsWav[channel]->step):length;
+	int gain=(amp<PSPAALIB_GAIN_MAX)?((int)(amp*PSPAALIB_GAIN_ONE)):(PSPAALIB_GAIN_MAX*PSPAALIB_GAIN_ONE);
+	short* pcm=resampled?(streamsWav[channel]->pcm+2*PSPAALIB_RESAMPLER_HISTORY):(buf);
+	LockStream(channel);
+	FinishSeek(channel,FALSE);
+	int done=(streamsWav[channel]->adpcm)?(FetchAdpcm(channel,pcm,frames,gain)):(FetchWav(channel,pcm,frames,gain));
+	if (done<frames)
+	{
+		//Played out the tail of the data,stop after this buffer
+		memset((char*)(pcm+2*done),0,4*(frames-done));
+		SetDataPos(channel,0,0);
+		if (!streamsWav[channel]->loadToRam)
+		{
+			ResetStream(channel);
+		}
+		streamsWav[channel]->paused=TRUE;
+		streamsWav[channel]->stopReason=PSPAALIB_STOP_END_OF_STREAM;
+	}
+	UnlockStream(channel);
+	if (resampled)
+	{
+		ResampleLinear(buf,pcm,length,streamsWav[channel]->step,&streamsWav[channel]->resampler);
+	}
+	return PSPAALIB_SUCCESS;
+}
+
+int GetMetadataWav(int channel,AalibMetadata* metadata)
+{
+	if ((channel<0)||(channel>31))
+	{
+		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
+	}
+	if ((!streamsWav[channel])||(!streamsWav[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
+	}
+	memcpy(metadata,&streamsWav[channel]->metadata,sizeof(AalibMetadata));
 	return PSPAALIB_SUCCESS;
 }
 
-static int FindWavChunk(SceUID file, const char* chunkId, int* chunkSize, int* chunkPos) {
-    char temp[4];
+int GetStreamInfoWav(int channel,AalibStreamInfo* info)
+{
+	if ((channel<0)||(channel>31))
+	{
+		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
+	}
+	if ((!streamsWav[channel])||(!streamsWav[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
+	}
+	if (streamsWav[channel]->loadToRam)
+	{
+		info->bufferSize=streamsWav[channel]->dataLength;
+		info->bufferFill=streamsWav[channel]->loaded;
+	}
+	else
+	{
+		info->bufferSize=PSPAALIB_WAV_RING_SIZE;
+		info->bufferFill=streamsWav[channel]->ringFill;
+	}
+	info->underruns=streamsWav[channel]->underruns;
+	info->seekLatency=streamsWav[channel]->seekLatency;
+	info->cacheSize=streamsWav[channel]->cacheSize;
+	info->cacheFill=streamsWav[channel]->cacheFill;
+	info->ioBytes=streamsWav[channel]->ioBytes;
+	info->loopIoBytes=streamsWav[channel]->loopIoBytes;
+	info->loadTime=streamsWav[channel]->loadTime;
+	info->firstSampleTime=streamsWav[channel]->firstSampleTime;
+	info->decodeCost=0;
+	info->ioStallTime=streamsWav[channel]->request.waitTime+streamsWav[channel]->prerollRequest.waitTime;
+	return PSPAALIB_SUCCESS;
+}
+
+int SetStreamCacheWav(int channel,int size)
+{
+	if ((channel<0)||(channel>31))
+	{
+		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
+	}
+	if ((!streamsWav[channel])||(!streamsWav[channel]->initialized))
+	{
+		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
+	}
+	if (streamsWav[channel]->loadToRam)
+	{
+		return PSPAALIB_SUCCESS;
+	}
+	size=MINA(size,streamsWav[channel]->loopEnd-streamsWav[channel]->loopStart);
+	char* cache=(size>0)?((char*)malloc(size)):(NULL);
+	if ((size>0)&&(!cache))
+	{
+		return PSPAALIB_ERROR_WAV_INSUFFICIENT_RAM;
+	}
+	LockStream(channel);
+	free(streamsWav[channel]->cache);
+	streamsWav[channel]->cache=cache;
+	streamsWav[channel]->cacheSize=MAXA(size,0);
+	streamsWav[channel]->cacheFill=0;
+	UnlockStream(channel);
+	return PSPAALIB_SUCCESS;
+}
+
+typedef struct {
+    char id[4];
     int size;
-    int filePos = 12; // Пропускаем RIFF заголовок
-    
-	while (1) {
-        if (sceIoLseek(file, filePos, PSP_SEEK_SET) != filePos) break;
-        if (sceIoRead(file, temp, 4) != 4) break;
-        if (sceIoRead(file, &size, 4) != 4) break;
-
-        // Проверка соответствия chunkId
-        int match = 1;
-        match = (memcmp(temp, chunkId, 4) == 0);
-        
-		if (match) {
-            *chunkSize = size;
-            *chunkPos = filePos + 8;
-            return 1;
+    int pos;
+} WavChunk;
+
+typedef struct {
+    char* header;
+    int headerLength;
+    WavChunk chunks[PSPAALIB_WAV_MAX_CHUNKS];
+    int count;
+} WavChunkIndex;
+
+// Один проход по RIFF: начало файла читается одним вызовом, заголовки чанков
+// берутся из этого буфера. Только чанки за его пределами (например, LIST после
+// data) стоят отдельного чтения 8 байт.
+static int IndexWavChunks(SceUID file, WavChunkIndex* index) {
+    index->count = 0;
+    index->headerLength = sceIoRead(file, index->header, PSPAALIB_WAV_HEADER_SIZE);
+    if (index->headerLength < 12 || memcmp(index->header, "RIFF", 4) != 0 || memcmp(index->header + 8, "WAVE", 4) != 0) {
+        return 0;
+    }
+
+    unsigned int riffSize;
+    memcpy(&riffSize, index->header + 4, 4);
+    // Некоторые программы пишут 0 или -1 в размер RIFF, тогда идём до конца файла
+    int riffEnd = (riffSize >= 4 && riffSize < INT_MAX - 8) ? (int)riffSize + 8 : INT_MAX;
+    int pos = 12;
+    char chunkHeader[8];
+    while (index->count < PSPAALIB_WAV_MAX_CHUNKS && pos <= riffEnd - 8) {
+        if (pos + 8 <= index->headerLength) {
+            memcpy(chunkHeader, index->header + pos, 8);
+        } else if (sceIoLseek(file, pos, PSP_SEEK_SET) != pos || sceIoRead(file, chunkHeader, 8) != 8) {
+            break;
+        }
+        WavChunk* chunk = &index->chunks[index->count++];
+        memcpy(chunk->id, chunkHeader, 4);
+        memcpy(&chunk->size, chunkHeader + 4, 4);
+        chunk->pos = pos + 8;
+        if (chunk->size < 0 || chunk->size > INT_MAX - chunk->pos - 1) {
+            break;
         }
+        // Чанки выровнены на 2 байта
+        pos = chunk->pos + chunk->size + (chunk->size & 1);
+    }
+    return 1;
+}
 
-        // Переходим к следующему чанку (выравнивание до 2 байт)
-        filePos += (size + 8 + (size & 1));
+static const WavChunk* FindWavChunk(const WavChunkIndex* index, const char* chunkId) {
+    int i;
+    for (i = 0; i < index->count; i++) {
+        if (memcmp(index->chunks[i].id, chunkId, 4) == 0) {
+            return &index->chunks[i];
+        }
     }
+    return NULL;
+}
 
-    return 0;
+// Содержимое небольшого чанка: из буфера начала файла, если он туда попал,
+// иначе одним чтением в scratch (не больше scratchSize байт).
+static const char* ReadWavChunk(SceUID file, const WavChunkIndex* index, const WavChunk* chunk, char* scratch, int scratchSize, int* length) {
+    if (chunk->pos + chunk->size <= index->headerLength) {
+        *length = chunk->size;
+        return index->header + chunk->pos;
+    }
+    if (sceIoLseek(file, chunk->pos, PSP_SEEK_SET) != chunk->pos) {
+        return NULL;
+    }
+    *length = sceIoRead(file, scratch, MINA(chunk->size, scratchSize));
+    return (*length > 0) ? scratch : NULL;
 }
 
-int LoadWav(char* filename, int channel, bool loadToRam) {
-    if ((channel < 0) || (channel > 31)) {
-        return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
+// Точки петли из первой петли smpl чанка.Конец в smpl включительный.
+static void ParseWavLoop(int channel, const char* smpl, int length) {
+    int loopCount, loop[2];
+    if (length < 36 + 24) {
+        return;
     }
-    if (streamsWav[channel].initialized) {
-        UnloadWav(channel);
+    memcpy(&loopCount, smpl + 28, 4);
+    if (loopCount < 1) {
+        return;
+    }
+    memcpy(loop, smpl + 36 + 8, 8);
+    // Для ADPCM петля начинается с блока, в котором лежит первый сэмпл,
+    // лишние кадры пропускаются при декодировании
+    int perBlock = streamsWav[channel]->framesPerBlock;
+    int endFrame = MINA(loop[1] + 1, streamsWav[channel]->totalFrames);
+    if (loop[0] >= 0 && endFrame > loop[0]) {
+        streamsWav[channel]->loopStart = (loop[0] / perBlock) * streamsWav[channel]->blockAlign;
+        streamsWav[channel]->loopSkip = loop[0] % perBlock;
+        streamsWav[channel]->loopEnd = MINA(((endFrame + perBlock - 1) / perBlock) * streamsWav[channel]->blockAlign, streamsWav[channel]->dataLength);
+        streamsWav[channel]->loopEndFrame = endFrame;
     }
+}
 
-    // Инициализируем структуру метаданных
-    memset(&streamsWav[channel].metadata, 0, sizeof(AalibMetadata));
-    streamsWav[channel].metadata.has_cover = 0;
+static char* GetWavInfoField(AalibMetadata* metadata, const char* id, int* size) {
+    if (memcmp(id, "INAM", 4) == 0) {
+        *size = sizeof(metadata->title);
+        return metadata->title;
+    }
+    if (memcmp(id, "IART", 4) == 0) {
+        *size = sizeof(metadata->artist);
+        return metadata->artist;
+    }
+    if (memcmp(id, "IPRD", 4) == 0) {
+        *size = sizeof(metadata->album);
+        return metadata->album;
+    }
+    if (memcmp(id, "ICRD", 4) == 0) {
+        *size = sizeof(metadata->year);
+        return metadata->year;
+    }
+    if (memcmp(id, "IGNR", 4) == 0) {
+        *size = sizeof(metadata->genre);
+        return metadata->genre;
+    }
+    if (memcmp(id, "ICMT", 4) == 0) {
+        *size = sizeof(metadata->comment);
+        return metadata->comment;
+    }
+    return NULL;
+}
 
-    streamsWav[channel].loadToRam = loadToRam;
-    streamsWav[channel].file = sceIoOpen(filename, PSP_O_RDONLY, 0777);
-    if (streamsWav[channel].file <= 0) {
-        return PSPAALIB_ERROR_WAV_INVALID_FILE;
+// Теги из LIST/INFO. Кодировка в WAV не указывается, поэтому строки
+// приводятся к UTF-8 общими конвертерами (CP1251, KOI8-R, ISO 8859-1).
+static void ParseWavInfo(AalibMetadata* metadata, const char* list, int length) {
+    if (length < 4 || memcmp(list, "INFO", 4) != 0) {
+        return;
+    }
+    int pos = 4, size, fieldSize;
+    while (pos + 8 <= length) {
+        memcpy(&size, list + pos + 4, 4);
+        if (size < 0 || size > length - pos - 8) {
+            size = length - pos - 8;
+        }
+        char* field = GetWavInfoField(metadata, list + pos, &fieldSize);
+        if (field) {
+            int textLength = MINA(size, fieldSize - 1);
+            memcpy(field, list + pos + 8, textLength);
+            field[textLength] = '\0';
+            ConvertStringToUTF8(field, fieldSize);
+        }
+        pos += 8 + size + (size & 1);
     }
+}
 
-    char temp[4];
-    int size;
-    
-    // Проверяем RIFF заголовок
-    if (sceIoRead(streamsWav[channel].file, temp, 4) != 4 || memcmp(temp, "RIFF", 4) != 0) {
-        sceIoClose(streamsWav[channel].file);
-        return PSPAALIB_ERROR_WAV_INVALID_FILE;
+// Разбор заголовка по индексу чанков: формат, положение данных, петля и теги.
+static int ParseWavHeader(int channel) {
+    SceUID file = streamsWav[channel]->file;
+    WavChunkIndex index;
+    char* scratch = (char*)malloc(PSPAALIB_WAV_HEADER_SIZE + PSPAALIB_WAV_MAX_INFO_SIZE);
+    if (!scratch) {
+        return PSPAALIB_ERROR_WAV_INSUFFICIENT_RAM;
     }
-    
-    sceIoRead(streamsWav[channel].file, &size, 4);
-    if (sceIoRead(streamsWav[channel].file, temp, 4) != 4 || memcmp(temp, "WAVE", 4) != 0) {
-        sceIoClose(streamsWav[channel].file);
+    index.header = scratch + PSPAALIB_WAV_MAX_INFO_SIZE;
+    if (!IndexWavChunks(file, &index)) {
+        free(scratch);
         return PSPAALIB_ERROR_WAV_INVALID_FILE;
     }
 
-    // 1. Сначала ищем fmt чанк
-    int fmtSize, fmtPos;
-    if (!FindWavChunk(streamsWav[channel].file, "fmt ", &fmtSize, &fmtPos)) {
-        sceIoClose(streamsWav[channel].file);
+    const WavChunk* fmt = FindWavChunk(&index, "fmt ");
+    const WavChunk* data = FindWavChunk(&index, "data");
+    const char* chunk;
+    int length;
+    if (!fmt || !data || !(chunk = ReadWavChunk(file, &index, fmt, scratch, PSPAALIB_WAV_MAX_INFO_SIZE, &length)) || length < 16) {
+        free(scratch);
         return PSPAALIB_ERROR_WAV_INVALID_FILE;
     }
+    short compressionCode, bitsPerSample;
+    memcpy(&compressionCode, chunk, 2);
+    memcpy(&streamsWav[channel]->numChannels, chunk + 2, 2);
+    memcpy(&streamsWav[channel]->sampleRate, chunk + 4, 4);
+    memcpy(&bitsPerSample, chunk + 14, 2);
+    streamsWav[channel]->dataLength = data->size;
+    streamsWav[channel]->dataLocation = data->pos;
+    streamsWav[channel]->adpcm = (compressionCode == PSPAALIB_WAV_FORMAT_IMA_ADPCM);
 
-	printf("found fmt!\n");
-    // Читаем параметры fmt чанка
-    sceIoLseek(streamsWav[channel].file, fmtPos, PSP_SEEK_SET);
-    short compressionCode;
-    sceIoRead(streamsWav[channel].file, &compressionCode, 2);
-    if (compressionCode != 0 && compressionCode != 1) {
-        sceIoClose(streamsWav[channel].file);
+    if (streamsWav[channel]->adpcm) {
+        // IMA-ADPCM: блоки по blockAlign байт, в каждом framesPerBlock кадров
+        int header = 4 * streamsWav[channel]->numChannels;
+        memcpy(&streamsWav[channel]->blockAlign, chunk + 12, 2);
+        if (bitsPerSample != 4 || streamsWav[channel]->numChannels < 1 || streamsWav[channel]->numChannels > 2 ||
+            streamsWav[channel]->blockAlign <= header || streamsWav[channel]->blockAlign > PSPAALIB_WAV_READ_SIZE ||
+            (streamsWav[channel]->blockAlign - header) % header != 0) {
+            free(scratch);
+            return PSPAALIB_ERROR_WAV_COMPRESSED_FILE;
+        }
+        streamsWav[channel]->sigBytes = 2;
+        streamsWav[channel]->framesPerBlock = 1 + 8 * ((streamsWav[channel]->blockAlign - header) / header);
+        int blocks = data->size / streamsWav[channel]->blockAlign;
+        int rest = data->size % streamsWav[channel]->blockAlign;
+        streamsWav[channel]->totalFrames = blocks * streamsWav[channel]->framesPerBlock + ((rest >= header) ? 1 + 8 * ((rest - header) / header) : 0);
+        // Точное число кадров без добивки последнего блока лежит в fact
+        const WavChunk* fact = FindWavChunk(&index, "fact");
+        int factFrames;
+        if (fact && fact->size >= 4 && (chunk = ReadWavChunk(file, &index, fact, scratch, PSPAALIB_WAV_MAX_INFO_SIZE, &length)) && length >= 4) {
+            memcpy(&factFrames, chunk, 4);
+            if (factFrames > 0 && factFrames < streamsWav[channel]->totalFrames) {
+                streamsWav[channel]->totalFrames = factFrames;
+            }
+        }
+    } else if (compressionCode == 0 || compressionCode == 1) {
+        streamsWav[channel]->sigBytes = bitsPerSample >> 3; // block align из заголовка не используем, считаем сами
+        streamsWav[channel]->blockAlign = streamsWav[channel]->sigBytes * streamsWav[channel]->numChannels;
+        if (streamsWav[channel]->blockAlign <= 0) {
+            free(scratch);
+            return PSPAALIB_ERROR_WAV_INVALID_FILE;
+        }
+        streamsWav[channel]->framesPerBlock = 1;
+        streamsWav[channel]->totalFrames = data->size / streamsWav[channel]->blockAlign;
+    } else {
+        free(scratch);
         return PSPAALIB_ERROR_WAV_COMPRESSED_FILE;
     }
+    streamsWav[channel]->bytesPerSecond = MAXA(1, (int)((long long)streamsWav[channel]->blockAlign * streamsWav[channel]->sampleRate / streamsWav[channel]->framesPerBlock));
+    streamsWav[channel]->loopStart = 0;
+    streamsWav[channel]->loopEnd = data->size;
+    streamsWav[channel]->loopSkip = 0;
+    streamsWav[channel]->loopEndFrame = streamsWav[channel]->totalFrames;
 
-    sceIoRead(streamsWav[channel].file, &streamsWav[channel].numChannels, 2);
-    sceIoRead(streamsWav[channel].file, &streamsWav[channel].sampleRate, 4);
-    sceIoRead(streamsWav[channel].file, &streamsWav[channel].bytesPerSecond, 4);
-    sceIoLseek(streamsWav[channel].file, 2, PSP_SEEK_CUR); // Пропускаем block align
-    sceIoRead(streamsWav[channel].file, &streamsWav[channel].sigBytes, 2);
-    streamsWav[channel].sigBytes >>= 3;
+    // cue тоже попадает в индекс, но точки петли берутся только из smpl
+    const WavChunk* smpl = FindWavChunk(&index, "smpl");
+    if (smpl && (chunk = ReadWavChunk(file, &index, smpl, scratch, PSPAALIB_WAV_MAX_INFO_SIZE, &length))) {
+        ParseWavLoop(channel, chunk, length);
+    }
+    // LIST может быть несколько (INFO, adtl), теги есть только в INFO
+    int i;
+    for (i = 0; i < index.count; i++) {
+        if (memcmp(index.chunks[i].id, "LIST", 4) == 0 && (chunk = ReadWavChunk(file, &index, &index.chunks[i], scratch, PSPAALIB_WAV_MAX_INFO_SIZE, &length))) {
+            ParseWavInfo(&streamsWav[channel]->metadata, chunk, length);
+        }
+    }
+    free(scratch);
+    return PSPAALIB_SUCCESS;
+}
 
-    int dataSize, dataPos;
-    if (!FindWavChunk(streamsWav[channel].file, "data", &dataSize, &dataPos)) {
-        sceIoClose(streamsWav[channel].file);
+int LoadWav(char* filename, int channel, bool loadToRam) {
+    if ((channel < 0) || (channel > 31)) {
+        return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
+    }
+    if (streamsWav[channel]) {
+        UnloadWav(channel);
+    }
+    streamsWav[channel] = (WavFileInfo*)malloc(sizeof(WavFileInfo));
+    if (!streamsWav[channel]) {
+        return PSPAALIB_ERROR_WAV_INSUFFICIENT_RAM;
+    }
+    memset(streamsWav[channel], 0, sizeof(WavFileInfo));
+
+    // Инициализируем структуру метаданных
+    memset(&streamsWav[channel]->metadata, 0, sizeof(AalibMetadata));
+    streamsWav[channel]->metadata.has_cover = 0;
+
+    streamsWav[channel]->loadToRam = loadToRam;
+    streamsWav[channel]->loadStart = sceKernelGetSystemTimeLow();
+    streamsWav[channel]->file = sceIoOpen(filename, PSP_O_RDONLY, 0777);
+    if (streamsWav[channel]->file <= 0) {
         return PSPAALIB_ERROR_WAV_INVALID_FILE;
     }
-	printf("found data!\n");
-    streamsWav[channel].dataLength = dataSize;
-    streamsWav[channel].dataLocation = dataPos;
-    streamsWav[channel].dataPos = 0;
+
+    int error = ParseWavHeader(channel);
+    if (error != PSPAALIB_SUCCESS) {
+        sceIoClose(streamsWav[channel]->file);
+        return error;
+    }
+    int dataSize = streamsWav[channel]->dataLength;
+    streamsWav[channel]->step = ((unsigned long long)streamsWav[channel]->sampleRate << 16) / PSP_SAMPLE_RATE;
+    streamsWav[channel]->kernel = SelectKernel(streamsWav[channel]->sigBytes, streamsWav[channel]->numChannels);
+    ResetResampler(&streamsWav[channel]->resampler);
+    SetDataPos(channel, 0, 0);
+    streamsWav[channel]->underruns = 0;
+    streamsWav[channel]->seekPending = FALSE;
+    streamsWav[channel]->seekLatency = 0;
+    streamsWav[channel]->prerollPos = -1;
+    streamsWav[channel]->cache = NULL;
+    streamsWav[channel]->cacheSize = 0;
+    streamsWav[channel]->cacheFill = 0;
+    streamsWav[channel]->ioBytes = 0;
+    streamsWav[channel]->loopIoMark = 0;
+    streamsWav[channel]->loopIoBytes = 0;
+    streamsWav[channel]->lock = -1;
+    streamsWav[channel]->pcm = NULL;
+    streamsWav[channel]->loaded = 0;
+    streamsWav[channel]->loading = FALSE;
+    streamsWav[channel]->loadWaiting = FALSE;
+    streamsWav[channel]->loadSignal = -1;
+    streamsWav[channel]->loadTime = -1;
+    streamsWav[channel]->firstSampleTime = -1;
+
+    if (streamsWav[channel]->step != (1 << 16)) {
+        // Все кадры буфера на максимальной скорости ресемплируются за один раз
+        int maxFrames = GetResamplerMaxFrames(PSPAALIB_MAX_FETCH_LENGTH, streamsWav[channel]->step);
+        streamsWav[channel]->pcm = (short*)malloc((maxFrames + PSPAALIB_RESAMPLER_HISTORY) * 2 * sizeof(short));
+        if (!streamsWav[channel]->pcm) {
+            sceIoClose(streamsWav[channel]->file);
+            return PSPAALIB_ERROR_WAV_INSUFFICIENT_RAM;
+        }
+    }
 
     if (loadToRam) {
-        streamsWav[channel].data = (char*)malloc(dataSize);
-        if (!streamsWav[channel].data) {
-            sceIoClose(streamsWav[channel].file);
+        streamsWav[channel]->data = (char*)malloc(dataSize);
+        if (!streamsWav[channel]->data) {
+            free(streamsWav[channel]->pcm);
+            sceIoClose(streamsWav[channel]->file);
             return PSPAALIB_ERROR_WAV_INSUFFICIENT_RAM;
         }
-        sceIoLseek(streamsWav[channel].file, dataPos, PSP_SEEK_SET);
-        sceIoRead(streamsWav[channel].file, streamsWav[channel].data, dataSize);
-        sceIoClose(streamsWav[channel].file);
+        // Данные читаются кусками в фоновом потоке, играть можно сразу
+        int requestResult = AalibIoCreateRequest(&streamsWav[channel]->request);
+        streamsWav[channel]->loadSignal = sceKernelCreateSema("aalibwavloaded", 0, 0, 1, NULL);
+        if (requestResult != PSPAALIB_SUCCESS || streamsWav[channel]->loadSignal < 0 || StartLoader() != PSPAALIB_SUCCESS) {
+            AalibIoDeleteRequest(&streamsWav[channel]->request);
+            if (streamsWav[channel]->loadSignal >= 0) {
+                sceKernelDeleteSema(streamsWav[channel]->loadSignal);
+            }
+            streamsWav[channel]->loadSignal = -1;
+            free(streamsWav[channel]->data);
+            free(streamsWav[channel]->pcm);
+            sceIoClose(streamsWav[channel]->file);
+            return PSPAALIB_ERROR_CREATE_THREAD;
+        }
+        if (dataSize > 0) {
+            streamsWav[channel]->loading = TRUE;
+            sceKernelSignalSema(loaderWork, 1);
+        } else {
+            sceIoClose(streamsWav[channel]->file);
+            streamsWav[channel]->file = -1;
+            streamsWav[channel]->loadTime = 0;
+        }
     } else {
-        streamsWav[channel].data = (char*)malloc(1024 * streamsWav[channel].sigBytes * 
-            streamsWav[channel].numChannels * streamsWav[channel].sampleRate / PSP_SAMPLE_RATE);
-        if (!streamsWav[channel].data) {
-            sceIoClose(streamsWav[channel].file);
+        // ADPCM читается из кольца по блоку за раз
+        streamsWav[channel]->data = (char*)malloc(streamsWav[channel]->adpcm ? streamsWav[channel]->blockAlign : PSPAALIB_WAV_SCRATCH_FRAMES * streamsWav[channel]->blockAlign);
+        streamsWav[channel]->ring = (char*)malloc(PSPAALIB_WAV_RING_SIZE);
+        streamsWav[channel]->preroll = (char*)malloc(PSPAALIB_WAV_READ_SIZE);
+        if (!streamsWav[channel]->data || !streamsWav[channel]->ring || !streamsWav[channel]->preroll) {
+            free(streamsWav[channel]->data);
+            free(streamsWav[channel]->ring);
+            free(streamsWav[channel]->preroll);
+            free(streamsWav[channel]->pcm);
+            sceIoClose(streamsWav[channel]->file);
             return PSPAALIB_ERROR_WAV_INSUFFICIENT_RAM;
         }
-        sceIoLseek(streamsWav[channel].file, dataPos, PSP_SEEK_SET);
+        int requestResult = AalibIoCreateRequest(&streamsWav[channel]->request);
+        int prerollResult = AalibIoCreateRequest(&streamsWav[channel]->prerollRequest);
+        streamsWav[channel]->lock = sceKernelCreateSema("aalibwavlock", 0, 1, 1, NULL);
+        if (requestResult != PSPAALIB_SUCCESS || prerollResult != PSPAALIB_SUCCESS || streamsWav[channel]->lock < 0) {
+            AalibIoDeleteRequest(&streamsWav[channel]->request);
+            AalibIoDeleteRequest(&streamsWav[channel]->prerollRequest);
+            if (streamsWav[channel]->lock >= 0) {
+                sceKernelDeleteSema(streamsWav[channel]->lock);
+            }
+            streamsWav[channel]->lock = -1;
+            free(streamsWav[channel]->data);
+            free(streamsWav[channel]->ring);
+            free(streamsWav[channel]->preroll);
+            free(streamsWav[channel]->pcm);
+            sceIoClose(streamsWav[channel]->file);
+            return PSPAALIB_ERROR_CREATE_THREAD;
+        }
+        streamsWav[channel]->ringPending = 0;
+        PrimeStream(channel);
+        streamsWav[channel]->loaded = dataSize;
+        streamsWav[channel]->loadTime = sceKernelGetSystemTimeLow() - streamsWav[channel]->loadStart;
+        streamsWav[channel]->firstSampleTime = streamsWav[channel]->loadTime;
     }
 
-    streamsWav[channel].initialized = TRUE;
-    streamsWav[channel].paused = TRUE;
-    streamsWav[channel].stopReason = PSPAALIB_STOP_JUST_LOADED;
+    streamsWav[channel]->initialized = TRUE;
+    streamsWav[channel]->paused = TRUE;
+    streamsWav[channel]->stopReason = PSPAALIB_STOP_JUST_LOADED;
 
     return PSPAALIB_SUCCESS;
 }
 
+//The loader may have read the slot just before it is cleared,so it is only
+//freed once the loader is off the channel.
+static void FreeStreamWav(int channel)
+{
+	WavFileInfo* stream=streamsWav[channel];
+	streamsWav[channel]=NULL;
+	PSPAALIB_BARRIER();
+	while (loaderChannel==channel)
+	{
+		sceKernelDelayThread(1000);
+	}
+	free(stream);
+}
+
 int UnloadWav(int channel)
 {
 	if ((channel<0)||(channel>31))
 	{
 		return PSPAALIB_ERROR_WAV_INVALID_CHANNEL;
 	}
+	if (!streamsWav[channel])
+	{
+		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
+	}
+	if (!streamsWav[channel]->initialized)
+	{
+		//Left behind by a load which failed
+		FreeStreamWav(channel);
+		return PSPAALIB_ERROR_WAV_UNINITIALIZED_CHANNEL;
+	}
 	StopWav(channel);
-	if(!streamsWav[channel].loadToRam)
+	if(!streamsWav[channel]->loadToRam)
 	{
-		sceIoClose(streamsWav[channel].file);
+		AalibIoDeleteRequest(&streamsWav[channel]->request);
+		AalibIoDeleteRequest(&streamsWav[channel]->prerollRequest);
+		sceKernelDeleteSema(streamsWav[channel]->lock);
+		streamsWav[channel]->lock=-1;
+		sceIoClose(streamsWav[channel]->file);
+		free(streamsWav[channel]->ring);
+		streamsWav[channel]->ring=NULL;
+		free(streamsWav[channel]->preroll);
+		streamsWav[channel]->preroll=NULL;
+		free(streamsWav[channel]->cache);
+		streamsWav[channel]->cache=NULL;
+		streamsWav[channel]->cacheSize=0;
 	}
-	free(streamsWav[channel].data);
-	streamsWav[channel].initialized=FALSE;
-	streamsWav[channel].stopReason=PSPAALIB_STOP_UNLOADED;
+	else
+	{
+		//Stop the background load and wait until the loader is off this channel
+		streamsWav[channel]->loading=FALSE;
+		PSPAALIB_BARRIER();
+		while (loaderChannel==channel)
+		{
+			sceKernelDelayThread(1000);
+		}
+		//Wake an audio thread still waiting for data
+		sceKernelSignalSema(streamsWav[channel]->loadSignal,1);
+		sceKernelDeleteSema(streamsWav[channel]->loadSignal);
+		streamsWav[channel]->loadSignal=-1;
+		AalibIoDeleteRequest(&streamsWav[channel]->request);
+		if (streamsWav[channel]->file>=0)
+		{
+			sceIoClose(streamsWav[channel]->file);
+			streamsWav[channel]->file=-1;
+		}
+	}
+	free(streamsWav[channel]->data);
+	free(streamsWav[channel]->pcm);
+	streamsWav[channel]->pcm=NULL;
+	FreeStreamWav(channel);
 	return PSPAALIB_SUCCESS;
 }
+
+const AalibCodec codecWav=
+{
+	PSPAALIB_CHANNEL_WAV_1,
+	PSPAALIB_CHANNEL_WAV_32,
+	PSPAALIB_ERROR_WAV_INVALID_SEEK_TIME,
+	LoadWav,
+	UnloadWav,
+	GetBufferWav,
+	PlayWav,
+	StopWav,
+	PauseWav,
+	SeekWavSample,
+	PrerollWav,
+	GetSampleForMsWav,
+	SetAutoloopWav,
+	GetStopReasonWav,
+	GetPausedWav,
+	GetStreamInfoWav,
+	GetMetadataWav,
+	SetStreamCacheWav
+};
@@ -13,6 +13,19 @@
 #define _PSPAALIBWAV_H_
 
 #include "pspaalibcommon.h"
+#include "pspaalibio.h"
+#include "pspaalibeffects.h"
+
+#define PSPAALIB_WAV_READ_SIZE (16*1024)
+//Frames a streamed PCM channel copies out of its ring at a time
+#define PSPAALIB_WAV_SCRATCH_FRAMES PSPAALIB_MAX_BUFFER_LENGTH
+#define PSPAALIB_WAV_RING_SIZE (4*PSPAALIB_WAV_READ_SIZE)
+#define PSPAALIB_WAV_LOAD_CHUNK (64*1024)
+#define PSPAALIB_WAV_HEADER_SIZE (4*1024)
+#define PSPAALIB_WAV_MAX_INFO_SIZE (4*1024)
+#define PSPAALIB_WAV_MAX_CHUNKS 16
+
+#define PSPAALIB_WAV_FORMAT_IMA_ADPCM 0x11
 
 bool GetPausedWav(int channel);
 int SetAutoloopWav(int channel,bool autoloop);
@@ -20,11 +33,17 @@ int GetStopReasonWav(int channel);
 int PlayWav(int channel);
 int StopWav(int channel);
 int PauseWav(int channel);
-int SeekWav(int time,int channel);
+int SeekWavSample(int sample,int channel);
+int PrerollWav(int sample,int channel);
+int GetSampleForMsWav(int ms,int channel);
 int RewindWav(int channel);
 int GetBufferWav(short* buf,int length,float amp,int channel);
 int LoadWav(char* filename,int channel,bool loadToRam);
 int UnloadWav(int channel);
 int GetMetadataWav(int channel, AalibMetadata* metadata);
+int GetStreamInfoWav(int channel,AalibStreamInfo* info);
+int SetStreamCacheWav(int channel,int size);
+
+extern const AalibCodec codecWav;
 
 #endif
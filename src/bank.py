@@ -0,0 +1,141 @@
+from array import array
+import argparse
+import os
+import re
+import struct
+import sys
+from pydub import AudioSegment
+
+# Формат банка (см. audio/pspaalibbank.h), все числа little endian:
+# Header: Magic(4), Version(2), ClipCount(2), DataOffset(4), DataSize(4)
+# Clip:   Offset(4), Frames(4), LoopStart(4), LoopEnd(4) - смещение в кадрах от начала данных,
+#         петля в кадрах от начала клипа
+HEADER_FORMAT = "<4sHHII"
+CLIP_FORMAT = "<IIII"
+MAGIC = b"AALB"
+VERSION = 1
+
+# Данные и каждый клип начинаются на границе 64 байт (строка кэша PSP)
+ALIGN = 64
+FRAME_SIZE = 4  # 16 бит, стерео
+
+SAMPLE_RATE = 44100
+
+
+def align(value):
+    return (value + ALIGN - 1) // ALIGN * ALIGN
+
+
+def read_wav_loop(path):
+    """Ищет в WAV чанк smpl, возвращает (начало, конец) петли в кадрах или None"""
+    try:
+        with open(path, "rb") as f:
+            data = f.read()
+    except OSError:
+        return None
+    if data[:4] != b"RIFF" or data[8:12] != b"WAVE":
+        return None
+    pos = 12
+    while pos + 8 <= len(data):
+        chunk_id, size = struct.unpack("<4sI", data[pos:pos + 8])
+        payload = data[pos + 8:pos + 8 + size]
+        if chunk_id == b"smpl" and len(payload) >= 36 + 24:
+            loop_count = struct.unpack("<I", payload[28:32])[0]
+            if loop_count:
+                start, end = struct.unpack("<II", payload[36 + 8:36 + 16])
+                # В smpl конец петли включительно
+                return start, end + 1
+        pos += 8 + size + (size & 1)
+    return None
+
+
+def load_clip(path):
+    """Конвертирует файл в 44100Hz, 16-bit, Stereo, возвращает (кадры, петля)"""
+    audio = AudioSegment.from_file(path)
+    source_rate = audio.frame_rate
+    audio = audio.set_frame_rate(SAMPLE_RATE)
+    audio = audio.set_channels(2)
+    audio = audio.set_sample_width(2)
+    samples = array("h", audio.raw_data)
+    if sys.byteorder == "big":
+        samples.byteswap()
+    raw = samples.tobytes()
+    frames = len(raw) // FRAME_SIZE
+
+    loop = read_wav_loop(path) if path.lower().endswith(".wav") else None
+    if loop:
+        # Точки петли пересчитываются в новую частоту
+        start = min(frames, loop[0] * SAMPLE_RATE // source_rate)
+        end = min(frames, loop[1] * SAMPLE_RATE // source_rate)
+        if start >= end:
+            start, end = 0, frames
+    else:
+        start, end = 0, frames
+    return raw[:frames * FRAME_SIZE], start, end
+
+
+def clip_name(path):
+    """Имя для #define: имя файла без расширения, заглавными буквами"""
+    name = re.sub(r"[^0-9A-Za-z]+", "_", os.path.splitext(os.path.basename(path))[0]).upper()
+    return "BANK_" + name.strip("_")
+
+
+def write_bank(output, paths):
+    clips = []
+    data = bytearray()
+    for path in paths:
+        print(f"Обработка: {os.path.basename(path)}...")
+        raw, loop_start, loop_end = load_clip(path)
+        offset = len(data) // FRAME_SIZE
+        frames = len(raw) // FRAME_SIZE
+        clips.append((offset, frames, loop_start, loop_end))
+        data.extend(raw)
+        data.extend(b"\0" * (align(len(data)) - len(data)))
+
+    data_offset = align(struct.calcsize(HEADER_FORMAT) + len(clips) * struct.calcsize(CLIP_FORMAT))
+    with open(output, "wb") as f:
+        f.write(struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(clips), data_offset, len(data)))
+        for clip in clips:
+            f.write(struct.pack(CLIP_FORMAT, *clip))
+        f.write(b"\0" * (data_offset - f.tell()))
+        f.write(data)
+    return clips, data_offset + len(data)
+
+
+def write_header(path, paths):
+    """Пишет C заголовок с номерами клипов для AalibLoadClip()"""
+    guard = re.sub(r"[^0-9A-Za-z]+", "_", os.path.basename(path)).upper()
+    with open(path, "w") as f:
+        f.write(f"#ifndef _{guard}_\n#define _{guard}_\n\n")
+        for index, clip_path in enumerate(paths):
+            f.write(f"#define {clip_name(clip_path)} {index}\n")
+        f.write(f"\n#define BANK_CLIP_COUNT {len(paths)}\n\n#endif\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Собирает короткие звуки в банк для AalibLoadBank()")
+    parser.add_argument("output", help="файл банка")
+    parser.add_argument("files", nargs="+", help="звуки в порядке номеров клипов")
+    parser.add_argument("--header", help="записать номера клипов в C заголовок")
+    args = parser.parse_args()
+
+    if len(args.files) > 0xFFFF:
+        print("Слишком много клипов для одного банка")
+        sys.exit(1)
+    try:
+        clips, size = write_bank(args.output, args.files)
+    except Exception as e:
+        print(f"Ошибка при обработке аудио: {e}")
+        print("Убедитесь, что установлен FFmpeg, если используете форматы отличные от WAV.")
+        sys.exit(1)
+    if args.header:
+        write_header(args.header, args.files)
+
+    print("-" * 30)
+    for index, (path, clip) in enumerate(zip(args.files, clips)):
+        print(f"{index:3d}  {os.path.basename(path)}: {clip[1]} кадров, петля {clip[2]}-{clip[3]}")
+    print(f"Банк сохранен: {args.output} ({size/1024:.1f} KB)")
+
+
+if __name__ == "__main__":
+    main()
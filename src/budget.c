@@ -0,0 +1,107 @@
+#ifdef PSPAALIB_HOST
+#include "pspaalibhost.h"
+#else
+#include <pspkernel.h>
+#endif
+#include <stdlib.h>
+#include <malloc.h>
+
+#include "budget.h"
+#include "log.h"
+
+#define PROBE_GRANULARITY (16 * 1024)
+#define PROBE_LIMIT (64 * 1024 * 1024)
+
+static const char *mode_names[] = { "ram", "cache", "stream" };
+
+/*
+ * The newlib heap grabs its partition lazily, so sceKernel*FreeMemSize()
+ * alone doesn't tell how much malloc can still hand out. Binary search the
+ * largest block instead; it's a dozen malloc/free pairs at startup.
+ */
+static unsigned int query_free_memory(void) {
+    unsigned int lo = 0, hi = PROBE_LIMIT / PROBE_GRANULARITY;
+
+    while (lo < hi) {
+        unsigned int mid = (lo + hi + 1) / 2;
+        void *block = malloc(mid * PROBE_GRANULARITY);
+        if (block) {
+            free(block);
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo * PROBE_GRANULARITY;
+}
+
+void budget_init(Budget *budget, unsigned int headroom) {
+    budget->free_at_start = query_free_memory();
+    budget->headroom = headroom;
+    budget->committed = 0;
+    budget->peak_used = 0;
+    budget_sample(budget);
+
+    log_printf("budget: %u KB free (kernel total %u KB), headroom %u KB\n",
+               budget->free_at_start / 1024,
+               (unsigned int)sceKernelTotalFreeMemSize() / 1024,
+               headroom / 1024);
+}
+
+unsigned int budget_available(const Budget *budget) {
+    unsigned int reserved = budget->headroom + budget->committed;
+    if (budget->free_at_start <= reserved) return 0;
+    return budget->free_at_start - reserved;
+}
+
+AssetMode budget_plan(Budget *budget, const char *name,
+                      unsigned int full_cost, unsigned int min_cost,
+                      unsigned int reserve, int shares, unsigned int *granted) {
+    unsigned int available = budget_available(budget);
+    unsigned int needed = min_cost + reserve;
+    AssetMode mode;
+
+    /* Only what is left once every asset can stream gets split, so an asset
+     * with a large min_cost isn't pushed to streaming by an equal share */
+    available = min_cost + ((available > needed) ? (available - needed) / (shares > 0 ? shares : 1) : 0);
+
+    if (full_cost <= available) {
+        mode = ASSET_MODE_RAM;
+        *granted = full_cost;
+    } else if (min_cost < available) {
+        /* Less than full_cost, whatever the asset doesn't take stays for the
+         * ones planned after it */
+        mode = ASSET_MODE_CACHE;
+        *granted = available;
+    } else {
+        mode = ASSET_MODE_STREAM;
+        *granted = min_cost;
+    }
+    budget->committed += *granted;
+
+    log_printf("budget: %s needs %u KB resident, %u KB streamed, %u KB available -> %s (%u KB)\n",
+               name, full_cost / 1024, min_cost / 1024, available / 1024,
+               mode_names[mode], *granted / 1024);
+    return mode;
+}
+
+void budget_release(Budget *budget, unsigned int bytes) {
+    budget->committed -= (bytes < budget->committed) ? bytes : budget->committed;
+}
+
+void budget_sample(Budget *budget) {
+    struct mallinfo info = mallinfo();
+    if ((unsigned int)info.uordblks > budget->peak_used) {
+        budget->peak_used = info.uordblks;
+    }
+}
+
+void budget_report(const Budget *budget) {
+    log_printf("budget: peak heap usage %u KB of %u KB, %u KB committed to assets\n",
+               budget->peak_used / 1024, budget->free_at_start / 1024,
+               budget->committed / 1024);
+}
+
+const char *budget_mode_name(AssetMode mode) {
+    return mode_names[mode];
+}
@@ -0,0 +1,41 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#define BUDGET_DEFAULT_HEADROOM (512 * 1024)
+
+typedef enum {
+    ASSET_MODE_RAM = 0,   /* whole asset resident */
+    ASSET_MODE_CACHE,     /* part of the asset resident, rest streamed */
+    ASSET_MODE_STREAM     /* only working buffers resident */
+} AssetMode;
+
+typedef struct {
+    unsigned int free_at_start;  /* largest block malloc could give us at init */
+    unsigned int headroom;       /* kept back for decode queues, stacks, stdio */
+    unsigned int committed;      /* bytes granted to assets so far */
+    unsigned int peak_used;      /* highest heap usage seen by budget_sample() */
+} Budget;
+
+void budget_init(Budget *budget, unsigned int headroom);
+unsigned int budget_available(const Budget *budget);
+
+/*
+ * Picks a residency mode for one asset. full_cost is what the asset needs
+ * to be entirely in RAM, min_cost what it needs to play while streaming.
+ * The bytes granted to it (always >= min_cost) are written to *granted and
+ * committed against the budget. When several assets still have to be
+ * planned, reserve is the sum of their min_cost, which is kept for them,
+ * and shares (this asset included) splits what is left beyond every
+ * min_cost, so the first one can't take all.
+ */
+AssetMode budget_plan(Budget *budget, const char *name,
+                      unsigned int full_cost, unsigned int min_cost,
+                      unsigned int reserve, int shares, unsigned int *granted);
+void budget_release(Budget *budget, unsigned int bytes);
+
+void budget_sample(Budget *budget);
+void budget_report(const Budget *budget);
+
+const char *budget_mode_name(AssetMode mode);
+
+#endif
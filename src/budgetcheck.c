@@ -0,0 +1,181 @@
+/* Checks the plans of the memory budget in budget.c on a PC, with made up
+ * amounts of free memory. Built with AddressSanitizer and run by
+ * "make -f Makefile.host check". */
+#include <stdio.h>
+#include <string.h>
+
+#include "budget.h"
+
+#define KB 1024
+#define MB (1024 * 1024)
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            printf("  FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            failures++; \
+        } \
+    } while (0)
+
+typedef struct {
+    unsigned int full_cost;
+    unsigned int min_cost;
+} asset;
+
+typedef struct {
+    AssetMode mode;
+    unsigned int granted;
+} plan;
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} test_case;
+
+/* A budget as budget_init() would leave it with free bytes found */
+static void make_budget(Budget *budget, unsigned int free, unsigned int headroom) {
+    memset(budget, 0, sizeof(Budget));
+    budget->free_at_start = free;
+    budget->headroom = headroom;
+}
+
+/* Plans the assets in order the way main.c does: the last one is the audio,
+ * and every asset keeps back the min_cost of the ones after it */
+static void plan_assets(Budget *budget, const asset *assets, int count, plan *plans) {
+    unsigned int reserve = 0;
+    for (int i = 0; i < count; i++) reserve += assets[i].min_cost;
+    for (int i = 0; i < count; i++) {
+        reserve -= assets[i].min_cost;
+        plans[i].mode = budget_plan(budget, "asset", assets[i].full_cost, assets[i].min_cost,
+                                    reserve, count - i, &plans[i].granted);
+    }
+}
+
+/* What every plan has to satisfy: an asset gets at least what it needs to
+ * stream and never more than all of it, and the committed total adds up */
+static void check_plans(const Budget *budget, const asset *assets, int count, const plan *plans) {
+    unsigned int total = 0;
+    for (int i = 0; i < count; i++) {
+        CHECK(plans[i].granted >= assets[i].min_cost, "asset %d granted %u of min %u", i, plans[i].granted, assets[i].min_cost);
+        CHECK(plans[i].granted <= assets[i].full_cost, "asset %d granted %u of full %u", i, plans[i].granted, assets[i].full_cost);
+        CHECK((plans[i].mode == ASSET_MODE_RAM) == (plans[i].granted == assets[i].full_cost),
+              "asset %d in %s mode with %u of %u", i, budget_mode_name(plans[i].mode), plans[i].granted, assets[i].full_cost);
+        total += plans[i].granted;
+    }
+    CHECK(budget->committed == total, "committed %u, granted %u", budget->committed, total);
+}
+
+/* Tests */
+
+/* Everything fits */
+static void test_fits(void) {
+    static const asset assets[] = {{1 * MB, 10 * KB}, {1 * MB, 10 * KB}, {2 * MB, 100 * KB}};
+    Budget budget;
+    plan plans[3];
+    make_budget(&budget, 8 * MB, 512 * KB);
+    plan_assets(&budget, assets, 3, plans);
+    check_plans(&budget, assets, 3, plans);
+    for (int i = 0; i < 3; i++) CHECK(plans[i].mode == ASSET_MODE_RAM, "asset %d in %s mode", i, budget_mode_name(plans[i].mode));
+}
+
+/* Two tiles which would each take everything, and the audio after them: the
+ * tiles must not leave the audio less than it needs to stream, and nobody
+ * may be granted more than there is */
+static void test_over_limit(void) {
+    static const asset assets[] = {{3 * MB, 10 * KB}, {3 * MB, 10 * KB}, {2 * MB, 200 * KB}};
+    Budget budget;
+    plan plans[3];
+    make_budget(&budget, 4 * MB, 512 * KB);
+    plan_assets(&budget, assets, 3, plans);
+    check_plans(&budget, assets, 3, plans);
+    CHECK(budget.committed <= 4 * MB - 512 * KB, "committed %u of %u", budget.committed, 4 * MB - 512 * KB);
+    CHECK(plans[2].mode == ASSET_MODE_CACHE, "audio in %s mode", budget_mode_name(plans[2].mode));
+    for (int i = 0; i < 2; i++) CHECK(plans[i].mode == ASSET_MODE_CACHE, "tile %d in %s mode", i, budget_mode_name(plans[i].mode));
+}
+
+/* One asset that doesn't fit gets everything there is, but no more */
+static void test_cache(void) {
+    static const asset assets[] = {{8 * MB, 100 * KB}};
+    Budget budget;
+    plan plans[1];
+    make_budget(&budget, 4 * MB, 512 * KB);
+    plan_assets(&budget, assets, 1, plans);
+    check_plans(&budget, assets, 1, plans);
+    CHECK(plans[0].mode == ASSET_MODE_CACHE && plans[0].granted == 4 * MB - 512 * KB,
+          "%s mode with %u", budget_mode_name(plans[0].mode), plans[0].granted);
+}
+
+/* A small tile takes only what it needs, the large tile and the audio after
+ * it split the rest and nothing is left over */
+static void test_leftover(void) {
+    static const asset assets[] = {{100 * KB, 10 * KB}, {6 * MB, 10 * KB}, {5 * MB, 200 * KB}};
+    Budget budget;
+    plan plans[3];
+    make_budget(&budget, 4 * MB, 512 * KB);
+    plan_assets(&budget, assets, 3, plans);
+    check_plans(&budget, assets, 3, plans);
+    CHECK(plans[0].mode == ASSET_MODE_RAM, "small tile in %s mode", budget_mode_name(plans[0].mode));
+    CHECK(plans[1].mode == ASSET_MODE_CACHE && plans[2].mode == ASSET_MODE_CACHE, "large tile in %s mode, audio in %s mode",
+          budget_mode_name(plans[1].mode), budget_mode_name(plans[2].mode));
+    CHECK(budget.committed + 2 >= 4 * MB - 512 * KB && budget.committed <= 4 * MB - 512 * KB,
+          "committed %u of %u", budget.committed, 4 * MB - 512 * KB);
+}
+
+/* Assets with large minimums split what is left beyond them evenly, instead
+ * of the first one being pushed to streaming by an even split of it all */
+static void test_fair(void) {
+    static const asset assets[] = {{4 * MB, 1 * MB}, {4 * MB, 1 * MB}};
+    Budget budget;
+    plan plans[2];
+    make_budget(&budget, 3 * MB + 512 * KB, 512 * KB);
+    plan_assets(&budget, assets, 2, plans);
+    check_plans(&budget, assets, 2, plans);
+    for (int i = 0; i < 2; i++) {
+        CHECK(plans[i].mode == ASSET_MODE_CACHE && plans[i].granted == 1 * MB + 512 * KB,
+              "asset %d in %s mode with %u", i, budget_mode_name(plans[i].mode), plans[i].granted);
+    }
+}
+
+/* Not even the minimums fit: everything streams */
+static void test_minimums(void) {
+    static const asset assets[] = {{3 * MB, 300 * KB}, {2 * MB, 300 * KB}};
+    Budget budget;
+    plan plans[2];
+    make_budget(&budget, 1 * MB, 512 * KB);
+    plan_assets(&budget, assets, 2, plans);
+    check_plans(&budget, assets, 2, plans);
+    for (int i = 0; i < 2; i++) CHECK(plans[i].mode == ASSET_MODE_STREAM, "asset %d in %s mode", i, budget_mode_name(plans[i].mode));
+}
+
+static const test_case tests[] = {
+    {"fits", test_fits},
+    {"overlimit", test_over_limit},
+    {"cache", test_cache},
+    {"leftover", test_leftover},
+    {"fair", test_fair},
+    {"minimums", test_minimums},
+};
+
+int main(int argc, char **argv) {
+    int count = sizeof(tests) / sizeof(tests[0]), run = 0;
+    for (int i = 0; i < count; i++) {
+        int selected = (argc < 2);
+        for (int j = 1; j < argc; j++) {
+            if (strcmp(argv[j], tests[i].name) == 0) selected = 1;
+        }
+        if (!selected) continue;
+        int before = failures;
+        tests[i].run();
+        printf("%-12s %s\n", tests[i].name, (failures == before) ? "ok" : "FAILED");
+        run++;
+    }
+    if (!run) {
+        printf("no such test\n");
+        return 1;
+    }
+    printf("%d tests, %d failures\n", run, failures);
+    return failures != 0;
+}
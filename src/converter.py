@@ -1,4 +1,5 @@
 from PIL import Image
+from array import array
 import struct
 import os
 import sys
@@ -11,6 +12,11 @@ OUTPUT_DATA = "animation.dat"
 OUTPUT_AUDIO_NAME = "sound.wav" # Имя итогового аудиофайла
 OUTPUT_CONFIG = "config.ini"
 
+# Сжимать звук в IMA-ADPCM: в 4 раза меньше места на карте памяти и чтения,
+# декодирование на PSP почти ничего не стоит. Можно включить ключом --adpcm
+AUDIO_ADPCM = "--adpcm" in sys.argv
+ADPCM_BLOCK_ALIGN = 2048 # Размер блока в байтах (для стерео 2041 кадр)
+
 # PSP Debug screen size
 WIDTH = 60
 HEIGHT = 34
@@ -47,8 +53,82 @@ def select_files():
         
     return gif_path, audio_path
 
+IMA_STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+]
+IMA_INDEX_SHIFT = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+def encode_ima_adpcm(samples, channels, block_align):
+    """Кодирует 16-битные сэмплы (каналы чередуются) в блоки IMA-ADPCM, как в WAV от Microsoft"""
+    frames_per_block = (block_align - 4 * channels) * 2 // channels + 1
+    frame_count = len(samples) // channels
+    predictor = [0] * channels
+    index = [0] * channels
+    out = bytearray()
+
+    for start in range(0, frame_count, frames_per_block):
+        # Заголовок блока: первый сэмпл как есть и индекс шага для каждого канала
+        for c in range(channels):
+            predictor[c] = samples[start * channels + c]
+            out += struct.pack("<hBB", predictor[c], index[c], 0)
+
+        codes = [[] for _ in range(channels)]
+        for i in range(start + 1, start + frames_per_block):
+            for c in range(channels):
+                # Последний блок добивается тишиной, реальная длина пишется в fact
+                sample = samples[i * channels + c] if i < frame_count else predictor[c]
+                step = IMA_STEPS[index[c]]
+                diff = sample - predictor[c]
+                code = 0
+                if diff < 0:
+                    code = 8
+                    diff = -diff
+                delta = step >> 3
+                if diff >= step:
+                    code |= 4
+                    diff -= step
+                    delta += step
+                if diff >= step >> 1:
+                    code |= 2
+                    diff -= step >> 1
+                    delta += step >> 1
+                if diff >= step >> 2:
+                    code |= 1
+                    delta += step >> 2
+                predictor[c] += -delta if code & 8 else delta
+                predictor[c] = max(-32768, min(32767, predictor[c]))
+                index[c] = max(0, min(88, index[c] + IMA_INDEX_SHIFT[code & 7]))
+                codes[c].append(code)
+
+        # Коды идут группами по 8 (4 байта) на канал, младший полубайт первый
+        for group in range(0, frames_per_block - 1, 8):
+            for c in range(channels):
+                for k in range(group, group + 8, 2):
+                    out.append(codes[c][k] | (codes[c][k + 1] << 4))
+
+    return out, frame_count, frames_per_block
+
+def write_adpcm_wav(output_filename, samples, channels, frame_rate):
+    """Сохраняет WAV в формате IMA-ADPCM (fmt 0x11 + fact)"""
+    data, frame_count, frames_per_block = encode_ima_adpcm(samples, channels, ADPCM_BLOCK_ALIGN)
+    fmt = struct.pack("<HHIIHHHH", 0x11, channels, frame_rate,
+                      frame_rate * ADPCM_BLOCK_ALIGN // frames_per_block,
+                      ADPCM_BLOCK_ALIGN, 4, 2, frames_per_block)
+    chunks = b""
+    for chunk_id, payload in ((b"fmt ", fmt), (b"fact", struct.pack("<I", frame_count)), (b"data", data)):
+        chunks += chunk_id + struct.pack("<I", len(payload)) + payload
+    with open(output_filename, "wb") as f:
+        f.write(b"RIFF" + struct.pack("<I", 4 + len(chunks)) + b"WAVE" + chunks)
+    return len(data)
+
 def process_audio(input_path, output_filename):
-    """Конвертирует аудио в 44100Hz, 16-bit, Stereo"""
+    """Конвертирует аудио в 44100Hz, 16-bit, Stereo (по желанию сжимает в IMA-ADPCM)"""
     print(f"Обработка аудио: {os.path.basename(input_path)}...")
     
     try:
@@ -60,7 +140,15 @@ def process_audio(input_path, output_filename):
         audio = audio.set_sample_width(2)   # 2 байта = 16 бит
         
         # Экспорт
-        audio.export(output_filename, format="wav")
+        if AUDIO_ADPCM:
+            print("Сжатие в IMA-ADPCM...")
+            samples = array("h", audio.raw_data)
+            if sys.byteorder == "big":
+                samples.byteswap()
+            size = write_adpcm_wav(output_filename, samples, 2, 44100)
+            print(f"IMA-ADPCM: {size/1024/1024:.2f} MB вместо {len(audio.raw_data)/1024/1024:.2f} MB")
+        else:
+            audio.export(output_filename, format="wav")
         print(f"Аудио успешно конвертировано и сохранено как: {output_filename}")
         return output_filename
     except Exception as e:
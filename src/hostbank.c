@@ -0,0 +1,132 @@
+/* Compares loading a sound bank against loading the same clips as separate
+ * WAV files, on a PC through the host build of the audio library. Built by
+ * Makefile.host. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pspaalib.h"
+
+#define MAX_WAVS 32
+
+typedef struct {
+    unsigned int calls;   /* until the load calls have returned */
+    unsigned int ready;   /* until every byte is in RAM */
+    unsigned int requests;
+    unsigned int bytes;
+} load_time;
+
+static void usage(void) {
+    printf("usage: hostbank BANK WAV... [--rounds N]\n");
+    printf("  loads BANK and then the WAV files one by one, N times each (default 20),\n");
+    printf("  and prints the average time and the I/O it took\n");
+}
+
+static void read_io(load_time *t) {
+    AalibEngineStats stats;
+    AalibGetEngineStats(&stats);
+    t->requests += stats.ioRequests;
+    t->bytes += stats.ioBytes;
+}
+
+static int time_bank(const char *bank, load_time *t) {
+    AalibResetStats();
+    unsigned int start = sceKernelGetSystemTimeLow();
+    int result = AalibLoadBank((char *)bank, 0);
+    t->calls += sceKernelGetSystemTimeLow() - start;
+    t->ready += sceKernelGetSystemTimeLow() - start;
+    read_io(t);
+    if (result != 0) {
+        printf("can't load %s: %d\n", bank, result);
+        return result;
+    }
+    AalibUnloadBank(0);
+    return 0;
+}
+
+/* A WAV loaded to RAM is read by a background thread, so it only counts as
+ * ready once its buffer is full */
+static int time_wavs(char **wavs, int count, load_time *t) {
+    int i, result = 0;
+    AalibResetStats();
+    unsigned int start = sceKernelGetSystemTimeLow();
+    for (i = 0; i < count; i++) {
+        result = AalibLoad(wavs[i], PSPAALIB_CHANNEL_WAV_1 + i, 1);
+        if (result != 0) {
+            printf("can't load %s: %d\n", wavs[i], result);
+            count = i;
+            break;
+        }
+    }
+    t->calls += sceKernelGetSystemTimeLow() - start;
+    for (i = 0; i < count; i++) {
+        AalibStreamInfo info;
+        do {
+            AalibGetStreamInfo(PSPAALIB_CHANNEL_WAV_1 + i, &info);
+        } while (info.bufferFill < info.bufferSize);
+    }
+    t->ready += sceKernelGetSystemTimeLow() - start;
+    read_io(t);
+    for (i = 0; i < count; i++) {
+        AalibUnload(PSPAALIB_CHANNEL_WAV_1 + i);
+    }
+    return result;
+}
+
+static void print_time(const char *name, load_time *t, int rounds) {
+    printf("%-12s %8u us to return %8u us to ready %6u I/O requests %9u bytes\n", name,
+           t->calls / rounds, t->ready / rounds, t->requests / rounds, t->bytes / rounds);
+}
+
+int main(int argc, char **argv) {
+    const char *bank = NULL;
+    char *wavs[MAX_WAVS];
+    int count = 0, rounds = 20, i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) rounds = atoi(argv[++i]);
+        else if (argv[i][0] == '-') {
+            usage();
+            return 1;
+        }
+        else if (!bank) bank = argv[i];
+        else if (count < MAX_WAVS) wavs[count++] = argv[i];
+        else {
+            printf("at most %d WAV files\n", MAX_WAVS);
+            return 1;
+        }
+    }
+    if (!bank || !count || rounds <= 0) {
+        usage();
+        return 1;
+    }
+
+    AalibHostSetClock(0);
+    AalibInit();
+    AalibEnableStats(1);
+
+    load_time bank_time = {0}, wav_time = {0};
+    for (i = 0; i < rounds; i++) {
+        if (time_bank(bank, &bank_time) || time_wavs(wavs, count, &wav_time)) {
+            return 1;
+        }
+    }
+
+    /* Starting a clip from the bank,on channels which already have a slot */
+    AalibLoadBank((char *)bank, 0);
+    int clips = AalibGetClipCount(0), triggers = 1000;
+    for (i = 0; i < 16; i++) AalibLoadClip(PSPAALIB_CHANNEL_BANK_1 + i, 0, i % clips);
+    unsigned int start = sceKernelGetSystemTimeLow();
+    for (i = 0; i < triggers; i++) {
+        AalibLoadClip(PSPAALIB_CHANNEL_BANK_1 + i % 16, 0, i % clips);
+    }
+    unsigned int trigger_time = sceKernelGetSystemTimeLow() - start;
+
+    printf("%d clips in the bank, %d WAV files, average of %d rounds\n", clips, count, rounds);
+    print_time("bank", &bank_time, rounds);
+    print_time("WAV to RAM", &wav_time, rounds);
+    printf("clip start   %8.2f us per AalibLoadClip\n", (float)trigger_time / triggers);
+
+    AalibUnloadBank(0);
+    return 0;
+}
@@ -0,0 +1,744 @@
+/* Benchmarks for the audio library on a PC, through its host build. Each
+ * benchmark prints what it measured; the names of single benchmarks can be
+ * given on the command line. Built by Makefile.host and run by
+ * "make -f Makefile.host bench". */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pspaalib.h"
+#include "pspaalibeffects.h"
+#include "pspaalibwav.h"
+#include "hostwav.h"
+
+#define SAMPLE_RATE 44100
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} benchmark;
+
+#define MAX_OGG_FILES 8
+
+static const char *ogg_paths[MAX_OGG_FILES];
+static int ogg_count = 0;
+
+/* Loads path on a WAV channel and times the codec alone fetching seconds of
+ * audio from it in buffers of length frames, looping the file, with no play
+ * thread in between. Returns microseconds per second of audio, or -1. */
+static float fetch_cost(const char *path, int ram, int seconds, int length) {
+    static short buffer[2 * PSPAALIB_MAX_BUFFER_LENGTH];
+    int channel = PSPAALIB_CHANNEL_WAV_1, stream = channel - codecWav.firstChannel;
+    int result = AalibLoad((char *)path, channel, ram);
+    if (result != 0) {
+        printf("  can't load %s: %d\n", path, result);
+        return -1;
+    }
+    AalibStreamInfo info;
+    do {
+        sceKernelDelayThread(1000);
+        AalibGetStreamInfo(channel, &info);
+    } while (ram && info.bufferFill < info.bufferSize);
+    AalibSetAutoloop(channel, 1);
+    codecWav.play(stream);
+    int buffers = seconds * SAMPLE_RATE / length;
+    unsigned int start = sceKernelGetSystemTimeLow();
+    for (int i = 0; i < buffers; i++) codecWav.getBuffer(buffer, length, 1.0f, stream);
+    unsigned int elapsed = sceKernelGetSystemTimeLow() - start;
+    codecWav.stop(stream);
+    AalibUnload(channel);
+    return (float)elapsed / seconds;
+}
+
+/* Benchmarks */
+
+static long file_size(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+/* The loop GetBufferWav() had for files in RAM: the sample size checked and
+ * the source index divided out for every frame, and a float gain. Kept to
+ * compare the kernels against. pos is the byte position in data. */
+static void old_get_buffer(short *buf, int length, float amp, const char *data, int data_length, int *pos,
+                           int sig_bytes, int channels, int rate) {
+    int i, index;
+    int real_length = length * sig_bytes * channels * rate / SAMPLE_RATE;
+    if (*pos + real_length >= data_length) *pos = 0;
+    for (i = 0; i < length; i++) {
+        if (sig_bytes == 1) {
+            index = channels * (int)(i * rate / SAMPLE_RATE) + *pos;
+            buf[2 * i] = (data[index] << 8) * amp;
+            index += (channels > 1) ? 1 : 0;
+            buf[2 * i + 1] = (data[index] << 8) * amp;
+        }
+        else if (sig_bytes == 2) {
+            index = channels * (int)(i * rate / SAMPLE_RATE) + (*pos / 2);
+            buf[2 * i] = (((short *)data)[index]) * amp;
+            index += (channels > 1) ? 1 : 0;
+            buf[2 * i + 1] = (((short *)data)[index]) * amp;
+        }
+    }
+    *pos += real_length;
+}
+
+/* The old loop over the same file contents, in microseconds per second of
+ * audio */
+static float old_fetch_cost(const pcm_data *pcm, int seconds, int length) {
+    static short buffer[2 * PSPAALIB_MAX_BUFFER_LENGTH];
+    int sig_bytes = pcm->bits / 8, size = pcm->frames * pcm->channels * sig_bytes, pos = 0;
+    char *data = malloc(size);
+    for (int i = 0; i < pcm->frames * pcm->channels; i++) {
+        if (sig_bytes == 1) data[i] = (char)(pcm->samples[i] >> 8);
+        else ((short *)data)[i] = pcm->samples[i];
+    }
+    int buffers = seconds * SAMPLE_RATE / length;
+    unsigned int start = sceKernelGetSystemTimeLow();
+    for (int i = 0; i < buffers; i++) old_get_buffer(buffer, length, 1.0f, data, size, &pos, sig_bytes, pcm->channels, pcm->rate);
+    unsigned int elapsed = sceKernelGetSystemTimeLow() - start;
+    free(data);
+    return (float)elapsed / seconds;
+}
+
+/* The WAV kernels for every sample format, at 44100Hz and resampled from
+ * 22050Hz, against the loop they replaced, in output frames per second. The
+ * kernels are timed through the codec's getBuffer, so their column also pays
+ * for the locking and bookkeeping around them. */
+static void bench_wav(void) {
+    static const int formats[][3] = {
+        {16, 2, 44100}, {16, 1, 44100}, {8, 2, 44100}, {8, 1, 44100},
+        {16, 2, 22050}, {16, 1, 22050}, {8, 2, 22050}, {8, 1, 22050},
+    };
+    pcm_data pcm;
+    printf("  format              kernel      old loop   (M frames/s)\n");
+    for (int i = 0; i < 8; i++) {
+        make_pcm(&pcm, 5 * formats[i][2], formats[i][1], formats[i][2], formats[i][0], 20000, 2 + i);
+        if (!write_wav("bench_wav.wav", &pcm, 0, 0)) return;
+        /* the best of a few runs, the machine is not always ours */
+        float cost = 1e30f, old_cost = 1e30f;
+        for (int run = 0; run < 3; run++) {
+            float c = fetch_cost("bench_wav.wav", 1, 600, 1024), old_c = old_fetch_cost(&pcm, 600, 1024);
+            if (c >= 0 && c < cost) cost = c;
+            if (old_c < old_cost) old_cost = old_c;
+        }
+        printf("  %2d bit %-6s %5dHz %9.1f %11.1f\n", formats[i][0], (formats[i][1] > 1) ? "stereo" : "mono", formats[i][2],
+               SAMPLE_RATE / cost, SAMPLE_RATE / old_cost);
+        free_pcm(&pcm);
+        remove("bench_wav.wav");
+    }
+    printf("  (at 22050Hz the kernels interpolate, the old loop repeated frames)\n");
+}
+
+/* What decoding IMA-ADPCM costs against plain PCM, for the same 44100Hz
+ * stereo audio from RAM, and how much less there is to read */
+static void bench_adpcm(void) {
+    static const char *paths[] = {"bench_pcm.wav", "bench_adpcm.wav"};
+    static const char *names[] = {"PCM", "IMA-ADPCM"};
+    pcm_data pcm;
+    int seconds = 10;
+    make_pcm(&pcm, seconds * SAMPLE_RATE, 2, SAMPLE_RATE, 16, 20000, 1);
+    if (!write_wav(paths[0], &pcm, 0, 0) || !write_adpcm_wav(paths[1], &pcm, 2048, 0, 0, NULL)) return;
+    for (int i = 0; i < 2; i++) {
+        float cost = fetch_cost(paths[i], 1, 60, 1024);
+        printf("  %-10s %8.1f us per second of audio, %5.2f MB per minute\n", names[i], cost,
+               file_size(paths[i]) * 60.0f / seconds / (1024 * 1024));
+        remove(paths[i]);
+    }
+    free_pcm(&pcm);
+}
+
+/* Resamplers over a whole source of frames stereo frames, in buffers of
+ * RESAMPLE_BUFFER output frames the way the codecs call them. src has
+ * PSPAALIB_RESAMPLER_HISTORY frames in front of it. Each returns how many
+ * frames it wrote to dest and, in delay, how many source frames late its
+ * output is. */
+#define RESAMPLE_BUFFER 1024
+
+typedef int (*resampler)(short *dest, short *src, int frames, unsigned int step, int *delay);
+
+/* What the codecs run now */
+static int resample_linear(short *dest, short *src, int frames, unsigned int step, int *delay) {
+    AalibResampler state;
+    int out = 0, used = 0, need;
+    ResetResampler(&state);
+    while ((need = GetResamplerFrames(&state, RESAMPLE_BUFFER, step)) + used <= frames) {
+        ResampleLinear(dest + 2 * out, src + 2 * used, RESAMPLE_BUFFER, step, &state);
+        used += need;
+        out += RESAMPLE_BUFFER;
+    }
+    *delay = PSPAALIB_RESAMPLER_HISTORY;
+    return out;
+}
+
+/* The loop GetBufferSpeedEffect() had: every buffer starts over on a whole
+ * source frame and picks the nearest one before, with the index in float */
+static int resample_nearest(short *dest, short *src, int frames, unsigned int step, int *delay) {
+    float speed = step / 65536.0f;
+    int out = 0, used = 0, chunk = (int)(RESAMPLE_BUFFER * speed);
+    while (used + chunk + 1 <= frames) {
+        short *in = src + 2 * used, *buf = dest + 2 * out;
+        for (int i = 0; i < RESAMPLE_BUFFER; i++) {
+            buf[2 * i] = in[2 * (int)(i * speed)];
+            buf[2 * i + 1] = in[2 * (int)(i * speed) + 1];
+        }
+        used += chunk;
+        out += RESAMPLE_BUFFER;
+    }
+    *delay = 0;
+    return out;
+}
+
+/* A 4-tap Catmull-Rom cubic in fixed point with 10 bits of fraction, which
+ * keeps the products inside an int. Only here to weigh against the linear
+ * one; it runs in one pass with no state to carry between buffers. */
+static int resample_cubic(short *dest, short *src, int frames, unsigned int step, int *delay) {
+    int out = (int)(((long long)(frames - 2) << 16) / step);
+    unsigned long long position = 0;
+    for (int i = 0; i < out; i++, position += step) {
+        int index = 2 * (int)(position >> 16), t = (int)(position & 0xFFFF) >> 6;
+        for (int side = 0; side < 2; side++) {
+            int p0 = src[index + side - 2], p1 = src[index + side], p2 = src[index + side + 2], p3 = src[index + side + 4];
+            int a3 = -p0 + 3 * p1 - 3 * p2 + p3, a2 = 2 * p0 - 5 * p1 + 4 * p2 - p3, a1 = p2 - p0;
+            int v = (((((a3 * t) >> 10) + a2) * t >> 10) + a1) * t >> 10;
+            v = (v + 2 * p1) >> 1;
+            dest[2 * i + side] = (v > 32767) ? 32767 : ((v < -32768) ? -32768 : v);
+        }
+    }
+    *delay = 0;
+    return out;
+}
+
+/* Throughput in nanoseconds per output frame and THD+N in dB of a 1kHz sine
+ * at rate, played step source frames per output frame */
+static void measure_resampler(const char *name, resampler run, int rate, unsigned int step) {
+    int frames = 2 * rate, history = PSPAALIB_RESAMPLER_HISTORY;
+    int capacity = (int)(((long long)frames << 16) / step) + RESAMPLE_BUFFER;
+    short *source = calloc(2 * (frames + history), sizeof(short)), *src = source + 2 * history;
+    short *dest = malloc(2 * capacity * sizeof(short));
+    for (int i = 0; i < frames; i++) src[2 * i] = src[2 * i + 1] = (short)(16384 * sin(2 * M_PI * 1000 * i / rate));
+    int delay, out = run(dest, src, frames, step, &delay);
+    /* Against the sine at the exact position, past the start up */
+    double error = 0, power = 0;
+    for (int i = 64; i < out; i++) {
+        double t = (double)i * step / 65536 - delay;
+        double expected = 16384 * sin(2 * M_PI * 1000 * t / rate);
+        error += (dest[2 * i] - expected) * (dest[2 * i] - expected);
+        power += expected * expected;
+    }
+    /* The best of a few timed runs */
+    int repeats = 50000000 / out + 1;
+    unsigned int best = 0xFFFFFFFF;
+    for (int run_index = 0; run_index < 3; run_index++) {
+        unsigned int start = sceKernelGetSystemTimeLow();
+        for (int i = 0; i < repeats; i++) run(dest, src, frames, step, &delay);
+        unsigned int elapsed = sceKernelGetSystemTimeLow() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    printf("    %-20s %6.2f ns/frame %8.1f dB THD+N\n", name, best * 1000.0 / ((double)repeats * out),
+           10 * log10(error / power));
+    free(source);
+    free(dest);
+}
+
+/* The linear resampler against the nearest frame picking it replaced and a
+ * 4-tap cubic, for a rate conversion and a play speed */
+static void bench_resampler(void) {
+    static const struct {
+        const char *name;
+        int rate;
+        unsigned int step;
+    } cases[] = {
+        {"22050Hz to 44100Hz", 22050, 0x8000},
+        {"play speed 1.5", 44100, 0x18000},
+    };
+    for (int i = 0; i < 2; i++) {
+        printf("  %s, 1kHz sine\n", cases[i].name);
+        measure_resampler("nearest (old loop)", resample_nearest, cases[i].rate, cases[i].step);
+        measure_resampler("linear", resample_linear, cases[i].rate, cases[i].step);
+        measure_resampler("4-tap cubic", resample_cubic, cases[i].rate, cases[i].step);
+    }
+}
+
+/* The path GetProcessedBuffer() had: the fetch applied amp in float into a
+ * buffer allocated for the call, then GetBufferSpeedEffect() took a pass of
+ * its own. Volume and pan were left to sceAudioOutputPanned(). */
+static void old_process(short *dest, const short *source, int length, float speed, int mix, float amp) {
+    if (speed == 1.0f && !mix) {
+        for (int i = 0; i < 2 * length; i++) dest[i] = source[i] * amp;
+        return;
+    }
+    int frames = (int)(length * speed);
+    short *temp = malloc(frames * 2 * sizeof(short));
+    for (int i = 0; i < 2 * frames; i++) temp[i] = source[i] * amp;
+    for (int i = 0; i < length; i++) {
+        if (mix) {
+            dest[2 * i] = (temp[2 * (int)(i * speed)] + temp[2 * (int)(i * speed) + 1]) / 2;
+            dest[2 * i + 1] = dest[2 * i];
+        }
+        else {
+            dest[2 * i] = temp[2 * (int)(i * speed)];
+            dest[2 * i + 1] = temp[2 * (int)(i * speed) + 1];
+        }
+    }
+    free(temp);
+}
+
+/* The path now: the fetch only copies the frames, and the compiled chain
+ * resamples, mixes down, gains and pans them in one pass */
+static void fused_process(short *dest, const short *source, short *work, AalibDspChain *chain, int length, float speed,
+                          int mix, float gain_left, float gain_right) {
+    CompileDspChain(chain, speed != 1.0f, (unsigned int)(speed * 65536.0f), mix, gain_left, gain_right, FALSE, length);
+    short *src = work + 2 * PSPAALIB_RESAMPLER_HISTORY;
+    memcpy(src, source, GetDspChainFrames(chain, length) * 2 * sizeof(short));
+    chain->kernel(dest, src, length, chain);
+}
+
+/* Cost per output frame of the fused chain against the old passes, for the
+ * effects a channel can have on. The old path's volume cost nothing on the
+ * CPU, the fused one pays for it. */
+static void bench_chain(void) {
+    static const struct {
+        const char *name;
+        float speed;
+        int mix;
+    } cases[] = {
+        {"gain and pan", 1.0f, 0},
+        {"mixdown", 1.0f, 1},
+        {"speed 1.5", 1.5f, 0},
+        {"speed 1.5, mixdown", 1.5f, 1},
+    };
+    int length = 1024, buffers = 20000;
+    pcm_data pcm;
+    make_pcm(&pcm, 2 * length, 2, SAMPLE_RATE, 16, 20000, 3);
+    short *source = pcm.samples;
+    short *work = malloc(2 * (2 * length + PSPAALIB_RESAMPLER_HISTORY) * sizeof(short));
+    short *dest = malloc(2 * length * sizeof(short));
+    printf("  effects                old passes   fused chain   (ns/frame)\n");
+    for (int i = 0; i < 4; i++) {
+        unsigned int best_old = 0xFFFFFFFF, best_fused = 0xFFFFFFFF;
+        for (int run = 0; run < 3; run++) {
+            AalibDspChain chain;
+            AalibResampler resampler;
+            memset(&chain, 0, sizeof(chain));
+            ResetResampler(&resampler);
+            chain.resampler = &resampler;
+            unsigned int start = sceKernelGetSystemTimeLow();
+            for (int j = 0; j < buffers; j++) old_process(dest, source, length, cases[i].speed, cases[i].mix, 0.8f);
+            unsigned int middle = sceKernelGetSystemTimeLow();
+            for (int j = 0; j < buffers; j++) fused_process(dest, source, work, &chain, length, cases[i].speed, cases[i].mix, 0.4f, 0.8f);
+            unsigned int end = sceKernelGetSystemTimeLow();
+            if (middle - start < best_old) best_old = middle - start;
+            if (end - middle < best_fused) best_fused = end - middle;
+        }
+        printf("  %-20s %10.2f %13.2f\n", cases[i].name, best_old * 1000.0 / ((double)buffers * length),
+               best_fused * 1000.0 / ((double)buffers * length));
+    }
+    free_pcm(&pcm);
+    free(work);
+    free(dest);
+}
+
+/* CPU time all the threads of the process have used, in microseconds */
+static double cpu_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+/* Frames all the simulated hardware channels have written */
+static unsigned int frames_output(void) {
+    unsigned int frames = 0;
+    for (int i = 0; i < PSP_AUDIO_CHANNEL_MAX; i++) frames += AalibHostGetFramesOutput(i);
+    return frames;
+}
+
+/* What the software mixer costs per voice: N looping WAV voices from RAM are
+ * mixed with no clock to wait for, and the CPU time a second of mixed output
+ * takes is split between them. The last column is what each voice added
+ * since the row before costs. */
+static void bench_mixer(void) {
+    static const int counts[] = {1, 2, 4, 8, 16, 32};
+    pcm_data pcm;
+    make_pcm(&pcm, 2 * SAMPLE_RATE, 2, SAMPLE_RATE, 16, 20000, 4);
+    if (!write_wav("bench_mix.wav", &pcm, 0, 0)) return;
+    free_pcm(&pcm);
+    if (AalibSetMixerMode(TRUE) != 0) {
+        printf("  can't turn the mixer on\n");
+        return;
+    }
+    AalibHostSetClock(0);
+    float last_cost = 0;
+    int last_voices = 0;
+    printf("  voices   us per second of audio   per voice   per added voice\n");
+    for (int i = 0; i < 6; i++) {
+        int voices = counts[i];
+        for (int j = 0; j < voices; j++) {
+            int channel = PSPAALIB_CHANNEL_WAV_1 + j;
+            AalibStreamInfo info;
+            if (AalibLoad("bench_mix.wav", channel, 1) != 0) {
+                printf("  can't load bench_mix.wav\n");
+                voices = j;
+                break;
+            }
+            do {
+                sceKernelDelayThread(1000);
+                AalibGetStreamInfo(channel, &info);
+            } while (info.bufferFill < info.bufferSize);
+            AalibSetAutoloop(channel, 1);
+            AalibSetVolume(channel, (AalibVolume){0.5f, 0.25f});
+            AalibEnable(channel, PSPAALIB_EFFECT_VOLUME_MANUAL);
+        }
+        AalibHostSetSink(NULL);
+        for (int j = 0; j < voices; j++) AalibPlay(PSPAALIB_CHANNEL_WAV_1 + j);
+        sceKernelDelayThread(100000);
+        double start = cpu_time();
+        unsigned int first = frames_output();
+        sceKernelDelayThread(1000000);
+        double elapsed = cpu_time() - start;
+        unsigned int frames = frames_output() - first;
+        for (int j = 0; j < voices; j++) AalibUnload(PSPAALIB_CHANNEL_WAV_1 + j);
+        if (!voices || !frames) continue;
+        float cost = elapsed * SAMPLE_RATE / frames;
+        printf("  %6d %24.1f %11.1f %17.1f\n", voices, cost, cost / voices, (cost - last_cost) / (voices - last_voices));
+        last_cost = cost;
+        last_voices = voices;
+    }
+    AalibSetMixerMode(FALSE);
+    remove("bench_mix.wav");
+}
+
+/* The spatial functions pspaalibeffects.c had, in double precision with
+ * trigonometry, one channel at a time */
+static float old_vector_angle(ScePspFVector2 v) {
+    if (v.x == 0) v.x = 0.000001;
+    return (v.x > 0) ? atan(v.y / v.x) : atan(v.y / v.x) + PI;
+}
+
+static float old_vector_length(ScePspFVector2 v) {
+    return sqrt(pow(v.x, 2) + pow(v.y, 2));
+}
+
+static float old_clipped_angle(float angle, float clip) {
+    while (angle > clip) angle -= 2 * clip;
+    while (angle < -clip) angle += 2 * clip;
+    return angle;
+}
+
+static void old_rotate_vector(ScePspFVector2 *v, float angle) {
+    float length = old_vector_length(*v), vector_angle = old_vector_angle(*v);
+    v->x = length * cos(vector_angle + angle);
+    v->y = length * sin(vector_angle + angle);
+}
+
+static void old_spatial_voice(AalibSpatialVoice *voice) {
+    ScePspFVector2 rel = voice->position, to_observer = {-rel.x, -rel.y};
+    ScePspFVector2 source_velocity = voice->velocity, observer_velocity = voice->observerVelocity;
+    float pad = sin(old_clipped_angle(old_vector_angle(rel) - old_vector_angle(voice->front), PI));
+    voice->volume.right = (pad > 0) ? MAXA(0, 1 - pad) : 1.0f;
+    voice->volume.left = (pad < 0) ? MAXA(0, 1 + pad) : 1.0f;
+    voice->strength = MINA(1, sqrt(1 / old_vector_length(rel)));
+    float angle = old_vector_angle(to_observer);
+    old_rotate_vector(&observer_velocity, -angle);
+    old_rotate_vector(&source_velocity, -angle);
+    voice->playSpeed = (340 - observer_velocity.x) / (340 - source_velocity.x);
+}
+
+/* Largest jump between neighbouring frames of a chain's output for a DC
+ * input whose gain goes from 0.2 to 1.0 between two buffers. With ramp off
+ * the chain is restarted for the second buffer, the way the gain used to
+ * change at once. */
+static int gain_step_jump(int ramp) {
+    static short work[2 * (1024 + PSPAALIB_RESAMPLER_HISTORY)], out[2 * 2 * 1024];
+    short *src = work + 2 * PSPAALIB_RESAMPLER_HISTORY;
+    AalibDspChain chain;
+    AalibResampler resampler;
+    memset(&chain, 0, sizeof(chain));
+    ResetResampler(&resampler);
+    chain.resampler = &resampler;
+    for (int i = 0; i < 2 * 1024; i++) src[i] = 16384;
+    for (int buffer = 0; buffer < 2; buffer++) {
+        if (buffer && !ramp) chain.primed = FALSE;
+        CompileDspChain(&chain, FALSE, 1 << 16, FALSE, buffer ? 1.0f : 0.2f, buffer ? 1.0f : 0.2f, FALSE, 1024);
+        if (chain.kernel) chain.kernel(out + 2 * 1024 * buffer, src, 1024, &chain);
+        else for (int i = 0; i < 2 * 1024; i++) out[2 * 1024 * buffer + i] = src[i] * (buffer ? 1.0f : 0.2f);
+    }
+    int jump = 0;
+    for (int i = 1; i < 2 * 1024; i++) jump = MAXA(jump, abs(out[2 * i] - out[2 * i - 2]));
+    return jump;
+}
+
+/* UpdateSpatialVoices() against the old functions, in nanoseconds per voice,
+ * how far apart their results are, and what the ramps do to a gain step */
+static void bench_spatial(void) {
+    enum { VOICES = 32, PASSES = 100000 };
+    static AalibSpatialVoice voices[VOICES], old_voices[VOICES];
+    unsigned int seed = 5;
+    for (int i = 0; i < VOICES; i++) {
+        float values[8];
+        for (int j = 0; j < 8; j++) {
+            seed = seed * 1103515245 + 12345;
+            values[j] = (float)((seed >> 8) % 2001) / 10.0f - 100.0f;
+        }
+        voices[i].position = (ScePspFVector2){values[0], values[1]};
+        voices[i].velocity = (ScePspFVector2){values[2] / 4, values[3] / 4};
+        voices[i].observerVelocity = (ScePspFVector2){values[4] / 4, values[5] / 4};
+        voices[i].front = (ScePspFVector2){values[6], values[7]};
+        old_voices[i] = voices[i];
+    }
+    unsigned int start = sceKernelGetSystemTimeLow();
+    for (int pass = 0; pass < PASSES; pass++) UpdateSpatialVoices(voices, VOICES);
+    unsigned int middle = sceKernelGetSystemTimeLow();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (int i = 0; i < VOICES; i++) old_spatial_voice(&old_voices[i]);
+    }
+    unsigned int end = sceKernelGetSystemTimeLow();
+    float difference = 0;
+    for (int i = 0; i < VOICES; i++) {
+        difference = MAXA(difference, fabsf(voices[i].volume.left - old_voices[i].volume.left));
+        difference = MAXA(difference, fabsf(voices[i].volume.right - old_voices[i].volume.right));
+        difference = MAXA(difference, fabsf(voices[i].strength - old_voices[i].strength));
+        difference = MAXA(difference, fabsf(voices[i].playSpeed - old_voices[i].playSpeed));
+    }
+    printf("  batch update     %7.1f ns per voice\n", (middle - start) * 1000.0 / ((double)PASSES * VOICES));
+    printf("  old functions    %7.1f ns per voice\n", (end - middle) * 1000.0 / ((double)PASSES * VOICES));
+    printf("  largest difference in volume, strength or speed: %g\n", difference);
+    printf("  gain 0.2 to 1.0 on DC, largest jump between frames: %d ramped, %d stepped\n", gain_step_jump(1),
+           gain_step_jump(0));
+}
+
+/* Wakeups of the library's threads and CPU time per second over a second of
+ * the channel's current state */
+static void measure_wakeups(const char *state) {
+    unsigned int wakeups = AalibHostGetWakeups(), start = sceKernelGetSystemTimeLow();
+    double cpu = cpu_time();
+    sceKernelDelayThread(1000000);
+    float seconds = (sceKernelGetSystemTimeLow() - start) / 1000000.0f;
+    printf("    %-8s %8.0f wakeups/s %10.0f us CPU/s\n", state, (AalibHostGetWakeups() - wakeups) / seconds,
+           (cpu_time() - cpu) / seconds);
+}
+
+/* How often the threads wake up and how much CPU they take for a streamed
+ * WAV channel playing in real time and paused, with its own thread and
+ * through the mixer. The old play thread polled every 100 us, up to 10000
+ * wakeups a second for each channel. */
+static void bench_wakeups(void) {
+    int channel = PSPAALIB_CHANNEL_WAV_1;
+    pcm_data pcm;
+    make_pcm(&pcm, 10 * SAMPLE_RATE, 2, SAMPLE_RATE, 16, 20000, 6);
+    if (!write_wav("bench_wakeups.wav", &pcm, 0, 0)) return;
+    free_pcm(&pcm);
+    AalibHostSetClock(1);
+    AalibHostSetSink(NULL);
+    for (int mixer = 0; mixer < 2; mixer++) {
+        if (AalibSetMixerMode(mixer) != 0 || AalibLoad("bench_wakeups.wav", channel, 0) != 0) {
+            printf("  can't load bench_wakeups.wav\n");
+            break;
+        }
+        AalibSetAutoloop(channel, 1);
+        printf("  %s\n", mixer ? "mixer" : "own thread");
+        AalibPlay(channel);
+        sceKernelDelayThread(200000);
+        measure_wakeups("playing");
+        AalibPause(channel);
+        sceKernelDelayThread(200000);
+        measure_wakeups("paused");
+        AalibUnload(channel);
+    }
+    AalibSetMixerMode(FALSE);
+    remove("bench_wakeups.wav");
+}
+
+/* Tremor reading straight from a file, for the reference decode */
+static size_t read_ogg(void *ptr, size_t size, size_t count, void *source) {
+    return fread(ptr, size, count, (FILE *)source);
+}
+
+static int seek_ogg(void *source, ogg_int64_t offset, int whence) {
+    return fseek((FILE *)source, (long)offset, whence);
+}
+
+static int close_ogg(void *source) {
+    return fclose((FILE *)source);
+}
+
+static long tell_ogg(void *source) {
+    return ftell((FILE *)source);
+}
+
+/* The file decoded with Tremor alone, as 16 bit stereo the way the library
+ * plays it: a mono file on both sides. Returns NULL if it can't be read. */
+static short *decode_ogg(const char *path, int *frames, int *rate) {
+    OggVorbis_File vf;
+    ov_callbacks callbacks = {read_ogg, seek_ogg, close_ogg, tell_ogg};
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    if (ov_open_callbacks(f, &vf, NULL, 0, callbacks) < 0) {
+        fclose(f);
+        return NULL;
+    }
+    int capacity = 1 << 16, bitstream;
+    short *out = malloc(capacity * 2 * sizeof(short)), pcm[4096];
+    long got;
+    *frames = 0;
+    *rate = ov_info(&vf, -1)->rate;
+    while ((got = ov_read(&vf, (char *)pcm, sizeof(pcm), &bitstream)) != 0) {
+        if (got < 0) continue;
+        int channels = ov_info(&vf, -1)->channels, count = (int)(got / (channels * sizeof(short)));
+        if (*frames + count > capacity) {
+            capacity *= 2;
+            out = realloc(out, capacity * 2 * sizeof(short));
+        }
+        for (int i = 0; i < count; i++) {
+            out[2 * (*frames + i)] = pcm[i * channels];
+            out[2 * (*frames + i) + 1] = pcm[i * channels + ((channels > 1) ? 1 : 0)];
+        }
+        *frames += count;
+    }
+    ov_clear(&vf);
+    return out;
+}
+
+/* Plays the file to the end on an Ogg channel as fast as the decoder goes.
+ * Returns the microseconds it took, or 0 if it can't be loaded. */
+static unsigned int play_ogg(const char *path, AalibStreamInfo *info, int *frames) {
+    int channel = PSPAALIB_CHANNEL_OGG_1;
+    int result = AalibLoad((char *)path, channel, 0);
+    if (result != 0) {
+        printf("  can't load %s: %d\n", path, result);
+        return 0;
+    }
+    AalibHostSetClock(0);
+    unsigned int start = sceKernelGetSystemTimeLow();
+    AalibPlay(channel);
+    while (AalibGetStatus(channel) != PSPAALIB_STATUS_STOPPED) {
+        AalibGetStreamInfo(channel, info);
+        sceKernelDelayThread(1000);
+    }
+    unsigned int elapsed = sceKernelGetSystemTimeLow() - start;
+    AalibPlaybackPosition position;
+    AalibGetPlaybackPosition(channel, &position);
+    AalibUnload(channel);
+    *frames = position.samplesPlayed;
+    return (elapsed) ? elapsed : 1;
+}
+
+/* What came out of the one hardware channel that played, compared with the
+ * reference decode. Returns the frames which differ, or -1 if the output is
+ * missing or short. */
+static int check_ogg_output(const short *expect, int frames) {
+    char path[64];
+    for (int i = 0; i < PSP_AUDIO_CHANNEL_MAX; i++) {
+        if (!AalibHostGetFramesOutput(i)) continue;
+        snprintf(path, sizeof(path), "bench_ogg%d.raw", i);
+        FILE *f = fopen(path, "rb");
+        if (!f) return -1;
+        short *out = malloc(frames * 2 * sizeof(short));
+        int got = (int)fread(out, 2 * sizeof(short), frames, f), bad = 0;
+        fclose(f);
+        for (int j = 0; j < got; j++) {
+            if (out[2 * j] != expect[2 * j] || out[2 * j + 1] != expect[2 * j + 1]) bad++;
+        }
+        free(out);
+        return (got < frames) ? -1 : bad;
+    }
+    return -1;
+}
+
+/* Plays each Ogg Vorbis file given to the end as fast as the decoder goes and
+ * reports what AalibGetStreamInfo() says decoding a second of audio cost.
+ * A 44100Hz file is then played again into a sink and checked frame by
+ * frame against Tremor decoding it alone, which is worth doing with a mono
+ * and a stereo file: a mono file decodes twice the frames per read. */
+static void bench_ogg(void) {
+    if (!ogg_count) {
+        printf("  no file given with --ogg, skipped\n");
+        return;
+    }
+    for (int i = 0; i < ogg_count; i++) {
+        AalibStreamInfo info;
+        int frames, rate;
+        memset(&info, 0, sizeof(info));
+        AalibHostSetSink(NULL);
+        unsigned int elapsed = play_ogg(ogg_paths[i], &info, &frames);
+        if (!elapsed) continue;
+        float seconds = (float)frames / SAMPLE_RATE;
+        printf("  %s: %.1f s of audio in %.1f ms, %.0fx real time\n", ogg_paths[i], seconds, elapsed / 1000.0f,
+               seconds * 1000000 / elapsed);
+        printf("  decoding: %d us per second of audio (%.2f%% of one core)\n", info.decodeCost, info.decodeCost / 10000.0f);
+        short *expect = decode_ogg(ogg_paths[i], &frames, &rate);
+        if (!expect || rate != SAMPLE_RATE) {
+            printf("  output not checked, %s\n", expect ? "the file is resampled" : "Tremor can't open the file");
+            free(expect);
+            continue;
+        }
+        AalibHostSetSink("bench_ogg%d.raw");
+        play_ogg(ogg_paths[i], &info, &rate);
+        int bad = check_ogg_output(expect, frames);
+        AalibHostSetSink(NULL);
+        for (int j = 0; j < PSP_AUDIO_CHANNEL_MAX; j++) {
+            char path[64];
+            snprintf(path, sizeof(path), "bench_ogg%d.raw", j);
+            remove(path);
+        }
+        if (bad < 0) printf("  output: short of the %d frames Tremor decodes\n", frames);
+        else if (bad) printf("  output: %d of %d frames differ from Tremor's own decode\n", bad, frames);
+        else printf("  output: all %d frames match Tremor's own decode\n", frames);
+        free(expect);
+    }
+}
+
+static const benchmark benchmarks[] = {
+    {"ogg", bench_ogg},
+    {"wav", bench_wav},
+    {"adpcm", bench_adpcm},
+    {"resampler", bench_resampler},
+    {"chain", bench_chain},
+    {"mixer", bench_mixer},
+    {"spatial", bench_spatial},
+    {"wakeups", bench_wakeups},
+};
+
+static void usage(void) {
+    printf("usage: hostbench [--ogg FILE]... [NAME...]\n");
+    printf("  runs the named benchmarks, or all of them:");
+    for (int i = 0; i < (int)(sizeof(benchmarks) / sizeof(benchmarks[0])); i++) printf(" %s", benchmarks[i].name);
+    printf("\n  --ogg FILE  an Ogg Vorbis file the ogg benchmark decodes, can be given up to %d times\n", MAX_OGG_FILES);
+}
+
+int main(int argc, char **argv) {
+    int count = sizeof(benchmarks) / sizeof(benchmarks[0]), run = 0, named = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ogg") == 0 && i + 1 < argc && ogg_count < MAX_OGG_FILES) ogg_paths[ogg_count++] = argv[++i];
+        else if (argv[i][0] == '-') {
+            usage();
+            return 1;
+        }
+        else named++;
+    }
+    int result = AalibInit();
+    if (result != 0) {
+        printf("AalibInit failed: %d\n", result);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        int selected = !named;
+        for (int j = 1; j < argc; j++) {
+            if (strcmp(argv[j], benchmarks[i].name) == 0) selected = 1;
+        }
+        if (!selected) continue;
+        printf("%s\n", benchmarks[i].name);
+        benchmarks[i].run();
+        run++;
+    }
+    if (!run) {
+        usage();
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,1111 @@
+/* Plays generated WAV files through the host build of the audio library and
+ * checks what comes out of the simulated hardware: the samples written to
+ * the sink and how many frames went out when. Built with AddressSanitizer
+ * and run by "make -f Makefile.host check"; the names of single tests can
+ * be given on the command line. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pspaalib.h"
+#include "pspaalibio.h"
+#include "hostwav.h"
+
+#define SAMPLE_RATE 44100
+#define HARDWARE_CHANNELS 8
+#define SINK_PATTERN "check_out%d.raw"
+/* A stream which should have stopped by then is reported as stuck */
+#define STOP_TIMEOUT 20000000
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            printf("  FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            failures++; \
+        } \
+    } while (0)
+
+/* What one simulated hardware channel wrote, 16 bit stereo */
+typedef struct {
+    short *samples;
+    int frames;
+    int hardware_channel;
+} capture;
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} test_case;
+
+/* Frame i of the file as the library plays it at its own rate: stereo, 16
+ * bit, silence past the end */
+static short source_sample(const pcm_data *pcm, int frame, int side) {
+    if (frame < 0 || frame >= pcm->frames) return 0;
+    return pcm->samples[frame * pcm->channels + ((pcm->channels > 1) ? side : 0)];
+}
+
+/* The library's linear resampler: 16.16 steps, a 15 bit fraction and two
+ * frames of silence in front of the source, which are the history it starts
+ * with. Returns count stereo frames. */
+static short *resample_reference(const short *src, int frames, unsigned int step, int count) {
+    short *out = malloc(sizeof(short) * 2 * count);
+    unsigned long long position = 0;
+    for (int i = 0; i < count; i++, position += step) {
+        int index = (int)(position >> 16) - 2;
+        int frac = (int)(position & 0xFFFF) >> 1;
+        for (int side = 0; side < 2; side++) {
+            int a = (index >= 0 && index < frames) ? src[2 * index + side] : 0;
+            int b = (index + 1 >= 0 && index + 1 < frames) ? src[2 * (index + 1) + side] : 0;
+            out[2 * i + side] = a + (((b - a) * frac) >> 15);
+        }
+    }
+    return out;
+}
+
+/* The file converted to 44100Hz stereo the way the WAV codec does it */
+static short *play_reference(const pcm_data *pcm, int count) {
+    short *stereo = malloc(sizeof(short) * 2 * (pcm->frames + 1));
+    for (int i = 0; i < pcm->frames; i++) {
+        stereo[2 * i] = source_sample(pcm, i, 0);
+        stereo[2 * i + 1] = source_sample(pcm, i, 1);
+    }
+    if (pcm->rate == SAMPLE_RATE) {
+        short *out = calloc(2 * count, sizeof(short));
+        memcpy(out, stereo, sizeof(short) * 2 * ((count < pcm->frames) ? count : pcm->frames));
+        free(stereo);
+        return out;
+    }
+    short *out = resample_reference(stereo, pcm->frames, (unsigned int)(((unsigned long long)pcm->rate << 16) / SAMPLE_RATE), count);
+    free(stereo);
+    return out;
+}
+
+/* Playback */
+
+static int mixer_mode = 0;
+
+static void set_mixer_mode(int enable) {
+    CHECK(AalibSetMixerMode(enable) == 0, "mixer mode %d", enable);
+    mixer_mode = enable;
+}
+
+static void begin_capture(float clock) {
+    AalibHostSetClock(clock);
+    CHECK(AalibHostSetSink(SINK_PATTERN) == 0, "can't create the sink files");
+}
+
+static int wait_stopped(int channel) {
+    unsigned int start = sceKernelGetSystemTimeLow();
+    while (AalibGetStatus(channel) != PSPAALIB_STATUS_STOPPED) {
+        if (sceKernelGetSystemTimeLow() - start > STOP_TIMEOUT) {
+            CHECK(0, "channel %d did not stop", channel);
+            return 0;
+        }
+        sceKernelDelayThread(1000);
+    }
+    return 1;
+}
+
+/* Frames all the simulated hardware channels have taken */
+static unsigned int frames_output(void) {
+    unsigned int frames = 0;
+    for (int i = 0; i < HARDWARE_CHANNELS; i++) frames += AalibHostGetFramesOutput(i);
+    return frames;
+}
+
+static short *read_file(const char *path, int *frames) {
+    FILE *f = fopen(path, "rb");
+    *frames = 0;
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    short *samples = malloc(size + 4);
+    *frames = (int)(fread(samples, 1, size, f) / 4);
+    fclose(f);
+    return samples;
+}
+
+/* Unloads the channels once they have stopped and collects the output. The
+ * play thread or the mixer is waited for first, so the last buffer is in the
+ * file. Exactly one hardware channel should have been used. */
+static void end_capture(const int *channels, int count, capture *out) {
+    char path[64];
+    unsigned int frames[HARDWARE_CHANNELS];
+    for (int i = 0; i < count; i++) wait_stopped(channels[i]);
+    for (int i = 0; i < count; i++) AalibUnload(channels[i]);
+    if (mixer_mode) {
+        set_mixer_mode(0);
+        set_mixer_mode(1);
+    }
+    for (int i = 0; i < HARDWARE_CHANNELS; i++) frames[i] = AalibHostGetFramesOutput(i);
+    AalibHostSetSink(NULL);
+
+    out->samples = NULL;
+    out->frames = 0;
+    out->hardware_channel = -1;
+    for (int i = 0; i < HARDWARE_CHANNELS; i++) {
+        int length;
+        snprintf(path, sizeof(path), SINK_PATTERN, i);
+        short *samples = read_file(path, &length);
+        remove(path);
+        CHECK((unsigned int)length == frames[i], "hardware channel %d wrote %d frames but counted %u", i, length, frames[i]);
+        if (length == 0) {
+            free(samples);
+            continue;
+        }
+        CHECK(out->hardware_channel < 0, "output on hardware channels %d and %d", out->hardware_channel, i);
+        free(out->samples);
+        out->samples = samples;
+        out->frames = length;
+        out->hardware_channel = i;
+    }
+}
+
+static void free_capture(capture *out) {
+    free(out->samples);
+    out->samples = NULL;
+}
+
+/* Index of the first frame where the output differs from expect by more than
+ * tolerance, or -1 */
+static int compare(const short *out, const short *expect, int frames, int tolerance) {
+    for (int i = 0; i < 2 * frames; i++) {
+        if (abs(out[i] - expect[i]) > tolerance) return i / 2;
+    }
+    return -1;
+}
+
+static int is_silent(const short *out, int frames) {
+    for (int i = 0; i < 2 * frames; i++) {
+        if (out[i]) return 0;
+    }
+    return 1;
+}
+
+static int round_up(int frames, int length) {
+    return (frames + length - 1) / length * length;
+}
+
+/* Loads path, plays it to the end and checks the output against the file.
+ * Returns 0 if the file could not be played. */
+static int play_file(const char *path, const pcm_data *pcm, int channel, int ram, int length, capture *out) {
+    int result = AalibLoad((char *)path, channel, ram);
+    CHECK(result == 0, "load %s: %d", path, result);
+    if (result != 0) return 0;
+    if (mixer_mode) AalibSetBufferSize(PSPAALIB_CHANNEL_NONE, length);
+    else AalibSetBufferSize(channel, length);
+    begin_capture(0);
+    AalibPlay(channel);
+    end_capture(&channel, 1, out);
+    return 1;
+}
+
+static void check_file(const char *path, const pcm_data *pcm, int ram, int length) {
+    capture out;
+    if (!write_wav(path, pcm, 0, 0)) return;
+    if (!play_file(path, pcm, PSPAALIB_CHANNEL_WAV_1, ram, length, &out)) return;
+    int frames = (int)((long long)pcm->frames * SAMPLE_RATE / pcm->rate);
+    CHECK(out.frames >= frames && out.frames <= round_up(frames, length) + length,
+          "%s: %d frames out for %d", path, out.frames, frames);
+    short *expect = play_reference(pcm, out.frames);
+    int bad = compare(out.samples, expect, out.frames, 0);
+    CHECK(bad < 0, "%s %s, %d frame buffers: differs at frame %d of %d", path, ram ? "in RAM" : "streamed", length, bad, out.frames);
+    free(expect);
+    free_capture(&out);
+    remove(path);
+}
+
+/* Tests */
+
+/* Every sample format at 44100Hz,streamed and at two buffer sizes */
+static void test_streamed(void) {
+    static const int formats[][2] = {{16, 2}, {16, 1}, {8, 2}, {8, 1}};
+    pcm_data pcm;
+    for (int i = 0; i < 4; i++) {
+        make_pcm(&pcm, 30001 + i * 777, formats[i][1], SAMPLE_RATE, formats[i][0], 20000, 10 + i);
+        check_file("check_streamed.wav", &pcm, 0, 1024);
+        check_file("check_streamed.wav", &pcm, 0, 320);
+        free_pcm(&pcm);
+    }
+}
+
+static void test_ram(void) {
+    static const int formats[][2] = {{16, 2}, {16, 1}, {8, 2}, {8, 1}};
+    pcm_data pcm;
+    for (int i = 0; i < 4; i++) {
+        make_pcm(&pcm, 40003 + i * 555, formats[i][1], SAMPLE_RATE, formats[i][0], 20000, 20 + i);
+        check_file("check_ram.wav", &pcm, 1, 1024);
+        check_file("check_ram.wav", &pcm, 1, 4096);
+        free_pcm(&pcm);
+    }
+}
+
+/* Two files mixed into one hardware channel. The second may start a few
+ * buffers after the first, whichever offset fits must fit exactly. */
+static void test_mixer(void) {
+    pcm_data a, b;
+    capture out;
+    int channels[2] = {PSPAALIB_CHANNEL_WAV_1, PSPAALIB_CHANNEL_WAV_2};
+    make_pcm(&a, 50000, 2, SAMPLE_RATE, 16, 20000, 30);
+    make_pcm(&b, 35000, 1, SAMPLE_RATE, 16, 20000, 31);
+    if (!write_wav("check_mix_a.wav", &a, 0, 0) || !write_wav("check_mix_b.wav", &b, 0, 0)) return;
+    set_mixer_mode(1);
+    AalibSetBufferSize(PSPAALIB_CHANNEL_NONE, 512);
+    CHECK(AalibLoad("check_mix_a.wav", channels[0], 0) == 0, "load a");
+    CHECK(AalibLoad("check_mix_b.wav", channels[1], 1) == 0, "load b");
+    begin_capture(0);
+    AalibPlay(channels[0]);
+    AalibPlay(channels[1]);
+    end_capture(channels, 2, &out);
+    set_mixer_mode(0);
+
+    short *ra = play_reference(&a, out.frames), *rb = play_reference(&b, out.frames);
+    short *expect = malloc(sizeof(short) * 2 * out.frames);
+    int matched = -1;
+    for (int offset = 0; offset < out.frames && matched < 0; offset += 512) {
+        for (int i = 0; i < 2 * out.frames; i++) {
+            int sum = ra[i] + ((i >= 2 * offset) ? rb[i - 2 * offset] : 0);
+            expect[i] = (sum > 32767) ? 32767 : ((sum < -32768) ? -32768 : sum);
+        }
+        if (compare(out.samples, expect, out.frames, 0) < 0) matched = offset;
+    }
+    CHECK(matched >= 0, "mixed output is not the saturated sum of the two files");
+    CHECK(out.frames == round_up(50000, 512) || (matched >= 0 && out.frames == round_up(matched + 35000, 512)),
+          "mixer wrote %d frames", out.frames);
+    free(expect);
+    free(ra);
+    free(rb);
+    free_capture(&out);
+    free_pcm(&a);
+    free_pcm(&b);
+    remove("check_mix_a.wav");
+    remove("check_mix_b.wav");
+}
+
+/* With autoloop on the whole file repeats, so the output has to be copies of
+ * it back to back, however the buffers fall */
+static void test_looped(void) {
+    pcm_data pcm;
+    capture out;
+    int channel = PSPAALIB_CHANNEL_WAV_1;
+    for (int ram = 0; ram < 2; ram++) {
+        make_pcm(&pcm, 3001, 2, SAMPLE_RATE, 16, 20000, 40 + ram);
+        if (!write_wav("check_loop.wav", &pcm, 0, 0)) return;
+        CHECK(AalibLoad("check_loop.wav", channel, ram) == 0, "load");
+        AalibSetBufferSize(channel, 1024);
+        AalibSetAutoloop(channel, 1);
+        begin_capture(4.0f);
+        AalibPlay(channel);
+        sceKernelDelayThread(50000);
+        AalibSetAutoloop(channel, 0);
+        end_capture(&channel, 1, &out);
+
+        /* Turning autoloop off lets the pass in progress play to the end */
+        int copies = out.frames / pcm.frames, bad = -1;
+        for (int i = 0; i < copies * pcm.frames && bad < 0; i++) {
+            int frame = i % pcm.frames;
+            if (out.samples[2 * i] != source_sample(&pcm, frame, 0) || out.samples[2 * i + 1] != source_sample(&pcm, frame, 1)) bad = i;
+        }
+        CHECK(copies >= 2, "only %d copies in %d frames", copies, out.frames);
+        CHECK(bad < 0, "%s loop differs at frame %d of %d", ram ? "RAM" : "streamed", bad, out.frames);
+        CHECK(is_silent(out.samples + 2 * copies * pcm.frames, out.frames - copies * pcm.frames), "%s loop did not end after a whole copy", ram ? "RAM" : "streamed");
+        free_capture(&out);
+        free_pcm(&pcm);
+    }
+    remove("check_loop.wav");
+}
+
+/* Plays a file with smpl loop points until it has looped a few times and
+ * turns autoloop off. The pass in progress then plays on to the end of the
+ * file, so the output has to be frames up to the loop end, copies of the loop
+ * back to back and the rest of the file, with nothing dropped or doubled
+ * where a wrap falls inside a buffer. decoded is the file played once through
+ * as stereo. */
+static void check_loop_points(const char *path, const short *decoded, int frames, int loop_start, int loop_end,
+                              int ram, int cache, int length) {
+    capture out;
+    int channel = PSPAALIB_CHANNEL_WAV_1, loop = loop_end - loop_start;
+    CHECK(AalibLoad((char *)path, channel, ram) == 0, "load %s", path);
+    if (cache) CHECK(AalibSetStreamCache(channel, cache) == 0, "cache");
+    AalibSetBufferSize(channel, length);
+    AalibSetAutoloop(channel, 1);
+    begin_capture(8.0f);
+    AalibPlay(channel);
+    AalibPlaybackPosition position;
+    unsigned int start = sceKernelGetSystemTimeLow();
+    do {
+        sceKernelDelayThread(10000);
+        AalibGetPlaybackPosition(channel, &position);
+    } while (position.samplesPlayed < loop_end + 2 * loop && sceKernelGetSystemTimeLow() - start < STOP_TIMEOUT);
+    AalibStreamInfo info;
+    AalibGetStreamInfo(channel, &info);
+    CHECK(!cache || info.cacheFill > 0, "%s: nothing cached", path);
+    AalibSetAutoloop(channel, 0);
+    end_capture(&channel, 1, &out);
+
+    int copies = (out.frames - frames) / loop, total = frames + copies * loop, bad = -1;
+    for (int i = 0; i < total && i < out.frames && bad < 0; i++) {
+        int frame = (i < loop_end) ? i : ((i < loop_end + copies * loop) ? loop_start + (i - loop_end) % loop : i - copies * loop);
+        if (out.samples[2 * i] != decoded[2 * frame] || out.samples[2 * i + 1] != decoded[2 * frame + 1]) bad = i;
+    }
+    CHECK(copies >= 2 && out.frames == round_up(total, length), "%s: %d frames out, %d copies of the loop", path, out.frames, copies);
+    CHECK(bad < 0, "%s %s, cache %d, %d frame buffers: differs at frame %d of %d", path, ram ? "in RAM" : "streamed", cache, length, bad, out.frames);
+    CHECK(is_silent(out.samples + 2 * total, out.frames - total), "%s: output goes on after the end of the file", path);
+    free_capture(&out);
+}
+
+/* Loops which start and end inside a buffer, at buffer sizes which aren't a
+ * power of two. ADPCM loops start and end inside a block as well. */
+static void test_loop_points(void) {
+    static const int lengths[] = {448, 1088};
+    static const int caches[] = {0, 4096, 1 << 20};
+    pcm_data pcm;
+    capture once;
+    make_pcm(&pcm, 12345, 2, SAMPLE_RATE, 16, 20000, 140);
+    for (int adpcm = 0; adpcm < 2; adpcm++) {
+        const char *path = adpcm ? "check_loop_points_adpcm.wav" : "check_loop_points.wav";
+        int loop_start = 1237, loop_end = 9001;
+        if (!(adpcm ? write_adpcm_wav(path, &pcm, 512, loop_start, loop_end, NULL) : write_wav(path, &pcm, loop_start, loop_end))) return;
+        if (!play_file(path, &pcm, PSPAALIB_CHANNEL_WAV_1, 0, 1024, &once)) return;
+        CHECK(once.frames == round_up(pcm.frames, 1024), "%s: %d frames played once", path, once.frames);
+        if (!adpcm) CHECK(compare(once.samples, pcm.samples, pcm.frames, 0) < 0, "%s: played once differs from the file", path);
+        for (int i = 0; i < 2; i++) {
+            check_loop_points(path, once.samples, pcm.frames, loop_start, loop_end, 1, 0, lengths[i]);
+            for (int c = 0; c < 3; c++) check_loop_points(path, once.samples, pcm.frames, loop_start, loop_end, 0, caches[c], lengths[i]);
+        }
+        free_capture(&once);
+        remove(path);
+    }
+    free_pcm(&pcm);
+}
+
+/* A seek before the start lands on the exact sample. One while playing takes
+ * effect on a buffer boundary and the rest of the file follows unbroken. */
+static void test_seeked(void) {
+    pcm_data pcm;
+    capture out;
+    int channel = PSPAALIB_CHANNEL_WAV_1, length = 1024, target = 12345;
+    make_pcm(&pcm, 60000, 2, SAMPLE_RATE, 16, 20000, 50);
+    if (!write_wav("check_seek.wav", &pcm, 0, 0)) return;
+    for (int ram = 0; ram < 2; ram++) {
+        CHECK(AalibLoad("check_seek.wav", channel, ram) == 0, "load");
+        CHECK(AalibSeekSample(channel, target) == 0, "seek");
+        begin_capture(0);
+        AalibPlay(channel);
+        end_capture(&channel, 1, &out);
+        CHECK(out.frames == round_up(pcm.frames - target, length), "%d frames after the seek", out.frames);
+        CHECK(compare(out.samples, pcm.samples + 2 * target, pcm.frames - target, 0) < 0, "%s seek did not land on sample %d", ram ? "RAM" : "streamed", target);
+        free_capture(&out);
+
+        CHECK(AalibLoad("check_seek.wav", channel, ram) == 0, "load");
+        CHECK(AalibSeekMs(channel, 250) == 0, "seek ms");
+        begin_capture(0);
+        AalibPlay(channel);
+        end_capture(&channel, 1, &out);
+        CHECK(compare(out.samples, pcm.samples + 2 * (SAMPLE_RATE / 4), pcm.frames - SAMPLE_RATE / 4, 0) < 0, "seek to 250 ms");
+        free_capture(&out);
+
+        CHECK(AalibLoad("check_seek.wav", channel, ram) == 0, "load");
+        AalibSetBufferSize(channel, length);
+        begin_capture(2.0f);
+        AalibPlay(channel);
+        sceKernelDelayThread(100000);
+        CHECK(AalibSeekSample(channel, target) == 0, "seek while playing");
+        end_capture(&channel, 1, &out);
+        int split = -1;
+        for (int at = length; at < out.frames && split < 0; at += length) {
+            if (compare(out.samples, pcm.samples, at, 0) >= 0) break;
+            if (at + pcm.frames - target <= out.frames && compare(out.samples + 2 * at, pcm.samples + 2 * target, pcm.frames - target, 0) < 0) split = at;
+        }
+        CHECK(split > 0, "%s seek while playing did not continue from sample %d", ram ? "RAM" : "streamed", target);
+        free_capture(&out);
+    }
+    free_pcm(&pcm);
+    remove("check_seek.wav");
+}
+
+/* Files at other rates go through the linear resampler */
+static void test_resampled(void) {
+    static const int rates[][2] = {{22050, 1}, {48000, 2}, {11025, 2}, {32000, 1}};
+    pcm_data pcm;
+    for (int i = 0; i < 4; i++) {
+        make_pcm(&pcm, 20000 + i * 999, rates[i][1], rates[i][0], 16, 20000, 60 + i);
+        check_file("check_rate.wav", &pcm, i & 1, 1024);
+        free_pcm(&pcm);
+    }
+}
+
+/* Three mono blocks of 17 frames, decoded by CPython's audioop.adpcm2lin(),
+ * which is an IMA-ADPCM decoder of its own, with the nibbles swapped into
+ * the order WAV files keep them in. They run into both ends of the sample
+ * range and of the step index. */
+static const unsigned char adpcm_vector[3][12] = {
+    {0xE8, 0x03, 0x14, 0x00, 0x77, 0x77, 0x77, 0x77, 0x03, 0xF8, 0xFF, 0xFF},
+    {0x00, 0x83, 0x3C, 0x00, 0xFF, 0x77, 0x77, 0x77, 0x91, 0xA2, 0xC4, 0x80},
+    {0x00, 0x7D, 0x58, 0x00, 0x77, 0x80, 0xD5, 0xE6, 0xB3, 0x91, 0x00, 0x00},
+};
+
+static const short adpcm_vector_decoded[3][17] = {
+    {1000, 1093, 1292, 1722, 2647, 4634, 8894, 18025, 32767, 32767, 32767, 30455, -1078, -32768, -32768, -32768, -32768},
+    {-32000, -32768, -32768, -13190, 28781, 32767, 32767, 32767, 32767, 32767, 21595, 32767, 17379, 32767, 2296, 6391, 2667},
+    {32000, 32767, 32767, 32767, 29043, 32767, -12286, 32767, -20478, 8191, -17878, -7722, -16954, -14156, -11613, -9301, -7199},
+};
+
+/* IMA-ADPCM files decode to the known vectors, and to what the encoder made
+ * of them when buffers split blocks, a seek lands inside a block and a loop
+ * starts and ends inside one */
+static void test_adpcm(void) {
+    static const int formats[][2] = {{2, 2048}, {1, 256}, {2, 520}, {1, 2048}};
+    pcm_data pcm, decoded;
+    capture out;
+    int channel = PSPAALIB_CHANNEL_WAV_1;
+    short expect[2 * 51];
+    for (int i = 0; i < 51; i++) expect[2 * i] = expect[2 * i + 1] = adpcm_vector_decoded[i / 17][i % 17];
+    if (!write_adpcm_data("check_adpcm.wav", adpcm_vector[0], sizeof(adpcm_vector), 51, 1, SAMPLE_RATE, 12, 0, 0)) return;
+    for (int ram = 0; ram < 2; ram++) {
+        if (!play_file("check_adpcm.wav", NULL, channel, ram, 256, &out)) return;
+        int bad = compare(out.samples, expect, 51, 0);
+        CHECK(out.frames == 256 && bad < 0 && is_silent(out.samples + 2 * 51, out.frames - 51),
+              "%s known blocks: %d frames, differ at frame %d", ram ? "RAM" : "streamed", out.frames, bad);
+        free_capture(&out);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        int channels = formats[i][0], block_align = formats[i][1], loop_start = 777 + i, loop_end = 20001;
+        make_pcm(&pcm, 30001 + i * 333, channels, SAMPLE_RATE, 16, 20000, 150 + i);
+        decoded = pcm;
+        decoded.samples = malloc(sizeof(short) * pcm.frames * channels);
+        if (!write_adpcm_wav("check_adpcm.wav", &pcm, block_align, loop_start, loop_end, decoded.samples)) return;
+        short *reference = play_reference(&decoded, pcm.frames + PSPAALIB_MAX_BUFFER_LENGTH);
+        const char *mode = (i & 1) ? "RAM" : "streamed";
+
+        for (int length = 320; length <= 1088; length += 768) {
+            if (!play_file("check_adpcm.wav", NULL, channel, i & 1, length, &out)) break;
+            int bad = compare(out.samples, reference, out.frames, 0);
+            CHECK(out.frames == round_up(pcm.frames, length) && bad < 0, "%d channels, %d byte blocks %s, %d frame buffers: %d frames, differ at frame %d",
+                  channels, block_align, mode, length, out.frames, bad);
+            free_capture(&out);
+        }
+
+        int target = 12345 + i;
+        CHECK(AalibLoad("check_adpcm.wav", channel, i & 1) == 0, "load");
+        CHECK(AalibSeekSample(channel, target) == 0, "seek");
+        begin_capture(0);
+        AalibPlay(channel);
+        end_capture(&channel, 1, &out);
+        int bad = (out.frames >= pcm.frames - target) ? compare(out.samples, reference + 2 * target, pcm.frames - target, 0) : 0;
+        CHECK(out.frames >= pcm.frames - target && bad < 0, "%d channels, %d byte blocks %s: seek to %d differs at frame %d",
+              channels, block_align, mode, target, bad);
+        free_capture(&out);
+
+        check_loop_points("check_adpcm.wav", reference, pcm.frames, loop_start, loop_end, i & 1, 0, 448);
+        free(reference);
+        free_pcm(&decoded);
+        free_pcm(&pcm);
+    }
+    remove("check_adpcm.wav");
+}
+
+/* The play speed effect resamples the fetched frames once more */
+static void test_speed(void) {
+    static const float speeds[] = {2.0f, 1.5f, 0.75f, 3.0f};
+    pcm_data pcm;
+    capture out;
+    int channel = PSPAALIB_CHANNEL_WAV_1;
+    make_pcm(&pcm, 50000, 2, SAMPLE_RATE, 16, 20000, 70);
+    if (!write_wav("check_speed.wav", &pcm, 0, 0)) return;
+    for (int i = 0; i < 4; i++) {
+        CHECK(AalibLoad("check_speed.wav", channel, i & 1) == 0, "load");
+        AalibSetPlaySpeed(channel, speeds[i]);
+        AalibEnable(channel, PSPAALIB_EFFECT_PLAYSPEED);
+        begin_capture(0);
+        AalibPlay(channel);
+        end_capture(&channel, 1, &out);
+        int frames = (int)(pcm.frames / speeds[i]);
+        CHECK(out.frames >= frames && out.frames <= round_up(frames, 1024) + 1024, "speed %.2f: %d frames out for %d", speeds[i], out.frames, frames);
+        short *expect = resample_reference(pcm.samples, pcm.frames, (unsigned int)(speeds[i] * 65536.0f), out.frames);
+        int bad = compare(out.samples, expect, out.frames, 0);
+        CHECK(bad < 0, "speed %.2f differs at frame %d of %d", speeds[i], bad, out.frames);
+        free(expect);
+        free_capture(&out);
+    }
+    free_pcm(&pcm);
+    remove("check_speed.wav");
+}
+
+/* The largest buffer at the highest play speed fetches the most source
+ * frames a channel can ask for at once, more still for files above 44100Hz,
+ * which are resampled before the speed effect */
+static void test_max_speed(void) {
+    static const int formats[][3] = {{44100, 2, 16}, {48000, 2, 16}, {96000, 1, 16}, {48000, 1, 8}};
+    pcm_data pcm;
+    capture out;
+    int channel = PSPAALIB_CHANNEL_WAV_1;
+    for (int i = 0; i < 8; i++) {
+        const int *format = formats[i / 2];
+        make_pcm(&pcm, 200000, format[1], format[0], format[2], 20000, 90 + i);
+        if (!write_wav("check_max_speed.wav", &pcm, 0, 0)) return;
+        CHECK(AalibLoad("check_max_speed.wav", channel, i & 1) == 0, "load");
+        AalibSetBufferSize(channel, PSPAALIB_MAX_BUFFER_LENGTH);
+        AalibSetPlaySpeed(channel, PSPAALIB_MAX_PLAY_SPEED);
+        AalibEnable(channel, PSPAALIB_EFFECT_PLAYSPEED);
+        begin_capture(0);
+        AalibPlay(channel);
+        end_capture(&channel, 1, &out);
+        int native = (int)((long long)pcm.frames * SAMPLE_RATE / pcm.rate) + 4;
+        short *stage = play_reference(&pcm, native);
+        short *expect = resample_reference(stage, native, (unsigned int)(PSPAALIB_MAX_PLAY_SPEED * 65536.0f), out.frames);
+        int bad = compare(out.samples, expect, out.frames, 0);
+        CHECK(out.frames >= native / 4 - 4, "%dHz: %d frames out", pcm.rate, out.frames);
+        CHECK(bad < 0, "%dHz %s at max speed differs at frame %d of %d", pcm.rate, (i & 1) ? "in RAM" : "streamed", bad, out.frames);
+        free(stage);
+        free(expect);
+        free_capture(&out);
+        free_pcm(&pcm);
+    }
+    remove("check_max_speed.wav");
+}
+
+/* With the clock running the hardware takes frames at 44100Hz times the clock
+ * speed. It holds one buffer playing and one queued, so it may be up to two
+ * buffers ahead of the clock, and the library has to keep it from falling
+ * behind. The playback position has to agree. */
+static void test_timing(void) {
+    pcm_data pcm;
+    capture out;
+    int channel = PSPAALIB_CHANNEL_WAV_1, length = 1024;
+    float clock = 2.0f;
+    make_pcm(&pcm, SAMPLE_RATE, 2, SAMPLE_RATE, 16, 20000, 80);
+    if (!write_wav("check_timing.wav", &pcm, 0, 0)) return;
+    for (int mixer = 0; mixer < 2; mixer++) {
+        if (mixer) set_mixer_mode(1);
+        CHECK(AalibLoad("check_timing.wav", channel, 1) == 0, "load");
+        AalibSetBufferSize(mixer ? PSPAALIB_CHANNEL_NONE : channel, length);
+        begin_capture(clock);
+        unsigned int start = sceKernelGetSystemTimeLow();
+        AalibPlay(channel);
+        int late = 0, early = 0, samples = 0;
+        while (AalibGetStatus(channel) != PSPAALIB_STATUS_STOPPED) {
+            sceKernelDelayThread(20000);
+            double elapsed = (double)(sceKernelGetSystemTimeLow() - start) * SAMPLE_RATE * clock / 1000000;
+            unsigned int frames = frames_output();
+            AalibPlaybackPosition position;
+            AalibGetPlaybackPosition(channel, &position);
+            if (frames > elapsed + 3 * length) early++;
+            if (frames < elapsed - 2 * length && AalibGetStatus(channel) == PSPAALIB_STATUS_PLAYING) late++;
+            if (position.samplesPlayed > elapsed + length || position.samplesPlayed + 3 * length < elapsed) samples++;
+        }
+        unsigned int elapsed = sceKernelGetSystemTimeLow() - start;
+        end_capture(&channel, 1, &out);
+        unsigned int expect = (unsigned int)((double)round_up(pcm.frames, length) * 1000000 / SAMPLE_RATE / clock);
+        CHECK(!early && !late, "%s: hardware ran ahead %d and behind %d times", mixer ? "mixer" : "thread", early, late);
+        CHECK(!samples, "%s: playback position off %d times", mixer ? "mixer" : "thread", samples);
+        CHECK(elapsed + 3.0 * length * 1000000 / SAMPLE_RATE / clock >= expect && elapsed <= expect + 200000,
+              "%s: played in %u us, expected about %u", mixer ? "mixer" : "thread", elapsed, expect);
+        CHECK(out.frames == round_up(pcm.frames, length), "%s: %d frames out", mixer ? "mixer" : "thread", out.frames);
+        free_capture(&out);
+        if (mixer) set_mixer_mode(0);
+    }
+    free_pcm(&pcm);
+    remove("check_timing.wav");
+}
+
+/* Waits up to half a second for a command to reach the channel */
+static int wait_status(int channel, int status) {
+    unsigned int start = sceKernelGetSystemTimeLow();
+    while (AalibGetStatus(channel) != status) {
+        if (sceKernelGetSystemTimeLow() - start > 500000) return 0;
+        sceKernelDelayThread(1000);
+    }
+    return 1;
+}
+
+/* Lets the threads settle, then checks that over the next 200 ms none of
+ * them wakes up and nothing goes out */
+static void check_quiet(const char *mode, const char *state) {
+    sceKernelDelayThread(50000);
+    unsigned int wakeups = AalibHostGetWakeups(), frames = frames_output();
+    sceKernelDelayThread(200000);
+    wakeups = AalibHostGetWakeups() - wakeups;
+    frames = frames_output() - frames;
+    CHECK(!wakeups && !frames, "%s: %s channel woke threads %u times and output %u frames", mode, state, wakeups, frames);
+}
+
+/* Play, pause, resume, stop and unload: each reaches the status and the
+ * output, and a paused, stopped or unloaded channel costs no wakeups */
+static void test_states(void) {
+    pcm_data pcm;
+    int channel = PSPAALIB_CHANNEL_WAV_1;
+    make_pcm(&pcm, 5 * SAMPLE_RATE, 2, SAMPLE_RATE, 16, 20000, 150);
+    if (!write_wav("check_states.wav", &pcm, 0, 0)) return;
+    for (int mixer = 0; mixer < 2; mixer++) {
+        const char *mode = mixer ? "mixer" : "thread";
+        AalibStreamInfo info;
+        if (mixer) set_mixer_mode(1);
+        CHECK(AalibLoad("check_states.wav", channel, 1) == 0, "load");
+        do {
+            sceKernelDelayThread(1000);
+            AalibGetStreamInfo(channel, &info);
+        } while (info.bufferFill < info.bufferSize);
+        AalibSetBufferSize(mixer ? PSPAALIB_CHANNEL_NONE : channel, 1024);
+        AalibHostSetClock(4.0f);
+        AalibHostSetSink(NULL);
+        CHECK(AalibGetStatus(channel) == PSPAALIB_STATUS_STOPPED, "%s: loaded channel not stopped", mode);
+        check_quiet(mode, "loaded");
+
+        AalibPlay(channel);
+        CHECK(wait_status(channel, PSPAALIB_STATUS_PLAYING), "%s: not playing after AalibPlay()", mode);
+        unsigned int frames = frames_output();
+        sceKernelDelayThread(50000);
+        CHECK(frames_output() > frames, "%s: no output while playing", mode);
+
+        AalibPause(channel);
+        CHECK(wait_status(channel, PSPAALIB_STATUS_PAUSED), "%s: not paused after AalibPause()", mode);
+        check_quiet(mode, "paused");
+
+        AalibPause(channel);
+        CHECK(wait_status(channel, PSPAALIB_STATUS_PLAYING), "%s: not playing after the second AalibPause()", mode);
+        frames = frames_output();
+        sceKernelDelayThread(50000);
+        CHECK(frames_output() > frames, "%s: no output after resuming", mode);
+
+        AalibStop(channel);
+        CHECK(wait_status(channel, PSPAALIB_STATUS_STOPPED), "%s: not stopped after AalibStop()", mode);
+        check_quiet(mode, "stopped");
+
+        CHECK(AalibUnload(channel) == 0, "%s: unload", mode);
+        CHECK(AalibGetStatus(channel) == PSPAALIB_STATUS_STOPPED, "%s: unloaded channel not stopped", mode);
+        check_quiet(mode, "unloaded");
+        if (mixer) set_mixer_mode(0);
+    }
+    free_pcm(&pcm);
+    remove("check_states.wav");
+}
+
+/* Once playback has warmed up, nothing the audio threads do may allocate:
+ * not fetching, resampling, mixing, refilling streams or logging stats, nor
+ * seeking, pausing or changing parameters from outside */
+static void test_allocations(void) {
+    pcm_data pcm;
+    int channels[2] = {PSPAALIB_CHANNEL_WAV_1, PSPAALIB_CHANNEL_WAV_2};
+    AalibVolume volume = {0.5f, 0.75f};
+    make_pcm(&pcm, 100000, 2, 48000, 16, 20000, 100);
+    if (!write_wav("check_allocations.wav", &pcm, 0, 0)) return;
+    AalibEnableStats(1);
+    for (int mixer = 0; mixer < 2; mixer++) {
+        if (mixer) set_mixer_mode(1);
+        for (int i = 0; i < 2; i++) {
+            CHECK(AalibLoad("check_allocations.wav", channels[i], i) == 0, "load");
+            AalibSetAutoloop(channels[i], 1);
+            AalibSetPlaySpeed(channels[i], 1.5f);
+            AalibEnable(channels[i], PSPAALIB_EFFECT_PLAYSPEED);
+        }
+        AalibHostSetClock(4.0f);
+        for (int i = 0; i < 2; i++) AalibPlay(channels[i]);
+        sceKernelDelayThread(200000);
+        unsigned int before = AalibHostGetThreadAllocations();
+        for (int round = 0; round < 20; round++) {
+            int channel = channels[round & 1];
+            AalibSetVolume(channel, volume);
+            AalibSetPlaySpeed(channel, (round & 2) ? 0.75f : 2.0f);
+            if (round % 5 == 0) AalibSeekMs(channel, round * 50);
+            if (round % 7 == 0) {
+                AalibPause(channel);
+                sceKernelDelayThread(5000);
+                AalibPause(channel);
+            }
+            sceKernelDelayThread(20000);
+        }
+        unsigned int after = AalibHostGetThreadAllocations();
+        CHECK(after == before, "%s: %u allocations after warm-up", mixer ? "mixer" : "thread", after - before);
+        for (int i = 0; i < 2; i++) {
+            AalibStop(channels[i]);
+            AalibUnload(channels[i]);
+        }
+        if (mixer) set_mixer_mode(0);
+    }
+    AalibEnableStats(0);
+    free_pcm(&pcm);
+    remove("check_allocations.wav");
+}
+
+/* Pauses the channel and waits until the audio thread has taken it. Pausing
+ * again resumes. */
+static void pause_channel(int channel) {
+    AalibPause(channel);
+    while (AalibGetStatus(channel) == PSPAALIB_STATUS_PLAYING) sceKernelDelayThread(1000);
+    sceKernelDelayThread(10000);
+}
+
+/* A hardware channel which isn't waited on has nothing queued, so with the
+ * clock stopped every buffer but the first after a play or resume finds it
+ * dry. With the clock running the library keeps ahead and finds none. */
+static void test_underruns(void) {
+    pcm_data pcm;
+    AalibChannelStats stats;
+    AalibEngineStats engine;
+    int channel = PSPAALIB_CHANNEL_WAV_1;
+    make_pcm(&pcm, SAMPLE_RATE, 2, SAMPLE_RATE, 16, 20000, 110);
+    if (!write_wav("check_underruns.wav", &pcm, 0, 0)) return;
+    for (int mixer = 0; mixer < 2; mixer++) {
+        const char *mode = mixer ? "mixer" : "thread";
+        if (mixer) set_mixer_mode(1);
+        CHECK(AalibLoad("check_underruns.wav", channel, 1) == 0, "load");
+        /* Nothing may be missing for the fetches, the load runs in the background */
+        AalibStreamInfo info;
+        do {
+            sceKernelDelayThread(1000);
+            AalibGetStreamInfo(channel, &info);
+        } while (info.bufferFill < info.bufferSize);
+        AalibSetAutoloop(channel, 1);
+        AalibHostSetClock(0);
+        AalibEnableStats(1);
+        AalibPlay(channel);
+        sceKernelDelayThread(20000);
+        pause_channel(channel);
+        AalibGetChannelStats(channel, &stats);
+        CHECK(stats.buffers > 1 && stats.underruns == stats.buffers - 1, "%s: %u underruns in %u buffers", mode, stats.underruns, stats.buffers);
+        AalibPause(channel);
+        sceKernelDelayThread(20000);
+        pause_channel(channel);
+        AalibGetChannelStats(channel, &stats);
+        AalibGetEngineStats(&engine);
+        CHECK(stats.underruns == stats.buffers - 2, "%s: %u underruns in %u buffers after a resume", mode, stats.underruns, stats.buffers);
+        unsigned int hardware = 0;
+        for (int i = 0; i < HARDWARE_CHANNELS; i++) {
+            if (engine.hardwareUnderruns[i]) hardware++;
+        }
+        CHECK(engine.underruns == stats.underruns && hardware == 1, "%s: engine counted %u underruns on %u hardware channels",
+              mode, engine.underruns, hardware);
+        CHECK(stats.ioStarvation == 0, "%s: RAM channel starved %u times", mode, stats.ioStarvation);
+        AalibStop(channel);
+        wait_stopped(channel);
+
+        AalibResetStats();
+        AalibSetAutoloop(channel, 0);
+        AalibRewind(channel);
+        AalibHostSetClock(4.0f);
+        AalibPlay(channel);
+        wait_stopped(channel);
+        AalibGetChannelStats(channel, &stats);
+        CHECK(stats.buffers > 1 && stats.underruns == 0, "%s: %u underruns in %u buffers in real time", mode, stats.underruns, stats.buffers);
+        AalibEnableStats(0);
+        AalibUnload(channel);
+        if (mixer) set_mixer_mode(0);
+    }
+    free_pcm(&pcm);
+    remove("check_underruns.wav");
+}
+
+/* A streamed channel shares a slow card with an animation reading frames as
+ * fast as it can through the same scheduler: the audio reads go first, so
+ * the stream never starves and the hardware never runs dry. Like the player,
+ * the second pass turns autoloop on before playing and off again while it
+ * plays: neither may throw away the ring filled at load */
+static void test_contention(void) {
+    enum { FRAME_SIZE = 16 * 1024, FRAMES = 64 };
+    pcm_data pcm;
+    AalibChannelStats stats;
+    AalibStreamInfo info;
+    int channel = PSPAALIB_CHANNEL_WAV_1;
+    static char frame[FRAME_SIZE];
+    make_pcm(&pcm, 3 * SAMPLE_RATE, 2, SAMPLE_RATE, 16, 20000, 160);
+    if (!write_wav("check_contention.wav", &pcm, 0, 0)) return;
+    FILE *f = fopen("check_contention.dat", "wb");
+    if (!f) return;
+    for (int i = 0; i < FRAMES; i++) fwrite(frame, 1, FRAME_SIZE, f);
+    fclose(f);
+    SceUID animation = sceIoOpen("check_contention.dat", PSP_O_RDONLY, 0777);
+    CHECK(animation >= 0, "can't open the animation");
+    for (int pass = 0; pass < 4 && animation >= 0; pass++) {
+        int mixer = pass & 1, autoloop = pass >> 1;
+        const char *modes[] = {"thread", "mixer", "thread autoloop", "mixer autoloop"};
+        const char *mode = modes[pass];
+        if (mixer) set_mixer_mode(1);
+        CHECK(AalibLoad("check_contention.wav", channel, 0) == 0, "load");
+        if (autoloop) {
+            AalibSetAutoloop(channel, 1);
+            AalibGetStreamInfo(channel, &info);
+            CHECK(info.bufferFill == info.bufferSize, "%s: %d of %d bytes buffered", mode, info.bufferFill, info.bufferSize);
+        }
+        /* About 4 times what the stream needs at this clock, and a seek for
+         * every read */
+        AalibHostSetIoThrottle(4 * 2 * SAMPLE_RATE * 4, 2000);
+        AalibHostSetClock(2.0f);
+        AalibHostSetSink(NULL);
+        AalibEnableStats(1);
+        AalibPlay(channel);
+        int reads = 0;
+        unsigned int start = sceKernelGetSystemTimeLow();
+        while (AalibGetStatus(channel) != PSPAALIB_STATUS_STOPPED && sceKernelGetSystemTimeLow() - start < STOP_TIMEOUT) {
+            int offset = (reads % FRAMES) * FRAME_SIZE;
+            CHECK(AalibIoRead(animation, offset, frame, FRAME_SIZE, PSPAALIB_IO_PRIORITY_ANIMATION, 50000) == FRAME_SIZE,
+                  "%s: animation read failed", mode);
+            reads++;
+            /* Ends the stream at the end of the first pass */
+            if (autoloop && reads == 1) AalibSetAutoloop(channel, 0);
+        }
+        unsigned int elapsed = sceKernelGetSystemTimeLow() - start;
+        wait_stopped(channel);
+        AalibGetChannelStats(channel, &stats);
+        AalibEnableStats(0);
+        AalibHostSetIoThrottle(0, 0);
+        AalibUnload(channel);
+        if (mixer) set_mixer_mode(0);
+        /* The animation has to have kept the card busy for it to count */
+        CHECK((double)reads * FRAME_SIZE > 1.5 * elapsed * 2 * SAMPLE_RATE * 4 / 1000000, "%s: only %d animation reads in %u us",
+              mode, reads, elapsed);
+        CHECK(stats.buffers > 0 && stats.underruns == 0 && stats.ioStarvation == 0,
+              "%s: %u underruns and %u starved fetches in %u buffers", mode, stats.underruns, stats.ioStarvation, stats.buffers);
+    }
+    if (animation >= 0) sceIoClose(animation);
+    free_pcm(&pcm);
+    remove("check_contention.wav");
+    remove("check_contention.dat");
+}
+
+/* Errors are >0, and a load which fails leaves the channel free (AalibIsFree
+ * returns 0 for a free channel). A load which can't create a thread or a
+ * semaphore fails and deletes the ones it made, so the next load works: it
+ * succeeds once every object it needs can be created. The same goes for mixer
+ * mode, the first time it is turned on, and it stays off while no hardware
+ * channel is free for it */
+static void test_errors(void) {
+    static const int channels[] = {PSPAALIB_CHANNEL_WAV_1, PSPAALIB_CHANNEL_OGG_1};
+    pcm_data pcm;
+    FILE *f = fopen("check_errors.wav", "wb");
+    if (f) {
+        fputs("not a WAV file", f);
+        fclose(f);
+    }
+    for (int i = 0; i < 2; i++) {
+        int result = AalibLoad("check_missing.wav", channels[i], 0);
+        CHECK(result > 0 && AalibIsFree(channels[i]) == 0, "missing file on channel %d: %d", channels[i], result);
+        result = AalibLoad("check_errors.wav", channels[i], 1);
+        CHECK(result > 0 && AalibIsFree(channels[i]) == 0, "invalid file on channel %d: %d", channels[i], result);
+    }
+    int result = AalibSetStatsLog("check_no_such_dir/stats.log", 100);
+    CHECK(result > 0, "stats log in a missing directory: %d", result);
+    CHECK(AalibSetStatsLog(NULL, 0) == 0, "stopping the stats log");
+    AalibEnableStats(0);
+    remove("check_errors.wav");
+
+    for (int after = 0; after < 4; after++) {
+        unsigned int objects = AalibHostGetObjects();
+        AalibHostFailCreate(after);
+        result = AalibSetMixerMode(1);
+        AalibHostFailCreate(-1);
+        unsigned int made = AalibHostGetObjects() - objects;
+        CHECK(result == 0 ? made == (unsigned int)after || made == 0 : result > 0 && made == 0,
+              "mixer mode failing after %d objects returned %d and kept %u objects", after, result, made);
+        if (result == 0) {
+            set_mixer_mode(0);
+            break;
+        }
+    }
+    int reserved[HARDWARE_CHANNELS], count = 0;
+    while (count < HARDWARE_CHANNELS && (reserved[count] = sceAudioChReserve(PSP_AUDIO_NEXT_CHANNEL, 1024, PSP_AUDIO_FORMAT_STEREO)) >= 0) count++;
+    result = AalibSetMixerMode(1);
+    CHECK(result > 0, "mixer mode without a free hardware channel: %d", result);
+    for (int i = 0; i < count; i++) sceAudioChRelease(reserved[i]);
+    set_mixer_mode(1);
+    set_mixer_mode(0);
+
+    make_pcm(&pcm, SAMPLE_RATE / 4, 2, SAMPLE_RATE, 16, 0, 0);
+    if (!write_wav("check_errors.wav", &pcm, 0, 0)) return;
+    AalibHostSetClock(0.0f);
+    AalibHostSetSink(NULL);
+    for (int ram = 0; ram < 2; ram++) {
+        const char *mode = ram ? "ram" : "streamed";
+        int loaded = 0;
+        for (int after = 0; after < 8 && !loaded; after++) {
+            unsigned int objects = AalibHostGetObjects();
+            AalibHostFailCreate(after);
+            result = AalibLoad("check_errors.wav", PSPAALIB_CHANNEL_WAV_1, ram);
+            AalibHostFailCreate(-1);
+            loaded = (result == 0);
+            unsigned int made = AalibHostGetObjects() - objects;
+            CHECK(loaded ? (after > 0 && made == (unsigned int)after) : (result > 0 && AalibIsFree(PSPAALIB_CHANNEL_WAV_1) == 0 && made == 0),
+                  "%s: load failing after %d objects returned %d and kept %u objects", mode, after, result, made);
+        }
+        CHECK(loaded, "%s: load never succeeded", mode);
+        if (!loaded) continue;
+        AalibPlay(PSPAALIB_CHANNEL_WAV_1);
+        CHECK(wait_stopped(PSPAALIB_CHANNEL_WAV_1), "%s: didn't play to the end", mode);
+        AalibUnload(PSPAALIB_CHANNEL_WAV_1);
+    }
+    free_pcm(&pcm);
+    remove("check_errors.wav");
+}
+
+/* The game thread flips a DC file between two gain settings, each made of a
+ * volume and an amplification set in one update, as fast as it can while the
+ * audio thread plays it. Gains ramp across a buffer but start each one
+ * exactly on the previous target, so the first frame of every buffer shows
+ * which settings the audio thread took: a torn read mixes the two. */
+static void test_snapshots(void) {
+    static const float settings[2][3] = {{1.0f, 0.5f, 0.5f}, {0.5f, 1.0f, 1.0f}};
+    pcm_data pcm;
+    capture out;
+    int channel = PSPAALIB_CHANNEL_WAV_1, length = 256, level = 16000;
+    make_pcm(&pcm, 20000, 1, SAMPLE_RATE, 16, 0, 120);
+    for (int i = 0; i < pcm.frames; i++) pcm.samples[i] = level;
+    if (!write_wav("check_snapshots.wav", &pcm, 0, 0)) return;
+    for (int mixer = 0; mixer < 2; mixer++) {
+        const char *mode = mixer ? "mixer" : "thread";
+        if (mixer) set_mixer_mode(1);
+        CHECK(AalibLoad("check_snapshots.wav", channel, 1) == 0, "load");
+        AalibSetBufferSize(mixer ? PSPAALIB_CHANNEL_NONE : channel, length);
+        AalibSetAutoloop(channel, 1);
+        AalibEnable(channel, PSPAALIB_EFFECT_VOLUME_MANUAL);
+        AalibEnable(channel, PSPAALIB_EFFECT_AMPLIFY);
+        AalibSetVolume(channel, (AalibVolume){settings[0][0], settings[0][1]});
+        AalibSetAmplification(channel, settings[0][2]);
+        begin_capture(8.0f);
+        AalibPlay(channel);
+        unsigned int start = sceKernelGetSystemTimeLow(), updates = 0;
+        while (sceKernelGetSystemTimeLow() - start < 300000) {
+            const float *setting = settings[updates++ & 1];
+            AalibBeginUpdate(channel);
+            AalibSetVolume(channel, (AalibVolume){setting[0], setting[1]});
+            AalibSetAmplification(channel, setting[2]);
+            AalibEndUpdate(channel);
+        }
+        AalibSetAutoloop(channel, 0);
+        end_capture(&channel, 1, &out);
+
+        int buffers = out.frames / length, torn = 0, seen[2] = {0, 0};
+        for (int i = 0; i < buffers; i++) {
+            short *frame = out.samples + 2 * i * length;
+            int matched = -1;
+            for (int s = 0; s < 2; s++) {
+                if (frame[0] == (int)(level * settings[s][0] * settings[s][2]) && frame[1] == (int)(level * settings[s][1] * settings[s][2])) matched = s;
+            }
+            if (matched < 0) torn++;
+            else seen[matched]++;
+        }
+        CHECK(torn == 0, "%s: %d torn of %d buffers", mode, torn, buffers);
+        CHECK(seen[0] && seen[1], "%s: settings taken %d and %d times in %u updates", mode, seen[0], seen[1], updates);
+        free_capture(&out);
+        if (mixer) set_mixer_mode(0);
+    }
+    free_pcm(&pcm);
+    remove("check_snapshots.wav");
+}
+
+/* Posts a volley of seeks, each followed by a pause and a resume, while the
+ * channel plays. Every sample says which frame of the file it came from, so
+ * the output has to be runs of the file which only jump on buffer
+ * boundaries, to targets in the order they were posted, ending with the last
+ * one played out to the end of the file. */
+static void test_commands(void) {
+    pcm_data pcm;
+    capture out;
+    int channel = PSPAALIB_CHANNEL_WAV_1, length = 256, seeks = 150;
+    make_pcm(&pcm, 200000, 2, SAMPLE_RATE, 16, 0, 130);
+    for (int i = 0; i < pcm.frames; i++) {
+        pcm.samples[2 * i] = i & 0x7FFF;
+        pcm.samples[2 * i + 1] = i >> 15;
+    }
+    if (!write_wav("check_commands.wav", &pcm, 0, 0)) return;
+    for (int mixer = 0; mixer < 2; mixer++) {
+        const char *mode = mixer ? "mixer" : "thread";
+        if (mixer) set_mixer_mode(1);
+        CHECK(AalibLoad("check_commands.wav", channel, mixer) == 0, "load");
+        AalibSetBufferSize(mixer ? PSPAALIB_CHANNEL_NONE : channel, length);
+        begin_capture(8.0f);
+        AalibPlay(channel);
+        int full = 0;
+        for (int k = 1; k <= seeks; k++) {
+            int result;
+            while ((result = AalibSeekSample(channel, k * 1000 + 7)) == PSPAALIB_WARNING_COMMAND_QUEUE_FULL) {
+                full++;
+                sceKernelDelayThread(100);
+            }
+            CHECK(result == 0, "%s: seek %d: %d", mode, k, result);
+            for (int p = 0; p < 2; p++) {
+                while (AalibPause(channel) == PSPAALIB_WARNING_COMMAND_QUEUE_FULL) {
+                    full++;
+                    sceKernelDelayThread(100);
+                }
+            }
+            if (k % 10 == 0) sceKernelDelayThread(1000);
+        }
+        end_capture(&channel, 1, &out);
+
+        /* The mixer goes on with silence while the channel is paused, and the
+         * last buffer is padded with it */
+        int previous = -1, jumps = 0, last = 0, bad = -1, i;
+        for (i = 0; i < out.frames && bad < 0 && previous < pcm.frames - 1; i++) {
+            if (i && is_silent(out.samples + 2 * i, 1)) continue;
+            int frame = (out.samples[2 * i] & 0x7FFF) | (out.samples[2 * i + 1] << 15);
+            if (frame != previous + 1) {
+                if (i % length || (frame - 7) % 1000 || frame <= last) bad = i;
+                last = frame;
+                jumps++;
+            }
+            previous = frame;
+        }
+        CHECK(bad < 0, "%s: output jumps at frame %d of %d", mode, bad, out.frames);
+        CHECK(is_silent(out.samples + 2 * i, out.frames - i), "%s: output goes on after the end of the file", mode);
+        CHECK(jumps > 1 && last == seeks * 1000 + 7 && previous == pcm.frames - 1,
+              "%s: %d seeks taken, the last to %d, ending on %d (%d times the queue was full)", mode, jumps, last, previous, full);
+        free_capture(&out);
+        if (mixer) set_mixer_mode(0);
+    }
+    free_pcm(&pcm);
+    remove("check_commands.wav");
+}
+
+static const test_case tests[] = {
+    {"streamed", test_streamed},
+    {"ram", test_ram},
+    {"mixer", test_mixer},
+    {"looped", test_looped},
+    {"looppoints", test_loop_points},
+    {"seeked", test_seeked},
+    {"resampled", test_resampled},
+    {"adpcm", test_adpcm},
+    {"speed", test_speed},
+    {"maxspeed", test_max_speed},
+    {"timing", test_timing},
+    {"allocations", test_allocations},
+    {"underruns", test_underruns},
+    {"contention", test_contention},
+    {"errors", test_errors},
+    {"snapshots", test_snapshots},
+    {"commands", test_commands},
+    {"states", test_states},
+};
+
+int main(int argc, char **argv) {
+    int count = sizeof(tests) / sizeof(tests[0]), run = 0;
+    int result = AalibInit();
+    if (result != 0) {
+        printf("AalibInit failed: %d\n", result);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        int selected = (argc < 2);
+        for (int j = 1; j < argc; j++) {
+            if (strcmp(argv[j], tests[i].name) == 0) selected = 1;
+        }
+        if (!selected) continue;
+        int before = failures;
+        unsigned int start = sceKernelGetSystemTimeLow();
+        tests[i].run();
+        printf("%-12s %s (%u ms)\n", tests[i].name, (failures == before) ? "ok" : "FAILED",
+               (sceKernelGetSystemTimeLow() - start) / 1000);
+        run++;
+    }
+    if (!run) {
+        printf("no such test\n");
+        return 1;
+    }
+    printf("%d tests, %d failures\n", run, failures);
+    return failures != 0;
+}
@@ -0,0 +1,93 @@
+/* Plays a sound file through the audio library on a PC, for checking and
+ * profiling its playback path without a PSP. Built by Makefile.host. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "pspaalib.h"
+
+static int is_ogg(const char *filename) {
+    const char *ext = strrchr(filename, '.');
+    return ext && strcasecmp(ext, ".ogg") == 0;
+}
+
+static void usage(void) {
+    printf("usage: hostplay FILE [--sink out%%d.raw] [--speed N] [--mixer] [--ram] [--stats FILE]\n");
+    printf("  --sink   raw 16 bit stereo output per hardware channel, %%d is the channel\n");
+    printf("  --speed  simulated hardware clock, 1 is real time, 0 runs flat out\n");
+    printf("  --mixer  play through the mixer thread instead of a play thread\n");
+    printf("  --ram    load WAV files to RAM instead of streaming them\n");
+    printf("  --stats  write the engine counters there every 100 ms\n");
+}
+
+int main(int argc, char **argv) {
+    const char *file = NULL, *sink = NULL, *stats_file = NULL;
+    float speed = 1.0f;
+    int mixer = 0, ram = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sink") == 0 && i + 1 < argc) sink = argv[++i];
+        else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) speed = atof(argv[++i]);
+        else if (strcmp(argv[i], "--mixer") == 0) mixer = 1;
+        else if (strcmp(argv[i], "--ram") == 0) ram = 1;
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) stats_file = argv[++i];
+        else if (argv[i][0] != '-' && !file) file = argv[i];
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (!file) {
+        usage();
+        return 1;
+    }
+
+    AalibHostSetClock(speed);
+    if (AalibHostSetSink(sink) != 0) {
+        printf("can't create %s\n", sink);
+        return 1;
+    }
+    AalibInit();
+    if (mixer) AalibSetMixerMode(1);
+    if (stats_file) AalibSetStatsLog((char *)stats_file, 100);
+    else AalibEnableStats(1);
+
+    int channel = is_ogg(file) ? PSPAALIB_CHANNEL_OGG_1 : PSPAALIB_CHANNEL_WAV_1;
+    int result = AalibLoad((char *)file, channel, ram && !is_ogg(file));
+    if (result != 0) {
+        printf("can't load %s: %d\n", file, result);
+        return 1;
+    }
+
+    unsigned int start = sceKernelGetSystemTimeLow();
+    AalibPlay(channel);
+    /* The stream stops by itself at the end of the file */
+    while (AalibGetStatus(channel) != PSPAALIB_STATUS_STOPPED) {
+        sceKernelDelayThread(10000);
+    }
+    unsigned int elapsed = sceKernelGetSystemTimeLow() - start;
+
+    AalibChannelStats channel_stats;
+    AalibEngineStats engine_stats;
+    AalibGetChannelStats(channel, &channel_stats);
+    AalibGetEngineStats(&engine_stats);
+    AalibPlaybackPosition position;
+    AalibGetPlaybackPosition(channel, &position);
+
+    printf("%s: %u frames in %u us\n", file, position.samplesPlayed, elapsed);
+    printf("channel: %u buffers, %u underruns, %u starved of I/O, %u/%u/%u us per buffer, %u bytes read, %u us waiting for I/O\n",
+           channel_stats.buffers, channel_stats.underruns, channel_stats.ioStarvation, channel_stats.processTimeMin,
+           channel_stats.processTimeAvg, channel_stats.processTimeMax,
+           channel_stats.ioBytes, channel_stats.ioStallTime);
+    printf("engine: %u buffers, %u/%u/%u us per buffer, %u I/O requests, %u us reading, %u late\n",
+           engine_stats.buffers, engine_stats.processTimeMin, engine_stats.processTimeAvg,
+           engine_stats.processTimeMax, engine_stats.ioRequests, engine_stats.ioReadTime,
+           engine_stats.ioLate);
+
+    AalibSetStatsLog(NULL, 0);
+    AalibUnload(channel);
+    if (mixer) AalibSetMixerMode(0);
+    AalibHostSetSink(NULL);
+    return 0;
+}
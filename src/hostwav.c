@@ -0,0 +1,206 @@
+/* WAV files generated for the host tests and benchmarks: noise, and PCM or
+ * IMA-ADPCM files with smpl loop points. */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hostwav.h"
+
+static unsigned int next_random(unsigned int *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/* Noise, so that a frame played twice or skipped shows up right away.
+ * 8 bit samples only use the top byte. */
+void make_pcm(pcm_data *pcm, int frames, int channels, int rate, int bits, int amplitude, unsigned int seed) {
+    pcm->frames = frames;
+    pcm->channels = channels;
+    pcm->rate = rate;
+    pcm->bits = bits;
+    pcm->samples = malloc(sizeof(short) * frames * channels);
+    for (int i = 0; i < frames * channels; i++) {
+        int sample = (int)(next_random(&seed) % (2 * amplitude + 1)) - amplitude;
+        pcm->samples[i] = (bits == 8) ? (short)(sample & ~0xFF) : (short)sample;
+    }
+}
+
+void free_pcm(pcm_data *pcm) {
+    free(pcm->samples);
+    pcm->samples = NULL;
+}
+
+static void put_u16(FILE *f, int value) {
+    fputc(value & 0xFF, f);
+    fputc((value >> 8) & 0xFF, f);
+}
+
+static void put_u32(FILE *f, unsigned int value) {
+    put_u16(f, value & 0xFFFF);
+    put_u16(f, value >> 16);
+}
+
+/* A smpl chunk looping frames loop_start to loop_end (exclusive), which is
+ * 8 + smpl_size bytes */
+static void put_smpl(FILE *f, int smpl_size, int loop_start, int loop_end) {
+    fwrite("smpl", 1, 4, f);
+    put_u32(f, smpl_size);
+    for (int i = 0; i < 7; i++) put_u32(f, 0);
+    put_u32(f, 1);
+    put_u32(f, 0);
+    put_u32(f, 0);
+    put_u32(f, 0);
+    put_u32(f, loop_start);
+    put_u32(f, loop_end - 1);
+    put_u32(f, 0);
+    put_u32(f, 0);
+}
+
+/* Writes a PCM WAV, with a smpl chunk looping frames loop_start to loop_end
+ * (exclusive) if loop_end is above 0 */
+int write_wav(const char *path, const pcm_data *pcm, int loop_start, int loop_end) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        printf("can't create %s\n", path);
+        return 0;
+    }
+    int frame_size = pcm->channels * pcm->bits / 8;
+    int data_size = pcm->frames * frame_size;
+    int smpl_size = (loop_end > 0) ? 36 + 24 : 0;
+    fwrite("RIFF", 1, 4, f);
+    put_u32(f, 4 + 8 + 16 + ((smpl_size) ? 8 + smpl_size : 0) + 8 + data_size);
+    fwrite("WAVEfmt ", 1, 8, f);
+    put_u32(f, 16);
+    put_u16(f, 1);
+    put_u16(f, pcm->channels);
+    put_u32(f, pcm->rate);
+    put_u32(f, pcm->rate * frame_size);
+    put_u16(f, frame_size);
+    put_u16(f, pcm->bits);
+    if (smpl_size) put_smpl(f, smpl_size, loop_start, loop_end);
+    fwrite("data", 1, 4, f);
+    put_u32(f, data_size);
+    for (int i = 0; i < pcm->frames * pcm->channels; i++) {
+        if (pcm->bits == 8) fputc(((pcm->samples[i] >> 8) + 128) & 0xFF, f);
+        else put_u16(f, pcm->samples[i]);
+    }
+    fclose(f);
+    return 1;
+}
+
+static const short ima_steps[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+    107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+    724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int ima_index_shift[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+static int adpcm_frames_per_block(int block_align, int channels) {
+    return (block_align - 4 * channels) * 2 / channels + 1;
+}
+
+/* Encodes 16 bit samples into IMA-ADPCM blocks the way converter.py does:
+ * each block starts with the first sample and step index of every channel,
+ * then 4 bit codes in groups of 8 per channel, low nibble first. The last
+ * block is padded, the fact chunk has the real length. The encoder tracks
+ * what a decoder makes of the codes, which goes to decoded if it isn't
+ * NULL. */
+static unsigned char *encode_adpcm(const pcm_data *pcm, int block_align, int *size, short *decoded) {
+    int channels = pcm->channels, per_block = adpcm_frames_per_block(block_align, channels);
+    int blocks = (pcm->frames + per_block - 1) / per_block;
+    int predictor[2] = {0, 0}, index[2] = {0, 0};
+    unsigned char *data = calloc(blocks, block_align);
+    unsigned char *codes = malloc(per_block);
+    *size = blocks * block_align;
+    for (int b = 0; b < blocks; b++) {
+        unsigned char *block = data + b * block_align;
+        int start = b * per_block;
+        for (int c = 0; c < channels; c++) {
+            predictor[c] = pcm->samples[start * channels + c];
+            block[4 * c] = predictor[c] & 0xFF;
+            block[4 * c + 1] = (predictor[c] >> 8) & 0xFF;
+            block[4 * c + 2] = index[c];
+            if (decoded) decoded[start * channels + c] = predictor[c];
+            for (int i = 1; i < per_block; i++) {
+                int sample = (start + i < pcm->frames) ? pcm->samples[(start + i) * channels + c] : predictor[c];
+                int step = ima_steps[index[c]], diff = sample - predictor[c], code = 0, delta = step >> 3;
+                if (diff < 0) {
+                    code = 8;
+                    diff = -diff;
+                }
+                if (diff >= step) {
+                    code |= 4;
+                    diff -= step;
+                    delta += step;
+                }
+                if (diff >= step >> 1) {
+                    code |= 2;
+                    diff -= step >> 1;
+                    delta += step >> 1;
+                }
+                if (diff >= step >> 2) {
+                    code |= 1;
+                    delta += step >> 2;
+                }
+                predictor[c] += (code & 8) ? -delta : delta;
+                predictor[c] = (predictor[c] > 32767) ? 32767 : ((predictor[c] < -32768) ? -32768 : predictor[c]);
+                index[c] += ima_index_shift[code & 7];
+                index[c] = (index[c] < 0) ? 0 : ((index[c] > 88) ? 88 : index[c]);
+                codes[i - 1] = code;
+                if (decoded && start + i < pcm->frames) decoded[(start + i) * channels + c] = predictor[c];
+            }
+            for (int i = 0; i < per_block - 1; i += 2) {
+                block[4 * channels * (1 + i / 8) + 4 * c + (i & 7) / 2] = codes[i] | (codes[i + 1] << 4);
+            }
+        }
+    }
+    free(codes);
+    return data;
+}
+
+/* Writes IMA-ADPCM blocks as a WAV of frames frames, with a smpl chunk as
+ * write_wav() does */
+int write_adpcm_data(const char *path, const unsigned char *data, int data_size, int frames, int channels, int rate,
+                     int block_align, int loop_start, int loop_end) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        printf("can't create %s\n", path);
+        return 0;
+    }
+    int per_block = adpcm_frames_per_block(block_align, channels);
+    int smpl_size = (loop_end > 0) ? 36 + 24 : 0;
+    fwrite("RIFF", 1, 4, f);
+    put_u32(f, 4 + 8 + 20 + 12 + ((smpl_size) ? 8 + smpl_size : 0) + 8 + data_size);
+    fwrite("WAVEfmt ", 1, 8, f);
+    put_u32(f, 20);
+    put_u16(f, 0x11);
+    put_u16(f, channels);
+    put_u32(f, rate);
+    put_u32(f, rate * block_align / per_block);
+    put_u16(f, block_align);
+    put_u16(f, 4);
+    put_u16(f, 2);
+    put_u16(f, per_block);
+    fwrite("fact", 1, 4, f);
+    put_u32(f, 4);
+    put_u32(f, frames);
+    if (smpl_size) put_smpl(f, smpl_size, loop_start, loop_end);
+    fwrite("data", 1, 4, f);
+    put_u32(f, data_size);
+    fwrite(data, 1, data_size, f);
+    fclose(f);
+    return 1;
+}
+
+/* Encodes pcm into an IMA-ADPCM WAV with block_align byte blocks. What a
+ * decoder makes of it goes to decoded if that isn't NULL, in the same layout
+ * as pcm->samples. */
+int write_adpcm_wav(const char *path, const pcm_data *pcm, int block_align, int loop_start, int loop_end, short *decoded) {
+    int size;
+    unsigned char *data = encode_adpcm(pcm, block_align, &size, decoded);
+    int result = write_adpcm_data(path, data, size, pcm->frames, pcm->channels, pcm->rate, block_align, loop_start, loop_end);
+    free(data);
+    return result;
+}
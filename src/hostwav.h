@@ -0,0 +1,23 @@
+#ifndef HOSTWAV_H
+#define HOSTWAV_H
+
+/* Interleaved samples as they are stored in the file */
+typedef struct {
+    short *samples;
+    int frames;
+    int channels;
+    int rate;
+    int bits;
+} pcm_data;
+
+void make_pcm(pcm_data *pcm, int frames, int channels, int rate, int bits, int amplitude, unsigned int seed);
+void free_pcm(pcm_data *pcm);
+
+/* Both return 0 if the file could not be written. loop_end above 0 adds a
+ * smpl chunk looping frames loop_start to loop_end (exclusive). */
+int write_wav(const char *path, const pcm_data *pcm, int loop_start, int loop_end);
+int write_adpcm_wav(const char *path, const pcm_data *pcm, int block_align, int loop_start, int loop_end, short *decoded);
+int write_adpcm_data(const char *path, const unsigned char *data, int data_size, int frames, int channels, int rate,
+                     int block_align, int loop_start, int loop_end);
+
+#endif
@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "log.h"
+
+static FILE *log_file = NULL;
+
+int log_open(const char *filename) {
+    if (log_file) fclose(log_file);
+    log_file = fopen(filename, "w");
+    return log_file != NULL;
+}
+
+void log_printf(const char *fmt, ...) {
+    if (!log_file) return;
+
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(log_file, fmt, args);
+    va_end(args);
+    fflush(log_file);
+}
+
+void log_close(void) {
+    if (log_file) {
+        fclose(log_file);
+        log_file = NULL;
+    }
+}
@@ -0,0 +1,8 @@
+#ifndef LOG_H
+#define LOG_H
+
+int log_open(const char *filename);
+void log_printf(const char *fmt, ...);
+void log_close(void);
+
+#endif
@@ -5,26 +5,50 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "audio/pspaalib.h"
+#include "animation.h"
+#include "budget.h"
+#include "log.h"
+#include "render.h"
 
 PSP_MODULE_INFO("ASCII_PLAYER", 0, 1, 1);
 PSP_MAIN_THREAD_ATTR(THREAD_ATTR_USER | THREAD_ATTR_VFPU);
 
+#define AUDIO_STREAM_COST (PSPAALIB_WAV_RING_SIZE + PSPAALIB_WAV_READ_SIZE + 32 * 1024)
+/* Decoded ring, one ov_read buffer and the Tremor decoder state */
+#define AUDIO_OGG_COST ((PSPAALIB_OGG_RING_FRAMES + PSPAALIB_OGG_DECODE_FRAMES) * 4 + 64 * 1024)
+#define BUDGET_SAMPLE_INTERVAL 60
+#define MAX_TILES 9
+
+typedef struct {
+    char file[256];
+    int x;
+    int y;
+    int frame_delay;
+    int loop;
+} TileConfig;
+
 typedef struct {
-    unsigned int frame_count;
-    unsigned short width;
-    unsigned short height;
-    unsigned int frame_size; 
-    char *data; 
-} Animation;
+    Animation *anim;
+    TileConfig *config;
+    int current_frame;
+    int tick;
+    int dirty;
+} Tile;
 
 typedef struct {
     char anim_file[256];
     char audio_file[256];
     int volume;
+    char stats_file[256];
     int frame_delay;
     int loop;
+    unsigned int headroom;
+    char log_file[256];
+    TileConfig tiles[MAX_TILES];
+    int tile_count;
 } Config;
 
 int exit_callback(int arg1, int arg2, void *common) {
@@ -55,18 +79,23 @@ int read_ini_value(const char *line, const char *key, char *value) {
     return 0;
 }
 
+/* Returns 0 if there is no config.ini, config then holds the defaults */
 int load_config(Config *config) {
-    FILE *file = fopen("config.ini", "r");
-    if (!file) return 0;
-    
-    config->audio_file[0] = '\0';
+    strcpy(config->anim_file, "animation.dat");
+    strcpy(config->audio_file, "sound.wav");
     config->volume = 80;
+    config->stats_file[0] = '\0';
     config->frame_delay = 3;
     config->loop = 1;
+    config->headroom = BUDGET_DEFAULT_HEADROOM;
+    strcpy(config->log_file, "player.log");
+    config->tile_count = 0;
+    memset(config->tiles, 0, sizeof(config->tiles));
 
+    FILE *file = fopen("config.ini", "r");
     char line[256], section[64] = "";
     
-    while (fgets(line, sizeof(line), file)) {
+    while (file && fgets(line, sizeof(line), file)) {
         if (line[0] == '#' || line[0] == ';' || strlen(line) < 2) continue;
         if (line[0] == '[') { 
             sscanf(line, "[%63[^]]]", section); 
@@ -74,6 +103,7 @@ int load_config(Config *config) {
         }
 
         char key[64], val[192];
+        int tile = 0;
         if (sscanf(line, "%63[^= ] = %191[^\n\r]", key, val) == 2) {
             char *clean_val = val;
             while(*clean_val == ' ') clean_val++;
@@ -84,69 +114,83 @@ int load_config(Config *config) {
             else if (strcmp(section, "Audio") == 0) {
                 if (strcmp(key, "File") == 0) strcpy(config->audio_file, clean_val);
                 if (strcmp(key, "Volume") == 0) config->volume = atoi(clean_val);
+                if (strcmp(key, "Stats") == 0) strcpy(config->stats_file, clean_val);
             }
             else if (strcmp(section, "Display") == 0) {
                 if (strcmp(key, "FrameDelay") == 0) config->frame_delay = atoi(clean_val);
                 if (strcmp(key, "Loop") == 0) config->loop = atoi(clean_val);
             }
+            else if (sscanf(section, "Tile%d", &tile) == 1 && tile >= 1 && tile <= MAX_TILES) {
+                TileConfig *t = &config->tiles[tile - 1];
+                if (strcmp(key, "File") == 0) strcpy(t->file, clean_val);
+                if (strcmp(key, "X") == 0) t->x = atoi(clean_val);
+                if (strcmp(key, "Y") == 0) t->y = atoi(clean_val);
+                if (strcmp(key, "FrameDelay") == 0) t->frame_delay = atoi(clean_val);
+                if (strcmp(key, "Loop") == 0) t->loop = atoi(clean_val) + 1;
+                if (config->tile_count < tile) config->tile_count = tile;
+            }
+            else if (strcmp(section, "Memory") == 0) {
+                if (strcmp(key, "Headroom") == 0) config->headroom = atoi(clean_val) * 1024;
+                if (strcmp(key, "Log") == 0) strcpy(config->log_file, clean_val);
+            }
         }
     }
-    fclose(file);
-    return 1;
-}
+    if (file) fclose(file);
 
-Animation* load_animation(const char *filename) {
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        pspDebugScreenPrintf("Error: File not found %s\n", filename);
-        return NULL;
+    /* Without [TileN] sections the single [Animation] fills the screen */
+    if (config->tile_count == 0) {
+        strcpy(config->tiles[0].file, config->anim_file);
+        config->tile_count = 1;
     }
-
-    Animation *anim = (Animation*)malloc(sizeof(Animation));
-    if (!anim) { fclose(file); return NULL; }
-
-    fread(&anim->frame_count, 4, 1, file);
-    fread(&anim->width, 2, 1, file);
-    fread(&anim->height, 2, 1, file);
-
-    int line_stride = anim->width + 1; 
-    anim->frame_size = line_stride * anim->height;
-    
-    unsigned int total_data_size = anim->frame_count * anim->frame_size;
-    
-    anim->data = (char*)malloc(total_data_size);
-    if (!anim->data) {
-        pspDebugScreenPrintf("Error: Out of memory (Need %d bytes)\n", total_data_size);
-        free(anim);
-        fclose(file);
-        return NULL;
+    for (int i = 0; i < config->tile_count; i++) {
+        TileConfig *t = &config->tiles[i];
+        if (t->frame_delay <= 0) t->frame_delay = config->frame_delay;
+        t->loop = t->loop ? t->loop - 1 : config->loop;
     }
+    return file != NULL;
+}
 
-    size_t read_size = fread(anim->data, 1, total_data_size, file);
-    fclose(file);
-
-    if (read_size != total_data_size) {
-        pspDebugScreenPrintf("Warning: File size mismatch\n");
-    }
+static unsigned int file_size(const char *filename) {
+    SceIoStat stat;
+    if (sceIoGetstat(filename, &stat) < 0) return 0;
+    return (unsigned int)stat.st_size;
+}
 
-    return anim;
+static int is_ogg(const char *filename) {
+    const char *ext = strrchr(filename, '.');
+    return ext && strcasecmp(ext, ".ogg") == 0;
 }
 
-void free_animation(Animation *anim) {
-    if (anim) {
-        if (anim->data) free(anim->data);
-        free(anim);
-    }
+static Animation *load_tile(Budget *budget, TileConfig *config, const Animation *header,
+                            unsigned int reserve, int shares) {
+    pspDebugScreenPrintf("Loading %s...\n", config->file);
+
+    unsigned int granted;
+    AssetMode mode = budget_plan(budget, config->file,
+                                 header->frame_count * header->frame_size,
+                                 header->frame_size, reserve, shares, &granted);
+    unsigned int cached_frames = (mode == ASSET_MODE_STREAM) ? 0 : granted / header->frame_size;
+    /* A partial frame can't be cached, it goes back to the assets after this one */
+    if (mode == ASSET_MODE_CACHE) budget_release(budget, granted - cached_frames * header->frame_size);
+    Animation *anim = load_animation(config->file, cached_frames);
+    if (!anim) return NULL;
+
+    pspDebugScreenPrintf("Loaded: %d frames (%dx%d), %s mode\n", anim->frame_count, anim->width, anim->height, budget_mode_name(mode));
+    log_printf("animation: %s at %d,%d, %u of %u frames resident\n", config->file, config->x, config->y, anim->cached_frames, anim->frame_count);
+    return anim;
 }
 
-static inline void draw_frame(Animation *anim, int frame_num) {
-    char *ptr = anim->data + (frame_num * anim->frame_size);
-    int stride = anim->width + 1;
+static void advance_tile(Tile *tile) {
+    if (++tile->tick < tile->config->frame_delay) return;
+    tile->tick = 0;
 
-    for (int y = 0; y < anim->height; y++) {
-        pspDebugScreenSetXY(0, y);
-        pspDebugScreenPuts(ptr); 
-        ptr += stride;
+    int frame = tile->current_frame + 1;
+    if (frame >= tile->anim->frame_count) {
+        frame = tile->config->loop ? 0 : tile->anim->frame_count - 1;
+    }
+    if (frame != tile->current_frame) {
+        tile->current_frame = frame;
+        tile->dirty = 1;
     }
 }
 
@@ -160,45 +204,125 @@ int main(void) {
         pspDebugScreenPrintf("Config load failed, using defaults.\n");
     }
 
-    pspDebugScreenPrintf("Loading %s...\n", config.anim_file);
+    log_open(config.log_file);
+
+    Budget budget;
+    budget_init(&budget, config.headroom);
+
     sceKernelDelayThread(1000000);
-    Animation *anim = load_animation(config.anim_file);
-    
-    if (!anim) {
-        sceKernelDelayThread(3000000);
-        sceKernelExitGame();
-        return 0;
-    }
 
-    pspDebugScreenPrintf("\nLoaded: %d frames (%dx%d)\n", anim->frame_count, anim->width, anim->height);
+    /* Every tile and the audio get a share of the budget, and the smallest
+     * part each of them can play with is kept back for the ones planned later */
+    Tile tiles[MAX_TILES];
+    Animation headers[MAX_TILES];
+    unsigned int audio_min_cost = is_ogg(config.audio_file) ? AUDIO_OGG_COST : AUDIO_STREAM_COST;
+    unsigned int reserve = audio_min_cost;
+    for (int i = 0; i < config.tile_count; i++) {
+        if (!probe_animation(config.tiles[i].file, &headers[i])) {
+            pspDebugScreenPrintf("Error: File not found %s\n", config.tiles[i].file);
+            sceKernelDelayThread(3000000);
+            sceKernelExitGame();
+            return 0;
+        }
+        reserve += headers[i].frame_size;
+    }
+    for (int i = 0; i < config.tile_count; i++) {
+        reserve -= headers[i].frame_size;
+        tiles[i].config = &config.tiles[i];
+        tiles[i].current_frame = 0;
+        tiles[i].tick = 0;
+        tiles[i].dirty = 1;
+        tiles[i].anim = load_tile(&budget, &config.tiles[i], &headers[i], reserve, config.tile_count - i + 1);
+        if (!tiles[i].anim) {
+            sceKernelDelayThread(3000000);
+            sceKernelExitGame();
+            return 0;
+        }
+    }
     sceKernelDelayThread(500000);
+
+    unsigned int audio_granted;
+    AssetMode audio_mode;
+    int audio_channel = PSPAALIB_CHANNEL_WAV_1;
+    if (is_ogg(config.audio_file)) {
+        /* Vorbis is always streamed, only the decoder's buffers are resident */
+        audio_channel = PSPAALIB_CHANNEL_OGG_1;
+        budget_plan(&budget, config.audio_file, AUDIO_OGG_COST, AUDIO_OGG_COST, 0, 1, &audio_granted);
+        audio_mode = ASSET_MODE_STREAM;
+    } else {
+        audio_mode = budget_plan(&budget, config.audio_file,
+                                 file_size(config.audio_file),
+                                 AUDIO_STREAM_COST, 0, 1, &audio_granted);
+    }
     
-    if (AalibLoad(config.audio_file, PSPAALIB_CHANNEL_WAV_1, 0) != 0) pspDebugScreenPrintf("Can't load %s. Exiting...\n", config.audio_file);
+    if (AalibLoad(config.audio_file, audio_channel, audio_mode == ASSET_MODE_RAM) != 0) pspDebugScreenPrintf("Can't load %s. Exiting...\n", config.audio_file);
+    if (audio_mode == ASSET_MODE_CACHE) {
+        /* Streamed, but the loop is kept in RAM as far as the budget allows */
+        if (AalibSetStreamCache(audio_channel, audio_granted - AUDIO_STREAM_COST) != 0) {
+            budget_release(&budget, audio_granted - AUDIO_STREAM_COST);
+        }
+    }
+    budget_sample(&budget);
     
     pspDebugScreenPrintf("Loaded audio file: %s\n", config.audio_file);
     sceKernelDelayThread(500000);
     pspDebugScreenPrintf("\nAnimation is ready to start. Enjoy =)\n\nP.S. Press Start to exit...\n");
     sceKernelDelayThread(2500000);
     pspDebugScreenClear();
+    render_init();
 
-    int current_frame = 0;
-    int tick = 0;
+    int sample_tick = 0;
+    int audio_load_logged = (audio_mode != ASSET_MODE_RAM);
+    RenderStats render_stats;
+    AalibStreamInfo audio_info;
     SceCtrlData pad;
 
-    AalibSetAutoloop(PSPAALIB_CHANNEL_WAV_1, 1);
-    AalibSetVolume(PSPAALIB_CHANNEL_WAV_1, (AalibVolume){config.volume, config.volume});
-    AalibPlay(PSPAALIB_CHANNEL_WAV_1);
+    /* Engine counters once a second, to tell I/O stalls from slow effects */
+    if (config.stats_file[0] && AalibSetStatsLog(config.stats_file, 1000) != 0) {
+        log_printf("audio: can't write stats to %s\n", config.stats_file);
+    }
+    AalibSetAutoloop(audio_channel, 1);
+    AalibSetVolume(audio_channel, (AalibVolume){config.volume, config.volume});
+    AalibPlay(audio_channel);
 
     while (1) {
-        draw_frame(anim, current_frame);
-
-        tick++;
-        if (tick >= config.frame_delay) {
-            tick = 0;
-            current_frame++;
-            if (current_frame >= anim->frame_count) {
-                if (config.loop) current_frame = 0;
-                else current_frame = anim->frame_count - 1;
+        /* One render pass per vblank for all tiles, only changed cells get printed */
+        for (int i = 0; i < config.tile_count; i++) {
+            Tile *tile = &tiles[i];
+            if (tile->dirty) {
+                Animation *anim = tile->anim;
+                render_blit(get_frame(anim, tile->current_frame), anim->width, anim->height,
+                            tile->config->x, tile->config->y);
+                tile->dirty = 0;
+            }
+        }
+        render_flush();
+
+        for (int i = 0; i < config.tile_count; i++) {
+            advance_tile(&tiles[i]);
+        }
+
+        if (++sample_tick >= BUDGET_SAMPLE_INTERVAL) {
+            sample_tick = 0;
+            budget_sample(&budget);
+            render_take_stats(&render_stats);
+            log_printf("render: %u passes, %u cells changed, %u written, %u us\n",
+                       render_stats.passes, render_stats.cells_changed,
+                       render_stats.cells_written, render_stats.time_us);
+            if (AalibGetStreamInfo(audio_channel, &audio_info) == 0) {
+                log_printf("audio: cache %d of %d bytes, %u bytes read last loop, starved of I/O %d times\n",
+                           audio_info.cacheFill, audio_info.cacheSize,
+                           audio_info.loopIoBytes, audio_info.underruns);
+                /* RAM audio is loaded in the background while playing */
+                if (!audio_load_logged && audio_info.loadTime >= 0) {
+                    log_printf("audio: %d bytes loaded in %d us, first samples after %d us\n",
+                               audio_info.bufferSize, audio_info.loadTime,
+                               audio_info.firstSampleTime);
+                    audio_load_logged = 1;
+                }
+                if (audio_channel == PSPAALIB_CHANNEL_OGG_1) {
+                    log_printf("audio: decoding takes %d us per second of audio\n", audio_info.decodeCost);
+                }
             }
         }
 
@@ -208,7 +332,13 @@ int main(void) {
         sceDisplayWaitVblankStart();
     }
 
-    free_animation(anim);
+    budget_sample(&budget);
+    budget_report(&budget);
+    log_close();
+
+    for (int i = 0; i < config.tile_count; i++) {
+        free_animation(tiles[i].anim);
+    }
     sceKernelExitGame();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,177 @@
+import argparse
+import os
+import struct
+import sys
+import time
+
+# Формат заголовка: Frames(4), Width(2), Height(2)
+HEADER_FORMAT = "<IHH"
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+
+# Частота кадров PSP, FrameDelay в config.ini считается в кадрах развертки
+VBLANK_HZ = 59.94
+
+# Если между двумя изменившимися участками строки меньше клеток, чем это значение,
+# дешевле перепечатать их, чем ставить курсор заново
+MERGE_GAP = 6
+
+
+def read_header(f):
+    """Читает заголовок .dat, возвращает (frame_count, width, height)"""
+    data = f.read(HEADER_SIZE)
+    if len(data) != HEADER_SIZE:
+        raise ValueError("файл слишком короткий для заголовка")
+    return struct.unpack(HEADER_FORMAT, data)
+
+
+def decode_frame(raw, width, height):
+    """Превращает сырой кадр (строки с \\0 в конце) в список строк ширины width"""
+    stride = width + 1
+    rows = []
+    for y in range(height):
+        line = raw[y * stride:(y + 1) * stride]
+        end = line.find(0)
+        if end < 0:
+            end = width
+        rows.append(line[:end].ljust(width, b" ")[:width])
+    return rows
+
+
+def iter_frames(path):
+    """Последовательно отдает (номер кадра, строки, время декодирования в секундах)"""
+    with open(path, "rb") as f:
+        frame_count, width, height = read_header(f)
+        frame_size = (width + 1) * height
+        for n in range(frame_count):
+            start = time.perf_counter()
+            raw = f.read(frame_size)
+            if len(raw) != frame_size:
+                raise ValueError(f"кадр {n}: ожидалось {frame_size} байт, прочитано {len(raw)}")
+            rows = decode_frame(raw, width, height)
+            yield n, rows, time.perf_counter() - start
+
+
+def diff_rows(prev, rows):
+    """Строит ANSI-вывод только для изменившихся клеток"""
+    out = bytearray()
+    for y, (old, new) in enumerate(zip(prev, rows)):
+        if old == new:
+            continue
+        x = 0
+        width = len(new)
+        while x < width:
+            if old[x] == new[x]:
+                x += 1
+                continue
+            # Начало изменившегося участка, расширяем его с учетом MERGE_GAP
+            start = x
+            end = x + 1
+            gap = 0
+            x += 1
+            while x < width and gap < MERGE_GAP:
+                if old[x] != new[x]:
+                    end = x + 1
+                    gap = 0
+                else:
+                    gap += 1
+                x += 1
+            out += b"\x1b[%d;%dH" % (y + 1, start + 1)
+            out += new[start:end]
+            x = end
+    return out
+
+
+def play(path, frame_delay, loop, render, stats_file):
+    with open(path, "rb") as f:
+        frame_count, width, height = read_header(f)
+
+    interval = frame_delay / VBLANK_HZ
+    out = sys.stdout.buffer
+    stats = []
+
+    if render:
+        # Очистка экрана и скрытие курсора
+        out.write(b"\x1b[2J\x1b[?25l")
+        out.flush()
+
+    # Экран очищен один раз, дальше на нем всегда последний выведенный кадр:
+    # при повторе петли первый кадр сравнивается с ним, а не с пустым экраном
+    prev = [b" " * width] * height
+    try:
+        while True:
+            for n, rows, decode_time in iter_frames(path):
+                frame_start = time.perf_counter()
+                data = diff_rows(prev, rows)
+                prev = rows
+
+                if render:
+                    out.write(data)
+                    out.flush()
+
+                stats.append((n, decode_time, len(data)))
+                if stats_file:
+                    stats_file.write(f"{n},{decode_time * 1e6:.1f},{len(data)}\n")
+
+                if render:
+                    sleep = interval - (time.perf_counter() - frame_start)
+                    if sleep > 0:
+                        time.sleep(sleep)
+            if not loop:
+                break
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if render:
+            out.write(b"\x1b[%d;1H\x1b[?25h\n" % (height + 1))
+            out.flush()
+
+    return frame_count, width, height, stats
+
+
+def print_summary(path, frame_count, width, height, stats):
+    if not stats:
+        return
+    decode = [s[1] for s in stats]
+    written = [s[2] for s in stats]
+    full = (width + 1) * height
+    print(f"{os.path.basename(path)}: {frame_count} кадров, {width}x{height}", file=sys.stderr)
+    print(f"Декодирование: сред. {sum(decode) / len(decode) * 1e6:.1f} мкс, "
+          f"макс. {max(decode) * 1e6:.1f} мкс", file=sys.stderr)
+    print(f"Вывод: сред. {sum(written) / len(written):.0f} байт/кадр, "
+          f"макс. {max(written)} байт/кадр (полная перерисовка ~{full} байт)", file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Просмотр animation.dat в терминале")
+    parser.add_argument("file", nargs="?", default="animation.dat", help="путь к .dat файлу")
+    parser.add_argument("--delay", type=int, default=3, help="FrameDelay, как в config.ini")
+    parser.add_argument("--loop", action="store_true", help="зациклить проигрывание")
+    parser.add_argument("--no-render", action="store_true",
+                        help="только декодировать и считать статистику, без вывода в терминал")
+    parser.add_argument("--stats", metavar="CSV",
+                        help="записать по кадрам: номер, время декодирования (мкс), байт выведено")
+    args = parser.parse_args()
+
+    if not os.path.exists(args.file):
+        print(f"Файл {args.file} не найден.", file=sys.stderr)
+        sys.exit(1)
+
+    stats_file = open(args.stats, "w") if args.stats else None
+    if stats_file:
+        stats_file.write("frame,decode_us,bytes\n")
+
+    try:
+        result = play(args.file, args.delay, args.loop and not args.no_render,
+                      not args.no_render, stats_file)
+    except ValueError as e:
+        print(f"Ошибка в {args.file}: {e}", file=sys.stderr)
+        sys.exit(1)
+    finally:
+        if stats_file:
+            stats_file.close()
+
+    print_summary(args.file, *result)
+
+
+if __name__ == "__main__":
+    main()
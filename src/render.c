@@ -0,0 +1,73 @@
+#include <pspkernel.h>
+#include <pspdebug.h>
+#include <string.h>
+
+#include "render.h"
+
+static char screen[SCREEN_ROWS][SCREEN_COLS];
+static int dirty_lo[SCREEN_ROWS];
+static int dirty_hi[SCREEN_ROWS];
+static RenderStats stats;
+
+void render_init(void) {
+    memset(screen, ' ', sizeof(screen));
+    for (int y = 0; y < SCREEN_ROWS; y++) {
+        dirty_lo[y] = SCREEN_COLS;
+        dirty_hi[y] = 0;
+    }
+    memset(&stats, 0, sizeof(stats));
+}
+
+void render_blit(const char *frame, int width, int height, int x, int y) {
+    unsigned int start = sceKernelGetSystemTimeLow();
+    int stride = width + 1;
+    int col0 = (x < 0) ? -x : 0;
+    int col1 = (x + width > SCREEN_COLS) ? SCREEN_COLS - x : width;
+    int row0 = (y < 0) ? -y : 0;
+    int row1 = (y + height > SCREEN_ROWS) ? SCREEN_ROWS - y : height;
+
+    for (int row = row0; row < row1; row++) {
+        const char *src = frame + row * stride;
+        char *dst = screen[y + row] + x;
+        int lo = SCREEN_COLS, hi = -1;
+        int ended = 0;
+
+        for (int col = col0; col < col1; col++) {
+            char c = ended ? ' ' : src[col];
+            if (c == '\0') { ended = 1; c = ' '; }
+            if (dst[col] != c) {
+                dst[col] = c;
+                if (lo > col) lo = col;
+                hi = col;
+                stats.cells_changed++;
+            }
+        }
+
+        if (hi >= 0) {
+            if (dirty_lo[y + row] > x + lo) dirty_lo[y + row] = x + lo;
+            if (dirty_hi[y + row] < x + hi + 1) dirty_hi[y + row] = x + hi + 1;
+        }
+    }
+    stats.time_us += sceKernelGetSystemTimeLow() - start;
+}
+
+void render_flush(void) {
+    unsigned int start = sceKernelGetSystemTimeLow();
+
+    for (int y = 0; y < SCREEN_ROWS; y++) {
+        if (dirty_lo[y] >= dirty_hi[y]) continue;
+        pspDebugScreenSetXY(dirty_lo[y], y);
+        pspDebugScreenPrintData(screen[y] + dirty_lo[y], dirty_hi[y] - dirty_lo[y]);
+        stats.cells_written += dirty_hi[y] - dirty_lo[y];
+        dirty_lo[y] = SCREEN_COLS;
+        dirty_hi[y] = 0;
+    }
+
+    stats.passes++;
+    stats.time_us += sceKernelGetSystemTimeLow() - start;
+}
+
+void render_take_stats(RenderStats *out) {
+    *out = stats;
+    memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,25 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+/* pspDebugScreen text grid */
+#define SCREEN_COLS 68
+#define SCREEN_ROWS 34
+
+typedef struct {
+    unsigned int passes;
+    unsigned int cells_changed;
+    unsigned int cells_written;
+    unsigned int time_us;
+} RenderStats;
+
+void render_init(void);
+
+/* Copies a frame into the shadow screen at (x, y), clipped to the screen */
+void render_blit(const char *frame, int width, int height, int x, int y);
+
+/* Prints everything blitted since the last flush that differs from the screen */
+void render_flush(void);
+
+void render_take_stats(RenderStats *stats);
+
+#endif